@@ -28,25 +28,7 @@ layout(std430, binding = 5) writeonly buffer WriteBlockVelocities
     vec4 WriteVelAndLifetimes[];
 };
 
-layout(binding = 10) uniform EmitterBlock
-{
-	vec4 origin;
-	vec4 dir;
-	vec4 startColor;
-	vec4 endColor;
-	uint numParticles;
-	float theta;
-	float startSpeed;
-	float endSpeed;
-	float startScale;
-	float endScale;
-	float decayTime;
-	float randomTimeOffsetDist;
-	uint looping;
-	uint fireOnce;
-	uint emitterType; // 0 is spherical, 1 is from a circular disc with "dir" as normal and theta as spread.
-	float discRadius; // only used if the emitterType is 1.
-};
+#include "shd/particles.glsl"
 
 uniform float TimeStep;
 uniform uvec3 Random;
@@ -56,22 +38,10 @@ float random(vec2 st)
     return fract(sin(dot(st.xy, vec2(12.9898,78.233))) * 43758.5453123);
 }
 
-vec3 GetConeDir(vec3 dir, float theta)
-{
-	uint maxId = uint(abs((-(float(numParticles) * cos(theta) - 1.0f) + 1.0f) / 2.0f));
-	vec3 v = SphericalFibonacci(float(gl_GlobalInvocationID.x % maxId), float(numParticles - (gl_GlobalInvocationID.x / maxId)));
-
-	vec3 ww = dir;
-	vec3 uu = normalize(cross(ww, vec3(0,1,0)));
-	vec3 vv = normalize(cross(uu, ww));
-	mat3 m  = mat3(uu, vv, ww);
-	return m*v;
-}
-
-vec2 RandomOnUnitCircle(float radius)
+vec2 RandomOnUnitCircle(float id, float radius)
 {
-    float a = random(vec2(float(gl_GlobalInvocationID.x) / float(numParticles), TimeStep));
-	float b = random(vec2(TimeStep, float(gl_GlobalInvocationID.x) / float(numParticles)));
+    float a = random(vec2(id, TimeStep));
+	float b = random(vec2(TimeStep, id));
 	if (b < a)
 	{
 		float c = b;
@@ -87,9 +57,13 @@ vec2 RandomOnUnitCircle(float radius)
 layout(local_size_x = THREADS_X, local_size_y = THREADS_Y, local_size_z = THREADS_Z) in;
 void main()
 {
-	uint pid = gl_GlobalInvocationID.x;
-	if (pid >= numParticles)
+	if (gl_GlobalInvocationID.x >= NumParticles)
 		return;
+
+	Emitter emitter = emitters[FindEmitter(gl_GlobalInvocationID.x)];
+	uint localId = gl_GlobalInvocationID.x - emitter.dispatchOffset;
+	uint pid = emitter.firstParticle + localId;
+	float id = float(localId) / float(emitter.numParticles);
 	
 	vec3 pos = ReadPosAndScale[pid].xyz;
 	vec3 moveDir = ReadVelAndLifetime[pid].xyz;
@@ -97,31 +71,31 @@ void main()
 	
 	lifetime -= TimeStep;
 	
-	if ((lifetime <= 0 && looping > 0) || fireOnce > 0)
+	if ((lifetime <= 0 && emitter.looping > 0) || emitter.fireOnce > 0)
 	{
 		// reset particle
-		float rnd = random(vec2(float(gl_GlobalInvocationID.x) / float(numParticles), TimeStep));
-		lifetime = decayTime - (rnd * randomTimeOffsetDist);
-		pos = origin.xyz;
-		if (emitterType == 0) // Sphere emitter
+		float rnd = random(vec2(id, TimeStep));
+		lifetime = emitter.decayTime - (rnd * emitter.randomTimeOffsetDist);
+		pos = emitter.origin.xyz;
+		if (emitter.emitterType == 0) // Sphere emitter
 		{
-			vec3 v = SphericalFibonacci(float(gl_GlobalInvocationID.x), float(numParticles));
+			vec3 v = SphericalFibonacci(float(localId), float(emitter.numParticles));
 			moveDir = v;
 		}
-		else if (emitterType == 1)// Disc emitter
+		else if (emitter.emitterType == 1)// Disc emitter
 		{
-			vec2 emitFrom = RandomOnUnitCircle(discRadius);
+			vec2 emitFrom = RandomOnUnitCircle(id, emitter.discRadius);
 			
-			float rnd0 = random(vec2(float(gl_GlobalInvocationID.x) / float(numParticles), TimeStep));
-			float rnd1 = random(vec2(TimeStep, float(gl_GlobalInvocationID.x) / float(numParticles)));
+			float rnd0 = random(vec2(id, TimeStep));
+			float rnd1 = random(vec2(TimeStep, id));
 			float angle = rnd0 * 3.14159265f * 2.0f;
 			float radius = rnd1;
 			vec2 p = vec2(cos(angle)*radius, sin(angle)*radius);
 
-			p = normalize(p) * sin(theta);
-			vec3 v = vec3(p,cos(theta));
+			p = normalize(p) * sin(emitter.theta);
+			vec3 v = vec3(p,cos(emitter.theta));
 
-			vec3 ww = dir.xyz;
+			vec3 ww = emitter.dir.xyz;
 			vec3 uu = normalize(cross(ww, vec3(0,1,0)));
 			vec3 vv = normalize(cross(uu, ww));
 			mat3 m  = mat3(uu, vv, ww);
@@ -130,15 +104,15 @@ void main()
 		}
 	}
 
-	float t = 1.0f - (lifetime / decayTime);
+	float t = 1.0f - (lifetime / emitter.decayTime);
 
-	vec3 velocity = mix(moveDir * startSpeed, moveDir * endSpeed, t);
+	vec3 velocity = mix(moveDir * emitter.startSpeed, moveDir * emitter.endSpeed, t);
 	pos += velocity * TimeStep;
 	
-	float scale = mix(startScale, endScale, t);
-	vec4 col = mix(startColor, endColor, t);
+	float scale = mix(emitter.startScale, emitter.endScale, t);
+	vec4 col = mix(emitter.startColor, emitter.endColor, t);
 
 	WritePosAndScale[pid] = vec4(pos, scale);
 	WriteVelAndLifetimes[pid] = vec4(moveDir,lifetime);
 	WriteColors[pid] = col;
-}
\ No newline at end of file
+}
@@ -1,24 +1,23 @@
 #version 430
-layout(location=0) in float dummy;
+struct DebugVertex
+{
+	vec4 position;
+	vec4 color;
+};
+
+// pairs of line end points, read by vertex id
+layout(std430, binding = 7) readonly buffer DebugLineVertices
+{
+	DebugVertex vertices[];
+};
 
 uniform mat4 viewProjection;
-uniform vec4 v0pos;
-uniform vec4 v1pos;
-uniform vec4 v0color;
-uniform vec4 v1color;
 
 out vec4 fragColor;
 
 void main()
 {
-	if (gl_VertexID == 0)
-	{
-		gl_Position = viewProjection * vec4(v0pos.xyz, 1.0f);
-		fragColor = v0color;
-	}
-	else
-	{
-		gl_Position = viewProjection * vec4(v1pos.xyz, 1.0f);
-		fragColor = v1color;
-	}
+	DebugVertex v = vertices[gl_VertexID];
+	gl_Position = viewProjection * vec4(v.position.xyz, 1.0f);
+	fragColor = v.color;
 }
@@ -0,0 +1,32 @@
+#version 430
+// xyz, and w is the side of a capsule the vertex is on
+layout(location=0) in vec4 position;
+
+struct DebugInstance
+{
+	mat4 transform;
+	vec4 color;
+	vec4 params; // x is half the length of the cylinder of a capsule
+};
+
+layout(std430, binding = 7) readonly buffer DebugInstances
+{
+	DebugInstance instances[];
+};
+
+uniform mat4 viewProjection;
+// where the instances of the current batch start
+uniform uint instanceOffset;
+
+out vec4 fragColor;
+
+void main()
+{
+	DebugInstance instance = instances[instanceOffset + gl_InstanceID];
+	vec3 p = position.xyz;
+	p.y += position.w * instance.params.x;
+	// frustums are drawn with the inverse of a projection, so w isn't always one
+	vec4 worldPos = instance.transform * vec4(p, 1.0f);
+	gl_Position = viewProjection * vec4(worldPos.xyz / worldPos.w, 1.0f);
+	fragColor = instance.color;
+}
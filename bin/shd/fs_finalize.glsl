@@ -0,0 +1,32 @@
+#version 430
+layout(location=0) in vec2 in_TexCoords;
+
+layout(location=0) out vec4 out_Color;
+
+uniform sampler2D LightTexture;
+uniform float Exposure;
+/// 0 = clamp, 1 = Reinhard, 2 = ACES filmic
+uniform int TonemapOperator;
+
+// fitted ACES curve by Krzysztof Narkowicz
+vec3 TonemapACES(vec3 x)
+{
+	const float a = 2.51f;
+	const float b = 0.03f;
+	const float c = 2.43f;
+	const float d = 0.59f;
+	const float e = 0.14f;
+	return clamp((x * (a * x + b)) / (x * (c * x + d) + e), 0.0f, 1.0f);
+}
+
+void main()
+{
+	vec3 color = texture(LightTexture, in_TexCoords).rgb * Exposure;
+
+	if (TonemapOperator == 1)
+		color = color / (color + vec3(1.0f));
+	else if (TonemapOperator == 2)
+		color = TonemapACES(color);
+
+	out_Color = vec4(clamp(color, 0.0f, 1.0f), 1.0f);
+}
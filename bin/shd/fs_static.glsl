@@ -24,40 +24,44 @@ layout(location=9) uniform float AlphaCutoff;
 
 layout(location=10) uniform vec4 CameraPosition;
 
-layout(std430, binding = 3) readonly buffer VisiblePointLightIndicesBuffer
-{
-	VisibleIndex data[];
-} visiblePointLightIndicesBuffer;
-
-layout(std430, binding = 4) readonly buffer VisibleProbesIndicesBuffer
-{
-	VisibleIndex data[];
-} visibleProbesIndicesBuffer;
-
 // V = view vector, N = surface normal, P = fragment point in world space
 vec3 CalculateGlobalLight(vec3 V, vec3 N, vec3 P, vec4 diffuseColor)
 {
     float diffuse = max(dot(GlobalLightDirection, N), 0.0);
-    vec4 shadowCoords = GlobalShadowMatrix * vec4(P, 1);
-    shadowCoords.xyzw /= shadowCoords.w;
-    shadowCoords = shadowCoords * 0.5f + 0.5f;
-    float shadowDepth = texture(GlobalShadowMap,shadowCoords.xy).r;
-    float geoDepth = shadowCoords.z;
-    // bias based on incidence angle
-    float bias = max(0.0003 * (1.0 - diffuse), 0.00035);  
-
-    // simple PCF with 3x3 kernel for now
+    vec2 texelSize = 1.0 / textureSize(GlobalShadowMap, 0).xy;
+
+    // use the first cascade that contains the point, with room for the filter kernel
+    uint cascade = NumShadowCascades;
+    vec3 shadowCoords = vec3(0);
+    for (uint i = 0; i < NumShadowCascades; i++)
+    {
+        vec4 coords = GlobalShadowMatrices[i] * vec4(P, 1);
+        shadowCoords = coords.xyz / coords.w * 0.5f + 0.5f;
+        if (all(greaterThan(shadowCoords.xy, texelSize * 2.0)) && all(lessThan(shadowCoords.xy, 1.0 - texelSize * 2.0)) && shadowCoords.z <= 1.0)
+        {
+            cascade = i;
+            break;
+        }
+    }
+
     float shadow = 0.0;
-    vec2 texelSize = 1.0 / textureSize(GlobalShadowMap, 0);
-    for(int x = -1; x <= 1; ++x)
+    if (cascade < NumShadowCascades)
     {
-        for(int y = -1; y <= 1; ++y)
+        float geoDepth = shadowCoords.z;
+        // bias based on incidence angle
+        float bias = ShadowCascadeBias[cascade] * (2.0 - diffuse);
+
+        // simple PCF with 3x3 kernel for now
+        for(int x = -1; x <= 1; ++x)
         {
-            float d = texture(GlobalShadowMap, shadowCoords.xy + vec2(x, y) * texelSize).r; 
-            shadow += geoDepth - bias > d ? 1.0 : 0.0;        
-        }    
+            for(int y = -1; y <= 1; ++y)
+            {
+                float d = texture(GlobalShadowMap, vec3(shadowCoords.xy + vec2(x, y) * texelSize, float(cascade))).r;
+                shadow += geoDepth - bias > d ? 1.0 : 0.0;
+            }
+        }
+        shadow /= 9.0;
     }
-    shadow /= 9.0;
 
     float shadowFactor = 1.0f - shadow;
     return shadowFactor * (GlobalLightColor * diffuse * diffuseColor.rgb);
@@ -73,13 +77,11 @@ const vec3 AmbientLight = vec3(0.15f);
 
 void main()
 {
-	// Determine which tile this fragment belongs to
-	ivec2 location = ivec2(gl_FragCoord.xy);
-	ivec2 tileID = location / ivec2(TILE_SIZE, TILE_SIZE);
-	uint index = tileID.y * NumTiles.x + tileID.x;
+	// Determine which cluster this fragment belongs to
+	uvec2 cluster = clusterLightsBuffer.data[ClusterIndex(gl_FragCoord)];
 
     vec4 baseColor = texture(BaseColorTexture, in_TexCoords).rgba * BaseColorFactor;
-    baseColor = pow(baseColor, vec4(1.0f/2.2f));
+    baseColor.rgb = pow(baseColor.rgb, vec3(1.0f/2.2f));
     vec3 normal = texture(NormalTexture, in_TexCoords).xyz;
 	vec2 metallicRoughness = texture(MetallicRoughnessTexture, in_TexCoords).xy;
 	vec3 emissive = texture(EmissiveTexture, in_TexCoords).xyz;
@@ -93,10 +95,9 @@ void main()
 
     light += CalculateGlobalLight(V, N, in_WorldSpacePos, baseColor);
 
-    uint offset = index * MaxTileLights;
-    for (uint i = 0; i < MaxTileLights && visiblePointLightIndicesBuffer.data[offset + i].index != -1; i++)
+    for (uint i = cluster.x; i < cluster.x + cluster.y; i++)
 	{
-        uint lightIndex = visiblePointLightIndicesBuffer.data[offset + i].index;
+        uint lightIndex = clusterLightIndicesBuffer.data[i];
 		vec3 LightPos = pointLightPositionsBuffer.data[lightIndex].xyz;
         vec3 LightColor = pointLightColorsBuffer.data[lightIndex].rgb;
         float LightRadius = pointLightRadiiBuffer.data[lightIndex];
@@ -113,5 +114,6 @@ void main()
         light += diffuse * radiance;
     }
 
-    out_Color = vec4(light.rgb * baseColor.rgb + emissive, 1.0f);
+    // alpha is only used by blended materials, opaque ones are drawn without blending
+    out_Color = vec4(light.rgb * baseColor.rgb + emissive, baseColor.a);
 }
\ No newline at end of file
@@ -1,10 +1,3 @@
-#define TILE_SIZE 32
-
-struct VisibleIndex 
-{
-	int index;
-};
-
 layout(std430, binding = 0) readonly buffer PointLightPositionsBuffer
 {
 	vec4 data[];
@@ -20,16 +13,47 @@ layout(std430, binding = 2) readonly buffer PointLightRadiiBuffer
 	float data[];
 } pointLightRadiiBuffer;
 
-layout(location=16) uniform sampler2D GlobalShadowMap;
-layout(location=17) uniform mat4 GlobalShadowMatrix;
+// offset and count into clusterLightIndicesBuffer for every cluster
+layout(std430, binding = 3) readonly buffer ClusterLightsBuffer
+{
+	uvec2 data[];
+} clusterLightsBuffer;
+
+layout(std430, binding = 4) readonly buffer ClusterLightIndicesBuffer
+{
+	uint data[];
+} clusterLightIndicesBuffer;
+
+// one layer per cascade
+layout(location=16) uniform sampler2DArray GlobalShadowMap;
+layout(location=17) uniform uint NumShadowCascades;
 layout(location=18) uniform vec3 GlobalLightDirection;
 layout(location=19) uniform vec3 GlobalLightColor;
 
-// num tiles (work groups) in x,y for tiled forward binning
-layout(location=20) uniform uvec2 NumTiles;
+// clusters in x, y and z, and tile size in pixels. Must match LightClusterGrid
+layout(location=20) uniform uvec4 ClusterGridSize;
+// slice scale, slice bias, near and far plane
+layout(location=21) uniform vec4 ClusterDepthParams;
+
+// Must be same as LightServer::MaxShadowCascades
+const uint MaxShadowCascades = 4;
+// depth bias per cascade, in normalized depth
+layout(location=22) uniform vec4 ShadowCascadeBias;
+layout(location=23) uniform mat4 GlobalShadowMatrices[MaxShadowCascades];
 
 // number of lights in light buffers
 uniform uint NumLights;
 
-// Must be same as CPU side max lights constant
-const uint MaxTileLights = 512;
+// get the cluster of a fragment from its window coordinates
+uint ClusterIndex(vec4 fragCoord)
+{
+	float nearZ = ClusterDepthParams.z;
+	float farZ = ClusterDepthParams.w;
+	float ndcZ = fragCoord.z * 2.0 - 1.0;
+	float viewDepth = (2.0 * nearZ * farZ) / (farZ + nearZ - ndcZ * (farZ - nearZ));
+
+	// slice = log(depth) * scale - bias, with everything before the first slice clamped to it
+	uint slice = uint(clamp(floor(log(viewDepth) * ClusterDepthParams.x - ClusterDepthParams.y), 0.0, float(ClusterGridSize.z - 1)));
+	uvec2 tile = min(uvec2(fragCoord.xy) / ClusterGridSize.w, ClusterGridSize.xy - 1);
+	return (slice * ClusterGridSize.y + tile.y) * ClusterGridSize.x + tile.x;
+}
@@ -0,0 +1,53 @@
+// emitter table shared by the particle simulation and the particle draw.
+// must match GpuEmitter in particlesystem.h
+struct Emitter
+{
+	vec4 origin;
+	vec4 dir;
+	vec4 startColor;
+	vec4 endColor;
+	uint numParticles;
+	float theta;
+	float startSpeed;
+	float endSpeed;
+	float startScale;
+	float endScale;
+	float decayTime;
+	float randomTimeOffsetDist;
+	uint looping;
+	uint fireOnce;
+	uint emitterType; // 0 is spherical, 1 is from a circular disc with "dir" as normal and theta as spread.
+	float discRadius; // only used if the emitterType is 1.
+	uint firstParticle; // where the emitter's particles start in the particle buffers
+	uint dispatchOffset; // where the emitter's particles start in the range that is simulated and drawn
+	uint padding0;
+	uint padding1;
+};
+
+layout(std430, binding = 6) readonly buffer EmitterTable
+{
+	Emitter emitters[];
+};
+
+// number of emitters in the table, and the sum of their particles
+uniform uint NumEmitters;
+uniform uint NumParticles;
+
+// the emitter that the index:th particle of the simulated range belongs to. The dispatch offsets are ascending.
+uint FindEmitter(uint index)
+{
+	uint first = 0;
+	uint count = NumEmitters;
+	while (count > 1)
+	{
+		uint halfCount = count / 2;
+		if (emitters[first + halfCount].dispatchOffset <= index)
+		{
+			first += halfCount;
+			count -= halfCount;
+		}
+		else
+			count = halfCount;
+	}
+	return first;
+}
@@ -0,0 +1,30 @@
+// Decoding of compressed vertices, see Model::VertexAttribute::Encoding.
+// Positions are 16 bit unorm relative to the bounds of the primitive, normals
+// are octahedral in 2x16 bits, and tangents are octahedral in 2x8 bits with
+// the bitangent sign in the third component.
+uniform vec3 PositionScale;
+uniform vec3 PositionOffset;
+uniform bool OctahedralNormals;
+
+vec3 DecodePosition(vec3 position)
+{
+	return position * PositionScale + PositionOffset;
+}
+
+vec3 OctahedralDecode(vec2 e)
+{
+	vec3 n = vec3(e.xy, 1.0 - abs(e.x) - abs(e.y));
+	float t = max(-n.z, 0.0);
+	n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+	return normalize(n);
+}
+
+vec3 DecodeNormal(vec3 normal)
+{
+	return OctahedralNormals ? OctahedralDecode(normal.xy) : normal;
+}
+
+vec4 DecodeTangent(vec4 tangent)
+{
+	return OctahedralNormals ? vec4(OctahedralDecode(tangent.xy), tangent.z) : tangent;
+}
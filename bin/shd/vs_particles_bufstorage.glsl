@@ -15,6 +15,8 @@ layout(std430, binding = 1) readonly buffer ReadBlockColors
     vec4 ReadColors[];
 };
 
+#include "shd/particles.glsl"
+
 const vec3 TriangleBaseVertices[] = {
 	vec3(0.5, 0.5, 0),
 	vec3(-0.5, 0.5, 0),
@@ -27,7 +29,9 @@ const vec3 TriangleBaseVertices[] = {
 void main()
 {
 	int localIndex = gl_VertexID % 6;
-	int index1D = ParticleOffset + gl_VertexID / 6;
+	uint drawIndex = uint(ParticleOffset + gl_VertexID / 6);
+	Emitter emitter = emitters[FindEmitter(drawIndex)];
+	uint index1D = emitter.firstParticle + (drawIndex - emitter.dispatchOffset);
 	vec4 translation = vec4(ReadPosAndScale[index1D].xyz, 1);
 	float scale = ReadPosAndScale[index1D].w;
 	vec4 projectedVertexPos = BillBoardViewProjection * vec4(TriangleBaseVertices[localIndex] * scale,0);
@@ -1,5 +1,7 @@
 #version 430
 
+#include "shd/vertexdecode.glsl"
+
 layout(location=0) in vec3 in_Position;
 layout(location=1) in vec3 in_Normal;
 layout(location=2) in vec4 in_Tangent;
@@ -17,10 +19,11 @@ invariant gl_Position;
 
 void main()
 {
-	vec4 wPos = (Model * vec4(in_Position, 1.0f));
+	vec4 wPos = (Model * vec4(DecodePosition(in_Position), 1.0f));
 	out_WorldSpacePos = wPos.xyz;
 	out_TexCoords = in_TexCoord_0;
-	out_Tangent = vec4(normalize((Model * vec4(in_Tangent.xyz, 0)).xyz), in_Tangent.w);
-    out_Normal = normalize((Model * vec4(in_Normal, 0)).xyz);
+	vec4 tangent = DecodeTangent(in_Tangent);
+	out_Tangent = vec4(normalize((Model * vec4(tangent.xyz, 0)).xyz), tangent.w);
+    out_Normal = normalize((Model * vec4(DecodeNormal(in_Normal), 0)).xyz);
 	gl_Position = ViewProjection * wPos;
 }
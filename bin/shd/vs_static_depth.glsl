@@ -0,0 +1,17 @@
+#version 430
+
+#include "shd/vertexdecode.glsl"
+
+layout(location=0) in vec3 in_Position;
+
+uniform mat4 ViewProjection;
+uniform mat4 Model;
+
+invariant gl_Position;
+
+// The forward pass tests against this depth with GL_EQUAL, so gl_Position has to be computed exactly as in vs_static.
+void main()
+{
+	vec4 wPos = Model * vec4(DecodePosition(in_Position), 1.0f);
+	gl_Position = ViewProjection * wPos;
+}
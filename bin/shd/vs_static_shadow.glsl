@@ -1,4 +1,7 @@
 #version 430
+
+#include "shd/vertexdecode.glsl"
+
 layout(location=0) in vec3 in_Position;
 layout(location=3) in vec2 in_TexCoord_0;
 
@@ -14,6 +17,6 @@ void main()
 	out_TexCoords = in_TexCoord_0;
 	// BUG: this must be calculated EXACTLY the same way as in our vs_static shader, otherwise, we get zbuffer fighting since the write to gl_Position is not invariant.
 	// 	    check out https://stackoverflow.com/a/46920273
-	vec4 wPos = Model * vec4(in_Position, 1.0f);
+	vec4 wPos = Model * vec4(DecodePosition(in_Position), 1.0f);
 	gl_Position = ViewProjection * wPos;
 }
@@ -0,0 +1,277 @@
+//------------------------------------------------------------------------------
+//  @file framearena.cc
+//  @copyright (C) 2022 Individual contributors, see AUTHORS file
+//------------------------------------------------------------------------------
+#include "config.h"
+#include "framearena.h"
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <algorithm>
+
+/// every call to the global operator new and delete, counted for the frame stats
+static std::atomic<uint64_t> heapAllocations = 0;
+static std::atomic<uint64_t> heapFrees = 0;
+
+#if SPACE_COUNT_HEAP_ALLOCATIONS
+//------------------------------------------------------------------------------
+/**
+    Replacing the global operators affects every library linked into the
+    program, so it is only done when the option is turned on. All the plain,
+    array, sized, nothrow and aligned versions are replaced, and end up in
+    these, so nothing goes around the counters.
+*/
+static void*
+CountedAlloc(size_t size, size_t alignment)
+{
+    size = size > 0 ? size : 1;
+    void* ptr;
+    if (alignment <= alignof(std::max_align_t))
+        ptr = std::malloc(size);
+    else
+    {
+#ifdef _MSC_VER
+        ptr = _aligned_malloc(size, alignment);
+#else
+        // aligned_alloc wants the size to be a multiple of the alignment
+        ptr = std::aligned_alloc(alignment, (size + alignment - 1) & ~(alignment - 1));
+#endif
+    }
+    if (ptr != nullptr)
+        heapAllocations.fetch_add(1, std::memory_order_relaxed);
+    return ptr;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+static void
+CountedFree(void* ptr, [[maybe_unused]] size_t alignment)
+{
+    if (ptr == nullptr)
+        return;
+    heapFrees.fetch_add(1, std::memory_order_relaxed);
+#ifdef _MSC_VER
+    if (alignment > alignof(std::max_align_t))
+    {
+        _aligned_free(ptr);
+        return;
+    }
+#endif
+    std::free(ptr);
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+static void*
+CountedAllocOrThrow(size_t size, size_t alignment)
+{
+    void* const ptr = CountedAlloc(size, alignment);
+    if (ptr == nullptr)
+        throw std::bad_alloc();
+    return ptr;
+}
+
+static constexpr size_t DefaultAlignment = alignof(std::max_align_t);
+
+void* operator new(size_t size) { return CountedAllocOrThrow(size, DefaultAlignment); }
+void* operator new[](size_t size) { return CountedAllocOrThrow(size, DefaultAlignment); }
+void* operator new(size_t size, std::nothrow_t const&) noexcept { return CountedAlloc(size, DefaultAlignment); }
+void* operator new[](size_t size, std::nothrow_t const&) noexcept { return CountedAlloc(size, DefaultAlignment); }
+void* operator new(size_t size, std::align_val_t alignment) { return CountedAllocOrThrow(size, (size_t)alignment); }
+void* operator new[](size_t size, std::align_val_t alignment) { return CountedAllocOrThrow(size, (size_t)alignment); }
+void* operator new(size_t size, std::align_val_t alignment, std::nothrow_t const&) noexcept { return CountedAlloc(size, (size_t)alignment); }
+void* operator new[](size_t size, std::align_val_t alignment, std::nothrow_t const&) noexcept { return CountedAlloc(size, (size_t)alignment); }
+
+void operator delete(void* ptr) noexcept { CountedFree(ptr, DefaultAlignment); }
+void operator delete[](void* ptr) noexcept { CountedFree(ptr, DefaultAlignment); }
+void operator delete(void* ptr, size_t) noexcept { CountedFree(ptr, DefaultAlignment); }
+void operator delete[](void* ptr, size_t) noexcept { CountedFree(ptr, DefaultAlignment); }
+void operator delete(void* ptr, std::nothrow_t const&) noexcept { CountedFree(ptr, DefaultAlignment); }
+void operator delete[](void* ptr, std::nothrow_t const&) noexcept { CountedFree(ptr, DefaultAlignment); }
+void operator delete(void* ptr, std::align_val_t alignment) noexcept { CountedFree(ptr, (size_t)alignment); }
+void operator delete[](void* ptr, std::align_val_t alignment) noexcept { CountedFree(ptr, (size_t)alignment); }
+void operator delete(void* ptr, size_t, std::align_val_t alignment) noexcept { CountedFree(ptr, (size_t)alignment); }
+void operator delete[](void* ptr, size_t, std::align_val_t alignment) noexcept { CountedFree(ptr, (size_t)alignment); }
+void operator delete(void* ptr, std::align_val_t alignment, std::nothrow_t const&) noexcept { CountedFree(ptr, (size_t)alignment); }
+void operator delete[](void* ptr, std::align_val_t alignment, std::nothrow_t const&) noexcept { CountedFree(ptr, (size_t)alignment); }
+#endif
+
+namespace Core
+{
+
+//------------------------------------------------------------------------------
+/**
+*/
+LinearArena::LinearArena(size_t capacity)
+{
+    if (capacity > 0)
+    {
+        this->block = (char*)::operator new(capacity);
+        this->capacity = capacity;
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+LinearArena::~LinearArena()
+{
+    for (void* const raw : this->overflowBlocks)
+        ::operator delete(raw);
+    ::operator delete(this->block);
+}
+
+//------------------------------------------------------------------------------
+/**
+    Bumps the offset with a compare and swap, so concurrent allocations never
+    overlap. Allocations that don't fit go to the heap under a lock.
+*/
+void*
+LinearArena::Allocate(size_t size, size_t alignment)
+{
+    uintptr_t const base = (uintptr_t)this->block;
+    size_t current = this->offset.load(std::memory_order_relaxed);
+    while (true)
+    {
+        size_t const aligned = ((base + current + alignment - 1) & ~(uintptr_t)(alignment - 1)) - base;
+        size_t const end = aligned + size;
+        if (end > this->capacity)
+            break;
+        if (this->offset.compare_exchange_weak(current, end, std::memory_order_relaxed))
+            return this->block + aligned;
+    }
+
+    std::lock_guard<std::mutex> lock(this->overflowMutex);
+    void* const raw = ::operator new(size + alignment);
+    this->overflowBlocks.push_back(raw);
+    this->overflowBytes += size + alignment;
+    return (void*)(((uintptr_t)raw + alignment - 1) & ~(uintptr_t)(alignment - 1));
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+char const*
+LinearArena::CopyString(char const* str)
+{
+    size_t const size = strlen(str) + 1;
+    char* const copy = this->Allocate<char>(size);
+    memcpy(copy, str, size);
+    return copy;
+}
+
+//------------------------------------------------------------------------------
+/**
+    If anything overflowed, the block is replaced by one that would have fit
+    everything, and at least doubles, so a growing workload settles quickly.
+    Alignment padding depends on where each allocation lands in the new block,
+    so a quarter is added on top of what was used.
+*/
+void
+LinearArena::Reset(size_t minCapacity)
+{
+    size_t const used = std::max(this->GetUsed(), minCapacity);
+    for (void* const raw : this->overflowBlocks)
+        ::operator delete(raw);
+    this->overflowBlocks.clear();
+    this->overflowBytes = 0;
+
+    if (used > this->capacity)
+    {
+        ::operator delete(this->block);
+        this->capacity = std::max(used + used / 4, this->capacity * 2);
+        this->block = (char*)::operator new(this->capacity);
+    }
+    this->offset.store(0, std::memory_order_relaxed);
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+size_t
+LinearArena::GetUsed() const
+{
+    return std::min(this->offset.load(std::memory_order_relaxed), this->capacity) + this->overflowBytes;
+}
+
+namespace FrameArena
+{
+
+static LinearArena arenas[NumFrames];
+/// jobs on any thread read this, while NextFrame advances it on the main thread
+static std::atomic<uint32_t> currentFrame = 0;
+
+static Stats lastFrameStats;
+static uint64_t heapAllocationsAtFrameStart = 0;
+static uint64_t heapFreesAtFrameStart = 0;
+
+//------------------------------------------------------------------------------
+/**
+*/
+void*
+Allocate(size_t size, size_t alignment)
+{
+    return arenas[currentFrame.load(std::memory_order_acquire)].Allocate(size, alignment);
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+char const*
+CopyString(char const* str)
+{
+    return arenas[currentFrame.load(std::memory_order_acquire)].CopyString(str);
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+LinearArena&
+Current()
+{
+    return arenas[currentFrame.load(std::memory_order_acquire)];
+}
+
+//------------------------------------------------------------------------------
+/**
+    The arena that is reset was last used NumFrames frames ago, and the render
+    thread is done with everything older than the frame it is handed now. It
+    grows to what the frame that just ended used, so the arenas of the ring
+    don't each have to overflow before they fit.
+*/
+void
+NextFrame()
+{
+    uint32_t const frame = currentFrame.load(std::memory_order_relaxed);
+    LinearArena const& arena = arenas[frame];
+    lastFrameStats.arenaBytes = arena.GetUsed();
+    lastFrameStats.arenaCapacity = arena.GetCapacity();
+    lastFrameStats.arenaOverflows = arena.GetNumOverflows();
+
+    uint64_t const allocations = heapAllocations.load(std::memory_order_relaxed);
+    uint64_t const frees = heapFrees.load(std::memory_order_relaxed);
+    lastFrameStats.heapAllocations = allocations - heapAllocationsAtFrameStart;
+    lastFrameStats.heapFrees = frees - heapFreesAtFrameStart;
+    heapAllocationsAtFrameStart = allocations;
+    heapFreesAtFrameStart = frees;
+
+    // the arena is reset before it is published, so no thread sees it half reset
+    uint32_t const next = (frame + 1) % NumFrames;
+    arenas[next].Reset(lastFrameStats.arenaBytes);
+    currentFrame.store(next, std::memory_order_release);
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+Stats const&
+GetLastFrameStats()
+{
+    return lastFrameStats;
+}
+
+} // namespace FrameArena
+
+} // namespace Core
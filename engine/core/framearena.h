@@ -0,0 +1,166 @@
+#pragma once
+//------------------------------------------------------------------------------
+/**
+    @file framearena.h
+
+    Linear allocators for transient memory.
+
+    A LinearArena hands out memory by bumping an offset into one block, and
+    frees everything at once when it is reset. Allocating is lock free, so
+    jobs can allocate from the same arena as the thread that started them.
+    When the block runs out the arena falls back to the heap, and the next
+    Reset grows the block to the size that was needed, so an arena that is
+    reset regularly stops touching the heap after a few rounds.
+
+    The frame arena is a ring of NumFrames linear arenas, and advances to the
+    next one every time the renderer hands a frame to the render thread. Memory
+    from the frame arena stays valid until NumFrames - 1 more frames have been
+    handed over, so data the game thread writes can be read by the render
+    thread while it draws that frame.
+
+    ArenaAllocator and FrameAllocator let standard containers live in an arena.
+    Deallocating is a no-op, and the memory is reclaimed when the arena is
+    reset, so containers in the frame arena must not outlive the frame.
+
+    With the SPACE_COUNT_HEAP_ALLOCATIONS build option, the global operator
+    new and delete are replaced to count heap allocations, and the counts of
+    the last frame are part of the frame arena's stats.
+
+    @copyright
+    (C) 2022 Individual contributors, see AUTHORS file
+*/
+//------------------------------------------------------------------------------
+#include <vector>
+#include <mutex>
+#include <cstddef>
+
+#ifndef SPACE_COUNT_HEAP_ALLOCATIONS
+#define SPACE_COUNT_HEAP_ALLOCATIONS 0
+#endif
+
+namespace Core
+{
+
+class LinearArena
+{
+public:
+    explicit LinearArena(size_t capacity = 0);
+    ~LinearArena();
+    LinearArena(LinearArena const&) = delete;
+    void operator=(LinearArena const&) = delete;
+
+    /// allocate size bytes. Can be called from any thread.
+    void* Allocate(size_t size, size_t alignment = alignof(std::max_align_t));
+    template <typename T>
+    T* Allocate(size_t count) { return (T*)this->Allocate(count * sizeof(T), alignof(T)); }
+    /// copy a string into the arena
+    char const* CopyString(char const* str);
+
+    /// free everything, and grow the block if it overflowed or is smaller than minCapacity. Nothing may allocate while the arena is reset.
+    void Reset(size_t minCapacity = 0);
+
+    /// bytes allocated since the last reset, including overflow
+    size_t GetUsed() const;
+    size_t GetCapacity() const { return this->capacity; }
+    /// number of allocations since the last reset that didn't fit into the block
+    uint32_t GetNumOverflows() const { return (uint32_t)this->overflowBlocks.size(); }
+
+private:
+    char* block = nullptr;
+    size_t capacity = 0;
+    std::atomic<size_t> offset = 0;
+
+    std::mutex overflowMutex;
+    std::vector<void*> overflowBlocks;
+    size_t overflowBytes = 0;
+};
+
+namespace FrameArena
+{
+
+static constexpr uint32_t NumFrames = 3;
+
+/// allocate from the arena of the current frame. Can be called from any thread.
+void* Allocate(size_t size, size_t alignment = alignof(std::max_align_t));
+template <typename T>
+T* Allocate(size_t count) { return (T*)Allocate(count * sizeof(T), alignof(T)); }
+/// copy a string into the arena of the current frame
+char const* CopyString(char const* str);
+
+/// arena of the current frame
+LinearArena& Current();
+/// start the next frame, and reset its arena. Called by RenderDevice while the render thread is idle.
+void NextFrame();
+
+struct Stats
+{
+    /// bytes allocated from the frame arena, and the size of its block
+    size_t arenaBytes = 0;
+    size_t arenaCapacity = 0;
+    /// frame arena allocations that had to go to the heap
+    uint32_t arenaOverflows = 0;
+    /// calls to the global operator new and delete, from every thread. Always 0 unless SPACE_COUNT_HEAP_ALLOCATIONS is on.
+    uint64_t heapAllocations = 0;
+    uint64_t heapFrees = 0;
+};
+/// stats of the last finished frame
+Stats const& GetLastFrameStats();
+
+} // namespace FrameArena
+
+//------------------------------------------------------------------------------
+/**
+    Allocates from a LinearArena. The arena has to outlive the container.
+*/
+template <typename T>
+class ArenaAllocator
+{
+public:
+    typedef T value_type;
+
+    ArenaAllocator(LinearArena* arena) : arena(arena) {}
+    template <typename U>
+    ArenaAllocator(ArenaAllocator<U> const& other) : arena(other.arena) {}
+
+    T* allocate(size_t count) { return this->arena->template Allocate<T>(count); }
+    void deallocate(T*, size_t) {}
+
+    template <typename U>
+    bool operator==(ArenaAllocator<U> const& rhs) const { return this->arena == rhs.arena; }
+    template <typename U>
+    bool operator!=(ArenaAllocator<U> const& rhs) const { return this->arena != rhs.arena; }
+
+private:
+    template <typename U> friend class ArenaAllocator;
+    LinearArena* arena;
+};
+
+//------------------------------------------------------------------------------
+/**
+    Allocates from the arena of the current frame.
+*/
+template <typename T>
+class FrameAllocator
+{
+public:
+    typedef T value_type;
+
+    FrameAllocator() = default;
+    template <typename U>
+    FrameAllocator(FrameAllocator<U> const&) {}
+
+    T* allocate(size_t count) { return FrameArena::Allocate<T>(count); }
+    void deallocate(T*, size_t) {}
+
+    template <typename U>
+    bool operator==(FrameAllocator<U> const&) const { return true; }
+    template <typename U>
+    bool operator!=(FrameAllocator<U> const&) const { return false; }
+};
+
+template <typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+template <typename T>
+using FrameVector = std::vector<T, FrameAllocator<T>>;
+
+} // namespace Core
@@ -0,0 +1,189 @@
+//------------------------------------------------------------------------------
+//  @file jobsystem.cc
+//  @copyright (C) 2022 Individual contributors, see AUTHORS file
+//------------------------------------------------------------------------------
+#include "config.h"
+#include "jobsystem.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <algorithm>
+
+namespace Core
+{
+namespace JobSystem
+{
+
+//------------------------------------------------------------------------------
+/**
+    One ParallelFor call. Lives on the stack of the calling thread.
+*/
+struct Batch
+{
+    std::function<void(uint, uint)> const* func;
+    uint count;
+    uint grainSize;
+    uint numChunks;
+    std::atomic<uint> nextChunk = 0;
+    std::atomic<uint> doneChunks = 0;
+    /// number of workers currently holding a pointer to the batch
+    std::atomic<uint> users = 0;
+};
+
+//------------------------------------------------------------------------------
+/**
+*/
+struct Pool
+{
+    Pool();
+    ~Pool();
+
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<Batch*> queue;
+    bool quit = false;
+};
+
+//------------------------------------------------------------------------------
+/**
+    Claims and runs one chunk. Returns false if there was nothing left to claim.
+*/
+static bool
+RunChunk(Batch* batch)
+{
+    uint const chunk = batch->nextChunk.fetch_add(1, std::memory_order_relaxed);
+    if (chunk >= batch->numChunks)
+        return false;
+
+    uint const begin = chunk * batch->grainSize;
+    uint const end = std::min(begin + batch->grainSize, batch->count);
+    (*batch->func)(begin, end);
+    batch->doneChunks.fetch_add(1, std::memory_order_release);
+    return true;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+static void
+WorkerLoop(Pool* pool)
+{
+    while (true)
+    {
+        Batch* batch;
+        {
+            std::unique_lock<std::mutex> lock(pool->mutex);
+            pool->wake.wait(lock, [pool] { return pool->quit || !pool->queue.empty(); });
+            if (pool->quit)
+                return;
+
+            batch = pool->queue.front();
+            if (batch->nextChunk.load(std::memory_order_relaxed) >= batch->numChunks)
+            {
+                // everything is claimed, the owner finishes it
+                pool->queue.pop_front();
+                continue;
+            }
+            batch->users.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        while (RunChunk(batch))
+        {
+        }
+        batch->users.fetch_sub(1, std::memory_order_release);
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+Pool::Pool()
+{
+    uint const hardwareThreads = std::max(std::thread::hardware_concurrency(), 2u);
+    for (uint i = 0; i < hardwareThreads - 1; i++)
+        this->threads.emplace_back(WorkerLoop, this);
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+Pool::~Pool()
+{
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->quit = true;
+    }
+    this->wake.notify_all();
+    for (std::thread& thread : this->threads)
+        thread.join();
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+static Pool&
+GetPool()
+{
+    static Pool pool;
+    return pool;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+uint
+NumWorkers()
+{
+    return (uint)GetPool().threads.size();
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+ParallelFor(uint count, uint grainSize, std::function<void(uint begin, uint end)> const& func)
+{
+    if (count == 0)
+        return;
+
+    grainSize = std::max(grainSize, 1u);
+    uint const numChunks = (count + grainSize - 1) / grainSize;
+    if (numChunks == 1)
+    {
+        func(0, count);
+        return;
+    }
+
+    Pool& pool = GetPool();
+
+    Batch batch;
+    batch.func = &func;
+    batch.count = count;
+    batch.grainSize = grainSize;
+    batch.numChunks = numChunks;
+    {
+        std::lock_guard<std::mutex> lock(pool.mutex);
+        pool.queue.push_back(&batch);
+    }
+    pool.wake.notify_all();
+
+    // help with the chunks until none are left to claim
+    while (RunChunk(&batch))
+    {
+    }
+
+    // make sure no worker can pick up the batch after it goes out of scope
+    {
+        std::lock_guard<std::mutex> lock(pool.mutex);
+        auto it = std::find(pool.queue.begin(), pool.queue.end(), &batch);
+        if (it != pool.queue.end())
+            pool.queue.erase(it);
+    }
+    while (batch.doneChunks.load(std::memory_order_acquire) < numChunks || batch.users.load(std::memory_order_acquire) > 0)
+        std::this_thread::yield();
+}
+
+} // namespace JobSystem
+} // namespace Core
@@ -0,0 +1,31 @@
+#pragma once
+//------------------------------------------------------------------------------
+/**
+    @file jobsystem.h
+
+    Contains a minimal worker thread pool for data parallel loops.
+
+    The workers are started the first time they are needed. The thread that
+    calls ParallelFor helps out with its own loop, so nested calls from inside
+    a job are fine.
+
+    @copyright
+    (C) 2022 Individual contributors, see AUTHORS file
+*/
+//------------------------------------------------------------------------------
+#include <functional>
+
+namespace Core
+{
+namespace JobSystem
+{
+
+/// number of worker threads, not counting the threads that call ParallelFor
+uint NumWorkers();
+
+/// Runs func(begin, end) over [0, count) in chunks of at most grainSize elements.
+/// Blocks until every chunk is done.
+void ParallelFor(uint count, uint grainSize, std::function<void(uint begin, uint end)> const& func);
+
+} // namespace JobSystem
+} // namespace Core
@@ -29,6 +29,8 @@ namespace CameraManager
 	struct State
 	{
 		CameraState cameras[32];
+		/// copies of cameras, read by the render thread
+		CameraState renderCameras[32];
 		unsigned char numCameras = 0;
 
 		std::unordered_map<uint32_t, uint32_t> cameraTable;
@@ -95,6 +97,34 @@ CameraManager::GetCamera(uint32_t CAMERA_HASH)
 	return reinterpret_cast<Camera*>(&state->cameras[state->cameraTable[CAMERA_HASH]]);
 }
 
+//------------------------------------------------------------------------------
+/**
+*/
+Camera const* const
+CameraManager::GetRenderCamera(uint32_t CAMERA_HASH)
+{
+	return reinterpret_cast<Camera const*>(&state->renderCameras[state->cameraTable.at(CAMERA_HASH)]);
+}
+
+//------------------------------------------------------------------------------
+/**
+	A point p is inside when dot(plane.xyz, p) + plane.w >= 0 for all planes.
+*/
+void
+CameraManager::GetFrustumPlanes(Camera const* const camera, glm::vec4 planes[6])
+{
+	glm::mat4 const& m = camera->viewProjection;
+	glm::vec4 const row3 = glm::vec4(m[0][3], m[1][3], m[2][3], m[3][3]);
+	for (int i = 0; i < 3; i++)
+	{
+		glm::vec4 const row = glm::vec4(m[0][i], m[1][i], m[2][i], m[3][i]);
+		planes[i * 2 + 0] = row3 + row;
+		planes[i * 2 + 1] = row3 - row;
+	}
+	for (int i = 0; i < 6; i++)
+		planes[i] /= glm::length(glm::vec3(planes[i]));
+}
+
 //------------------------------------------------------------------------------
 /**
 */
@@ -110,7 +140,7 @@ CameraManager::Destroy()
 /**
 */
 void
-CameraManager::OnBeforeRender()
+CameraManager::SyncRenderThread()
 {
 	index_t i;
 	for (i = 0; i < state->numCameras; i++)
@@ -118,6 +148,7 @@ CameraManager::OnBeforeRender()
 		glm::mat4 const view = state->cameras[i].view;
 		glm::mat4 const projection = state->cameras[i].projection;
 		state->cameras[i] = DeriveCameraState(view, projection);
+		state->renderCameras[i] = state->cameras[i];
 	}
 }
 
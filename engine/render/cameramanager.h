@@ -50,11 +50,18 @@ namespace CameraManager
 
 	void UpdateCamera(Camera* const camera);
 
-	/// get a camera by hash
+	/// get a camera by hash. Written by the game, so it must not be used while rendering.
 	Camera* const GetCamera(uint32_t CAMERA_HASH);
+	/// get the copy of a camera that the frame being rendered uses
+	Camera const* const GetRenderCamera(uint32_t CAMERA_HASH);
+
+	/// get the six planes of a camera's frustum, normalized and pointing inwards
+	void GetFrustumPlanes(Camera const* const camera, glm::vec4 planes[6]);
 
 	void Destroy();
-	void OnBeforeRender();
+	/// update the derived matrices of all cameras and copy them for the next frame to be rendered.
+	/// Called by RenderDevice while the render thread is idle.
+	void SyncRenderThread();
 };
 
 } // namespace Game
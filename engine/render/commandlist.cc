@@ -0,0 +1,141 @@
+//------------------------------------------------------------------------------
+//  @file commandlist.cc
+//  @copyright (C) 2022 Individual contributors, see AUTHORS file
+//------------------------------------------------------------------------------
+#include "config.h"
+#include "render/commandlist.h"
+#include "core/jobsystem.h"
+#include "core/framearena.h"
+#include <algorithm>
+
+namespace Render
+{
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+CommandList::Clear()
+{
+    this->drawCommands.clear();
+    for (uint32_t i = 0; i < this->numChunks; i++)
+        this->chunks[i].clear();
+    this->numChunks = 0;
+    this->sorted = false;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+size_t
+CommandList::GetNumPackets() const
+{
+    size_t numPackets = 0;
+    for (uint32_t i = 0; i < this->numChunks; i++)
+        numPackets += this->chunks[i].size();
+    return numPackets;
+}
+
+//------------------------------------------------------------------------------
+/**
+    The chunks of all lists are flattened into one job range, so a pass with
+    few draw commands doesn't leave workers idle while a large one records.
+*/
+void
+CommandList::Record(CommandList* const* lists, uint32_t numLists, std::function<void(CommandList const& list, uint32_t drawCommand, std::vector<DrawPacket>& packets)> const& record)
+{
+    struct Job
+    {
+        CommandList* list;
+        uint32_t chunk;
+    };
+    Core::FrameVector<Job> jobs;
+
+    for (uint32_t l = 0; l < numLists; l++)
+    {
+        CommandList* list = lists[l];
+        for (uint32_t i = 0; i < list->numChunks; i++)
+            list->chunks[i].clear();
+        list->sorted = false;
+
+        list->numChunks = ((uint32_t)list->drawCommands.size() + ChunkSize - 1) / ChunkSize;
+        if (list->chunks.size() < list->numChunks)
+            list->chunks.resize(list->numChunks);
+
+        for (uint32_t i = 0; i < list->numChunks; i++)
+            jobs.push_back({ list, i });
+    }
+
+    Core::JobSystem::ParallelFor((uint)jobs.size(), 1, [&jobs, &record](uint begin, uint end)
+    {
+        for (uint j = begin; j < end; j++)
+        {
+            CommandList* list = jobs[j].list;
+            std::vector<DrawPacket>& packets = list->chunks[jobs[j].chunk];
+            uint32_t const first = jobs[j].chunk * ChunkSize;
+            uint32_t const last = std::min(first + ChunkSize, (uint32_t)list->drawCommands.size());
+            for (uint32_t i = first; i < last; i++)
+                record(*list, list->drawCommands[i], packets);
+        }
+    });
+}
+
+//------------------------------------------------------------------------------
+/**
+    Least significant digit radix sort on the keys, 8 bits per pass. The
+    packet index in the low bits is carried along and never sorted on, and
+    passes where every key has the same digit are skipped, so keys that only
+    use a few bits sort in fewer passes.
+*/
+void
+CommandList::SortByKey(std::function<uint32_t(DrawPacket const& packet)> const& key)
+{
+    this->unsortedPackets.clear();
+    for (uint32_t i = 0; i < this->numChunks; i++)
+        this->unsortedPackets.insert(this->unsortedPackets.end(), this->chunks[i].begin(), this->chunks[i].end());
+
+    uint32_t const numPackets = (uint32_t)this->unsortedPackets.size();
+    this->sortItems.resize(numPackets);
+    this->sortScratch.resize(numPackets);
+
+    Core::JobSystem::ParallelFor(numPackets, 1024, [this, &key](uint begin, uint end)
+    {
+        for (uint i = begin; i < end; i++)
+            this->sortItems[i] = ((uint64_t)key(this->unsortedPackets[i]) << 32) | i;
+    });
+
+    // the histograms of all digits are counted in a single pass over the keys
+    static constexpr uint32_t NumDigits = 4;
+    uint32_t counts[NumDigits][256] = {};
+    for (uint64_t item : this->sortItems)
+    {
+        for (uint32_t digit = 0; digit < NumDigits; digit++)
+            counts[digit][(item >> (32 + digit * 8)) & 0xFF]++;
+    }
+
+    for (uint32_t digit = 0; digit < NumDigits; digit++)
+    {
+        uint32_t const shift = 32 + digit * 8;
+        if (numPackets == 0 || counts[digit][(this->sortItems[0] >> shift) & 0xFF] == numPackets)
+            continue;
+
+        uint32_t offsets[256];
+        uint32_t offset = 0;
+        for (uint32_t d = 0; d < 256; d++)
+        {
+            offsets[d] = offset;
+            offset += counts[digit][d];
+        }
+
+        for (uint64_t item : this->sortItems)
+            this->sortScratch[offsets[(item >> shift) & 0xFF]++] = item;
+        this->sortItems.swap(this->sortScratch);
+    }
+
+    this->sortedPackets.resize(numPackets);
+    for (uint32_t i = 0; i < numPackets; i++)
+        this->sortedPackets[i] = this->unsortedPackets[(uint32_t)this->sortItems[i]];
+    this->sorted = true;
+}
+
+} // namespace Render
@@ -0,0 +1,103 @@
+#pragma once
+//------------------------------------------------------------------------------
+/**
+    @file commandlist.h
+
+    API-agnostic command lists for the geometry passes.
+
+    A command list draws a set of the frame's draw commands. Recording expands
+    every draw command into one packet per primitive, and is split into chunks
+    of draw commands that are recorded by the job system, so that the lists of
+    all passes, and the chunks within them, are recorded at the same time.
+    Packets only refer to engine data by index, and never call GL. They are
+    translated to GL calls by the pass that submits them, on the render thread.
+
+    Every chunk is recorded into its own packet array, which keeps the packets
+    in the order of the draw commands without synchronizing the workers. The
+    arrays keep their capacity between frames.
+
+    Lists can be sorted afterwards by a 32 bit key per packet, with a stable
+    radix sort, so packets with the same key stay in recording order.
+
+    @copyright
+    (C) 2022 Individual contributors, see AUTHORS file
+*/
+//------------------------------------------------------------------------------
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace Render
+{
+
+struct DrawPacket
+{
+    /// index into the frame's draw commands
+    uint32_t drawCommand;
+    uint32_t model;
+    uint16_t mesh;
+    uint16_t primitive;
+};
+
+class CommandList
+{
+public:
+    /// number of draw commands recorded by one job
+    static constexpr uint32_t ChunkSize = 256;
+
+    /// remove all draw commands and packets
+    void Clear();
+    /// add a draw command to be recorded
+    void Add(uint32_t drawCommand) { this->drawCommands.push_back(drawCommand); }
+    /// the draw commands that were added, in order
+    std::vector<uint32_t> const& GetDrawCommands() const { return this->drawCommands; }
+
+    /// number of packets recorded
+    size_t GetNumPackets() const;
+
+    /// call func for every packet, in the order of the draw commands, or in sorted order after SortByKey
+    template<typename FUNC> void ForEachPacket(FUNC&& func) const;
+
+    /// sort the recorded packets by ascending key. The keys are computed on the job system.
+    void SortByKey(std::function<uint32_t(DrawPacket const& packet)> const& key);
+
+    /// Records the lists by calling record for every draw command in them, with
+    /// the packet array to append to. Blocks until every list is recorded.
+    static void Record(CommandList* const* lists, uint32_t numLists, std::function<void(CommandList const& list, uint32_t drawCommand, std::vector<DrawPacket>& packets)> const& record);
+
+private:
+    std::vector<uint32_t> drawCommands;
+    std::vector<std::vector<DrawPacket>> chunks;
+    /// number of chunks that were recorded, the rest of chunks is kept for later frames
+    uint32_t numChunks = 0;
+
+    /// packets in sorted order, if the list was sorted
+    bool sorted = false;
+    std::vector<DrawPacket> sortedPackets;
+    std::vector<DrawPacket> unsortedPackets;
+    /// key in the upper 32 bits, index into unsortedPackets in the lower
+    std::vector<uint64_t> sortItems;
+    std::vector<uint64_t> sortScratch;
+};
+
+//------------------------------------------------------------------------------
+/**
+*/
+template<typename FUNC> inline void
+CommandList::ForEachPacket(FUNC&& func) const
+{
+    if (this->sorted)
+    {
+        for (DrawPacket const& packet : this->sortedPackets)
+            func(packet);
+        return;
+    }
+
+    for (uint32_t i = 0; i < this->numChunks; i++)
+    {
+        for (DrawPacket const& packet : this->chunks[i])
+            func(packet);
+    }
+}
+
+} // namespace Render
@@ -3,9 +3,12 @@
 //  @copyright (C) 2021 Individual contributors, see AUTHORS file
 //------------------------------------------------------------------------------
 #include "config.h"
-#include <queue>
+#include <vector>
+#include <algorithm>
 #include "debugrender.h"
-#include "GL/glew.h"
+#include "render/renderbackend.h"
+#include "render/glstate.h"
+#include "core/framearena.h"
 #include "shaderresource.h"
 #include "cameramanager.h"
 #include "imgui.h"
@@ -25,149 +28,227 @@ enum DebugShape
 	CIRCLE,
 	NUM_DEBUG_SHAPES
 };
-struct RenderCommand
+
+/// matches DebugVertex in debug_lines.vs
+struct LineVertex
 {
-	DebugShape shape;
-	char rendermode = RenderMode::Normal;
-	float linewidth = 1.0f;
+	glm::vec4 position;
+	glm::vec4 color;
+};
+
+/// matches DebugInstance in debug_shapes.vs
+struct ShapeInstance
+{
+	glm::mat4 transform;
+	glm::vec4 color;
+	glm::vec4 params; // x is half the length of the cylinder of a capsule, relative to its radius
 };
 
-struct LineCommand : public RenderCommand
+/// lines that are drawn with the same state, as pairs of vertices
+struct LineBatch
 {
-	glm::vec3 startpoint = glm::vec3(0.0f);
-	glm::vec3 endpoint = glm::vec3(1.0f);
-	glm::vec4 startcolor = glm::vec4(1.0f);
-	glm::vec4 endcolor = glm::vec4(1.0f);
+	char rendermode;
+	float linewidth;
+	std::vector<LineVertex> vertices;
 };
 
-struct BoxCommand : public RenderCommand
+/// instances of a shape that are drawn with the same state
+struct ShapeBatch
 {
-	glm::mat4 transform = glm::mat4();
-	glm::vec4 color = glm::vec4(1.0f);
+	DebugShape shape;
+	char rendermode;
+	float linewidth;
+	std::vector<ShapeInstance> instances;
 };
 
 struct TextCommand
 {
 	glm::vec4 point;
 	glm::vec4 color;
-	std::string text;
+	/// copied into the frame arena, which keeps it until the render thread is done with the frame
+	char const* text;
 };
 
-static std::queue<RenderCommand*> cmds;
-static std::queue<TextCommand> textcmds;
-static GLuint shaders[NUM_DEBUG_SHAPES];
-static GLuint vao[NUM_DEBUG_SHAPES];
-static GLuint ib[NUM_DEBUG_SHAPES];
-static GLuint vbo[NUM_DEBUG_SHAPES];
+/// everything that is drawn in one frame. The batches are kept between frames, so their memory is reused.
+struct DebugFrame
+{
+	std::vector<LineBatch> lines;
+	std::vector<ShapeBatch> shapes;
+	std::vector<TextCommand> text;
+};
+
+/// where a shape is in the shape index buffer, in indices
+struct ShapeMesh
+{
+	GLuint firstTriangle = 0;
+	GLuint numTriangles = 0;
+	GLuint firstLine = 0;
+	GLuint numLines = 0;
+};
+
+static DebugFrame frames[2];
+/// filled by the game thread
+static DebugFrame* gameFrame = &frames[0];
+/// the previous frame, drawn by the render thread
+static DebugFrame* renderFrame = &frames[1];
+
+static Render::ShaderProgramId shaders[NUM_DEBUG_SHAPES];
+static ShapeMesh shapeMeshes[NUM_DEBUG_SHAPES];
+/// the lines are read from lineBuffer by vertex id, so their vertex array has no attributes
+static GLuint lineVao;
+static GLuint lineBuffer;
+static size_t lineBufferCapacity = 0;
+/// the meshes of all shapes share one vertex array, and the instances of all batches one buffer
+static GLuint shapeVao;
+static GLuint shapeVbo;
+static GLuint shapeIb;
+static GLuint instanceBuffer;
+static size_t instanceBufferCapacity = 0;
+
+/// storage buffer binding of the line vertices and shape instances
+static constexpr GLuint DebugBufferBinding = 7;
 
 void DrawDebugText(const char* text, glm::vec3 point, const glm::vec4 color)
 {
+	// text is drawn through the UI, which doesn't run without a window
+	if (Render::Backend::IsHeadless())
+		return;
+
 	TextCommand cmd;
 	cmd.color = color;
-	cmd.text = text;
+	cmd.text = Core::FrameArena::CopyString(text);
 	cmd.point = glm::vec4(point, 1.0f);
-	textcmds.push(cmd);
+	gameFrame->text.push_back(cmd);
+}
+
+// there are only a few combinations of render modes and line widths in a frame, so the batches are searched linearly
+static std::vector<LineVertex>& GetLineBatch(const char rendermode, const float linewidth)
+{
+	// wireframe doesn't change how lines are drawn
+	char const depthMode = rendermode & RenderMode::AlwaysOnTop;
+	for (LineBatch& batch : gameFrame->lines)
+	{
+		if (batch.rendermode == depthMode && batch.linewidth == linewidth)
+			return batch.vertices;
+	}
+	gameFrame->lines.push_back({ depthMode, linewidth, {} });
+	return gameFrame->lines.back().vertices;
+}
+
+static void AddShape(const DebugShape shape, const glm::mat4& transform, const glm::vec4& color, const glm::vec4& params, const char rendermode, const float lineWidth)
+{
+	// the line width only matters for wireframes
+	float const linewidth = (rendermode & RenderMode::WireFrame) ? lineWidth : 1.0f;
+	for (ShapeBatch& batch : gameFrame->shapes)
+	{
+		if (batch.shape == shape && batch.rendermode == rendermode && batch.linewidth == linewidth)
+		{
+			batch.instances.push_back({ transform, color, params });
+			return;
+		}
+	}
+	gameFrame->shapes.push_back({ shape, rendermode, linewidth, {} });
+	gameFrame->shapes.back().instances.push_back({ transform, color, params });
 }
 
 void DrawLine(const glm::vec3& startPoint, const glm::vec3& endPoint, const float lineWidth, const glm::vec4& startColor, const glm::vec4& endColor, const RenderMode& renderModes)
 {
-	LineCommand* cmd = new LineCommand();
-	cmd->shape = DebugShape::LINE;
-	cmd->startpoint = startPoint;
-	cmd->endpoint = endPoint;
-	cmd->linewidth = lineWidth;
-	cmd->rendermode = renderModes;
-	cmd->startcolor = startColor;
-	cmd->endcolor = endColor;
-	cmds.push(cmd);
+	std::vector<LineVertex>& vertices = GetLineBatch(renderModes, lineWidth);
+	vertices.push_back({ glm::vec4(startPoint, 1.0f), startColor });
+	vertices.push_back({ glm::vec4(endPoint, 1.0f), endColor });
 }
 
 void DrawBox(const glm::vec3& position, const glm::quat& rotation, const float scale, const glm::vec4& color, const RenderMode renderModes, const float lineWidth)
 {
-
-	glm::mat4 transform = glm::scale(glm::vec3(scale)) * (glm::mat4)rotation;
-	glm::translate(transform, position);
-	
-	BoxCommand* cmd = new BoxCommand();
-	cmd->shape = DebugShape::BOX;
-	cmd->transform = transform;
-	cmd->linewidth = lineWidth;
-	cmd->color = color;
-	cmd->rendermode = renderModes;
-	cmds.push(cmd);
+	glm::mat4 const transform = glm::translate(position) * (glm::mat4)rotation * glm::scale(glm::vec3(scale));
+	AddShape(DebugShape::BOX, transform, color, glm::vec4(0.0f), renderModes, lineWidth);
 }
 
 void DrawBox(const glm::vec3& position, const glm::quat& rotation, const float width, const float height, const float length, const glm::vec4& color, const RenderMode renderModes, const float lineWidth)
 {
-	glm::mat4 transform = glm::scale(glm::vec3(width, height, length)) * (glm::mat4)rotation;
-	glm::translate(transform, position);
-	
-	BoxCommand* cmd = new BoxCommand();
-	cmd->shape = DebugShape::BOX;
-	cmd->transform = transform;
-	cmd->linewidth = lineWidth;
-	cmd->color = color;
-	cmd->rendermode = renderModes;
-	cmds.push(cmd);
+	glm::mat4 const transform = glm::translate(position) * (glm::mat4)rotation * glm::scale(glm::vec3(width, height, length));
+	AddShape(DebugShape::BOX, transform, color, glm::vec4(0.0f), renderModes, lineWidth);
 }
 
 void DrawBox(const glm::mat4& transform, const glm::vec4& color, const RenderMode renderModes, const float lineWidth)
 {
-	BoxCommand* cmd = new BoxCommand();
-	cmd->shape = DebugShape::BOX;
-	cmd->transform = transform;
-	cmd->linewidth = lineWidth;
-	cmd->color = color;
-	cmd->rendermode = renderModes;
-	cmds.push(cmd);
+	AddShape(DebugShape::BOX, transform, color, glm::vec4(0.0f), renderModes, lineWidth);
 }
 
-void SetupShaders()
+void DrawSphere(const glm::vec3& position, const float radius, const glm::vec4& color, const RenderMode renderModes, const float lineWidth)
+{
+	AddShape(DebugShape::SPHERE, glm::translate(position) * glm::scale(glm::vec3(radius)), color, glm::vec4(0.0f), renderModes, lineWidth);
+}
+
+void DrawSphere(const glm::mat4& transform, const glm::vec4& color, const RenderMode renderModes, const float lineWidth)
 {
-	Render::ShaderResourceId const vsDebug = Render::ShaderResource::LoadShader(Render::ShaderResource::ShaderType::VERTEXSHADER, "shd/debug.vs");
-	Render::ShaderResourceId const psDebug = Render::ShaderResource::LoadShader(Render::ShaderResource::ShaderType::FRAGMENTSHADER, "shd/debug.fs");
-	Render::ShaderProgramId const progDebug = Render::ShaderResource::CompileShaderProgram({ vsDebug, psDebug });
-	shaders[DebugShape::BOX] = Render::ShaderResource::GetProgramHandle(progDebug);
+	AddShape(DebugShape::SPHERE, transform, color, glm::vec4(0.0f), renderModes, lineWidth);
+}
+
+void DrawCone(const glm::vec3& position, const glm::quat& rotation, const float radius, const float height, const glm::vec4& color, const RenderMode renderModes, const float lineWidth)
+{
+	glm::mat4 const transform = glm::translate(position) * (glm::mat4)rotation * glm::scale(glm::vec3(radius, height, radius));
+	AddShape(DebugShape::CONE, transform, color, glm::vec4(0.0f), renderModes, lineWidth);
+}
 
+void DrawCapsule(const glm::vec3& startPoint, const glm::vec3& endPoint, const float radius, const glm::vec4& color, const RenderMode renderModes, const float lineWidth)
+{
+	glm::vec3 const axis = endPoint - startPoint;
+	float const length = glm::length(axis);
+	glm::vec3 const y = length > 0.0f ? axis / length : glm::vec3(0, 1, 0);
+	glm::vec3 const x = glm::normalize(glm::cross(y, glm::abs(y.x) < 0.9f ? glm::vec3(1, 0, 0) : glm::vec3(0, 0, 1)));
+	glm::vec3 const z = glm::cross(x, y);
+
+	// the capsule mesh has a radius of one, and its hemispheres are moved apart in the shader
+	glm::mat4 const transform = glm::mat4(glm::vec4(x * radius, 0.0f), glm::vec4(y * radius, 0.0f), glm::vec4(z * radius, 0.0f), glm::vec4((startPoint + endPoint) * 0.5f, 1.0f));
+	float const halfLength = radius > 0.0f ? length * 0.5f / radius : 0.0f;
+	AddShape(DebugShape::CAPSULE, transform, color, glm::vec4(halfLength, 0.0f, 0.0f, 0.0f), renderModes, lineWidth);
+}
+
+void DrawFrustum(const glm::mat4& viewProjection, const glm::vec4& color, const RenderMode renderModes, const float lineWidth)
+{
+	// the frustum is the unit box scaled to clip space, and the shader divides by w after the transform
+	glm::mat4 const transform = glm::inverse(viewProjection) * glm::scale(glm::vec3(2.0f));
+	AddShape(DebugShape::FRUSTUM, transform, color, glm::vec4(0.0f), renderModes, lineWidth);
+}
+
+void DrawCircle(const glm::vec3& position, const glm::quat& rotation, const float radius, const glm::vec4& color, const RenderMode renderModes, const float lineWidth)
+{
+	glm::mat4 const transform = glm::translate(position) * (glm::mat4)rotation * glm::scale(glm::vec3(radius));
+	AddShape(DebugShape::CIRCLE, transform, color, glm::vec4(0.0f), renderModes, lineWidth);
+}
+
+void SetupShaders()
+{
+	Render::ShaderResourceId const vsShapes = Render::ShaderResource::LoadShader(Render::ShaderResource::ShaderType::VERTEXSHADER, "shd/debug_shapes.vs");
 	Render::ShaderResourceId const vsLine = Render::ShaderResource::LoadShader(Render::ShaderResource::ShaderType::VERTEXSHADER, "shd/debug_lines.vs");
 	Render::ShaderResourceId const psLine = Render::ShaderResource::LoadShader(Render::ShaderResource::ShaderType::FRAGMENTSHADER, "shd/debug_lines.fs");
+	Render::ShaderProgramId const progShapes = Render::ShaderResource::CompileShaderProgram({ vsShapes, psLine });
+	for (int i = 0; i < NUM_DEBUG_SHAPES; i++)
+		shaders[i] = progShapes;
+
 	Render::ShaderProgramId const progLine = Render::ShaderResource::CompileShaderProgram({ vsLine, psLine });
-	shaders[DebugShape::LINE] = Render::ShaderResource::GetProgramHandle(progLine);
+	shaders[DebugShape::LINE] = progLine;
 }
 
 void SetupLine()
 {
-	glGenVertexArrays(1, &vao[DebugShape::LINE]);
-	glBindVertexArray(vao[DebugShape::LINE]);
-
-	glGenBuffers(1, &vbo[DebugShape::LINE]);
-	glBindBuffer(GL_ARRAY_BUFFER, vbo[DebugShape::LINE]);
-	// buffer some dummy data. We use uniforms for setting the positions and colors of the lines.
-	glBufferData(GL_ARRAY_BUFFER, 2 * sizeof(float), NULL, GL_STATIC_DRAW);
-
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(0, 1, GL_FLOAT, GL_FALSE, sizeof(GLfloat), NULL);
-
-	glBindVertexArray(0);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glGenVertexArrays(1, &lineVao);
+	glCreateBuffers(1, &lineBuffer);
 }
 
-void SetupBox()
+// vertices are xyz and the side of a capsule the vertex is on, indices are absolute
+struct ShapeBuilder
 {
-	const int meshSize = 24;
-	const GLfloat mesh[meshSize] =
-	{
-		0.5, -0.5, -0.5,
-		0.5, -0.5, 0.5,
-		-0.5, -0.5, 0.5,
-		-0.5, -0.5, -0.5,
-		0.5, 0.5, -0.5,
-		0.5, 0.5, 0.5,
-		-0.5, 0.5, 0.5,
-		-0.5, 0.5, -0.5
-	};
-	const int indicesSize = 60;
-	const int indices[indicesSize] =
+	std::vector<glm::vec4> vertices;
+	std::vector<GLuint> triangles;
+	std::vector<GLuint> lines;
+};
+
+static void AddBox(ShapeBuilder& builder, ShapeMesh& mesh)
+{
+	GLuint const base = (GLuint)builder.vertices.size();
+	const GLuint indices[60] =
 	{
 		// triangles
 		0, 1, 2,
@@ -197,24 +278,160 @@ void SetupBox()
 		2, 6,
 		3, 7
 	};
+	builder.vertices.insert(builder.vertices.end(),
+	{
+		{ 0.5, -0.5, -0.5, 0 },
+		{ 0.5, -0.5, 0.5, 0 },
+		{ -0.5, -0.5, 0.5, 0 },
+		{ -0.5, -0.5, -0.5, 0 },
+		{ 0.5, 0.5, -0.5, 0 },
+		{ 0.5, 0.5, 0.5, 0 },
+		{ -0.5, 0.5, 0.5, 0 },
+		{ -0.5, 0.5, -0.5, 0 }
+	});
+
+	mesh.firstTriangle = (GLuint)builder.triangles.size();
+	mesh.numTriangles = 36;
+	for (int i = 0; i < 36; i++)
+		builder.triangles.push_back(base + indices[i]);
+	mesh.firstLine = (GLuint)builder.lines.size();
+	mesh.numLines = 24;
+	for (int i = 36; i < 60; i++)
+		builder.lines.push_back(base + indices[i]);
+}
 
-	glGenVertexArrays(1, &vao[DebugShape::BOX]);
-	glBindVertexArray(vao[DebugShape::BOX]);
+// a sphere with a radius of one, made of rings from the top to the bottom.
+// A capsule gets the equator twice, once for each hemisphere, and a cylinder between them.
+static void AddSphere(ShapeBuilder& builder, ShapeMesh& mesh, const bool capsule)
+{
+	const int segments = 16;
+	const int stacks = 8;
+	struct Ring { float angle; float side; };
+	std::vector<Ring> rings;
+	for (int i = 0; i <= stacks; i++)
+	{
+		float const angle = glm::pi<float>() * (float)i / (float)stacks;
+		if (!capsule)
+		{
+			rings.push_back({ angle, 0.0f });
+		}
+		else
+		{
+			if (i <= stacks / 2)
+				rings.push_back({ angle, 1.0f });
+			if (i >= stacks / 2)
+				rings.push_back({ angle, -1.0f });
+		}
+	}
 
-	glGenBuffers(1, &vbo[DebugShape::BOX]);
-	glBindBuffer(GL_ARRAY_BUFFER, vbo[DebugShape::BOX]);
-	glBufferData(GL_ARRAY_BUFFER, meshSize * sizeof(GLfloat), mesh, GL_STATIC_DRAW);
+	GLuint const base = (GLuint)builder.vertices.size();
+	for (Ring const& ring : rings)
+	{
+		for (int j = 0; j <= segments; j++)
+		{
+			float const angle = 2.0f * glm::pi<float>() * (float)j / (float)segments;
+			builder.vertices.push_back(glm::vec4(sinf(ring.angle) * cosf(angle), cosf(ring.angle), sinf(ring.angle) * sinf(angle), ring.side));
+		}
+	}
+
+	GLuint const rowSize = segments + 1;
+	mesh.firstTriangle = (GLuint)builder.triangles.size();
+	mesh.firstLine = (GLuint)builder.lines.size();
+	for (GLuint i = 0; i < (GLuint)rings.size(); i++)
+	{
+		for (GLuint j = 0; j < (GLuint)segments; j++)
+		{
+			GLuint const v = base + i * rowSize + j;
+			// the rings at the poles collapse to a point
+			if (i > 0 && i + 1 < (GLuint)rings.size())
+				builder.lines.insert(builder.lines.end(), { v, v + 1 });
+			if (i + 1 < (GLuint)rings.size())
+			{
+				builder.triangles.insert(builder.triangles.end(), { v, v + 1, v + rowSize, v + 1, v + rowSize + 1, v + rowSize });
+				// meridians, every other segment
+				if (j % 2 == 0)
+					builder.lines.insert(builder.lines.end(), { v, v + rowSize });
+			}
+		}
+	}
+	mesh.numTriangles = (GLuint)builder.triangles.size() - mesh.firstTriangle;
+	mesh.numLines = (GLuint)builder.lines.size() - mesh.firstLine;
+}
+
+// the base and the tip of a cone are at y = 0 and y = 1. A circle is the base on its own.
+static void AddDisc(ShapeBuilder& builder, ShapeMesh& mesh, const bool cone)
+{
+	const int segments = 32;
+	GLuint const base = (GLuint)builder.vertices.size();
+	GLuint const center = base + segments;
+	GLuint const tip = center + 1;
+	for (int i = 0; i < segments; i++)
+	{
+		float const angle = 2.0f * glm::pi<float>() * (float)i / (float)segments;
+		builder.vertices.push_back(glm::vec4(cosf(angle), 0.0f, sinf(angle), 0.0f));
+	}
+	builder.vertices.push_back(glm::vec4(0.0f));
+	if (cone)
+		builder.vertices.push_back(glm::vec4(0.0f, 1.0f, 0.0f, 0.0f));
+
+	mesh.firstTriangle = (GLuint)builder.triangles.size();
+	mesh.firstLine = (GLuint)builder.lines.size();
+	for (GLuint i = 0; i < (GLuint)segments; i++)
+	{
+		GLuint const v = base + i;
+		GLuint const next = base + (i + 1) % segments;
+		builder.triangles.insert(builder.triangles.end(), { center, next, v });
+		builder.lines.insert(builder.lines.end(), { v, next });
+		if (cone)
+		{
+			builder.triangles.insert(builder.triangles.end(), { tip, v, next });
+			if (i % (segments / 4) == 0)
+				builder.lines.insert(builder.lines.end(), { v, tip });
+		}
+	}
+	mesh.numTriangles = (GLuint)builder.triangles.size() - mesh.firstTriangle;
+	mesh.numLines = (GLuint)builder.lines.size() - mesh.firstLine;
+}
+
+void SetupShapes()
+{
+	ShapeBuilder builder;
+	AddBox(builder, shapeMeshes[DebugShape::BOX]);
+	AddSphere(builder, shapeMeshes[DebugShape::SPHERE], false);
+	AddSphere(builder, shapeMeshes[DebugShape::CAPSULE], true);
+	AddDisc(builder, shapeMeshes[DebugShape::CONE], true);
+	AddDisc(builder, shapeMeshes[DebugShape::CIRCLE], false);
+
+	// the outlines go after the triangles in the index buffer
+	GLuint const numTriangles = (GLuint)builder.triangles.size();
+	for (ShapeMesh& mesh : shapeMeshes)
+	{
+		if (mesh.numLines > 0)
+			mesh.firstLine += numTriangles;
+	}
+	// the frustum is drawn with the box mesh
+	shapeMeshes[DebugShape::FRUSTUM] = shapeMeshes[DebugShape::BOX];
+	builder.triangles.insert(builder.triangles.end(), builder.lines.begin(), builder.lines.end());
+
+	glGenVertexArrays(1, &shapeVao);
+	Render::GLState::BindVertexArray(shapeVao);
+
+	glGenBuffers(1, &shapeVbo);
+	glBindBuffer(GL_ARRAY_BUFFER, shapeVbo);
+	glBufferData(GL_ARRAY_BUFFER, builder.vertices.size() * sizeof(glm::vec4), builder.vertices.data(), GL_STATIC_DRAW);
 
 	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(GLfloat) * 3, NULL);
+	glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(glm::vec4), NULL);
 
-	glGenBuffers(1, &ib[DebugShape::BOX]);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ib[DebugShape::BOX]);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indicesSize * sizeof(GLuint), indices, GL_STATIC_DRAW);
+	glGenBuffers(1, &shapeIb);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, shapeIb);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, builder.triangles.size() * sizeof(GLuint), builder.triangles.data(), GL_STATIC_DRAW);
 
-	glBindVertexArray(0);
+	Render::GLState::BindVertexArray(0);
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+	glCreateBuffers(1, &instanceBuffer);
 }
 
 //------------------------------------------------------------------------------
@@ -225,133 +442,154 @@ void InitDebugRendering()
 {
 	SetupShaders();
 	SetupLine();
-	SetupBox();
+	SetupShapes();
 }
 
-void RenderLine(RenderCommand* command)
+// the state is left for the next batch, and isn't set again while the render modes are the same
+void SetDepthState(const char rendermode)
 {
-	LineCommand* lineCommand = (LineCommand*)command;
-
-	glUseProgram(shaders[DebugShape::LINE]);
-
-	if ((lineCommand->rendermode & RenderMode::AlwaysOnTop) == RenderMode::AlwaysOnTop)
+	if ((rendermode & RenderMode::AlwaysOnTop) == RenderMode::AlwaysOnTop)
 	{
-		glDepthFunc(GL_ALWAYS);
-		glDepthRange(0.0f, 0.01f);
+		Render::GLState::DepthFunc(GL_ALWAYS);
+		Render::GLState::DepthRange(0.0f, 0.01f);
 	}
-
-	glPolygonMode(GL_FRONT, GL_LINE);
-	glLineWidth(lineCommand->linewidth);
-
-	glBindVertexArray(vao[DebugShape::LINE]);
-
-	// This is so dumb, yet so much fun
-	static GLuint v0pos = glGetUniformLocation(shaders[DebugShape::LINE], "v0pos");
-	static GLuint v1pos = glGetUniformLocation(shaders[DebugShape::LINE], "v1pos");
-	static GLuint v0color = glGetUniformLocation(shaders[DebugShape::LINE], "v0color");
-	static GLuint v1color = glGetUniformLocation(shaders[DebugShape::LINE], "v1color");
-	static GLuint viewProjection = glGetUniformLocation(shaders[DebugShape::LINE], "viewProjection");
-
-	// Upload uniforms for positions and colors
-	glUniform4fv(v0pos, 1, &lineCommand->startpoint[0]);
-	glUniform4fv(v1pos, 1, &lineCommand->endpoint[0]);
-	glUniform4fv(v0color, 1, &lineCommand->startcolor[0]);
-	glUniform4fv(v1color, 1, &lineCommand->endcolor[0]);
-
-	Render::Camera* const mainCamera = Render::CameraManager::GetCamera(CAMERA_MAIN);
-	glUniformMatrix4fv(viewProjection, 1, GL_FALSE, &mainCamera->viewProjection[0][0]);
-
-	glDrawArrays(GL_LINES, 0, 2);
-
-	glBindVertexArray(0);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-
-	glPolygonMode(GL_FRONT, GL_FILL);
-
-	if ((lineCommand->rendermode & RenderMode::AlwaysOnTop) == RenderMode::AlwaysOnTop)
+	else
 	{
-		glDepthFunc(GL_LEQUAL);
-		glDepthRange(0.0f, 1.0f);
+		Render::GLState::DepthFunc(GL_LEQUAL);
+		Render::GLState::DepthRange(0.0f, 1.0f);
 	}
 }
 
-void RenderBox(RenderCommand* command)
+// grows a buffer that is rewritten every frame
+static void ReserveBuffer(const GLuint buffer, size_t& capacity, const size_t size)
 {
-	BoxCommand* cmd = (BoxCommand*)command;
-
-	glUseProgram(shaders[DebugShape::BOX]);
-
-	glBindVertexArray(vao[DebugShape::BOX]);
-
-	GLuint loc = glGetUniformLocation(shaders[DebugShape::BOX], "color");
-	glUniform4fv(loc, 1, &cmd->color.x);
-
-	static GLuint model = glGetUniformLocation(shaders[DebugShape::BOX], "model");
-	static GLuint viewProjection = glGetUniformLocation(shaders[DebugShape::BOX], "viewProjection");
-	Render::Camera* const mainCamera = Render::CameraManager::GetCamera(CAMERA_MAIN);
-	glUniformMatrix4fv(model, 1, GL_FALSE, &cmd->transform[0][0]);
-	glUniformMatrix4fv(viewProjection, 1, GL_FALSE, &mainCamera->viewProjection[0][0]);
-
-	if ((cmd->rendermode & RenderMode::AlwaysOnTop) == RenderMode::AlwaysOnTop)
+	if (size > capacity)
 	{
-		glDepthFunc(GL_ALWAYS);
-		glDepthRange(0.0f, 0.01f);
+		capacity = glm::max(size, capacity * 2);
+		glNamedBufferData(buffer, capacity, nullptr, GL_DYNAMIC_DRAW);
 	}
+}
 
-	if ((cmd->rendermode & RenderMode::WireFrame) == RenderMode::WireFrame)
-	{
-		glPolygonMode(GL_FRONT, GL_LINE);
-		glLineWidth(cmd->linewidth);
+// all lines are uploaded into one buffer, and each batch is drawn with one call
+void RenderLines(const glm::mat4& viewProjection)
+{
+	size_t numVertices = 0;
+	for (LineBatch const& batch : renderFrame->lines)
+		numVertices += batch.vertices.size();
+	if (numVertices == 0)
+		return;
 
-		glDrawElements(GL_LINES, 24, GL_UNSIGNED_INT, (void*)(36 * sizeof(GLuint)));
-		glPolygonMode(GL_FRONT, GL_FILL);
-	}
-	else
+	ReserveBuffer(lineBuffer, lineBufferCapacity, numVertices * sizeof(LineVertex));
+	size_t offset = 0;
+	for (LineBatch const& batch : renderFrame->lines)
 	{
-		glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, NULL);
+		glNamedBufferSubData(lineBuffer, offset * sizeof(LineVertex), batch.vertices.size() * sizeof(LineVertex), batch.vertices.data());
+		offset += batch.vertices.size();
 	}
 
-	if ((cmd->rendermode & RenderMode::AlwaysOnTop) == RenderMode::AlwaysOnTop)
+	Render::ShaderProgramId const program = shaders[DebugShape::LINE];
+	Render::GLState::UseProgram(Render::ShaderResource::GetProgramHandle(program));
+	glUniformMatrix4fv(Render::ShaderResource::GetUniformLocation(program, "viewProjection"), 1, GL_FALSE, &viewProjection[0][0]);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, DebugBufferBinding, lineBuffer);
+	Render::GLState::BindVertexArray(lineVao);
+
+	GLint first = 0;
+	for (LineBatch const& batch : renderFrame->lines)
 	{
-		glDepthFunc(GL_LEQUAL);
-		glDepthRange(0.0f, 1.0f);
+		if (!batch.vertices.empty())
+		{
+			SetDepthState(batch.rendermode);
+			Render::GLState::LineWidth(batch.linewidth);
+			glDrawArrays(GL_LINES, first, (GLsizei)batch.vertices.size());
+			first += (GLsizei)batch.vertices.size();
+		}
 	}
-
-	glBindVertexArray(0);
 }
 
-void DispatchDebugDrawing()
+// all instances are uploaded into one buffer, and each batch is drawn with one instanced call
+void RenderShapes(const glm::mat4& viewProjection)
 {
-	while (!cmds.empty())
+	size_t numInstances = 0;
+	for (ShapeBatch const& batch : renderFrame->shapes)
+		numInstances += batch.instances.size();
+	if (numInstances == 0)
+		return;
+
+	ReserveBuffer(instanceBuffer, instanceBufferCapacity, numInstances * sizeof(ShapeInstance));
+	size_t offset = 0;
+	for (ShapeBatch const& batch : renderFrame->shapes)
 	{
-		RenderCommand* currentCommand = cmds.front();
-		cmds.pop();
-		switch (currentCommand->shape)
-		{
-		case DebugShape::LINE:
-		{
-			RenderLine(currentCommand);
-			break;
-		}
-		case DebugShape::BOX:
+		glNamedBufferSubData(instanceBuffer, offset * sizeof(ShapeInstance), batch.instances.size() * sizeof(ShapeInstance), batch.instances.data());
+		offset += batch.instances.size();
+	}
+
+	Render::ShaderProgramId const program = shaders[DebugShape::BOX];
+	Render::GLState::UseProgram(Render::ShaderResource::GetProgramHandle(program));
+	glUniformMatrix4fv(Render::ShaderResource::GetUniformLocation(program, "viewProjection"), 1, GL_FALSE, &viewProjection[0][0]);
+	GLint const instanceOffset = Render::ShaderResource::GetUniformLocation(program, "instanceOffset");
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, DebugBufferBinding, instanceBuffer);
+	Render::GLState::BindVertexArray(shapeVao);
+
+	// the meshes aren't closed for every transform, a frustum can be inside out
+	Render::GLState::Disable(GL_CULL_FACE);
+	GLuint first = 0;
+	for (ShapeBatch const& batch : renderFrame->shapes)
+	{
+		if (batch.instances.empty())
+			continue;
+
+		ShapeMesh const& mesh = shapeMeshes[batch.shape];
+		SetDepthState(batch.rendermode);
+		glUniform1ui(instanceOffset, first);
+		if ((batch.rendermode & RenderMode::WireFrame) == RenderMode::WireFrame)
 		{
-			RenderBox(currentCommand);
-			break;
+			Render::GLState::LineWidth(batch.linewidth);
+			glDrawElementsInstanced(GL_LINES, mesh.numLines, GL_UNSIGNED_INT, (void*)(mesh.firstLine * sizeof(GLuint)), (GLsizei)batch.instances.size());
 		}
-		default:
+		else
 		{
-			n_assert2(false, "Debug::RenderShape not fully implemented!\n");
-			break;
+			Render::GLState::PolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+			glDrawElementsInstanced(GL_TRIANGLES, mesh.numTriangles, GL_UNSIGNED_INT, (void*)(mesh.firstTriangle * sizeof(GLuint)), (GLsizei)batch.instances.size());
 		}
-		} // switch
-
-		delete currentCommand;
+		first += (GLuint)batch.instances.size();
 	}
+	Render::GLState::Enable(GL_CULL_FACE);
+}
+
+// drops the batches that weren't used in the frame, and empties the rest
+static void ResetFrame(DebugFrame& frame)
+{
+	frame.lines.erase(std::remove_if(frame.lines.begin(), frame.lines.end(), [](LineBatch const& batch) { return batch.vertices.empty(); }), frame.lines.end());
+	frame.shapes.erase(std::remove_if(frame.shapes.begin(), frame.shapes.end(), [](ShapeBatch const& batch) { return batch.instances.empty(); }), frame.shapes.end());
+	for (LineBatch& batch : frame.lines)
+		batch.vertices.clear();
+	for (ShapeBatch& batch : frame.shapes)
+		batch.instances.clear();
+	frame.text.clear();
+}
+
+void SyncRenderThread()
+{
+	// batches the render thread didn't draw, because their pass was skipped, are dropped
+	ResetFrame(*renderFrame);
+	std::swap(gameFrame, renderFrame);
+}
+
+void DispatchDebugDrawing()
+{
+	Render::Camera const* const mainCamera = Render::CameraManager::GetRenderCamera(CAMERA_MAIN);
+	RenderLines(mainCamera->viewProjection);
+	RenderShapes(mainCamera->viewProjection);
+
+	Render::GLState::BindVertexArray(0);
+	Render::GLState::PolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+	Render::GLState::DepthFunc(GL_LESS);
+	Render::GLState::DepthRange(0.0f, 1.0f);
 }
 
 void DispatchDebugTextDrawing()
 {
-	if (textcmds.empty())
+	if (renderFrame->text.empty())
 		return;
 
 	static bool open = true;
@@ -365,12 +603,10 @@ void DispatchDebugTextDrawing()
 		ImGuiWindowFlags_NoNav
 	);
 
-	Render::Camera* const cam = Render::CameraManager::GetCamera(CAMERA_MAIN);
+	Render::Camera const* const cam = Render::CameraManager::GetRenderCamera(CAMERA_MAIN);
 
-	while (!textcmds.empty())
+	for (TextCommand& cmd : renderFrame->text)
 	{
-		TextCommand& cmd = textcmds.front();
-
 		// transform point into screenspace
 		cmd.point.w = 1.0f;
 		glm::vec4 ndc = cam->viewProjection * cmd.point;
@@ -385,16 +621,16 @@ void DispatchDebugTextDrawing()
 			cursorPos.x *= ImGui::GetWindowWidth();
 			cursorPos.y *= ImGui::GetWindowHeight();
 			// center text
-			cursorPos.x -= ImGui::CalcTextSize(cmd.text.c_str()).x / 2.0f;
+			cursorPos.x -= ImGui::CalcTextSize(cmd.text).x / 2.0f;
 
 			ImGui::SetCursorPos({ cursorPos.x, cursorPos.y });
 		
 			ImGui::PushStyleColor(ImGuiCol_Text, ImVec4(cmd.color.x, cmd.color.y, cmd.color.z, cmd.color.w));
-			ImGui::TextUnformatted(cmd.text.c_str());
+			ImGui::TextUnformatted(cmd.text);
 			ImGui::PopStyleColor();
 		}
-		textcmds.pop();
 	}
+	renderFrame->text.clear();
 	ImGui::End();
 }
 
@@ -30,8 +30,22 @@ void DrawBox(const glm::vec3& position, const glm::quat& rotation, const float s
 void DrawBox(const glm::vec3& position, const glm::quat& rotation, const float width, const float height, const float length, const glm::vec4& color, const RenderMode renderModes = RenderMode::Normal, const float lineWidth = 1.0f);
 ///Draws a colored box with transform
 void DrawBox(const glm::mat4& transform, const glm::vec4& color, const RenderMode renderModes = RenderMode::Normal, const float lineWidth = 1.0f);
+///Draws a sphere with radius at position
+void DrawSphere(const glm::vec3& position, const float radius, const glm::vec4& color, const RenderMode renderModes = RenderMode::Normal, const float lineWidth = 1.0f);
+///Draws a unit sphere with transform
+void DrawSphere(const glm::mat4& transform, const glm::vec4& color, const RenderMode renderModes = RenderMode::Normal, const float lineWidth = 1.0f);
+///Draws a cone with its base centered at position, and its tip height units along the rotated y-axis
+void DrawCone(const glm::vec3& position, const glm::quat& rotation, const float radius, const float height, const glm::vec4& color, const RenderMode renderModes = RenderMode::Normal, const float lineWidth = 1.0f);
+///Draws a capsule around the line from startPoint to endPoint
+void DrawCapsule(const glm::vec3& startPoint, const glm::vec3& endPoint, const float radius, const glm::vec4& color, const RenderMode renderModes = RenderMode::Normal, const float lineWidth = 1.0f);
+///Draws the frustum of a view projection matrix
+void DrawFrustum(const glm::mat4& viewProjection, const glm::vec4& color, const RenderMode renderModes = RenderMode::Normal, const float lineWidth = 1.0f);
+///Draws a circle at position, in the plane of the rotated x- and z-axis
+void DrawCircle(const glm::vec3& position, const glm::quat& rotation, const float radius, const glm::vec4& color, const RenderMode renderModes = RenderMode::Normal, const float lineWidth = 1.0f);
 
 void InitDebugRendering();
+///Hands the commands of the last frame to the render thread. Called by RenderDevice while the render thread is idle.
+void SyncRenderThread();
 void DispatchDebugDrawing();
 void DispatchDebugTextDrawing();
 
@@ -0,0 +1,138 @@
+//------------------------------------------------------------------------------
+//  @file dynamicresolution.cc
+//  @copyright (C) 2022 Individual contributors, see AUTHORS file
+//------------------------------------------------------------------------------
+#include "config.h"
+#include "render/dynamicresolution.h"
+#include "core/cvar.h"
+
+namespace Render
+{
+
+static Core::CVar* r_dynamic_resolution = nullptr;
+static Core::CVar* r_frame_budget_ms = nullptr;
+static Core::CVar* r_resolution_scale_min = nullptr;
+
+//------------------------------------------------------------------------------
+/**
+*/
+DynamicResolution::DynamicResolution() :
+    numFrames(0),
+    numResults(0),
+    smoothedFrameTime(0.0f),
+    scale(1.0f),
+    holdFrames(0)
+{
+    for (GLuint& query : this->queries)
+        query = 0;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+DynamicResolution::Setup()
+{
+    glGenQueries(NumQueries, this->queries);
+
+    r_dynamic_resolution = Core::CVarCreate(Core::CVarType::CVar_Int, "r_dynamic_resolution", "1");
+    r_frame_budget_ms = Core::CVarCreate(Core::CVarType::CVar_Float, "r_frame_budget_ms", "16.6");
+    r_resolution_scale_min = Core::CVarCreate(Core::CVarType::CVar_Float, "r_resolution_scale_min", "0.5");
+}
+
+//------------------------------------------------------------------------------
+/**
+    Frames are not measured while all queries are still waiting for results.
+*/
+void
+DynamicResolution::BeginFrame()
+{
+    if (this->numFrames - this->numResults >= NumQueries)
+        return;
+
+    glBeginQuery(GL_TIME_ELAPSED, this->queries[this->numFrames % NumQueries]);
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+DynamicResolution::EndFrame()
+{
+    if (this->numFrames - this->numResults >= NumQueries)
+        return;
+
+    glEndQuery(GL_TIME_ELAPSED);
+    this->numFrames++;
+}
+
+//------------------------------------------------------------------------------
+/**
+    Queries finish in order, so reading stops at the first one that isn't done.
+*/
+float
+DynamicResolution::Update()
+{
+    while (this->numResults < this->numFrames)
+    {
+        GLuint const query = this->queries[this->numResults % NumQueries];
+        GLint available = 0;
+        glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            break;
+
+        GLuint64 nanoseconds = 0;
+        glGetQueryObjectui64v(query, GL_QUERY_RESULT, &nanoseconds);
+        this->numResults++;
+        this->AddFrameTime((float)(nanoseconds * 1e-6));
+    }
+
+    if (Core::CVarReadInt(r_dynamic_resolution) <= 0)
+        this->scale = 1.0f;
+
+    return this->scale;
+}
+
+//------------------------------------------------------------------------------
+/**
+    The cost of a frame is assumed to follow the number of pixels, so the
+    scale that meets the budget is the square root of the time ratio.
+*/
+void
+DynamicResolution::AddFrameTime(float milliseconds)
+{
+    if (this->smoothedFrameTime <= 0.0f)
+        this->smoothedFrameTime = milliseconds;
+    else
+        this->smoothedFrameTime += (milliseconds - this->smoothedFrameTime) * 0.1f;
+
+    if (Core::CVarReadInt(r_dynamic_resolution) <= 0 || this->holdFrames > 0)
+    {
+        if (this->holdFrames > 0)
+            this->holdFrames--;
+        return;
+    }
+
+    float const budget = glm::max(Core::CVarReadFloat(r_frame_budget_ms), 0.1f);
+    float const minScale = glm::clamp(Core::CVarReadFloat(r_resolution_scale_min), ScaleStep, 1.0f);
+    float const idealScale = this->scale * glm::sqrt(budget / glm::max(this->smoothedFrameTime, 0.001f));
+
+    // drop to the ideal scale at once, but only raise it one step at a time, with some headroom
+    float target = this->scale;
+    if (this->smoothedFrameTime > budget)
+        target = idealScale;
+    else if (this->smoothedFrameTime < budget * 0.85f)
+        target = glm::min(idealScale, this->scale + ScaleStep);
+
+    target = glm::floor(target / ScaleStep + 0.001f) * ScaleStep;
+    target = glm::clamp(target, minScale, 1.0f);
+    if (target == this->scale)
+        return;
+
+    // predict the time at the new scale, so the smoothing doesn't keep reacting to the old one
+    this->smoothedFrameTime *= (target * target) / (this->scale * this->scale);
+    this->scale = target;
+    this->holdFrames = NumQueries;
+}
+
+} // namespace Render
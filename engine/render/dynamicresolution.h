@@ -0,0 +1,68 @@
+#pragma once
+//------------------------------------------------------------------------------
+/**
+    @file dynamicresolution.h
+
+    Dynamic resolution controller.
+
+    The GPU time of every frame is measured with timer queries, which are read
+    back a few frames later so the CPU never waits for them. The times are
+    smoothed, and the controller picks the resolution scale that would bring
+    the smoothed time to the r_frame_budget_ms budget, assuming the cost
+    follows the number of pixels. It lowers the scale at once when a frame
+    goes over budget, and only raises it slowly once there is headroom.
+
+    The scale is quantized, so the render targets only change size in steps,
+    and it is held for a few frames after every change until timings of the
+    new size come back.
+
+    @copyright
+    (C) 2022 Individual contributors, see AUTHORS file
+*/
+//------------------------------------------------------------------------------
+#include "render/renderbackend.h"
+
+namespace Render
+{
+
+class DynamicResolution
+{
+public:
+    /// number of frames that the timer queries are read back after
+    static constexpr uint32_t NumQueries = 4;
+    /// the scale is a multiple of this
+    static constexpr float ScaleStep = 1.0f / 32.0f;
+
+    DynamicResolution();
+
+    /// create the timer queries and CVars
+    void Setup();
+
+    /// start and stop measuring the GPU time of a frame
+    void BeginFrame();
+    void EndFrame();
+
+    /// read back the finished measurements, and return the scale to render the next frame with
+    float Update();
+
+    /// feed a GPU frame time to the controller. Called by Update.
+    void AddFrameTime(float milliseconds);
+
+    float GetScale() const { return this->scale; }
+    /// smoothed GPU frame time in milliseconds, or 0 until the first measurement
+    float GetSmoothedFrameTime() const { return this->smoothedFrameTime; }
+
+private:
+    GLuint queries[NumQueries];
+    /// number of frames that were measured, the query of frame i is queries[i % NumQueries]
+    uint64_t numFrames;
+    /// number of measurements that were read back
+    uint64_t numResults;
+
+    float smoothedFrameTime;
+    float scale;
+    /// frames left before the scale can change again
+    uint32_t holdFrames;
+};
+
+} // namespace Render
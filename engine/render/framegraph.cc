@@ -0,0 +1,644 @@
+//------------------------------------------------------------------------------
+//  @file framegraph.cc
+//  @copyright (C) 2022 Individual contributors, see AUTHORS file
+//------------------------------------------------------------------------------
+#include "config.h"
+#include "framegraph.h"
+#include "glstate.h"
+
+namespace Render
+{
+
+/// pooled textures that haven't been used for this many frames are deleted
+static constexpr uint64_t MaxUnusedFrames = 3;
+
+//------------------------------------------------------------------------------
+/**
+*/
+static bool
+IsDepthStencilFormat(GLenum format)
+{
+    return format == GL_DEPTH24_STENCIL8 || format == GL_DEPTH32F_STENCIL8;
+}
+
+//------------------------------------------------------------------------------
+/**
+    Pixel format and type that glTexImage2D accepts together with an internal format.
+*/
+static void
+GetPixelFormat(GLenum internalFormat, GLenum& format, GLenum& type)
+{
+    switch (internalFormat)
+    {
+    case GL_DEPTH_COMPONENT16:
+    case GL_DEPTH_COMPONENT24:
+    case GL_DEPTH_COMPONENT32F:
+        format = GL_DEPTH_COMPONENT;
+        type = GL_FLOAT;
+        break;
+    case GL_DEPTH24_STENCIL8:
+        format = GL_DEPTH_STENCIL;
+        type = GL_UNSIGNED_INT_24_8;
+        break;
+    case GL_DEPTH32F_STENCIL8:
+        format = GL_DEPTH_STENCIL;
+        type = GL_FLOAT_32_UNSIGNED_INT_24_8_REV;
+        break;
+    case GL_R16F:
+    case GL_R32F:
+        format = GL_RED;
+        type = GL_FLOAT;
+        break;
+    case GL_RG16F:
+    case GL_RG32F:
+        format = GL_RG;
+        type = GL_FLOAT;
+        break;
+    case GL_R11F_G11F_B10F:
+        format = GL_RGB;
+        type = GL_FLOAT;
+        break;
+    case GL_RGBA16F:
+    case GL_RGBA32F:
+        format = GL_RGBA;
+        type = GL_FLOAT;
+        break;
+    default:
+        format = GL_RGBA;
+        type = GL_UNSIGNED_BYTE;
+        break;
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+static uint32_t
+GetBytesPerPixel(GLenum internalFormat)
+{
+    switch (internalFormat)
+    {
+    case GL_R16F:
+    case GL_DEPTH_COMPONENT16:
+        return 2;
+    case GL_RGBA32F:
+        return 16;
+    case GL_RGBA16F:
+    case GL_RG32F:
+    case GL_DEPTH32F_STENCIL8:
+        return 8;
+    default:
+        return 4;
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+FrameGraph::Resource
+FrameGraph::PassBuilder::Read(Resource resource)
+{
+    n_assert(resource < this->graph->versions.size());
+    this->graph->passes[this->pass].reads.push_back(resource);
+    this->graph->versions[resource].numConsumers++;
+    return resource;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+FrameGraph::Resource
+FrameGraph::PassBuilder::Write(Resource resource, Attachment attachment)
+{
+    return this->AddWrite(resource, attachment, false);
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+FrameGraph::Resource
+FrameGraph::PassBuilder::Modify(Resource resource, Attachment attachment)
+{
+    return this->AddWrite(resource, attachment, true);
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+FrameGraph::PassBuilder::SideEffect()
+{
+    this->graph->passes[this->pass].sideEffect = true;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+FrameGraph::Resource
+FrameGraph::PassBuilder::AddWrite(Resource resource, Attachment attachment, bool read)
+{
+    FrameGraph* const graph = this->graph;
+    n_assert(resource < graph->versions.size());
+    uint32_t const textureIndex = graph->versions[resource].texture;
+    Texture const& texture = graph->textures[textureIndex];
+    n_assert2(texture.latest == resource, "Only the newest version of a texture can be written");
+    n_assert2(!texture.backbuffer || attachment == Attachment::Color0, "The backbuffer can only be written as color attachment 0");
+
+    if (read)
+        this->Read(resource);
+
+    Pass& pass = graph->passes[this->pass];
+    if (texture.imported)
+        pass.sideEffect = true;
+
+    Resource const version = (Resource)graph->versions.size();
+    graph->versions.push_back({ textureIndex, this->pass, resource, 0 });
+    graph->textures[textureIndex].latest = version;
+    pass.writes.push_back({ version, attachment });
+    return version;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+bool
+FrameGraph::FramebufferKey::operator==(FramebufferKey const& rhs) const
+{
+    for (uint32_t i = 0; i < MaxColorAttachments; i++)
+    {
+        if (this->color[i] != rhs.color[i])
+            return false;
+    }
+    return this->depth == rhs.depth && this->depthAttachment == rhs.depthAttachment;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+FrameGraph::FrameGraph() :
+    numPasses(0),
+    frameIndex(0),
+    numCulledPasses(0)
+{
+    // empty
+}
+
+//------------------------------------------------------------------------------
+/**
+    Pass objects are kept, so that their arrays don't have to be reallocated every frame.
+*/
+void
+FrameGraph::Reset()
+{
+    this->textures.clear();
+    this->versions.clear();
+    this->order.clear();
+    this->numPasses = 0;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+FrameGraph::Resource
+FrameGraph::Create(char const* name, TextureDesc const& desc)
+{
+    n_assert(desc.width > 0 && desc.height > 0);
+    Resource const version = (Resource)this->versions.size();
+    this->versions.push_back({ (uint32_t)this->textures.size(), InvalidResource, InvalidResource, 0 });
+    this->textures.push_back({ name, desc, 0, false, false, version, InvalidResource, InvalidResource, InvalidResource });
+    return version;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+FrameGraph::Resource
+FrameGraph::Import(char const* name, GLuint texture, TextureDesc const& desc)
+{
+    Resource const version = (Resource)this->versions.size();
+    this->versions.push_back({ (uint32_t)this->textures.size(), InvalidResource, InvalidResource, 0 });
+    this->textures.push_back({ name, desc, texture, true, false, version, InvalidResource, InvalidResource, InvalidResource });
+    return version;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+FrameGraph::Resource
+FrameGraph::ImportBackbuffer(uint32_t width, uint32_t height)
+{
+    Resource const version = this->Import("Backbuffer", 0, { GL_RGBA8, width, height });
+    this->textures.back().backbuffer = true;
+    return version;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+FrameGraph::PassBuilder
+FrameGraph::AddPass(char const* name, std::function<void()> const& execute)
+{
+    if (this->numPasses == this->passes.size())
+        this->passes.emplace_back();
+
+    Pass& pass = this->passes[this->numPasses];
+    pass.name = name;
+    pass.execute = execute;
+    pass.reads.clear();
+    pass.writes.clear();
+    pass.dependencies.clear();
+    pass.sideEffect = false;
+    pass.culled = false;
+    pass.scheduled = false;
+    pass.refCount = 0;
+    return PassBuilder(this, this->numPasses++);
+}
+
+//------------------------------------------------------------------------------
+/**
+    A pass is referenced by every read of a version it writes. Passes without
+    references are culled, which releases their references to the passes
+    that wrote what they read, until only passes that contribute remain.
+*/
+void
+FrameGraph::Cull()
+{
+    std::vector<uint32_t>& unreferenced = this->order;
+    unreferenced.clear();
+    for (uint32_t i = 0; i < this->numPasses; i++)
+    {
+        Pass& pass = this->passes[i];
+        pass.refCount = pass.sideEffect ? 1 : 0;
+        for (Access const& write : pass.writes)
+            pass.refCount += this->versions[write.resource].numConsumers;
+        if (pass.refCount == 0)
+            unreferenced.push_back(i);
+    }
+
+    this->numCulledPasses = 0;
+    while (!unreferenced.empty())
+    {
+        Pass& pass = this->passes[unreferenced.back()];
+        unreferenced.pop_back();
+        pass.culled = true;
+        this->numCulledPasses++;
+
+        for (Resource read : pass.reads)
+        {
+            uint32_t const producer = this->versions[read].producer;
+            if (producer != InvalidResource && --this->passes[producer].refCount == 0)
+                unreferenced.push_back(producer);
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+    A pass runs after the passes that wrote the versions it reads, after the
+    pass that wrote the version it replaces, and after the passes that read
+    that version. Otherwise passes run in the order they were added.
+*/
+void
+FrameGraph::Sort()
+{
+    for (uint32_t i = 0; i < this->numPasses; i++)
+    {
+        Pass& pass = this->passes[i];
+        if (pass.culled)
+            continue;
+
+        auto const AddDependency = [this, i, &pass](uint32_t other)
+        {
+            if (other != InvalidResource && other != i && !this->passes[other].culled)
+                pass.dependencies.push_back(other);
+        };
+
+        for (Resource read : pass.reads)
+            AddDependency(this->versions[read].producer);
+
+        for (Access const& write : pass.writes)
+        {
+            Resource const previous = this->versions[write.resource].previous;
+            AddDependency(this->versions[previous].producer);
+            for (uint32_t j = 0; j < this->numPasses; j++)
+            {
+                for (Resource read : this->passes[j].reads)
+                {
+                    if (read == previous)
+                        AddDependency(j);
+                }
+            }
+        }
+    }
+
+    this->order.clear();
+    uint32_t const numScheduled = this->numPasses - this->numCulledPasses;
+    while (this->order.size() < numScheduled)
+    {
+        uint32_t next = InvalidResource;
+        for (uint32_t i = 0; i < this->numPasses && next == InvalidResource; i++)
+        {
+            Pass const& pass = this->passes[i];
+            if (pass.culled || pass.scheduled)
+                continue;
+
+            bool ready = true;
+            for (uint32_t dependency : pass.dependencies)
+                ready = ready && this->passes[dependency].scheduled;
+            if (ready)
+                next = i;
+        }
+
+        if (next == InvalidResource)
+            n_error("FrameGraph: the passes depend on each other in a cycle");
+
+        this->passes[next].scheduled = true;
+        this->order.push_back(next);
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+FrameGraph::ComputeLifetimes()
+{
+    for (uint32_t position = 0; position < (uint32_t)this->order.size(); position++)
+    {
+        Pass const& pass = this->passes[this->order[position]];
+        auto const Use = [this, position](Resource resource)
+        {
+            Texture& texture = this->textures[this->versions[resource].texture];
+            if (texture.firstUse == InvalidResource)
+                texture.firstUse = position;
+            texture.lastUse = position;
+        };
+
+        for (Resource read : pass.reads)
+            Use(read);
+        for (Access const& write : pass.writes)
+            Use(write.resource);
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+    Takes a free texture with the same description from the pool, or creates one.
+*/
+uint32_t
+FrameGraph::AcquirePhysical(TextureDesc const& desc)
+{
+    for (uint32_t i = 0; i < (uint32_t)this->pool.size(); i++)
+    {
+        PhysicalTexture& physical = this->pool[i];
+        if (!physical.inUse && physical.desc == desc)
+        {
+            physical.inUse = true;
+            physical.lastUsedFrame = this->frameIndex;
+            return i;
+        }
+    }
+
+    GLenum format, type;
+    GetPixelFormat(desc.format, format, type);
+
+    PhysicalTexture physical;
+    physical.desc = desc;
+    physical.inUse = true;
+    physical.lastUsedFrame = this->frameIndex;
+    glGenTextures(1, &physical.handle);
+    GLState::BindTexture(GL_TEXTURE_2D, physical.handle);
+    glTexImage2D(GL_TEXTURE_2D, 0, desc.format, desc.width, desc.height, 0, format, type, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    GLState::BindTexture(GL_TEXTURE_2D, 0);
+
+    this->pool.push_back(physical);
+    return (uint32_t)this->pool.size() - 1;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+GLuint
+FrameGraph::FindFramebuffer(FramebufferKey const& key)
+{
+    for (Framebuffer const& framebuffer : this->framebuffers)
+    {
+        if (framebuffer.key == key)
+            return framebuffer.handle;
+    }
+
+    Framebuffer framebuffer;
+    framebuffer.key = key;
+    glGenFramebuffers(1, &framebuffer.handle);
+    GLState::BindFramebuffer(GL_FRAMEBUFFER, framebuffer.handle);
+
+    GLenum drawBuffers[MaxColorAttachments];
+    GLsizei numDrawBuffers = 0;
+    for (uint32_t i = 0; i < MaxColorAttachments; i++)
+    {
+        drawBuffers[i] = GL_NONE;
+        if (key.color[i] != 0)
+        {
+            glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, key.color[i], 0);
+            drawBuffers[i] = GL_COLOR_ATTACHMENT0 + i;
+            numDrawBuffers = i + 1;
+        }
+    }
+    if (key.depth != 0)
+        glFramebufferTexture(GL_FRAMEBUFFER, key.depthAttachment, key.depth, 0);
+
+    if (numDrawBuffers > 0)
+    {
+        glDrawBuffers(numDrawBuffers, drawBuffers);
+    }
+    else
+    {
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+    }
+
+    { GLenum err = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    assert(err == GL_FRAMEBUFFER_COMPLETE); }
+
+    this->framebuffers.push_back(framebuffer);
+    return framebuffer.handle;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+FrameGraph::BindAttachments(Pass const& pass)
+{
+    FramebufferKey key = {};
+    TextureDesc const* size = nullptr;
+    bool backbuffer = false;
+    for (Access const& write : pass.writes)
+    {
+        if (write.attachment == Attachment::None)
+            continue;
+
+        Texture const& texture = this->textures[this->versions[write.resource].texture];
+        n_assert2(size == nullptr || (size->width == texture.desc.width && size->height == texture.desc.height), "The attachments of a pass must have the same size");
+        size = &texture.desc;
+
+        if (texture.backbuffer)
+        {
+            backbuffer = true;
+        }
+        else if (write.attachment == Attachment::Depth)
+        {
+            key.depth = texture.handle;
+            key.depthAttachment = IsDepthStencilFormat(texture.desc.format) ? GL_DEPTH_STENCIL_ATTACHMENT : GL_DEPTH_ATTACHMENT;
+        }
+        else
+        {
+            key.color[(uint32_t)write.attachment - (uint32_t)Attachment::Color0] = texture.handle;
+        }
+    }
+
+    if (size == nullptr)
+        return;
+
+    if (backbuffer)
+    {
+        n_assert2(key == FramebufferKey(), "The backbuffer can't be combined with other attachments");
+        GLState::BindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+    else
+    {
+        GLState::BindFramebuffer(GL_FRAMEBUFFER, this->FindFramebuffer(key));
+    }
+    GLState::Viewport(0, 0, size->width, size->height);
+}
+
+//------------------------------------------------------------------------------
+/**
+    Deletes pooled textures that haven't been used for a while, and the framebuffers that use them.
+*/
+void
+FrameGraph::CollectGarbage()
+{
+    for (size_t i = 0; i < this->pool.size();)
+    {
+        PhysicalTexture const& physical = this->pool[i];
+        if (this->frameIndex - physical.lastUsedFrame <= MaxUnusedFrames)
+        {
+            i++;
+            continue;
+        }
+
+        for (size_t f = 0; f < this->framebuffers.size();)
+        {
+            FramebufferKey const& key = this->framebuffers[f].key;
+            bool uses = key.depth == physical.handle;
+            for (uint32_t c = 0; c < MaxColorAttachments; c++)
+                uses = uses || key.color[c] == physical.handle;
+
+            if (uses)
+            {
+                GLState::DeleteFramebuffers(1, &this->framebuffers[f].handle);
+                this->framebuffers[f] = this->framebuffers.back();
+                this->framebuffers.pop_back();
+            }
+            else
+            {
+                f++;
+            }
+        }
+
+        GLState::DeleteTextures(1, &physical.handle);
+        this->pool[i] = this->pool.back();
+        this->pool.pop_back();
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+FrameGraph::Execute()
+{
+    this->Cull();
+    this->Sort();
+    this->ComputeLifetimes();
+    this->frameIndex++;
+
+    for (uint32_t position = 0; position < (uint32_t)this->order.size(); position++)
+    {
+        for (Texture& texture : this->textures)
+        {
+            if (!texture.imported && texture.firstUse == position)
+            {
+                texture.physical = this->AcquirePhysical(texture.desc);
+                texture.handle = this->pool[texture.physical].handle;
+            }
+        }
+
+        Pass const& pass = this->passes[this->order[position]];
+        this->BindAttachments(pass);
+        pass.execute();
+
+        // the textures can be taken over by the following passes
+        for (Texture const& texture : this->textures)
+        {
+            if (!texture.imported && texture.lastUse == position)
+                this->pool[texture.physical].inUse = false;
+        }
+    }
+
+    GLState::BindFramebuffer(GL_FRAMEBUFFER, 0);
+    this->CollectGarbage();
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+GLuint
+FrameGraph::GetTexture(Resource resource) const
+{
+    n_assert(resource < this->versions.size());
+    return this->textures[this->versions[resource].texture].handle;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+FrameGraph::TextureDesc const&
+FrameGraph::GetDesc(Resource resource) const
+{
+    n_assert(resource < this->versions.size());
+    return this->textures[this->versions[resource].texture].desc;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+GLuint
+FrameGraph::GetFramebuffer(Resource color, Resource depth)
+{
+    FramebufferKey key = {};
+    key.color[0] = this->GetTexture(color);
+    if (depth != InvalidResource)
+    {
+        key.depth = this->GetTexture(depth);
+        key.depthAttachment = IsDepthStencilFormat(this->GetDesc(depth).format) ? GL_DEPTH_STENCIL_ATTACHMENT : GL_DEPTH_ATTACHMENT;
+    }
+    return this->FindFramebuffer(key);
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+uint64_t
+FrameGraph::GetPooledTextureBytes() const
+{
+    uint64_t bytes = 0;
+    for (PhysicalTexture const& physical : this->pool)
+        bytes += (uint64_t)physical.desc.width * physical.desc.height * GetBytesPerPixel(physical.desc.format);
+    return bytes;
+}
+
+} // namespace Render
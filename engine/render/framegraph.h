@@ -0,0 +1,219 @@
+#pragma once
+//------------------------------------------------------------------------------
+/**
+    @file framegraph.h
+
+    Frame graph for the GPU passes of a frame.
+
+    The graph is rebuilt every frame. Passes are added with the function that
+    records them, and declare the textures they read and write through the
+    returned PassBuilder. Every write creates a new version of the texture,
+    and later passes refer to that version. From these declarations Execute
+    computes the order of the passes, culls passes whose results are never
+    used, and only then allocates the transient textures.
+
+    Transient textures are created by the graph, and only live from the first
+    to the last pass that uses them. Their contents are undefined when the
+    first pass starts, so that pass has to clear or overwrite them. A transient
+    texture takes over the GL texture of an earlier transient texture with the
+    same format and size once its last pass has run, and the GL textures are
+    kept in a pool between frames. Textures that haven't been used for a few
+    frames are deleted, so a resolution change only allocates the new sizes
+    once. GL can't place textures of different formats in the same memory, so
+    only textures with identical descriptions alias each other.
+
+    Imported textures, like the shadow maps and the backbuffer, are owned by
+    someone else and outlive the frame, so passes that write them are never
+    culled.
+
+    Passes that write attachments get a framebuffer with those textures bound
+    before they run, with the viewport set to the size of the attachments.
+
+    @copyright
+    (C) 2022 Individual contributors, see AUTHORS file
+*/
+//------------------------------------------------------------------------------
+#include "render/renderbackend.h"
+#include <functional>
+#include <vector>
+
+namespace Render
+{
+
+class FrameGraph
+{
+public:
+    /// a version of a texture in the graph
+    typedef uint32_t Resource;
+    static constexpr Resource InvalidResource = UINT32_MAX;
+
+    struct TextureDesc
+    {
+        GLenum format;
+        uint32_t width;
+        uint32_t height;
+
+        bool operator==(TextureDesc const& rhs) const { return format == rhs.format && width == rhs.width && height == rhs.height; }
+    };
+
+    enum class Attachment : uint8_t
+    {
+        None,
+        Color0,
+        Color1,
+        Color2,
+        Color3,
+        Depth
+    };
+    static constexpr uint32_t MaxColorAttachments = 4;
+
+    //------------------------------------------------------------------------------
+    /**
+        Declares what a pass accesses. Write and Modify return the new version
+        of the texture, which following passes have to use.
+    */
+    class PassBuilder
+    {
+    public:
+        /// the pass reads the texture, for example by sampling it
+        Resource Read(Resource resource);
+        /// the pass overwrites the texture, and doesn't depend on its previous contents
+        Resource Write(Resource resource, Attachment attachment = Attachment::None);
+        /// the pass reads and writes the texture, for example by depth testing or blending against it
+        Resource Modify(Resource resource, Attachment attachment = Attachment::None);
+        /// the pass has effects outside the graph and is never culled
+        void SideEffect();
+
+    private:
+        friend class FrameGraph;
+        PassBuilder(FrameGraph* graph, uint32_t pass) : graph(graph), pass(pass) {}
+        Resource AddWrite(Resource resource, Attachment attachment, bool read);
+
+        FrameGraph* graph;
+        uint32_t pass;
+    };
+
+    FrameGraph();
+
+    /// clear all passes and textures, to start building the next frame
+    void Reset();
+
+    /// create a transient texture, that is allocated by the graph for this frame only
+    Resource Create(char const* name, TextureDesc const& desc);
+    /// import a texture that is owned outside of the graph
+    Resource Import(char const* name, GLuint texture, TextureDesc const& desc);
+    /// import the default framebuffer. Can only be used as color attachment 0.
+    Resource ImportBackbuffer(uint32_t width, uint32_t height);
+
+    /// add a pass, that runs execute when the graph is executed
+    PassBuilder AddPass(char const* name, std::function<void()> const& execute);
+
+    /// order and cull the passes, allocate the transient textures and run the passes
+    void Execute();
+
+    /// GL texture of a resource. Transient textures are only valid while the graph executes.
+    GLuint GetTexture(Resource resource) const;
+    TextureDesc const& GetDesc(Resource resource) const;
+    /// framebuffer with the given textures attached, for passes that need to read from one.
+    /// Binds the framebuffer if it has to be created.
+    GLuint GetFramebuffer(Resource color, Resource depth = InvalidResource);
+
+    /// number of passes that were culled by the last Execute
+    uint32_t GetNumCulledPasses() const { return this->numCulledPasses; }
+    /// number of GL textures in the transient pool, and their size in bytes
+    uint32_t GetNumPooledTextures() const { return (uint32_t)this->pool.size(); }
+    uint64_t GetPooledTextureBytes() const;
+
+private:
+    struct Texture
+    {
+        char const* name;
+        TextureDesc desc;
+        GLuint handle;
+        bool imported;
+        bool backbuffer;
+        /// newest version, the only one that can be written
+        Resource latest;
+        /// index into pool while the graph executes, for transient textures
+        uint32_t physical;
+        /// first and last position in the execution order, InvalidResource if unused
+        uint32_t firstUse;
+        uint32_t lastUse;
+    };
+
+    struct Version
+    {
+        uint32_t texture;
+        /// pass that wrote this version, InvalidResource for the initial version
+        uint32_t producer;
+        /// version that this one replaced
+        Resource previous;
+        /// number of passes that read this version, including the pass that modifies it
+        uint32_t numConsumers;
+    };
+
+    struct Access
+    {
+        Resource resource;
+        Attachment attachment;
+    };
+
+    struct Pass
+    {
+        char const* name;
+        std::function<void()> execute;
+        std::vector<Resource> reads;
+        std::vector<Access> writes;
+        /// passes that have to run before this one
+        std::vector<uint32_t> dependencies;
+        bool sideEffect;
+        bool culled;
+        bool scheduled;
+        uint32_t refCount;
+    };
+
+    struct PhysicalTexture
+    {
+        TextureDesc desc;
+        GLuint handle;
+        uint64_t lastUsedFrame;
+        bool inUse;
+    };
+
+    struct FramebufferKey
+    {
+        GLuint color[MaxColorAttachments];
+        GLuint depth;
+        GLenum depthAttachment;
+
+        bool operator==(FramebufferKey const& rhs) const;
+    };
+
+    struct Framebuffer
+    {
+        FramebufferKey key;
+        GLuint handle;
+    };
+
+    void Cull();
+    void Sort();
+    void ComputeLifetimes();
+    uint32_t AcquirePhysical(TextureDesc const& desc);
+    void BindAttachments(Pass const& pass);
+    GLuint FindFramebuffer(FramebufferKey const& key);
+    void CollectGarbage();
+
+    std::vector<Texture> textures;
+    std::vector<Version> versions;
+    std::vector<Pass> passes;
+    uint32_t numPasses;
+    /// pass indices in execution order, without culled passes
+    std::vector<uint32_t> order;
+
+    std::vector<PhysicalTexture> pool;
+    std::vector<Framebuffer> framebuffers;
+    uint64_t frameIndex;
+    uint32_t numCulledPasses;
+};
+
+} // namespace Render
@@ -0,0 +1,492 @@
+//------------------------------------------------------------------------------
+//  @file glstate.cc
+//  @copyright (C) 2022 Individual contributors, see AUTHORS file
+//------------------------------------------------------------------------------
+#include "config.h"
+#include "render/glstate.h"
+#include <cmath>
+
+namespace Render
+{
+namespace GLState
+{
+
+/// capabilities whose state is tracked, others are always passed on
+static constexpr GLenum TrackedCaps[] = {
+    GL_DEPTH_TEST,
+    GL_CULL_FACE,
+    GL_BLEND,
+    GL_DEPTH_CLAMP,
+    GL_SCISSOR_TEST,
+    GL_MULTISAMPLE,
+    GL_PROGRAM_POINT_SIZE
+};
+static constexpr uint32_t NumTrackedCaps = sizeof(TrackedCaps) / sizeof(TrackedCaps[0]);
+
+/// texture targets whose bindings are tracked
+static constexpr GLenum TrackedTextureTargets[] = {
+    GL_TEXTURE_2D,
+    GL_TEXTURE_2D_ARRAY,
+    GL_TEXTURE_CUBE_MAP
+};
+static constexpr uint32_t NumTrackedTextureTargets = sizeof(TrackedTextureTargets) / sizeof(TrackedTextureTargets[0]);
+
+/// values that no call sets, so the next call is always issued. Floats use NaN, which never compares equal.
+static constexpr GLuint UnknownName = UINT32_MAX;
+static constexpr GLenum UnknownEnum = GL_INVALID_ENUM;
+static constexpr uint8_t UnknownFlag = 0xFF;
+
+/// starts out unknown, since the state of a new context isn't assumed
+struct State
+{
+    State();
+
+    uint8_t caps[NumTrackedCaps];
+    GLenum depthFunc;
+    uint8_t depthMask;
+    GLclampd depthRange[2];
+    GLenum cullFace;
+    uint8_t colorMask;
+    GLenum blendFunc[2];
+    GLenum polygonMode;
+    GLfloat lineWidth;
+    GLint viewport[4];
+    GLclampf clearColor[4];
+
+    GLuint program;
+    GLuint vertexArray;
+    /// draw and read framebuffer
+    GLuint framebuffers[2];
+
+    GLenum activeTexture;
+    GLuint textures[MaxTextureUnits][NumTrackedTextureTargets];
+};
+
+static State state;
+static Stats stats;
+
+//------------------------------------------------------------------------------
+/**
+    Stores value in shadow, and returns true if the call has to be issued.
+*/
+template<typename T> static bool
+Changes(T& shadow, T const& value)
+{
+    if (shadow == value)
+    {
+        stats.elided++;
+        return false;
+    }
+    shadow = value;
+    stats.issued++;
+    return true;
+}
+
+//------------------------------------------------------------------------------
+/**
+    Same as Changes, for state that is set with several values at once.
+*/
+template<typename T, size_t N> static bool
+ChangesAll(T (&shadow)[N], T const (&values)[N])
+{
+    bool equal = true;
+    for (size_t i = 0; i < N; i++)
+        equal = equal && shadow[i] == values[i];
+
+    if (equal)
+    {
+        stats.elided++;
+        return false;
+    }
+    for (size_t i = 0; i < N; i++)
+        shadow[i] = values[i];
+    stats.issued++;
+    return true;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+static int
+CapIndex(GLenum cap)
+{
+    for (uint32_t i = 0; i < NumTrackedCaps; i++)
+    {
+        if (TrackedCaps[i] == cap)
+            return (int)i;
+    }
+    return -1;
+}
+
+//------------------------------------------------------------------------------
+/**
+    Shadowed binding of target on unit, or nullptr if it isn't tracked.
+*/
+static GLuint*
+TextureBinding(GLenum unit, GLenum target)
+{
+    GLuint const index = unit - GL_TEXTURE0;
+    if (index >= MaxTextureUnits)
+        return nullptr;
+
+    for (uint32_t t = 0; t < NumTrackedTextureTargets; t++)
+    {
+        if (TrackedTextureTargets[t] == target)
+            return &state.textures[index][t];
+    }
+    return nullptr;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+State::State()
+{
+    for (uint8_t& cap : this->caps)
+        cap = UnknownFlag;
+    this->depthFunc = UnknownEnum;
+    this->depthMask = UnknownFlag;
+    this->depthRange[0] = this->depthRange[1] = NAN;
+    this->cullFace = UnknownEnum;
+    this->colorMask = UnknownFlag;
+    this->blendFunc[0] = this->blendFunc[1] = UnknownEnum;
+    this->polygonMode = UnknownEnum;
+    this->lineWidth = NAN;
+    for (GLint& v : this->viewport)
+        v = -1;
+    for (GLclampf& c : this->clearColor)
+        c = NAN;
+
+    this->program = UnknownName;
+    this->vertexArray = UnknownName;
+    this->framebuffers[0] = this->framebuffers[1] = UnknownName;
+
+    this->activeTexture = UnknownEnum;
+    for (auto& unit : this->textures)
+    {
+        for (GLuint& texture : unit)
+            texture = UnknownName;
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+Invalidate()
+{
+    state = State();
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+Stats const&
+GetStats()
+{
+    return stats;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+ResetStats()
+{
+    stats = Stats();
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+Enable(GLenum cap)
+{
+    SetEnabled(cap, true);
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+Disable(GLenum cap)
+{
+    SetEnabled(cap, false);
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+SetEnabled(GLenum cap, bool enabled)
+{
+    int const index = CapIndex(cap);
+    if (index >= 0 && !Changes(state.caps[index], (uint8_t)enabled))
+        return;
+    if (index < 0)
+        stats.issued++;
+
+    if (enabled)
+        glEnable(cap);
+    else
+        glDisable(cap);
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+DepthFunc(GLenum func)
+{
+    if (Changes(state.depthFunc, func))
+        glDepthFunc(func);
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+DepthMask(GLboolean flag)
+{
+    if (Changes(state.depthMask, (uint8_t)(flag != GL_FALSE)))
+        glDepthMask(flag);
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+DepthRange(GLclampd zNear, GLclampd zFar)
+{
+    GLclampd const range[2] = { zNear, zFar };
+    if (ChangesAll(state.depthRange, range))
+        glDepthRange(zNear, zFar);
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+CullFace(GLenum mode)
+{
+    if (Changes(state.cullFace, mode))
+        glCullFace(mode);
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+ColorMask(GLboolean red, GLboolean green, GLboolean blue, GLboolean alpha)
+{
+    uint8_t const mask = (red ? 1 : 0) | (green ? 2 : 0) | (blue ? 4 : 0) | (alpha ? 8 : 0);
+    if (Changes(state.colorMask, mask))
+        glColorMask(red, green, blue, alpha);
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+BlendFunc(GLenum sfactor, GLenum dfactor)
+{
+    GLenum const factors[2] = { sfactor, dfactor };
+    if (ChangesAll(state.blendFunc, factors))
+        glBlendFunc(sfactor, dfactor);
+}
+
+//------------------------------------------------------------------------------
+/**
+    Core profiles only accept GL_FRONT_AND_BACK, other faces are passed on.
+*/
+void
+PolygonMode(GLenum face, GLenum mode)
+{
+    if (face != GL_FRONT_AND_BACK)
+    {
+        state.polygonMode = UnknownEnum;
+        stats.issued++;
+        glPolygonMode(face, mode);
+        return;
+    }
+
+    if (Changes(state.polygonMode, mode))
+        glPolygonMode(face, mode);
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+LineWidth(GLfloat width)
+{
+    if (Changes(state.lineWidth, width))
+        glLineWidth(width);
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+Viewport(GLint x, GLint y, GLsizei width, GLsizei height)
+{
+    GLint const viewport[4] = { x, y, width, height };
+    if (ChangesAll(state.viewport, viewport))
+        glViewport(x, y, width, height);
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+ClearColor(GLclampf red, GLclampf green, GLclampf blue, GLclampf alpha)
+{
+    GLclampf const color[4] = { red, green, blue, alpha };
+    if (ChangesAll(state.clearColor, color))
+        glClearColor(red, green, blue, alpha);
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+UseProgram(GLuint program)
+{
+    if (Changes(state.program, program))
+        glUseProgram(program);
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+BindVertexArray(GLuint array)
+{
+    if (Changes(state.vertexArray, array))
+        glBindVertexArray(array);
+}
+
+//------------------------------------------------------------------------------
+/**
+    GL_FRAMEBUFFER binds both the draw and the read framebuffer.
+*/
+void
+BindFramebuffer(GLenum target, GLuint framebuffer)
+{
+    bool changed;
+    if (target == GL_DRAW_FRAMEBUFFER)
+    {
+        changed = Changes(state.framebuffers[0], framebuffer);
+    }
+    else if (target == GL_READ_FRAMEBUFFER)
+    {
+        changed = Changes(state.framebuffers[1], framebuffer);
+    }
+    else
+    {
+        GLuint const framebuffers[2] = { framebuffer, framebuffer };
+        changed = ChangesAll(state.framebuffers, framebuffers);
+    }
+
+    if (changed)
+        glBindFramebuffer(target, framebuffer);
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+ActiveTexture(GLenum texture)
+{
+    if (Changes(state.activeTexture, texture))
+        glActiveTexture(texture);
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+BindTexture(GLenum target, GLuint texture)
+{
+    GLuint* const binding = state.activeTexture != UnknownEnum ? TextureBinding(state.activeTexture, target) : nullptr;
+    if (binding == nullptr)
+    {
+        stats.issued++;
+        glBindTexture(target, texture);
+        return;
+    }
+
+    if (Changes(*binding, texture))
+        glBindTexture(target, texture);
+}
+
+//------------------------------------------------------------------------------
+/**
+    The unit is only made active when the binding changes.
+*/
+void
+BindTextureUnit(GLuint unit, GLenum target, GLuint texture)
+{
+    GLuint* const binding = TextureBinding(GL_TEXTURE0 + unit, target);
+    if (binding != nullptr && *binding == texture)
+    {
+        stats.elided++;
+        return;
+    }
+
+    ActiveTexture(GL_TEXTURE0 + unit);
+    BindTexture(target, texture);
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+DeleteTextures(GLsizei n, GLuint const* textures)
+{
+    for (GLsizei i = 0; i < n; i++)
+    {
+        for (auto& unit : state.textures)
+        {
+            for (GLuint& binding : unit)
+            {
+                if (binding == textures[i])
+                    binding = UnknownName;
+            }
+        }
+    }
+    glDeleteTextures(n, textures);
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+DeleteFramebuffers(GLsizei n, GLuint const* framebuffers)
+{
+    for (GLsizei i = 0; i < n; i++)
+    {
+        for (GLuint& binding : state.framebuffers)
+        {
+            if (binding == framebuffers[i])
+                binding = UnknownName;
+        }
+    }
+    glDeleteFramebuffers(n, framebuffers);
+}
+
+//------------------------------------------------------------------------------
+/**
+    A program that is in use stays current until another one is used, so the
+    next UseProgram is always issued.
+*/
+void
+DeleteProgram(GLuint program)
+{
+    if (state.program == program)
+        state.program = UnknownName;
+    glDeleteProgram(program);
+}
+
+} // namespace GLState
+} // namespace Render
@@ -0,0 +1,83 @@
+#pragma once
+//------------------------------------------------------------------------------
+/**
+    @file glstate.h
+
+    Shadowed GL state.
+
+    The renderer sets its GL state through these functions instead of calling
+    GL directly. They remember the last value that was set, and drop calls that
+    wouldn't change anything, so passes can set the state they depend on
+    without knowing what the previous pass left behind.
+
+    The shadow is only correct while nothing else changes the tracked state.
+    Objects that are deleted while bound are unbound by GL, so they have to be
+    deleted through the functions here as well. Code that changes the state
+    behind the cache's back, like reloading shaders, has to call Invalidate
+    afterwards. The ImGui renderer restores everything it changes, so it
+    doesn't.
+
+    Only the thread that owns the GL context may use the cache.
+
+    @copyright
+    (C) 2022 Individual contributors, see AUTHORS file
+*/
+//------------------------------------------------------------------------------
+#include "render/renderbackend.h"
+
+namespace Render
+{
+namespace GLState
+{
+
+/// number of texture units whose bindings are tracked, binding to higher units is never elided
+static constexpr uint32_t MaxTextureUnits = 32;
+
+/// calls since the last ResetStats
+struct Stats
+{
+    /// calls that were passed on to GL
+    uint64_t issued = 0;
+    /// calls that were dropped because they wouldn't change the state
+    uint64_t elided = 0;
+};
+
+/// forget the shadowed state, so that the next call to every function is issued
+void Invalidate();
+
+Stats const& GetStats();
+void ResetStats();
+
+/// glEnable and glDisable
+void Enable(GLenum cap);
+void Disable(GLenum cap);
+void SetEnabled(GLenum cap, bool enabled);
+
+void DepthFunc(GLenum func);
+void DepthMask(GLboolean flag);
+void DepthRange(GLclampd zNear, GLclampd zFar);
+void CullFace(GLenum mode);
+void ColorMask(GLboolean red, GLboolean green, GLboolean blue, GLboolean alpha);
+void BlendFunc(GLenum sfactor, GLenum dfactor);
+void PolygonMode(GLenum face, GLenum mode);
+void LineWidth(GLfloat width);
+void Viewport(GLint x, GLint y, GLsizei width, GLsizei height);
+void ClearColor(GLclampf red, GLclampf green, GLclampf blue, GLclampf alpha);
+
+void UseProgram(GLuint program);
+void BindVertexArray(GLuint array);
+void BindFramebuffer(GLenum target, GLuint framebuffer);
+
+void ActiveTexture(GLenum texture);
+/// binds to the active texture unit
+void BindTexture(GLenum target, GLuint texture);
+/// makes unit the active texture unit and binds the texture to it
+void BindTextureUnit(GLuint unit, GLenum target, GLuint texture);
+
+/// delete objects, and forget them where they are bound
+void DeleteTextures(GLsizei n, GLuint const* textures);
+void DeleteFramebuffers(GLsizei n, GLuint const* framebuffers);
+void DeleteProgram(GLuint program);
+
+} // namespace GLState
+} // namespace Render
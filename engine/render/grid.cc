@@ -4,6 +4,7 @@
 //------------------------------------------------------------------------------
 #include "config.h"
 #include "grid.h"
+#include "glstate.h"
 #include <array>
 
 namespace Render
@@ -102,10 +103,10 @@ Grid::Grid() : lineBuffer(0)
 	glBufferData(GL_ARRAY_BUFFER, buf.size() * sizeof(float32), buf.data(), GL_STATIC_DRAW);
 	
 	glGenVertexArrays(1, &this->vao);
-	glBindVertexArray(this->vao);
+	GLState::BindVertexArray(this->vao);
 	glEnableVertexAttribArray(0);
 	glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(float32) * 4, NULL);
-	glBindVertexArray(0);
+	GLState::BindVertexArray(0);
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
 	
 }
@@ -115,7 +116,7 @@ Grid::Grid() : lineBuffer(0)
 */
 Grid::~Grid()
 {
-	glDeleteProgram(this->program);
+	GLState::DeleteProgram(this->program);
 	glDeleteBuffers(1, &this->lineBuffer);
 }
     
@@ -125,11 +126,11 @@ Grid::~Grid()
 void
 Grid::Draw(float const* const viewProjection)
 {
-	glUseProgram(this->program);
-	glBindVertexArray(this->vao);
+	GLState::UseProgram(this->program);
+	GLState::BindVertexArray(this->vao);
 	glUniformMatrix4fv(0, 1, false, viewProjection);
 	glDrawArrays(GL_LINES, 0, gridSize * 2 * 2);
-	glBindVertexArray(0);
+	GLState::BindVertexArray(0);
 
 }
 
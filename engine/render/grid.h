@@ -8,7 +8,7 @@
     (C) 2022 Individual contributors, see AUTHORS file
 */
 //------------------------------------------------------------------------------
-#include <GL/glew.h>
+#include "render/renderbackend.h"
 
 namespace Render
 {
@@ -0,0 +1,321 @@
+//------------------------------------------------------------------------------
+//  @file lightclusters.cc
+//  @copyright (C) 2022 Individual contributors, see AUTHORS file
+//------------------------------------------------------------------------------
+#include "config.h"
+#include "lightclusters.h"
+#include <bit>
+#include <cfloat>
+
+namespace Render
+{
+
+//------------------------------------------------------------------------------
+/**
+    Range of clusters that the screen space bounds of a light overlaps.
+*/
+struct ClusterRange
+{
+    uint32_t x0, x1;
+    uint32_t y0, y1;
+    uint32_t z0, z1;
+
+    bool Contains(uint32_t x, uint32_t y, uint32_t z) const
+    {
+        return x >= x0 && x <= x1 && y >= y0 && y <= y1 && z >= z0 && z <= z1;
+    }
+};
+
+//------------------------------------------------------------------------------
+/**
+*/
+uint32_t
+LightClusterGrid::Slice(float depth) const
+{
+    float const slice = floorf(logf(glm::max(depth, FLT_MIN)) * this->sliceScale - this->sliceBias);
+    return (uint32_t)glm::clamp(slice, 0.0f, (float)(this->numSlices - 1));
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+float
+LightClusterGrid::SliceBegin(uint32_t slice) const
+{
+    if (slice == 0)
+        return this->nearZ;
+    if (slice >= this->numSlices)
+        return this->farZ;
+    return expf(((float)slice + this->sliceBias) / this->sliceScale);
+}
+
+//------------------------------------------------------------------------------
+/**
+    Conservative cluster range of a view space sphere. The sphere is bounded by
+    a view space box, and the box is projected by finding the extreme x/depth
+    and y/depth ratios among its corners.
+    Returns false if the light cannot touch any cluster.
+*/
+static bool
+LightClusterRange(LightClusterGrid const& grid, glm::mat4 const& projection, glm::vec3 const& center, float radius, ClusterRange& range)
+{
+    float const depth = -center.z;
+    float dMin = depth - radius;
+    float const dMax = depth + radius;
+    if (dMax < grid.nearZ || dMin > grid.farZ)
+        return false;
+    dMin = glm::max(dMin, grid.nearZ);
+
+    // ndc = P00 * x / depth - P20
+    float const xl = center.x - radius;
+    float const xr = center.x + radius;
+    float const yb = center.y - radius;
+    float const yt = center.y + radius;
+    float const ndcL = projection[0][0] * (xl < 0.0f ? xl / dMin : xl / dMax) - projection[2][0];
+    float const ndcR = projection[0][0] * (xr > 0.0f ? xr / dMin : xr / dMax) - projection[2][0];
+    float const ndcB = projection[1][1] * (yb < 0.0f ? yb / dMin : yb / dMax) - projection[2][1];
+    float const ndcT = projection[1][1] * (yt > 0.0f ? yt / dMin : yt / dMax) - projection[2][1];
+    if (ndcR < -1.0f || ndcL > 1.0f || ndcT < -1.0f || ndcB > 1.0f)
+        return false;
+
+    float const tilesPerNdcX = 0.5f * (float)grid.width / (float)grid.tileSize;
+    float const tilesPerNdcY = 0.5f * (float)grid.height / (float)grid.tileSize;
+    auto Tile = [](float ndc, float tilesPerNdc, uint32_t numTiles) -> uint32_t
+    {
+        float const tile = floorf((ndc + 1.0f) * tilesPerNdc);
+        return (uint32_t)glm::clamp(tile, 0.0f, (float)(numTiles - 1));
+    };
+
+    range.x0 = Tile(ndcL, tilesPerNdcX, grid.numClustersX);
+    range.x1 = Tile(ndcR, tilesPerNdcX, grid.numClustersX);
+    range.y0 = Tile(ndcB, tilesPerNdcY, grid.numClustersY);
+    range.y1 = Tile(ndcT, tilesPerNdcY, grid.numClustersY);
+    range.z0 = grid.Slice(dMin);
+    range.z1 = grid.Slice(dMax);
+    return true;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+bool
+LightClusterBuilder::Setup(uint32_t width, uint32_t height, glm::mat4 const& projection)
+{
+    if (width == this->grid.width && height == this->grid.height && projection == this->projection)
+        return false;
+
+    n_assert2(projection[2][3] == -1.0f, "Light clustering requires a perspective projection!\n");
+
+    LightClusterGrid& grid = this->grid;
+    this->projection = projection;
+    grid.width = width;
+    grid.height = height;
+    grid.numClustersX = (width + grid.tileSize - 1) / grid.tileSize;
+    grid.numClustersY = (height + grid.tileSize - 1) / grid.tileSize;
+
+    grid.nearZ = projection[3][2] / (projection[2][2] - 1.0f);
+    grid.farZ = projection[3][2] / (projection[2][2] + 1.0f);
+    float const sliceNear = glm::clamp(grid.minSliceDepth, grid.nearZ, grid.farZ);
+    float const logRange = logf(grid.farZ / sliceNear);
+    grid.sliceScale = (float)grid.numSlices / logRange;
+    grid.sliceBias = (float)grid.numSlices * logf(sliceNear) / logRange;
+
+    this->rowStride = (grid.numClustersX + 3) & ~3u;
+    size_t const numPadded = (size_t)this->rowStride * grid.numClustersY * grid.numSlices;
+    for (int axis = 0; axis < 3; axis++)
+    {
+        // padding never intersects anything
+        this->boundsMin[axis].assign(numPadded, FLT_MAX);
+        this->boundsMax[axis].assign(numPadded, -FLT_MAX);
+    }
+
+    // view space bounds of each cluster from the rays through the tile corners
+    glm::mat4 const invProjection = glm::inverse(projection);
+    auto Ray = [&invProjection](float ndcX, float ndcY) -> glm::vec3
+    {
+        glm::vec4 p = invProjection * glm::vec4(ndcX, ndcY, -1.0f, 1.0f);
+        p /= p.w;
+        return glm::vec3(p) / -p.z;
+    };
+
+    for (uint32_t y = 0; y < grid.numClustersY; y++)
+    {
+        float const ndcY0 = (float)(y * grid.tileSize) / (float)height * 2.0f - 1.0f;
+        float const ndcY1 = glm::min((float)((y + 1) * grid.tileSize) / (float)height * 2.0f - 1.0f, 1.0f);
+        for (uint32_t x = 0; x < grid.numClustersX; x++)
+        {
+            float const ndcX0 = (float)(x * grid.tileSize) / (float)width * 2.0f - 1.0f;
+            float const ndcX1 = glm::min((float)((x + 1) * grid.tileSize) / (float)width * 2.0f - 1.0f, 1.0f);
+            glm::vec3 const rays[4] = { Ray(ndcX0, ndcY0), Ray(ndcX1, ndcY0), Ray(ndcX0, ndcY1), Ray(ndcX1, ndcY1) };
+
+            for (uint32_t z = 0; z < grid.numSlices; z++)
+            {
+                float const d0 = grid.SliceBegin(z);
+                float const d1 = grid.SliceBegin(z + 1);
+                glm::vec3 mn = glm::vec3(FLT_MAX);
+                glm::vec3 mx = glm::vec3(-FLT_MAX);
+                for (glm::vec3 const& ray : rays)
+                {
+                    mn = glm::min(mn, glm::min(ray * d0, ray * d1));
+                    mx = glm::max(mx, glm::max(ray * d0, ray * d1));
+                }
+
+                size_t const index = ((size_t)z * grid.numClustersY + y) * this->rowStride + x;
+                for (int axis = 0; axis < 3; axis++)
+                {
+                    this->boundsMin[axis][index] = mn[axis];
+                    this->boundsMax[axis][index] = mx[axis];
+                }
+            }
+        }
+    }
+    return true;
+}
+
+//------------------------------------------------------------------------------
+/**
+    For every light, the clusters inside its screen space range are tested
+    against the light sphere four at a time. Lanes outside the range are masked out.
+*/
+void
+LightClusterBuilder::Build(glm::mat4 const& view, glm::vec4 const* positions, float const* radii, uint32_t numLights)
+{
+    LightClusterGrid const& grid = this->grid;
+    this->counts.assign(grid.NumClusters(), 0);
+    this->pairs.clear();
+
+    __m128 const zero = _mm_setzero_ps();
+    float const* const minX = this->boundsMin[0].data();
+    float const* const minY = this->boundsMin[1].data();
+    float const* const minZ = this->boundsMin[2].data();
+    float const* const maxX = this->boundsMax[0].data();
+    float const* const maxY = this->boundsMax[1].data();
+    float const* const maxZ = this->boundsMax[2].data();
+
+    for (uint32_t i = 0; i < numLights; i++)
+    {
+        glm::vec3 const center = view * glm::vec4(glm::vec3(positions[i]), 1.0f);
+        float const radius = radii[i];
+
+        ClusterRange range;
+        if (!LightClusterRange(grid, this->projection, center, radius, range))
+            continue;
+
+        __m128 const cx = _mm_set1_ps(center.x);
+        __m128 const cy = _mm_set1_ps(center.y);
+        __m128 const cz = _mm_set1_ps(center.z);
+        __m128 const r2 = _mm_set1_ps(radius * radius);
+
+        for (uint32_t z = range.z0; z <= range.z1; z++)
+        {
+            for (uint32_t y = range.y0; y <= range.y1; y++)
+            {
+                size_t const row = ((size_t)z * grid.numClustersY + y) * this->rowStride;
+                uint32_t const clusterRow = (z * grid.numClustersY + y) * grid.numClustersX;
+
+                for (uint32_t x = range.x0 & ~3u; x <= range.x1; x += 4)
+                {
+                    size_t const index = row + x;
+                    __m128 const dx = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(minX + index), cx), _mm_sub_ps(cx, _mm_loadu_ps(maxX + index))), zero);
+                    __m128 const dy = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(minY + index), cy), _mm_sub_ps(cy, _mm_loadu_ps(maxY + index))), zero);
+                    __m128 const dz = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(minZ + index), cz), _mm_sub_ps(cz, _mm_loadu_ps(maxZ + index))), zero);
+                    __m128 const dist2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+
+                    uint32_t mask = (uint32_t)_mm_movemask_ps(_mm_cmple_ps(dist2, r2));
+                    if (x < range.x0)
+                        mask &= 0xFu << (range.x0 - x);
+                    if (x + 3 > range.x1)
+                        mask &= (1u << (range.x1 - x + 1)) - 1;
+
+                    while (mask != 0)
+                    {
+                        uint32_t const cluster = clusterRow + x + std::countr_zero(mask);
+                        mask &= mask - 1;
+                        this->counts[cluster]++;
+                        this->pairs.push_back({ cluster, i });
+                    }
+                }
+            }
+        }
+    }
+
+    this->Compact();
+}
+
+//------------------------------------------------------------------------------
+/**
+    Scalar sphere/box test, one cluster at a time. It applies the same
+    LightClusterRange as Build, so it only checks the SSE kernel; whether the
+    range itself is conservative is tested separately against sampled points.
+*/
+void
+LightClusterBuilder::BuildReference(glm::mat4 const& view, glm::vec4 const* positions, float const* radii, uint32_t numLights)
+{
+    LightClusterGrid const& grid = this->grid;
+    this->counts.assign(grid.NumClusters(), 0);
+    this->pairs.clear();
+
+    for (uint32_t i = 0; i < numLights; i++)
+    {
+        glm::vec3 const center = view * glm::vec4(glm::vec3(positions[i]), 1.0f);
+        float const radius = radii[i];
+
+        ClusterRange range;
+        bool const visible = LightClusterRange(grid, this->projection, center, radius, range);
+
+        for (uint32_t z = 0; z < grid.numSlices; z++)
+        {
+            for (uint32_t y = 0; y < grid.numClustersY; y++)
+            {
+                for (uint32_t x = 0; x < grid.numClustersX; x++)
+                {
+                    if (!visible || !range.Contains(x, y, z))
+                        continue;
+
+                    size_t const index = ((size_t)z * grid.numClustersY + y) * this->rowStride + x;
+                    float const dx = glm::max(glm::max(this->boundsMin[0][index] - center.x, center.x - this->boundsMax[0][index]), 0.0f);
+                    float const dy = glm::max(glm::max(this->boundsMin[1][index] - center.y, center.y - this->boundsMax[1][index]), 0.0f);
+                    float const dz = glm::max(glm::max(this->boundsMin[2][index] - center.z, center.z - this->boundsMax[2][index]), 0.0f);
+                    float const dist2 = (dx * dx + dy * dy) + dz * dz;
+                    if (dist2 <= radius * radius)
+                    {
+                        uint32_t const cluster = (z * grid.numClustersY + y) * grid.numClustersX + x;
+                        this->counts[cluster]++;
+                        this->pairs.push_back({ cluster, i });
+                    }
+                }
+            }
+        }
+    }
+
+    this->Compact();
+}
+
+//------------------------------------------------------------------------------
+/**
+    Exclusive prefix sum over the light counts gives every cluster its offset
+    into the packed index list. The pairs are then scattered in light order.
+*/
+void
+LightClusterBuilder::Compact()
+{
+    uint32_t const numClusters = this->grid.NumClusters();
+    this->clusterLights.resize(numClusters);
+
+    uint32_t offset = 0;
+    for (uint32_t c = 0; c < numClusters; c++)
+    {
+        this->clusterLights[c] = glm::uvec2(offset, this->counts[c]);
+        offset += this->counts[c];
+    }
+
+    // reuse the counts as write cursors
+    for (uint32_t c = 0; c < numClusters; c++)
+        this->counts[c] = this->clusterLights[c].x;
+
+    this->lightIndices.resize(offset);
+    for (glm::uvec2 const& pair : this->pairs)
+        this->lightIndices[this->counts[pair.x]++] = pair.y;
+}
+
+} // namespace Render
@@ -0,0 +1,94 @@
+#pragma once
+//------------------------------------------------------------------------------
+/**
+    @file lightclusters.h
+
+    Clustered light assignment.
+
+    The view frustum is divided into screen space tiles and exponentially
+    distributed depth slices. Every cluster gets a compact, variable length
+    list of the point lights whose bounding sphere intersects it. The lists
+    are stored back to back in a single index array, and each cluster stores
+    an offset and count into it (built with a prefix sum over the counts).
+
+    The builder has no GL dependencies, so it can run and be validated without
+    a context. The grid must match the ClusterIndex function in lights.glsl.
+
+    @copyright
+    (C) 2022 Individual contributors, see AUTHORS file
+*/
+//------------------------------------------------------------------------------
+#include <vector>
+
+namespace Render
+{
+
+//------------------------------------------------------------------------------
+/**
+    Dimensions and depth distribution of the cluster grid.
+*/
+struct LightClusterGrid
+{
+    /// size of a cluster in pixels, in x and y
+    uint32_t tileSize = 64;
+    /// number of depth slices
+    uint32_t numSlices = 24;
+    /// depth where the exponential slicing starts. Everything closer ends up in the first slice.
+    float minSliceDepth = 0.5f;
+
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t numClustersX = 0;
+    uint32_t numClustersY = 0;
+
+    float nearZ = 0.0f;
+    float farZ = 0.0f;
+    /// slice = log(depth) * sliceScale - sliceBias
+    float sliceScale = 0.0f;
+    float sliceBias = 0.0f;
+
+    uint32_t NumClusters() const { return numClustersX * numClustersY * numSlices; }
+    /// get the depth slice for a positive view space depth
+    uint32_t Slice(float depth) const;
+    /// get the depth where a slice begins
+    float SliceBegin(uint32_t slice) const;
+};
+
+//------------------------------------------------------------------------------
+/**
+*/
+class LightClusterBuilder
+{
+public:
+    /// setup the grid and precompute the view space bounds of all clusters. Returns false if nothing changed.
+    bool Setup(uint32_t width, uint32_t height, glm::mat4 const& projection);
+
+    /// assign lights to clusters, testing four clusters at a time with SSE
+    void Build(glm::mat4 const& view, glm::vec4 const* positions, float const* radii, uint32_t numLights);
+    /// scalar version of Build that tests the clusters in each light's range one at a time. Produces identical output to Build, but shares its cluster range.
+    void BuildReference(glm::mat4 const& view, glm::vec4 const* positions, float const* radii, uint32_t numLights);
+
+    LightClusterGrid grid;
+    /// offset and count into lightIndices for every cluster
+    std::vector<glm::uvec2> clusterLights;
+    /// light indices for all clusters, packed
+    std::vector<uint32_t> lightIndices;
+
+private:
+    /// builds clusterLights and lightIndices from counts and pairs
+    void Compact();
+
+    glm::mat4 projection = glm::mat4(0.0f);
+    /// number of clusters per row, rounded up to a multiple of four
+    uint32_t rowStride = 0;
+    /// view space bounds of every cluster as structure of arrays (x, y, z), padded to rowStride
+    std::vector<float> boundsMin[3];
+    std::vector<float> boundsMax[3];
+
+    /// number of lights per cluster
+    std::vector<uint32_t> counts;
+    /// intersecting (cluster, light) pairs in light order
+    std::vector<glm::uvec2> pairs;
+};
+
+} // namespace Render
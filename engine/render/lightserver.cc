@@ -3,7 +3,8 @@
 //  @copyright (C) 2021 Individual contributors, see AUTHORS file
 //------------------------------------------------------------------------------
 #include "config.h"
-#include "GL/glew.h"
+#include "render/renderbackend.h"
+#include "render/glstate.h"
 #include "lightserver.h"
 #include "model.h"
 #include "cameramanager.h"
@@ -11,17 +12,15 @@
 #include "core/idpool.h"
 #include "debugrender.h"
 #include "core/random.h"
+#include "lightclusters.h"
+#include <bit>
+#include <algorithm>
 
 namespace Render
 {
 namespace LightServer
 {
 
-struct VisibleIndex
-{
-	int index;
-};
-
 enum LightType
 {
 	NaN = 1,
@@ -30,12 +29,103 @@ enum LightType
 	Directional = 8
 };
 
+//------------------------------------------------------------------------------
+/**
+	Keeps track of which elements of a light array have been modified since
+	the last upload. One bit per light, flushed as coalesced ranges.
+*/
+struct DirtyRanges
+{
+	std::vector<uint64_t> bits;
+	bool any = false;
+
+	void Mark(size_t index)
+	{
+		size_t const word = index >> 6;
+		if (word >= this->bits.size())
+			this->bits.resize(word + 1, 0);
+		this->bits[word] |= uint64_t(1) << (index & 63);
+		this->any = true;
+	}
+	bool Test(size_t index) const
+	{
+		size_t const word = index >> 6;
+		return word < this->bits.size() && (this->bits[word] & (uint64_t(1) << (index & 63))) != 0;
+	}
+	void Clear()
+	{
+		std::fill(this->bits.begin(), this->bits.end(), 0);
+		this->any = false;
+	}
+};
+
+//------------------------------------------------------------------------------
+/**
+	Point lights are stored as a sparse set. The light data lives in densely
+	packed arrays, so the GPU buffers never contain holes, and PointLightId::index
+	is mapped to a position in the dense arrays. Removal swaps the last light
+	into the hole, which keeps destruction O(1).
+*/
 struct PointLights
 {
 	std::vector<glm::vec4> positions;
 	std::vector<glm::vec4> colors;
 	std::vector<float> radii;
-	GLuint buffers[4];
+	GLuint buffers[(int)PointLightBuffer::NUM_BUFFERS];
+
+	/// dense index for every PointLightId::index
+	std::vector<uint32_t> denseIndices;
+	/// owning id for every dense index
+	std::vector<PointLightId> ids;
+
+	/// dirty elements per array, indexed by PointLightBuffer
+	DirtyRanges dirty[3];
+	/// dense index each removal moved the last light to, and the index it came from, since the last sync
+	std::vector<std::pair<uint32_t, uint32_t>> moves;
+};
+
+//------------------------------------------------------------------------------
+/**
+	Copy of the light arrays that the render thread reads. SyncRenderThread
+	copies the lights that changed since the last frame, and their dirty bits
+	move along until OnBeforeRender has compacted them.
+*/
+struct RenderPointLights
+{
+	std::vector<glm::vec4> positions;
+	std::vector<glm::vec4> colors;
+	std::vector<float> radii;
+	DirtyRanges dirty[3];
+};
+
+//------------------------------------------------------------------------------
+/**
+	The point lights that are uploaded and clustered this frame. Lights outside
+	the main camera frustum are skipped, and when more than r_light_budget
+	remain, only the ones with the largest screen contribution are kept.
+
+	The selected lights are packed into the GPU buffers in dense index order,
+	so a light keeps its slot as long as the lights before it don't change,
+	and only the slots whose light or data changed are uploaded.
+*/
+struct VisiblePointLights
+{
+	/// dense index of the light in every slot, ascending
+	std::vector<uint32_t> indices;
+	std::vector<glm::vec4> positions;
+	std::vector<glm::vec4> colors;
+	std::vector<float> radii;
+	/// dirty slots per array, indexed by PointLightBuffer
+	DirtyRanges dirty[3];
+	/// number of lights the GPU buffers currently have room for
+	size_t bufferCapacity = 0;
+
+	/// 1 for every dense index that was selected last frame, moved along with the lights when they are removed
+	std::vector<uint8_t> selected;
+	/// lights in the frustum, reused between frames
+	std::vector<std::pair<float, uint32_t>> candidates;
+	/// lights in the frustum this frame, before the budget was applied
+	size_t numInFrustum = 0;
 };
 
 glm::vec3 globalLightDirection;
@@ -45,19 +135,162 @@ static ModelId icoSphereModel;
 static Util::IdPool<PointLightId> pointLightPool;
 
 static PointLights pointLights;
+static RenderPointLights renderPointLights;
+static VisiblePointLights visiblePointLights;
+
+constexpr uint32_t invalidDenseIndex = UINT32_MAX;
 
-constexpr GLuint maxTileLights = 512;
-constexpr GLuint maxTileProbes = 128;
-static GLuint workGroupsX = 0;
-static GLuint workGroupsY = 0;
+static LightClusterBuilder clusterBuilder;
+static uint clusterResolutionWidth = 0;
+static uint clusterResolutionHeight = 0;
+/// sizes of the cluster buffers in bytes
+static size_t clusterLightsCapacity = 0;
+static size_t clusterIndicesCapacity = 0;
 
 static GLuint globalShadowMap;
-static GLuint globalShadowFrameBuffer;
-const unsigned int shadowMapSize = 4096;
+static GLuint shadowCascadeFrameBuffers[MaxShadowCascades];
+static GLuint staticShadowCache;
+static GLuint staticShadowCacheFrameBuffers[MaxShadowCascades];
+const unsigned int shadowMapSize = 2048;
+
+static ShadowCascade shadowCascades[MaxShadowCascades];
+static uint numShadowCascades = 0;
+static uint64_t shadowFrameIndex = 0;
+static glm::vec3 shadowLightDirection = glm::vec3(0.0f);
+/// blend between uniform (0) and logarithmic (1) cascade splits
+constexpr float shadowSplitLambda = 0.8f;
+
+static Core::CVar* r_shadow_cascades = nullptr;
+static Core::CVar* r_shadow_distance = nullptr;
+static Core::CVar* r_shadow_cascade_interval = nullptr;
+static Core::CVar* r_shadow_cache = nullptr;
+static Core::CVar* r_shadow_cache_threshold = nullptr;
+
+/// dirty runs separated by at most this many clean lights are merged into one upload
+constexpr size_t dirtyRangeMergeGap = 16;
+/// a light that was selected last frame is only replaced by lights that score this much higher, so lights near the budget don't flicker
+constexpr float selectedScoreBias = 1.25f;
+
+static Core::CVar* r_light_budget = nullptr;
 
 static Core::CVar* r_draw_light_spheres = nullptr;
 static Core::CVar* r_draw_light_sphere_id = nullptr;
 
+//------------------------------------------------------------------------------
+/**
+*/
+inline uint32_t
+DenseIndex(PointLightId id)
+{
+	assert(pointLightPool.IsValid(id));
+	return pointLights.denseIndices[id.index];
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+inline void
+MarkDirty(PointLightBuffer buf, size_t index)
+{
+	pointLights.dirty[(GLuint)buf].Mark(index);
+}
+
+//------------------------------------------------------------------------------
+/**
+	Uploads data to a buffer, reallocating it only when it is too small.
+	Never leaves the buffer without storage, so it can always be bound.
+*/
+void
+UploadGrowing(GLuint buffer, size_t& capacity, void const* data, size_t size)
+{
+	if (size > capacity || capacity == 0)
+	{
+		capacity = glm::max(size, glm::max(capacity * 2, (size_t)256));
+		glNamedBufferData(buffer, capacity, nullptr, GL_DYNAMIC_DRAW);
+	}
+	if (size > 0)
+		glNamedBufferSubData(buffer, 0, size, data);
+}
+
+//------------------------------------------------------------------------------
+/**
+	Uploads all dirty elements of an array with as few glNamedBufferSubData
+	calls as possible. Runs that are close to each other are merged, since
+	uploading a few clean elements is cheaper than issuing another call.
+*/
+template<typename T> void
+FlushDirtyRanges(GLuint buffer, DirtyRanges& dirty, std::vector<T> const& data)
+{
+	if (!dirty.any)
+		return;
+
+	size_t const count = data.size();
+	size_t runBegin = SIZE_MAX;
+	size_t runEnd = 0;
+
+	auto Upload = [&](size_t begin, size_t end)
+	{
+		end = glm::min(end, count);
+		if (begin < end)
+			glNamedBufferSubData(buffer, begin * sizeof(T), (end - begin) * sizeof(T), data.data() + begin);
+	};
+
+	size_t const numWords = dirty.bits.size();
+	for (size_t w = 0; w < numWords; w++)
+	{
+		uint64_t word = dirty.bits[w];
+		while (word != 0)
+		{
+			size_t const index = (w << 6) + std::countr_zero(word);
+			word &= word - 1;
+
+			if (runBegin == SIZE_MAX)
+			{
+				runBegin = index;
+			}
+			else if (index - runEnd > dirtyRangeMergeGap)
+			{
+				Upload(runBegin, runEnd);
+				runBegin = index;
+			}
+			runEnd = index + 1;
+		}
+	}
+	if (runBegin != SIZE_MAX)
+		Upload(runBegin, runEnd);
+
+	dirty.Clear();
+}
+
+//------------------------------------------------------------------------------
+/**
+	Copies the dirty elements of a light array to the render thread's copy,
+	and hands the dirty bits over with them.
+*/
+template<typename T> void
+CopyDirtyElements(DirtyRanges& dirty, DirtyRanges& renderDirty, std::vector<T> const& data, std::vector<T>& renderData)
+{
+	if (!dirty.any)
+		return;
+
+	size_t const numWords = dirty.bits.size();
+	for (size_t w = 0; w < numWords; w++)
+	{
+		uint64_t word = dirty.bits[w];
+		while (word != 0)
+		{
+			size_t const index = (w << 6) + std::countr_zero(word);
+			word &= word - 1;
+			if (index < data.size())
+			{
+				renderData[index] = data[index];
+				renderDirty.Mark(index);
+			}
+		}
+	}
+	dirty.Clear();
+}
+
 //------------------------------------------------------------------------------
 /**
 */
@@ -71,109 +304,263 @@ Initialize()
 
 	r_draw_light_spheres = Core::CVarCreate(Core::CVarType::CVar_Int, "r_draw_light_spheres", "0");
 	r_draw_light_sphere_id = Core::CVarCreate(Core::CVarType::CVar_Int, "r_draw_light_sphere_id", "-1");
-
-	glGenBuffers((GLuint)PointLightBuffer::NUM_BUFFERS, pointLights.buffers);
+	r_shadow_cascades = Core::CVarCreate(Core::CVarType::CVar_Int, "r_shadow_cascades", "4");
+	r_shadow_distance = Core::CVarCreate(Core::CVarType::CVar_Float, "r_shadow_distance", "300");
+	// cascades after the first two are only re-rendered every n:th frame, staggered
+	r_shadow_cascade_interval = Core::CVarCreate(Core::CVarType::CVar_Int, "r_shadow_cascade_interval", "2");
+	r_shadow_cache = Core::CVarCreate(Core::CVarType::CVar_Int, "r_shadow_cache", "1");
+	// how far, in texels, the camera can move before a cached cascade is moved and its static casters re-rendered
+	r_shadow_cache_threshold = Core::CVarCreate(Core::CVarType::CVar_Int, "r_shadow_cache_threshold", "32");
+	// maximum number of point lights that are shaded per frame, 0 for no limit
+	r_light_budget = Core::CVarCreate(Core::CVarType::CVar_Int, "r_light_budget", "256");
+
+	// created (not just generated) since the light arrays are streamed with DSA calls
+	glCreateBuffers((GLuint)PointLightBuffer::NUM_BUFFERS, pointLights.buffers);
 	
-	// setup shadow pass
+	// setup shadow pass, one layer and framebuffer per cascade
 	glGenTextures(1, &globalShadowMap);
-	glBindTexture(GL_TEXTURE_2D, globalShadowMap);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, shadowMapSize, shadowMapSize, 0, GL_DEPTH_COMPONENT, GL_FLOAT, 0);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-
-	glGenFramebuffers(1, &globalShadowFrameBuffer);
-	glBindFramebuffer(GL_FRAMEBUFFER, globalShadowFrameBuffer);
-	glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, globalShadowMap, 0);
-	glDrawBuffer(GL_NONE);
-	glReadBuffer(GL_NONE);
-
-	// setup a shadow camera
-	Render::CameraCreateInfo shadowCameraInfo;
-	shadowCameraInfo.hash = CAMERA_SHADOW;
-	shadowCameraInfo.projection = glm::ortho(-50.0f, 50.0f, -50.0f, 50.0f, 0.1f, 500.0f);
-	shadowCameraInfo.view = glm::lookAt(glm::vec3(-10.0f,75.0f, -20.0f),
+	GLState::BindTexture(GL_TEXTURE_2D_ARRAY, globalShadowMap);
+	glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT32F, shadowMapSize, shadowMapSize, MaxShadowCascades, 0, GL_DEPTH_COMPONENT, GL_FLOAT, 0);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	GLState::BindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+	// static casters are cached here and copied into globalShadowMap before drawing dynamic casters
+	glGenTextures(1, &staticShadowCache);
+	GLState::BindTexture(GL_TEXTURE_2D_ARRAY, staticShadowCache);
+	glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT32F, shadowMapSize, shadowMapSize, MaxShadowCascades, 0, GL_DEPTH_COMPONENT, GL_FLOAT, 0);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	GLState::BindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+	glGenFramebuffers(MaxShadowCascades, shadowCascadeFrameBuffers);
+	glGenFramebuffers(MaxShadowCascades, staticShadowCacheFrameBuffers);
+	for (uint i = 0; i < MaxShadowCascades; i++)
+	{
+		GLState::BindFramebuffer(GL_FRAMEBUFFER, shadowCascadeFrameBuffers[i]);
+		glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, globalShadowMap, 0, i);
+		glDrawBuffer(GL_NONE);
+		glReadBuffer(GL_NONE);
+
+		GLState::BindFramebuffer(GL_FRAMEBUFFER, staticShadowCacheFrameBuffers[i]);
+		glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, staticShadowCache, 0, i);
+		glDrawBuffer(GL_NONE);
+		glReadBuffer(GL_NONE);
+	}
+	GLState::BindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	glm::mat4 const sunView = glm::lookAt(glm::vec3(-10.0f,75.0f, -20.0f),
 		glm::vec3(0.0f, 0.0f, 0.0f),
 		glm::vec3(0.0f, 1.0f, 0.0f));
-	LightServer::globalLightDirection = shadowCameraInfo.view[2];
-	CameraManager::CreateCamera(shadowCameraInfo);
+	LightServer::globalLightDirection = sunView[2];
 }
 
 //------------------------------------------------------------------------------
 /**
 */
 void
-UpdateWorkGroups(uint resolutionWidth, uint resolutionHeight)
+UpdateClusterGrid(uint resolutionWidth, uint resolutionHeight)
 {
-	// Define work group sizes in x and y direction based off screen size and tile size (in pixels)
-	const int TILE_SIZE = 32;
-	workGroupsX = (resolutionWidth + (resolutionWidth % TILE_SIZE)) / TILE_SIZE;
-	workGroupsY = (resolutionHeight + (resolutionHeight % TILE_SIZE)) / TILE_SIZE;
+	// the cluster bounds are rebuilt by the next BuildClusters
+	clusterResolutionWidth = resolutionWidth;
+	clusterResolutionHeight = resolutionHeight;
+}
 
-	size_t numberOfTiles = workGroupsX * workGroupsY;
+//------------------------------------------------------------------------------
+/**
+	Picks the lights to render and sorts them by dense index. Lights are scored
+	by radius / distance * intensity, a rough measure of how much of the screen
+	they light up and how brightly.
+*/
+void
+SelectVisiblePointLights()
+{
+	VisiblePointLights& visible = visiblePointLights;
+	size_t const numPointLights = renderPointLights.positions.size();
+
+	Camera const* const mainCamera = CameraManager::GetRenderCamera(CAMERA_MAIN);
+	glm::vec3 const eye = glm::vec3(mainCamera->invView[3]);
+	glm::vec4 planes[6];
+	CameraManager::GetFrustumPlanes(mainCamera, planes);
+
+	visible.selected.resize(numPointLights, 0);
+	visible.candidates.clear();
+	for (uint32_t i = 0; i < (uint32_t)numPointLights; i++)
+	{
+		glm::vec3 const position = renderPointLights.positions[i];
+		float const radius = renderPointLights.radii[i];
+		float const intensity = renderPointLights.colors[i].w;
+		if (radius <= 0.0f || intensity <= 0.0f)
+			continue;
+
+		bool inside = true;
+		for (glm::vec4 const& plane : planes)
+			inside = inside && glm::dot(glm::vec3(plane), position) + plane.w > -radius;
+		if (!inside)
+			continue;
+
+		float score = radius / glm::max(glm::distance(eye, position), 0.001f) * intensity;
+		if (visible.selected[i])
+			score *= selectedScoreBias;
+		visible.candidates.push_back({ score, i });
+	}
+	visible.numInFrustum = visible.candidates.size();
 
-	// Bind visible Point light indices buffer
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, pointLights.buffers[(GLuint)PointLightBuffer::VISIBLE_INDICES]);
-	glBufferData(GL_SHADER_STORAGE_BUFFER, numberOfTiles * sizeof(VisibleIndex) * maxTileLights, 0, GL_DYNAMIC_DRAW);
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	int const budget = Core::CVarReadInt(r_light_budget);
+	if (budget > 0 && visible.candidates.size() > (size_t)budget)
+	{
+		// ties go to the lower index, so equal lights don't swap places between frames
+		std::nth_element(visible.candidates.begin(), visible.candidates.begin() + budget, visible.candidates.end(),
+			[](std::pair<float, uint32_t> const& a, std::pair<float, uint32_t> const& b)
+			{
+				return a.first > b.first || (a.first == b.first && a.second < b.second);
+			});
+		visible.candidates.resize(budget);
+		std::sort(visible.candidates.begin(), visible.candidates.end(),
+			[](std::pair<float, uint32_t> const& a, std::pair<float, uint32_t> const& b) { return a.second < b.second; });
+	}
 }
 
 //------------------------------------------------------------------------------
 /**
+	Selects the lights for this frame and packs them into the upload arrays.
+	A slot is uploaded if it holds a different light than last frame, or if
+	its light was changed by the game.
 */
 void
 OnBeforeRender()
 {
-	float y = 70.0f;
-	float z = -cos(glfwGetTime() * 0.04f) * 20;
-	float x = -sin(glfwGetTime() * 0.02f) * 20;
-	//Camera* shadowCamera = CameraManager::GetCamera(CAMERA_SHADOW);
-	//shadowCamera->view = glm::lookAt(glm::vec3(x, 75.0f, z),
-	//	glm::vec3(0.0f, 0.0f, 0.0f),
-	//	glm::vec3(0.0f, 1.0f, 0.0f));
-	//LightServer::globalLightDirection = shadowCamera->view[2];
+	VisiblePointLights& visible = visiblePointLights;
+	SelectVisiblePointLights();
+
+	size_t const numVisible = visible.candidates.size();
+	size_t const numPrevious = visible.indices.size();
+	visible.positions.resize(numVisible);
+	visible.colors.resize(numVisible);
+	visible.radii.resize(numVisible);
+
+	std::fill(visible.selected.begin(), visible.selected.end(), 0);
+	for (size_t slot = 0; slot < numVisible; slot++)
+	{
+		uint32_t const index = visible.candidates[slot].second;
+		bool const moved = slot >= numPrevious || visible.indices[slot] != index;
+		visible.selected[index] = 1;
+
+		if (moved || renderPointLights.dirty[(GLuint)PointLightBuffer::POSITIONS].Test(index))
+		{
+			visible.positions[slot] = renderPointLights.positions[index];
+			visible.dirty[(GLuint)PointLightBuffer::POSITIONS].Mark(slot);
+		}
+		if (moved || renderPointLights.dirty[(GLuint)PointLightBuffer::COLORS].Test(index))
+		{
+			visible.colors[slot] = renderPointLights.colors[index];
+			visible.dirty[(GLuint)PointLightBuffer::COLORS].Mark(slot);
+		}
+		if (moved || renderPointLights.dirty[(GLuint)PointLightBuffer::RADII].Test(index))
+		{
+			visible.radii[slot] = renderPointLights.radii[index];
+			visible.dirty[(GLuint)PointLightBuffer::RADII].Mark(slot);
+		}
+	}
+	visible.indices.resize(numVisible);
+	for (size_t slot = 0; slot < numVisible; slot++)
+		visible.indices[slot] = visible.candidates[slot].second;
+
+	// lights that weren't selected are copied in full once they are
+	for (DirtyRanges& dirty : renderPointLights.dirty)
+		dirty.Clear();
 
-	static size_t prevNumPointLights = 0;
-	size_t numPointLights = pointLights.positions.size();
+	if (numVisible == 0)
+		return;
 
-	if (prevNumPointLights != numPointLights)
+	GLuint const positionBuffer = pointLights.buffers[(GLuint)PointLightBuffer::POSITIONS];
+	GLuint const colorBuffer = pointLights.buffers[(GLuint)PointLightBuffer::COLORS];
+	GLuint const radiusBuffer = pointLights.buffers[(GLuint)PointLightBuffer::RADII];
+
+	if (numVisible > visible.bufferCapacity)
 	{
-		glBindBuffer(GL_SHADER_STORAGE_BUFFER, pointLights.buffers[(GLuint)PointLightBuffer::POSITIONS]);
-		glBufferData(GL_SHADER_STORAGE_BUFFER, numPointLights * sizeof(glm::vec4), pointLights.positions.data(), GL_DYNAMIC_DRAW);
-		glBindBuffer(GL_SHADER_STORAGE_BUFFER, pointLights.buffers[(GLuint)PointLightBuffer::COLORS]);
-		glBufferData(GL_SHADER_STORAGE_BUFFER, numPointLights * sizeof(glm::vec4), pointLights.colors.data(), GL_DYNAMIC_DRAW);
-		glBindBuffer(GL_SHADER_STORAGE_BUFFER, pointLights.buffers[(GLuint)PointLightBuffer::RADII]);
-		glBufferData(GL_SHADER_STORAGE_BUFFER, numPointLights * sizeof(float), pointLights.radii.data(), GL_DYNAMIC_DRAW);
-		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
-
-		prevNumPointLights = numPointLights;
+		// grow geometrically so that spawning lights doesn't reallocate every frame.
+		// the whole array is uploaded with the reallocation, so nothing is dirty afterwards.
+		size_t const capacity = glm::max(numVisible, glm::max(visible.bufferCapacity * 2, (size_t)64));
+
+		glNamedBufferData(positionBuffer, capacity * sizeof(glm::vec4), nullptr, GL_DYNAMIC_DRAW);
+		glNamedBufferSubData(positionBuffer, 0, numVisible * sizeof(glm::vec4), visible.positions.data());
+		glNamedBufferData(colorBuffer, capacity * sizeof(glm::vec4), nullptr, GL_DYNAMIC_DRAW);
+		glNamedBufferSubData(colorBuffer, 0, numVisible * sizeof(glm::vec4), visible.colors.data());
+		glNamedBufferData(radiusBuffer, capacity * sizeof(float), nullptr, GL_DYNAMIC_DRAW);
+		glNamedBufferSubData(radiusBuffer, 0, numVisible * sizeof(float), visible.radii.data());
+
+		visible.bufferCapacity = capacity;
+		for (DirtyRanges& dirty : visible.dirty)
+			dirty.Clear();
+		return;
 	}
+
+	FlushDirtyRanges(positionBuffer, visible.dirty[(GLuint)PointLightBuffer::POSITIONS], visible.positions);
+	FlushDirtyRanges(colorBuffer, visible.dirty[(GLuint)PointLightBuffer::COLORS], visible.colors);
+	FlushDirtyRanges(radiusBuffer, visible.dirty[(GLuint)PointLightBuffer::RADII], visible.radii);
 }
 
 //------------------------------------------------------------------------------
 /**
+	Lights are only modified on the game thread, and only read through the
+	render thread's copy while rendering.
 */
-GLuint GetBuffer(PointLightBuffer buf)
+void
+SyncRenderThread()
 {
-	assert((int)buf < (int)PointLightBuffer::NUM_BUFFERS);
-	return pointLights.buffers[(GLuint)buf];
+	size_t const numPointLights = pointLights.positions.size();
+	renderPointLights.positions.resize(numPointLights);
+	renderPointLights.colors.resize(numPointLights);
+	renderPointLights.radii.resize(numPointLights);
+
+	CopyDirtyElements(pointLights.dirty[(GLuint)PointLightBuffer::POSITIONS], renderPointLights.dirty[(GLuint)PointLightBuffer::POSITIONS], pointLights.positions, renderPointLights.positions);
+	CopyDirtyElements(pointLights.dirty[(GLuint)PointLightBuffer::COLORS], renderPointLights.dirty[(GLuint)PointLightBuffer::COLORS], pointLights.colors, renderPointLights.colors);
+	CopyDirtyElements(pointLights.dirty[(GLuint)PointLightBuffer::RADII], renderPointLights.dirty[(GLuint)PointLightBuffer::RADII], pointLights.radii, renderPointLights.radii);
+
+	// replayed in order, so the selection bias stays with the light that was selected, and lights added at a freed index start without it
+	std::vector<uint8_t>& selected = visiblePointLights.selected;
+	for (std::pair<uint32_t, uint32_t> const& move : pointLights.moves)
+	{
+		if (move.second < selected.size())
+		{
+			if (move.first < selected.size())
+				selected[move.first] = selected[move.second];
+			selected[move.second] = 0;
+		}
+	}
+	pointLights.moves.clear();
 }
 
 //------------------------------------------------------------------------------
 /**
+	The cluster bounds only depend on the resolution and projection, so they
+	are recomputed only when either changes. The light lists are rebuilt every
+	frame, from the lights that OnBeforeRender selected, and index into the
+	compacted light buffers.
 */
-GLuint GetWorkGroupsX()
+void
+BuildClusters()
 {
-	return workGroupsX;
+	Camera const* const mainCamera = CameraManager::GetRenderCamera(CAMERA_MAIN);
+	clusterBuilder.Setup(clusterResolutionWidth, clusterResolutionHeight, mainCamera->projection);
+	clusterBuilder.Build(mainCamera->view, visiblePointLights.positions.data(), visiblePointLights.radii.data(), (uint32_t)visiblePointLights.positions.size());
+
+	UploadGrowing(pointLights.buffers[(GLuint)PointLightBuffer::CLUSTER_LIGHTS], clusterLightsCapacity,
+		clusterBuilder.clusterLights.data(), clusterBuilder.clusterLights.size() * sizeof(glm::uvec2));
+	UploadGrowing(pointLights.buffers[(GLuint)PointLightBuffer::CLUSTER_INDICES], clusterIndicesCapacity,
+		clusterBuilder.lightIndices.data(), clusterBuilder.lightIndices.size() * sizeof(uint32_t));
 }
 
 //------------------------------------------------------------------------------
 /**
 */
-GLuint GetWorkGroupsY()
+GLuint GetBuffer(PointLightBuffer buf)
 {
-	return workGroupsY;
+	assert((int)buf < (int)PointLightBuffer::NUM_BUFFERS);
+	return pointLights.buffers[(GLuint)buf];
 }
 
 //------------------------------------------------------------------------------
@@ -182,9 +569,36 @@ GLuint GetWorkGroupsY()
 void
 Update(Render::ShaderProgramId pid)
 {
-	GLuint programHandle = ShaderResource::GetProgramHandle(pid);
-	glUniform3fv(glGetUniformLocation(programHandle, "GlobalLightDirection"), 1, &globalLightDirection[0]);
-	glUniform3fv(glGetUniformLocation(programHandle, "GlobalLightColor"), 1, &globalLightColor[0]);
+	glUniform3fv(ShaderResource::GetUniformLocation(pid, "GlobalLightDirection"), 1, &globalLightDirection[0]);
+	glUniform3fv(ShaderResource::GetUniformLocation(pid, "GlobalLightColor"), 1, &globalLightColor[0]);
+
+	float shadowBias[MaxShadowCascades] = {};
+	glm::mat4 shadowMatrices[MaxShadowCascades];
+	for (uint i = 0; i < numShadowCascades; i++)
+	{
+		// one and a half texel of slope in normalized depth
+		ShadowCascade const& cascade = shadowCascades[i];
+		float const texelSize = (cascade.boundsMax.x - cascade.boundsMin.x) / (float)shadowMapSize;
+		shadowBias[i] = 1.5f * texelSize / (cascade.boundsMax.z - cascade.boundsMin.z);
+		shadowMatrices[i] = cascade.viewProjection;
+	}
+	glUniform1ui(ShaderResource::GetUniformLocation(pid, "NumShadowCascades"), numShadowCascades);
+	glUniformMatrix4fv(ShaderResource::GetUniformLocation(pid, "GlobalShadowMatrices"), numShadowCascades, GL_FALSE, &shadowMatrices[0][0][0]);
+	glUniform4fv(ShaderResource::GetUniformLocation(pid, "ShadowCascadeBias"), 1, shadowBias);
+
+	LightClusterGrid const& grid = clusterBuilder.grid;
+	glUniform4ui(ShaderResource::GetUniformLocation(pid, "ClusterGridSize"), grid.numClustersX, grid.numClustersY, grid.numSlices, grid.tileSize);
+	glUniform4f(ShaderResource::GetUniformLocation(pid, "ClusterDepthParams"), grid.sliceScale, grid.sliceBias, grid.nearZ, grid.farZ);
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+BindPointLightBuffers()
+{
+	for (GLuint i = 0; i < (GLuint)PointLightBuffer::NUM_BUFFERS; i++)
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, i, pointLights.buffers[i]);
 }
 
 //------------------------------------------------------------------------------
@@ -197,38 +611,40 @@ DebugDrawPointLights()
 	if (Core::CVarReadInt(r_draw_light_spheres) > 0)
 	{
 		Model::Mesh::Primitive const& primitive = GetModel(icoSphereModel).meshes[0].primitives[0];
-		glBindVertexArray(primitive.vao);
+		GLState::BindVertexArray(primitive.vao);
 
 		static Render::ShaderResourceId const vs = Render::ShaderResource::LoadShader(Render::ShaderResource::ShaderType::VERTEXSHADER, "shd/debug.vs");
 		static Render::ShaderResourceId const fs = Render::ShaderResource::LoadShader(Render::ShaderResource::ShaderType::FRAGMENTSHADER, "shd/debug.fs");
 		static ShaderProgramId debugProgram = Render::ShaderResource::CompileShaderProgram({ vs, fs });
 		GLuint debugProgramHandle = ShaderResource::GetProgramHandle(debugProgram);
-		glUseProgram(debugProgramHandle);
+		GLState::UseProgram(debugProgramHandle);
 
 		glm::vec4 color(1, 0, 0, 1);
-		glUniform4fv(glGetUniformLocation(debugProgramHandle, "color"), 1, &color.x);
+		glUniform4fv(ShaderResource::GetUniformLocation(debugProgram, "color"), 1, &color.x);
 
-		static GLuint model = glGetUniformLocation(debugProgramHandle, "model");
-		static GLuint viewProjection = glGetUniformLocation(debugProgramHandle, "viewProjection");
-		Render::Camera* const mainCamera = Render::CameraManager::GetCamera(CAMERA_MAIN);
+		GLint const model = ShaderResource::GetUniformLocation(debugProgram, "model");
+		GLint const viewProjection = ShaderResource::GetUniformLocation(debugProgram, "viewProjection");
+		Render::Camera const* const mainCamera = Render::CameraManager::GetRenderCamera(CAMERA_MAIN);
 		glUniformMatrix4fv(viewProjection, 1, GL_FALSE, &mainCamera->viewProjection[0][0]);
 
-		glDisable(GL_CULL_FACE);
-		glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+		GLState::Disable(GL_CULL_FACE);
+		GLState::PolygonMode(GL_FRONT_AND_BACK, GL_LINE);
 		int drawId = Core::CVarReadInt(r_draw_light_sphere_id);
-		for (int i = 0; i < pointLights.positions.size(); i++)
+		for (size_t i = 0; i < renderPointLights.positions.size(); i++)
 		{
-			if (drawId < 0 || i == drawId)
+			if (drawId < 0 || i == (size_t)drawId)
 			{
-				glm::mat4 transform = glm::translate(glm::vec3(pointLights.positions[i])) * glm::scale(glm::vec3(pointLights.radii[i]));
+				// debug.vs doesn't decode vertices, so the position decoding goes into the transform
+				glm::mat4 transform = glm::translate(glm::vec3(renderPointLights.positions[i])) * glm::scale(glm::vec3(renderPointLights.radii[i])) *
+					glm::translate(primitive.positionOffset) * glm::scale(primitive.positionScale);
 				glUniformMatrix4fv(model, 1, GL_FALSE, &transform[0][0]);
-				glDrawElements(GL_TRIANGLES, primitive.numIndices, primitive.indexType, (void*)(intptr_t)primitive.offset);
+				glDrawElements(GL_TRIANGLES, primitive.lods[0].numIndices, primitive.indexType, (void*)(intptr_t)primitive.lods[0].offset);
 			}
 		}
-		glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-		glEnable(GL_CULL_FACE);
+		GLState::PolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+		GLState::Enable(GL_CULL_FACE);
 		
-		glBindVertexArray(0);
+		GLState::BindVertexArray(0);
 	}
 #endif
 }
@@ -249,29 +665,56 @@ PointLightId
 CreatePointLight(glm::vec3 position, glm::vec3 color, float intensity, float radius)
 {
 	PointLightId id;
-	if (pointLightPool.Allocate(id))
-	{
-		pointLights.positions.push_back(glm::vec4(position, 1));
-		pointLights.colors.push_back(glm::vec4(color, 1) * intensity);
-		pointLights.radii.push_back(radius);
-	}
-	else
-	{
-		pointLights.positions[id.index] = glm::vec4(position, 1);
-		pointLights.colors[id.index] = glm::vec4(color, 1) * intensity;
-		pointLights.radii[id.index] = radius;
-	}
+	pointLightPool.Allocate(id);
+
+	uint32_t const dense = (uint32_t)pointLights.positions.size();
+	pointLights.positions.push_back(glm::vec4(position, 1));
+	pointLights.colors.push_back(glm::vec4(color, 1) * intensity);
+	pointLights.radii.push_back(radius);
+	pointLights.ids.push_back(id);
+
+	if (id.index >= pointLights.denseIndices.size())
+		pointLights.denseIndices.resize(id.index + 1, invalidDenseIndex);
+	pointLights.denseIndices[id.index] = dense;
+
+	MarkDirty(PointLightBuffer::POSITIONS, dense);
+	MarkDirty(PointLightBuffer::COLORS, dense);
+	MarkDirty(PointLightBuffer::RADII, dense);
 	return id;
 }
 
 //------------------------------------------------------------------------------
 /**
+	Removes the light by moving the last light in the dense arrays into its slot.
+	Only the moved light needs to be re-uploaded.
 */
 void
 DestroyPointLight(PointLightId id)
 {
-	assert(false);
-	// TODO: Need to add a hashtable to be able to remove lights, and still keep them packed.
+	uint32_t const dense = DenseIndex(id);
+	uint32_t const last = (uint32_t)pointLights.positions.size() - 1;
+
+	if (dense != last)
+	{
+		PointLightId const movedId = pointLights.ids[last];
+		pointLights.positions[dense] = pointLights.positions[last];
+		pointLights.colors[dense] = pointLights.colors[last];
+		pointLights.radii[dense] = pointLights.radii[last];
+		pointLights.ids[dense] = movedId;
+		pointLights.denseIndices[movedId.index] = dense;
+
+		MarkDirty(PointLightBuffer::POSITIONS, dense);
+		MarkDirty(PointLightBuffer::COLORS, dense);
+		MarkDirty(PointLightBuffer::RADII, dense);
+	}
+	pointLights.moves.push_back({ dense, last });
+
+	pointLights.positions.pop_back();
+	pointLights.colors.pop_back();
+	pointLights.radii.pop_back();
+	pointLights.ids.pop_back();
+	pointLights.denseIndices[id.index] = invalidDenseIndex;
+
 	pointLightPool.Deallocate(id);
 }
 
@@ -281,8 +724,9 @@ DestroyPointLight(PointLightId id)
 void 
 SetPosition(PointLightId id, glm::vec3 position)
 {
-	assert(IsValid(id));
-	pointLights.positions[id.index] = glm::vec4(position, 1);
+	uint32_t const dense = DenseIndex(id);
+	pointLights.positions[dense] = glm::vec4(position, 1);
+	MarkDirty(PointLightBuffer::POSITIONS, dense);
 }
 
 //------------------------------------------------------------------------------
@@ -291,8 +735,7 @@ SetPosition(PointLightId id, glm::vec3 position)
 glm::vec3 
 GetPosition(PointLightId id)
 {
-	assert(IsValid(id));
-	return pointLights.positions[id.index];
+	return pointLights.positions[DenseIndex(id)];
 }
 
 //------------------------------------------------------------------------------
@@ -301,8 +744,9 @@ GetPosition(PointLightId id)
 void 
 SetColorAndIntensity(PointLightId id, glm::vec3 color, float intensity)
 {
-	assert(IsValid(id));
-	pointLights.colors[id.index] = glm::vec4(color, 1) * intensity;
+	uint32_t const dense = DenseIndex(id);
+	pointLights.colors[dense] = glm::vec4(color, 1) * intensity;
+	MarkDirty(PointLightBuffer::COLORS, dense);
 }
 
 //------------------------------------------------------------------------------
@@ -311,8 +755,7 @@ SetColorAndIntensity(PointLightId id, glm::vec3 color, float intensity)
 glm::vec3 
 GetColorAndIntensity(PointLightId id)
 {
-	assert(IsValid(id));
-	return pointLights.colors[id.index];
+	return pointLights.colors[DenseIndex(id)];
 }
 
 //------------------------------------------------------------------------------
@@ -321,8 +764,9 @@ GetColorAndIntensity(PointLightId id)
 void 
 SetRadius(PointLightId id, float radius)
 {
-	assert(IsValid(id));
-	pointLights.radii[id.index] = radius;
+	uint32_t const dense = DenseIndex(id);
+	pointLights.radii[dense] = radius;
+	MarkDirty(PointLightBuffer::RADII, dense);
 }
 
 //------------------------------------------------------------------------------
@@ -331,8 +775,7 @@ SetRadius(PointLightId id, float radius)
 float 
 GetRadius(PointLightId id)
 {
-	assert(IsValid(id));
-	return pointLights.radii[id.index];
+	return pointLights.radii[DenseIndex(id)];
 }
 
 //------------------------------------------------------------------------------
@@ -344,6 +787,24 @@ GetNumPointLights()
 	return pointLights.positions.size();
 }
 
+//------------------------------------------------------------------------------
+/**
+*/
+size_t
+GetNumVisiblePointLights()
+{
+	return visiblePointLights.numInFrustum;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+size_t
+GetNumUploadedPointLights()
+{
+	return visiblePointLights.indices.size();
+}
+
 //------------------------------------------------------------------------------
 /**
 */
@@ -353,13 +814,171 @@ GetGlobalShadowMapHandle()
 	return globalShadowMap;
 }
 
+//------------------------------------------------------------------------------
+/**
+	Each cascade is fitted with a bounding sphere around its slice of the
+	main camera frustum, so its size doesn't change when the camera rotates.
+	The center is snapped to whole texels in light space, which keeps the
+	shadow edges from shimmering when the camera moves.
+
+	With the shadow cache enabled, the cascades are padded by the cache
+	threshold and only moved once the camera has moved further than that,
+	so the cached static casters stay valid in between.
+*/
+void
+UpdateShadowCascades()
+{
+	uint const count = (uint)glm::clamp(Core::CVarReadInt(r_shadow_cascades), 2, (int)MaxShadowCascades);
+	uint const interval = (uint)glm::max(Core::CVarReadInt(r_shadow_cascade_interval), 1);
+	bool const caching = IsShadowCacheEnabled();
+	// at most a quarter of the map on each side goes to padding
+	float const threshold = caching ? glm::clamp((float)Core::CVarReadInt(r_shadow_cache_threshold), 0.0f, shadowMapSize * 0.25f) : 0.0f;
+	glm::vec3 const lightDirection = glm::normalize(globalLightDirection);
+	bool const refitAll = count != numShadowCascades || lightDirection != shadowLightDirection;
+	numShadowCascades = count;
+	shadowLightDirection = lightDirection;
+
+	Camera const* const mainCamera = CameraManager::GetRenderCamera(CAMERA_MAIN);
+	glm::mat4 const& projection = mainCamera->projection;
+	float const nearZ = projection[3][2] / (projection[2][2] - 1.0f);
+	float const farZ = projection[3][2] / (projection[2][2] + 1.0f);
+	float const shadowFar = glm::clamp(Core::CVarReadFloat(r_shadow_distance), nearZ, farZ);
+
+	// corners of the near and far plane in world space
+	glm::vec3 nearCorners[4];
+	glm::vec3 farCorners[4];
+	for (int i = 0; i < 4; i++)
+	{
+		glm::vec2 const ndc = glm::vec2((i & 1) ? 1.0f : -1.0f, (i & 2) ? 1.0f : -1.0f);
+		glm::vec4 n = mainCamera->invViewProjection * glm::vec4(ndc, -1.0f, 1.0f);
+		glm::vec4 f = mainCamera->invViewProjection * glm::vec4(ndc, 1.0f, 1.0f);
+		nearCorners[i] = glm::vec3(n) / n.w;
+		farCorners[i] = glm::vec3(f) / f.w;
+	}
+
+	glm::vec3 const up = glm::abs(lightDirection.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+	glm::mat4 const lightView = glm::lookAt(glm::vec3(0.0f), -lightDirection, up);
+
+	float splitNear = nearZ;
+	for (uint i = 0; i < count; i++)
+	{
+		ShadowCascade& cascade = shadowCascades[i];
+
+		// practical split scheme
+		float const t = (float)(i + 1) / (float)count;
+		float const logSplit = nearZ * powf(shadowFar / nearZ, t);
+		float const uniformSplit = nearZ + (shadowFar - nearZ) * t;
+		float const splitFar = glm::mix(uniformSplit, logSplit, shadowSplitLambda);
+
+		// the first two cascades are always updated, the rest take turns
+		cascade.update = refitAll || i < 2 || (shadowFrameIndex % interval) == ((i - 2) % interval);
+		if (cascade.update)
+		{
+			// view depth is linear along the corner rays
+			float const t0 = (splitNear - nearZ) / (farZ - nearZ);
+			float const t1 = (splitFar - nearZ) / (farZ - nearZ);
+			glm::vec3 corners[8];
+			glm::vec3 center = glm::vec3(0.0f);
+			for (int c = 0; c < 4; c++)
+			{
+				corners[c] = glm::mix(nearCorners[c], farCorners[c], t0);
+				corners[c + 4] = glm::mix(nearCorners[c], farCorners[c], t1);
+				center += corners[c] + corners[c + 4];
+			}
+			center /= 8.0f;
+
+			float radius = 0.0f;
+			for (glm::vec3 const& corner : corners)
+				radius = glm::max(radius, glm::distance(corner, center));
+			radius = ceilf(radius * 16.0f) / 16.0f;
+
+			// r' = r + threshold * 2r' / size
+			float const paddedRadius = radius / (1.0f - 2.0f * threshold / (float)shadowMapSize);
+			glm::vec3 lightSpaceCenter = glm::vec3(lightView * glm::vec4(center, 1.0f));
+			float const texelSize = 2.0f * paddedRadius / (float)shadowMapSize;
+			lightSpaceCenter.x = floorf(lightSpaceCenter.x / texelSize) * texelSize;
+			lightSpaceCenter.y = floorf(lightSpaceCenter.y / texelSize) * texelSize;
+
+			bool const hold = caching && !refitAll
+				&& cascade.fitRadius == paddedRadius
+				&& glm::distance(lightSpaceCenter, cascade.fitCenter) <= threshold * texelSize;
+
+			cascade.moved = !hold;
+			if (!hold)
+			{
+				cascade.view = lightView;
+				cascade.fitCenter = lightSpaceCenter;
+				cascade.fitRadius = paddedRadius;
+				cascade.boundsMin = lightSpaceCenter - glm::vec3(paddedRadius);
+				cascade.boundsMax = lightSpaceCenter + glm::vec3(paddedRadius);
+				cascade.UpdateProjection();
+			}
+			cascade.splitFar = splitFar;
+		}
+		splitNear = splitFar;
+	}
+
+	for (uint i = count; i < MaxShadowCascades; i++)
+		shadowCascades[i].update = false;
+
+	shadowFrameIndex++;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+bool
+IsShadowCacheEnabled()
+{
+	return Core::CVarReadInt(r_shadow_cache) > 0;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+uint
+GetNumShadowCascades()
+{
+	return numShadowCascades;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+ShadowCascade&
+GetShadowCascade(uint cascade)
+{
+	n_assert(cascade < MaxShadowCascades);
+	return shadowCascades[cascade];
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+GLuint
+GetShadowCascadeFramebuffer(uint cascade)
+{
+	n_assert(cascade < MaxShadowCascades);
+	return shadowCascadeFrameBuffers[cascade];
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+GLuint
+GetStaticShadowCacheHandle()
+{
+	return staticShadowCache;
+}
+
 //------------------------------------------------------------------------------
 /**
 */
 GLuint
-GetGlobalShadowFramebuffer()
+GetStaticShadowCacheFramebuffer(uint cascade)
 {
-	return globalShadowFrameBuffer;
+	n_assert(cascade < MaxShadowCascades);
+	return staticShadowCacheFrameBuffers[cascade];
 }
 
 //------------------------------------------------------------------------------
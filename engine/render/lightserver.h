@@ -12,8 +12,6 @@
 #include "lightsources.h"
 #include <vector>
 
-#define CAMERA_SHADOW uint('GSHW')
-
 namespace Render
 {
 
@@ -23,18 +21,59 @@ namespace LightServer
 	extern glm::vec3 globalLightDirection;
 	extern glm::vec3 globalLightColor;
 
+	constexpr uint MaxShadowCascades = 4;
+
+	//------------------------------------------------------------------------------
+	/**
+		Orthographic shadow map fitted to a depth slice of the main camera frustum.
+		The bounds are in light space (looking down -z), so casters between the
+		light and the slice can be added by raising boundsMax.z.
+	*/
+	struct ShadowCascade
+	{
+		/// light space rotation, the same for all cascades
+		glm::mat4 view = glm::mat4(1.0f);
+		glm::mat4 projection = glm::mat4(1.0f);
+		glm::mat4 viewProjection = glm::mat4(1.0f);
+		glm::vec3 boundsMin = glm::vec3(0.0f);
+		glm::vec3 boundsMax = glm::vec3(0.0f);
+		/// view depth where the slice ends
+		float splitFar = 0.0f;
+		/// true if the cascade is refitted and rendered this frame
+		bool update = false;
+		/// true if the cascade was moved this frame, which invalidates the static caster cache
+		bool moved = true;
+		/// snapped light space center and padded radius of the placement
+		glm::vec3 fitCenter = glm::vec3(0.0f);
+		float fitRadius = 0.0f;
+		/// hash of the static casters in the static caster cache
+		uint64_t staticHash = 0;
+
+		void UpdateProjection()
+		{
+			this->projection = glm::ortho(this->boundsMin.x, this->boundsMax.x, this->boundsMin.y, this->boundsMax.y, -this->boundsMax.z, -this->boundsMin.z);
+			this->viewProjection = this->projection * this->view;
+		}
+	};
+
 	enum class PointLightBuffer
 	{
 		POSITIONS,
 		COLORS,
 		RADII,
-		VISIBLE_INDICES,
+		CLUSTER_LIGHTS,		// offset and count into CLUSTER_INDICES for every cluster
+		CLUSTER_INDICES,	// packed light indices of all clusters
 		NUM_BUFFERS
 	};
 
 	void Initialize();
-	void UpdateWorkGroups(uint resolutionWidth, uint resolutionHeight);
+	void UpdateClusterGrid(uint resolutionWidth, uint resolutionHeight);
+	/// copy the lights that changed to the render thread. Called by RenderDevice while the render thread is idle.
+	void SyncRenderThread();
+	/// select the point lights to render this frame, and upload the ones that changed
 	void OnBeforeRender();
+	/// assign point lights to the clusters of the main camera and upload the lists
+	void BuildClusters();
 	void Update(Render::ShaderProgramId pid);
 
 	void BindPointLightBuffers();
@@ -53,14 +92,26 @@ namespace LightServer
     float GetRadius(PointLightId id);
 
 	GLuint GetBuffer(PointLightBuffer buf);
-	
-	GLuint GetWorkGroupsX();
-	GLuint GetWorkGroupsY();
 
 	size_t GetNumPointLights();
+	/// number of point lights in the main camera frustum, and how many of them fit in the r_light_budget
+	size_t GetNumVisiblePointLights();
+	size_t GetNumUploadedPointLights();
+
+	/// fit the shadow cascades to the main camera and decide which of them are rendered this frame
+	void UpdateShadowCascades();
+	/// true if static casters are rendered into a separate cache that dynamic casters are composited on
+	bool IsShadowCacheEnabled();
+	uint GetNumShadowCascades();
+	ShadowCascade& GetShadowCascade(uint cascade);
 
+	/// texture array with one layer per cascade
 	GLuint GetGlobalShadowMapHandle();
-	GLuint GetGlobalShadowFramebuffer();
+	GLuint GetShadowCascadeFramebuffer(uint cascade);
+	/// texture array with the static casters of each cascade
+	GLuint GetStaticShadowCacheHandle();
+	GLuint GetStaticShadowCacheFramebuffer(uint cascade);
+	/// size of each cascade in texels
 	uint GetShadowMapSize();
 
 };
@@ -0,0 +1,692 @@
+//------------------------------------------------------------------------------
+//  @file meshprocessing.cc
+//  @copyright (C) 2022 Individual contributors, see AUTHORS file
+//------------------------------------------------------------------------------
+#include "config.h"
+#include "meshprocessing.h"
+#include <unordered_map>
+#include <queue>
+#include <algorithm>
+#include <cstring>
+#include <cfloat>
+
+namespace Render
+{
+namespace MeshProcessing
+{
+
+/// boundary edges are kept in place by planes perpendicular to their triangle, weighted by this much
+static constexpr double BoundaryWeight = 10.0;
+/// size of the LRU vertex cache that OptimizeVertexCache optimizes for
+static constexpr int32_t CacheSize = 32;
+/// size of the FIFO vertex cache that OptimizeOverdraw splits clusters with
+static constexpr uint32_t ClusterCacheSize = 16;
+
+//------------------------------------------------------------------------------
+/**
+    Symmetric 4x4 matrix that sums the squared distances to a set of weighted planes.
+*/
+struct Quadric
+{
+    double a00 = 0, a01 = 0, a02 = 0, a03 = 0;
+    double a11 = 0, a12 = 0, a13 = 0;
+    double a22 = 0, a23 = 0;
+    double a33 = 0;
+    double weight = 0;
+};
+
+//------------------------------------------------------------------------------
+/**
+*/
+static Quadric
+PlaneQuadric(glm::dvec3 const& n, double d, double w)
+{
+    Quadric q;
+    q.a00 = w * n.x * n.x; q.a01 = w * n.x * n.y; q.a02 = w * n.x * n.z; q.a03 = w * n.x * d;
+    q.a11 = w * n.y * n.y; q.a12 = w * n.y * n.z; q.a13 = w * n.y * d;
+    q.a22 = w * n.z * n.z; q.a23 = w * n.z * d;
+    q.a33 = w * d * d;
+    q.weight = w;
+    return q;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+static void
+QuadricAdd(Quadric& q, Quadric const& r)
+{
+    q.a00 += r.a00; q.a01 += r.a01; q.a02 += r.a02; q.a03 += r.a03;
+    q.a11 += r.a11; q.a12 += r.a12; q.a13 += r.a13;
+    q.a22 += r.a22; q.a23 += r.a23;
+    q.a33 += r.a33;
+    q.weight += r.weight;
+}
+
+//------------------------------------------------------------------------------
+/**
+    Weighted mean squared distance from v to the planes of the quadric.
+*/
+static double
+QuadricError(Quadric const& q, glm::dvec3 const& v)
+{
+    double const rx = q.a00 * v.x + q.a01 * v.y + q.a02 * v.z + q.a03;
+    double const ry = q.a01 * v.x + q.a11 * v.y + q.a12 * v.z + q.a13;
+    double const rz = q.a02 * v.x + q.a12 * v.y + q.a22 * v.z + q.a23;
+    double const rw = q.a03 * v.x + q.a13 * v.y + q.a23 * v.z + q.a33;
+    double const error = std::abs(rx * v.x + ry * v.y + rz * v.z + rw);
+    return q.weight > 0.0 ? error / q.weight : 0.0;
+}
+
+//------------------------------------------------------------------------------
+/**
+    Moves vertex 'from' onto vertex 'to'. The versions are used to throw away
+    collapses that were queued before either vertex changed.
+*/
+struct Collapse
+{
+    double error;
+    uint32_t from;
+    uint32_t to;
+    uint32_t fromVersion;
+    uint32_t toVersion;
+
+    bool operator>(Collapse const& rhs) const { return this->error > rhs.error; }
+};
+
+//------------------------------------------------------------------------------
+/**
+*/
+struct PositionKey
+{
+    uint32_t bits[3];
+    bool operator==(PositionKey const& rhs) const { return memcmp(this->bits, rhs.bits, sizeof(this->bits)) == 0; }
+};
+
+struct PositionKeyHash
+{
+    size_t operator()(PositionKey const& key) const
+    {
+        return (key.bits[0] * 73856093u) ^ (key.bits[1] * 19349663u) ^ (key.bits[2] * 83492791u);
+    }
+};
+
+//------------------------------------------------------------------------------
+/**
+    Vertices that share a position are welded before simplifying, so that
+    texture seams and hard edges are treated as a connected surface. The
+    output keeps the original vertex of every corner that wasn't collapsed,
+    and uses the first vertex at the target position for the ones that were.
+*/
+size_t
+Simplify(
+    uint32_t* outIndices,
+    uint32_t const* indices,
+    size_t numIndices,
+    void const* positions,
+    size_t numVertices,
+    size_t positionStride,
+    size_t targetIndexCount,
+    float targetError,
+    float* outError)
+{
+    n_assert(numIndices % 3 == 0);
+    if (outError != nullptr)
+        *outError = 0.0f;
+
+    if (targetIndexCount >= numIndices || numVertices == 0)
+    {
+        memcpy(outIndices, indices, numIndices * sizeof(uint32_t));
+        return numIndices;
+    }
+
+    // weld vertices with identical positions
+    std::vector<uint32_t> remap(numVertices);
+    std::vector<uint32_t> representative;
+    std::vector<glm::dvec3> points;
+    {
+        std::unordered_map<PositionKey, uint32_t, PositionKeyHash> welded;
+        welded.reserve(numVertices);
+        for (size_t v = 0; v < numVertices; v++)
+        {
+            glm::vec3 p;
+            memcpy(&p, (uint8_t const*)positions + v * positionStride, sizeof(p));
+            PositionKey key;
+            memcpy(key.bits, &p, sizeof(key.bits));
+            auto const result = welded.emplace(key, (uint32_t)points.size());
+            if (result.second)
+            {
+                representative.push_back((uint32_t)v);
+                points.push_back(glm::dvec3(p));
+            }
+            remap[v] = result.first->second;
+        }
+    }
+    uint32_t const numPoints = (uint32_t)points.size();
+
+    // work in a unit box so that errors are relative to the mesh size
+    glm::dvec3 boundsMin = points[0];
+    glm::dvec3 boundsMax = points[0];
+    for (glm::dvec3 const& p : points)
+    {
+        boundsMin = glm::min(boundsMin, p);
+        boundsMax = glm::max(boundsMax, p);
+    }
+    glm::dvec3 const extents = boundsMax - boundsMin;
+    double const extent = glm::max(glm::max(extents.x, extents.y), glm::max(extents.z, 1e-12));
+    for (glm::dvec3& p : points)
+        p = (p - boundsMin) / extent;
+
+    // triangles in welded vertices, next to the original vertex of every corner
+    std::vector<uint32_t> triangles;
+    std::vector<uint32_t> corners;
+    triangles.reserve(numIndices);
+    corners.reserve(numIndices);
+    for (size_t i = 0; i < numIndices; i += 3)
+    {
+        uint32_t const a = remap[indices[i]];
+        uint32_t const b = remap[indices[i + 1]];
+        uint32_t const c = remap[indices[i + 2]];
+        if (a == b || b == c || c == a)
+            continue;
+
+        triangles.insert(triangles.end(), { a, b, c });
+        corners.insert(corners.end(), { indices[i], indices[i + 1], indices[i + 2] });
+    }
+    uint32_t const numTriangles = (uint32_t)(triangles.size() / 3);
+
+    // plane quadrics weighted by triangle area
+    std::vector<Quadric> quadrics(numPoints);
+    std::vector<glm::dvec3> normals(numTriangles);
+    for (uint32_t t = 0; t < numTriangles; t++)
+    {
+        glm::dvec3 const& p0 = points[triangles[t * 3]];
+        glm::dvec3 const& p1 = points[triangles[t * 3 + 1]];
+        glm::dvec3 const& p2 = points[triangles[t * 3 + 2]];
+        glm::dvec3 const n = glm::cross(p1 - p0, p2 - p0);
+        double const length = glm::length(n);
+        if (length <= 0.0)
+            continue;
+
+        normals[t] = n / length;
+        Quadric const q = PlaneQuadric(normals[t], -glm::dot(normals[t], p0), length * 0.5);
+        for (uint32_t k = 0; k < 3; k++)
+            QuadricAdd(quadrics[triangles[t * 3 + k]], q);
+    }
+
+    // edges without a twin are on the boundary of the mesh
+    auto const EdgeKey = [](uint32_t a, uint32_t b) { return ((uint64_t)a << 32) | b; };
+    std::unordered_map<uint64_t, uint32_t> edges;
+    edges.reserve(triangles.size());
+    for (uint32_t t = 0; t < numTriangles; t++)
+        for (uint32_t k = 0; k < 3; k++)
+            edges.emplace(EdgeKey(triangles[t * 3 + k], triangles[t * 3 + (k + 1) % 3]), t);
+
+    for (uint32_t t = 0; t < numTriangles; t++)
+    {
+        for (uint32_t k = 0; k < 3; k++)
+        {
+            uint32_t const a = triangles[t * 3 + k];
+            uint32_t const b = triangles[t * 3 + (k + 1) % 3];
+            if (edges.count(EdgeKey(b, a)) != 0)
+                continue;
+
+            glm::dvec3 const edge = points[b] - points[a];
+            glm::dvec3 const n = glm::cross(edge, normals[t]);
+            double const length = glm::length(n);
+            if (length <= 0.0)
+                continue;
+
+            Quadric const q = PlaneQuadric(n / length, -glm::dot(n / length, points[a]), glm::dot(edge, edge) * BoundaryWeight);
+            QuadricAdd(quadrics[a], q);
+            QuadricAdd(quadrics[b], q);
+        }
+    }
+
+    std::vector<std::vector<uint32_t>> vertexTriangles(numPoints);
+    for (uint32_t t = 0; t < numTriangles; t++)
+        for (uint32_t k = 0; k < 3; k++)
+            vertexTriangles[triangles[t * 3 + k]].push_back(t);
+
+    std::vector<uint32_t> versions(numPoints, 0);
+    std::vector<uint8_t> removedVertices(numPoints, 0);
+    std::vector<uint8_t> removedTriangles(numTriangles, 0);
+
+    std::priority_queue<Collapse, std::vector<Collapse>, std::greater<Collapse>> queue;
+    auto const QueueEdge = [&](uint32_t a, uint32_t b)
+    {
+        Quadric q = quadrics[a];
+        QuadricAdd(q, quadrics[b]);
+        queue.push({ QuadricError(q, points[b]), a, b, versions[a], versions[b] });
+        queue.push({ QuadricError(q, points[a]), b, a, versions[b], versions[a] });
+    };
+
+    for (auto const& edge : edges)
+    {
+        uint32_t const a = (uint32_t)(edge.first >> 32);
+        uint32_t const b = (uint32_t)edge.first;
+        if (a < b || edges.count(EdgeKey(b, a)) == 0)
+            QueueEdge(a, b);
+    }
+
+    size_t const targetTriangles = targetIndexCount / 3;
+    double const maxError = (double)targetError * (double)targetError;
+    double resultError = 0.0;
+    size_t liveTriangles = numTriangles;
+    std::vector<uint32_t> neighbours;
+
+    while (liveTriangles > targetTriangles && !queue.empty())
+    {
+        Collapse const collapse = queue.top();
+        queue.pop();
+
+        uint32_t const from = collapse.from;
+        uint32_t const to = collapse.to;
+        if (removedVertices[from] || removedVertices[to] ||
+            versions[from] != collapse.fromVersion || versions[to] != collapse.toVersion)
+            continue;
+
+        if (collapse.error > maxError)
+            break;
+
+        // reject collapses that flip or squash any of the triangles that are kept
+        bool valid = true;
+        for (uint32_t t : vertexTriangles[from])
+        {
+            if (removedTriangles[t])
+                continue;
+
+            uint32_t const* tri = &triangles[t * 3];
+            if (tri[0] == to || tri[1] == to || tri[2] == to)
+                continue;
+
+            glm::dvec3 p[3];
+            for (uint32_t k = 0; k < 3; k++)
+                p[k] = points[tri[k] == from ? to : tri[k]];
+
+            glm::dvec3 const n = glm::cross(p[1] - p[0], p[2] - p[0]);
+            double const length = glm::length(n);
+            if (length <= 0.0 || glm::dot(n / length, normals[t]) < 0.25)
+            {
+                valid = false;
+                break;
+            }
+        }
+        if (!valid)
+            continue;
+
+        for (uint32_t t : vertexTriangles[from])
+        {
+            if (removedTriangles[t])
+                continue;
+
+            uint32_t* tri = &triangles[t * 3];
+            if (tri[0] == to || tri[1] == to || tri[2] == to)
+            {
+                removedTriangles[t] = 1;
+                liveTriangles--;
+                continue;
+            }
+
+            for (uint32_t k = 0; k < 3; k++)
+                if (tri[k] == from)
+                    tri[k] = to;
+            glm::dvec3 const n = glm::cross(points[tri[1]] - points[tri[0]], points[tri[2]] - points[tri[0]]);
+            normals[t] = glm::normalize(n);
+            vertexTriangles[to].push_back(t);
+        }
+
+        QuadricAdd(quadrics[to], quadrics[from]);
+        removedVertices[from] = 1;
+        vertexTriangles[from].clear();
+        versions[to]++;
+        resultError = glm::max(resultError, collapse.error);
+
+        // drop dead triangles and requeue every edge of the merged vertex
+        std::vector<uint32_t>& adjacent = vertexTriangles[to];
+        adjacent.erase(std::remove_if(adjacent.begin(), adjacent.end(), [&removedTriangles](uint32_t t) { return removedTriangles[t] != 0; }), adjacent.end());
+
+        neighbours.clear();
+        for (uint32_t t : adjacent)
+            for (uint32_t k = 0; k < 3; k++)
+                if (triangles[t * 3 + k] != to)
+                    neighbours.push_back(triangles[t * 3 + k]);
+        std::sort(neighbours.begin(), neighbours.end());
+        neighbours.erase(std::unique(neighbours.begin(), neighbours.end()), neighbours.end());
+        for (uint32_t n : neighbours)
+            QueueEdge(to, n);
+    }
+
+    size_t numOut = 0;
+    for (uint32_t t = 0; t < numTriangles; t++)
+    {
+        if (removedTriangles[t])
+            continue;
+
+        for (uint32_t k = 0; k < 3; k++)
+        {
+            uint32_t const vertex = triangles[t * 3 + k];
+            uint32_t const corner = corners[t * 3 + k];
+            outIndices[numOut++] = remap[corner] == vertex ? corner : representative[vertex];
+        }
+    }
+
+    if (outError != nullptr)
+        *outError = (float)glm::sqrt(resultError);
+    return numOut;
+}
+
+//------------------------------------------------------------------------------
+/**
+    Forsyth's vertex score. Vertices that were used recently score higher, and
+    vertices with few triangles left get a boost so that lone triangles are
+    cleaned up before they end up far away from their neighbours.
+*/
+static float
+VertexScore(int32_t cachePosition, uint32_t remainingTriangles)
+{
+    if (remainingTriangles == 0)
+        return -1.0f;
+
+    float score = 0.0f;
+    if (cachePosition >= 0)
+    {
+        // the last triangle gets a fixed score, otherwise strips would be favoured too much
+        if (cachePosition < 3)
+            score = 0.75f;
+        else
+            score = powf(1.0f - (float)(cachePosition - 3) / (float)(CacheSize - 3), 1.5f);
+    }
+    score += 2.0f * powf((float)remainingTriangles, -0.5f);
+    return score;
+}
+
+//------------------------------------------------------------------------------
+/**
+    Greedily adds the triangle with the highest score. Only the triangles of
+    the vertices in the cache change score, so they are the only candidates,
+    and when none of them are left the next triangle in input order is used.
+*/
+void
+OptimizeVertexCache(uint32_t* outIndices, uint32_t const* indices, size_t numIndices, size_t numVertices)
+{
+    n_assert(numIndices % 3 == 0);
+    n_assert(outIndices != indices);
+    size_t const numTriangles = numIndices / 3;
+    if (numTriangles == 0)
+        return;
+
+    // triangles of every vertex. The triangles that are left are kept first in every list.
+    std::vector<uint32_t> offsets(numVertices + 1, 0);
+    for (size_t i = 0; i < numIndices; i++)
+        offsets[indices[i] + 1]++;
+    for (size_t v = 0; v < numVertices; v++)
+        offsets[v + 1] += offsets[v];
+
+    std::vector<uint32_t> remaining(numVertices, 0);
+    std::vector<uint32_t> vertexTriangles(numIndices);
+    for (size_t i = 0; i < numIndices; i++)
+    {
+        uint32_t const v = indices[i];
+        vertexTriangles[offsets[v] + remaining[v]++] = (uint32_t)(i / 3);
+    }
+
+    std::vector<int32_t> cachePositions(numVertices, -1);
+    std::vector<float> vertexScores(numVertices);
+    for (size_t v = 0; v < numVertices; v++)
+        vertexScores[v] = VertexScore(-1, remaining[v]);
+
+    std::vector<float> triangleScores(numTriangles);
+    for (size_t t = 0; t < numTriangles; t++)
+        triangleScores[t] = vertexScores[indices[t * 3]] + vertexScores[indices[t * 3 + 1]] + vertexScores[indices[t * 3 + 2]];
+
+    auto const Rescore = [&](uint32_t v, int32_t cachePosition)
+    {
+        cachePositions[v] = cachePosition;
+        float const score = VertexScore(cachePosition, remaining[v]);
+        float const delta = score - vertexScores[v];
+        vertexScores[v] = score;
+        for (uint32_t i = 0; i < remaining[v]; i++)
+            triangleScores[vertexTriangles[offsets[v] + i]] += delta;
+    };
+
+    std::vector<uint8_t> emitted(numTriangles, 0);
+    uint32_t cache[CacheSize + 3];
+    uint32_t cacheCount = 0;
+    size_t cursor = 0;
+    int64_t best = -1;
+
+    for (size_t out = 0; out < numTriangles; out++)
+    {
+        if (best < 0)
+        {
+            while (emitted[cursor])
+                cursor++;
+            best = (int64_t)cursor;
+        }
+
+        uint32_t const* tri = &indices[best * 3];
+        outIndices[out * 3] = tri[0];
+        outIndices[out * 3 + 1] = tri[1];
+        outIndices[out * 3 + 2] = tri[2];
+        emitted[best] = 1;
+
+        for (uint32_t k = 0; k < 3; k++)
+        {
+            uint32_t const v = tri[k];
+            uint32_t* list = &vertexTriangles[offsets[v]];
+            for (uint32_t i = 0; i < remaining[v]; i++)
+            {
+                if (list[i] == (uint32_t)best)
+                {
+                    std::swap(list[i], list[remaining[v] - 1]);
+                    remaining[v]--;
+                    break;
+                }
+            }
+        }
+
+        // the triangle goes first, followed by the rest of the cache in order
+        uint32_t newCache[CacheSize + 3];
+        uint32_t newCount = 0;
+        for (uint32_t k = 0; k < 3; k++)
+            if (std::find(newCache, newCache + newCount, tri[k]) == newCache + newCount)
+                newCache[newCount++] = tri[k];
+        for (uint32_t i = 0; i < cacheCount; i++)
+            if (cache[i] != tri[0] && cache[i] != tri[1] && cache[i] != tri[2])
+                newCache[newCount++] = cache[i];
+
+        for (uint32_t i = CacheSize; i < newCount; i++)
+            Rescore(newCache[i], -1);
+
+        cacheCount = glm::min(newCount, (uint32_t)CacheSize);
+        memcpy(cache, newCache, cacheCount * sizeof(uint32_t));
+        for (uint32_t i = 0; i < cacheCount; i++)
+            Rescore(cache[i], (int32_t)i);
+
+        best = -1;
+        float bestScore = -FLT_MAX;
+        for (uint32_t i = 0; i < cacheCount; i++)
+        {
+            uint32_t const v = cache[i];
+            for (uint32_t j = 0; j < remaining[v]; j++)
+            {
+                uint32_t const t = vertexTriangles[offsets[v] + j];
+                if (triangleScores[t] > bestScore)
+                {
+                    bestScore = triangleScores[t];
+                    best = t;
+                }
+            }
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+    Sorting key of a cluster is the distance of its centroid from the mesh
+    centroid along the cluster's average normal, as in Sander et al. Clusters
+    on the outside of a convex-ish mesh come first and occlude the rest.
+*/
+void
+OptimizeOverdraw(
+    uint32_t* outIndices,
+    uint32_t const* indices,
+    size_t numIndices,
+    void const* positions,
+    size_t numVertices,
+    size_t positionStride)
+{
+    n_assert(numIndices % 3 == 0);
+    n_assert(outIndices != indices);
+    size_t const numTriangles = numIndices / 3;
+    if (numTriangles == 0)
+        return;
+
+    auto const Position = [positions, positionStride](uint32_t v)
+    {
+        glm::vec3 p;
+        memcpy(&p, (uint8_t const*)positions + v * positionStride, sizeof(p));
+        return p;
+    };
+
+    // a new cluster starts wherever a triangle misses the cache with every vertex
+    std::vector<uint32_t> clusterStarts = { 0 };
+    std::vector<uint32_t> timestamps(numVertices, 0);
+    uint32_t time = ClusterCacheSize + 1;
+    for (size_t t = 0; t < numTriangles; t++)
+    {
+        uint32_t misses = 0;
+        for (uint32_t k = 0; k < 3; k++)
+        {
+            uint32_t const v = indices[t * 3 + k];
+            if (time - timestamps[v] > ClusterCacheSize)
+            {
+                timestamps[v] = time++;
+                misses++;
+            }
+        }
+        if (misses == 3 && t > 0)
+            clusterStarts.push_back((uint32_t)t);
+    }
+    size_t const numClusters = clusterStarts.size();
+    clusterStarts.push_back((uint32_t)numTriangles);
+
+    struct Cluster
+    {
+        glm::vec3 centroid = glm::vec3(0.0f);
+        glm::vec3 normal = glm::vec3(0.0f);
+        float area = 0.0f;
+    };
+    std::vector<Cluster> clusters(numClusters);
+    glm::vec3 meshCentroid = glm::vec3(0.0f);
+    float meshArea = 0.0f;
+    for (size_t c = 0; c < numClusters; c++)
+    {
+        Cluster& cluster = clusters[c];
+        for (uint32_t t = clusterStarts[c]; t < clusterStarts[c + 1]; t++)
+        {
+            glm::vec3 const p0 = Position(indices[t * 3]);
+            glm::vec3 const p1 = Position(indices[t * 3 + 1]);
+            glm::vec3 const p2 = Position(indices[t * 3 + 2]);
+            glm::vec3 const n = glm::cross(p1 - p0, p2 - p0);
+            float const area = glm::length(n);
+            cluster.centroid += (p0 + p1 + p2) * (area / 3.0f);
+            cluster.normal += n;
+            cluster.area += area;
+        }
+        meshCentroid += cluster.centroid;
+        meshArea += cluster.area;
+        if (cluster.area > 0.0f)
+            cluster.centroid /= cluster.area;
+    }
+    if (meshArea > 0.0f)
+        meshCentroid /= meshArea;
+
+    std::vector<float> keys(numClusters);
+    for (size_t c = 0; c < numClusters; c++)
+    {
+        float const length = glm::length(clusters[c].normal);
+        keys[c] = length > 0.0f ? glm::dot(clusters[c].centroid - meshCentroid, clusters[c].normal / length) : 0.0f;
+    }
+
+    std::vector<uint32_t> order(numClusters);
+    for (size_t c = 0; c < numClusters; c++)
+        order[c] = (uint32_t)c;
+    std::stable_sort(order.begin(), order.end(), [&keys](uint32_t a, uint32_t b) { return keys[a] > keys[b]; });
+
+    size_t numOut = 0;
+    for (uint32_t c : order)
+    {
+        size_t const count = (clusterStarts[c + 1] - clusterStarts[c]) * 3;
+        memcpy(outIndices + numOut, indices + clusterStarts[c] * 3, count * sizeof(uint32_t));
+        numOut += count;
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+size_t
+OptimizeVertexFetch(uint32_t* remap, uint32_t const* indices, size_t numIndices, size_t numVertices)
+{
+    std::fill(remap, remap + numVertices, ~0u);
+    uint32_t next = 0;
+    for (size_t i = 0; i < numIndices; i++)
+    {
+        uint32_t const v = indices[i];
+        if (remap[v] == ~0u)
+            remap[v] = next++;
+    }
+    return next;
+}
+
+//------------------------------------------------------------------------------
+/**
+    A vertex is in the cache if fewer than cacheSize misses happened since it
+    was last loaded, which is exactly FIFO behaviour.
+*/
+float
+ComputeACMR(uint32_t const* indices, size_t numIndices, size_t numVertices, uint32_t cacheSize)
+{
+    if (numIndices < 3)
+        return 0.0f;
+
+    std::vector<uint32_t> timestamps(numVertices, 0);
+    uint32_t time = cacheSize + 1;
+    size_t misses = 0;
+    for (size_t i = 0; i < numIndices; i++)
+    {
+        uint32_t const v = indices[i];
+        if (time - timestamps[v] > cacheSize)
+        {
+            timestamps[v] = time++;
+            misses++;
+        }
+    }
+    return (float)misses / (float)(numIndices / 3);
+}
+
+//------------------------------------------------------------------------------
+/**
+    Projects the vector onto the octahedron |x| + |y| + |z| = 1 and folds the
+    lower half over the diagonals of the upper half.
+*/
+glm::vec2
+OctahedralEncode(glm::vec3 const& n)
+{
+    float const l1 = glm::abs(n.x) + glm::abs(n.y) + glm::abs(n.z);
+    if (l1 <= 0.0f)
+        return glm::vec2(0.0f);
+
+    glm::vec2 e = glm::vec2(n.x, n.y) / l1;
+    if (n.z < 0.0f)
+    {
+        glm::vec2 const sign = glm::vec2(e.x >= 0.0f ? 1.0f : -1.0f, e.y >= 0.0f ? 1.0f : -1.0f);
+        e = (1.0f - glm::abs(glm::vec2(e.y, e.x))) * sign;
+    }
+    return e;
+}
+
+} // namespace MeshProcessing
+} // namespace Render
@@ -0,0 +1,79 @@
+#pragma once
+//------------------------------------------------------------------------------
+/**
+    @file meshprocessing.h
+
+    Mesh processing that runs when models are imported.
+
+    Simplify builds lower detail versions of a triangle list with quadric error
+    edge collapses (Garland and Heckbert). Vertices are only ever collapsed onto
+    other existing vertices, so every level of detail indexes the same vertex
+    buffer and only needs its own index range.
+
+    OptimizeVertexCache reorders triangles for the post transform vertex cache
+    (Forsyth), OptimizeOverdraw reorders clusters of those triangles so that
+    surfaces facing outwards are drawn first, and OptimizeVertexFetch orders
+    the vertices by first use so that vertex fetches stay local.
+
+    OctahedralEncode maps unit vectors to the square [-1, 1]^2, for compressed
+    normals and tangents.
+
+    Has no GL dependencies, so it can run and be validated without a context.
+
+    @copyright
+    (C) 2022 Individual contributors, see AUTHORS file
+*/
+//------------------------------------------------------------------------------
+#include <vector>
+
+namespace Render
+{
+namespace MeshProcessing
+{
+
+/// Simplifies a triangle list until it has at most targetIndexCount indices,
+/// or until the next collapse would move the surface further than targetError.
+/// targetError is relative to the largest extent of the mesh.
+/// positions are read as vec3 from positions + vertex * positionStride (in bytes).
+/// Writes at most numIndices indices to outIndices and returns the number written.
+/// If outError is set, it receives the largest relative error of the collapses.
+size_t Simplify(
+    uint32_t* outIndices,
+    uint32_t const* indices,
+    size_t numIndices,
+    void const* positions,
+    size_t numVertices,
+    size_t positionStride,
+    size_t targetIndexCount,
+    float targetError,
+    float* outError = nullptr
+);
+
+/// Reorders the triangles of a triangle list to improve vertex cache hit rate.
+/// outIndices can not alias indices.
+void OptimizeVertexCache(uint32_t* outIndices, uint32_t const* indices, size_t numIndices, size_t numVertices);
+
+/// Splits a cache optimized triangle list into clusters where the vertex cache
+/// starts over anyway, and sorts the clusters so that outwards facing ones come
+/// first. Keeps most of the vertex cache efficiency. outIndices can not alias indices.
+void OptimizeOverdraw(
+    uint32_t* outIndices,
+    uint32_t const* indices,
+    size_t numIndices,
+    void const* positions,
+    size_t numVertices,
+    size_t positionStride
+);
+
+/// Writes the new position of every vertex to remap, in order of first use by indices.
+/// Unused vertices get ~0u. Returns the number of used vertices.
+size_t OptimizeVertexFetch(uint32_t* remap, uint32_t const* indices, size_t numIndices, size_t numVertices);
+
+/// average number of vertex transforms per triangle with a FIFO vertex cache of cacheSize entries
+float ComputeACMR(uint32_t const* indices, size_t numIndices, size_t numVertices, uint32_t cacheSize = 16);
+
+/// Octahedral encoding of a unit vector, in [-1, 1]. Decoded by OctahedralDecode in shd/vertexdecode.glsl.
+glm::vec2 OctahedralEncode(glm::vec3 const& n);
+
+} // namespace MeshProcessing
+} // namespace Render
@@ -6,6 +6,12 @@
 #include "model.h"
 #include "gltf.h"
 #include "textureresource.h"
+#include "glstate.h"
+#include "meshprocessing.h"
+#include "core/cvar.h"
+#include "core/framearena.h"
+#include "packing.hpp"
+#include "gtc/packing.hpp"
 
 #include "lightserver.h"
 
@@ -16,6 +22,10 @@ static uint nameCounter = 0;
 static std::vector<Model> modelAllocator;
 static std::unordered_map<std::string, ModelId> modelRegistry;
 
+static Core::CVar* r_mesh_overdraw = nullptr;
+static Core::CVar* r_mesh_compress = nullptr;
+static Core::CVar* r_mesh_verbose = nullptr;
+
 //------------------------------------------------------------------------------
 /**
 */
@@ -39,39 +49,400 @@ SlotFromGltf(std::string const& attr)
 //------------------------------------------------------------------------------
 /**
 */
+GLsizei
+ComponentSize(GLenum type)
+{
+	switch (type)
+	{
+	case GL_BYTE:
+	case GL_UNSIGNED_BYTE:
+		return 1;
+	case GL_SHORT:
+	case GL_UNSIGNED_SHORT:
+	case GL_HALF_FLOAT:
+		return 2;
+	case GL_INT:
+	case GL_UNSIGNED_INT:
+	case GL_FLOAT:
+		return 4;
+	default:
+		n_error("Unsupported component type!\n");
+		return 0;
+	}
+}
+
+//------------------------------------------------------------------------------
+/**
+	Finds the float positions of a primitive. Returns false if they are stored in another format.
+*/
+bool
+GetPositions(fx::gltf::Document const& doc, fx::gltf::Primitive const& primitive, uint8_t const*& positions, size_t& stride)
+{
+	fx::gltf::Accessor const& accessor = doc.accessors[primitive.attributes.at("POSITION")];
+	if (accessor.componentType != fx::gltf::Accessor::ComponentType::Float || accessor.type != fx::gltf::Accessor::Type::Vec3)
+		return false;
+
+	fx::gltf::BufferView const& bufferView = doc.bufferViews[accessor.bufferView];
+	positions = &doc.buffers[bufferView.buffer].data[bufferView.byteOffset + accessor.byteOffset];
+	stride = bufferView.byteStride != 0 ? bufferView.byteStride : sizeof(glm::vec3);
+	return true;
+}
+
+//------------------------------------------------------------------------------
+/**
+	Reads the indices of a primitive as 32 bit. Primitives without indices get a trivial index list.
+*/
 void
-InferBufferTargets(fx::gltf::Document& model)
+ReadIndices(fx::gltf::Document const& doc, fx::gltf::Primitive const& primitive, uint32_t numVertices, Core::ArenaVector<uint32_t>& indices)
 {
-    bool infer = false;
-	for (unsigned i = 0; i < model.bufferViews.size(); i++)
+	if (primitive.indices == -1)
 	{
-		bool br = false;
-		auto const& bufferView = model.bufferViews[i];
-		if (bufferView.target == fx::gltf::BufferView::TargetType::None)
-		{
-			infer = true;
+		indices.resize(numVertices);
+		for (uint32_t i = 0; i < numVertices; i++)
+			indices[i] = i;
+		return;
+	}
+
+	fx::gltf::Accessor const& accessor = doc.accessors[primitive.indices];
+	fx::gltf::BufferView const& bufferView = doc.bufferViews[accessor.bufferView];
+	uint8_t const* data = &doc.buffers[bufferView.buffer].data[bufferView.byteOffset + accessor.byteOffset];
+	indices.resize(accessor.count);
+	switch (accessor.componentType)
+	{
+	case fx::gltf::Accessor::ComponentType::UnsignedByte:
+		for (uint32_t i = 0; i < accessor.count; i++)
+			indices[i] = data[i];
+		break;
+	case fx::gltf::Accessor::ComponentType::UnsignedShort:
+		for (uint32_t i = 0; i < accessor.count; i++)
+			indices[i] = ((uint16_t const*)data)[i];
+		break;
+	case fx::gltf::Accessor::ComponentType::UnsignedInt:
+		memcpy(indices.data(), data, accessor.count * sizeof(uint32_t));
+		break;
+	default:
+		n_error("Unsupported index type!\n");
+		break;
+	}
+}
+
+//------------------------------------------------------------------------------
+/**
+	Simplifies the primitive with quadric edge collapses, halving the triangle
+	count for every lod. The chain stops early if a lod can't get meaningfully
+	smaller within its error budget. Lod indices are appended to indices, and
+	the lod offsets are counted in indices until the buffer is uploaded.
+*/
+void
+GenerateLods(fx::gltf::Document const& doc, fx::gltf::Primitive const& primitive, Model::Mesh::Primitive& p, Core::ArenaVector<uint32_t>& indices)
+{
+	// largest surface deviation of every lod, relative to the size of the primitive
+	static constexpr float LodErrors[Model::Mesh::Primitive::MaxLods] = { 0.0f, 0.02f, 0.04f, 0.08f };
+
+	size_t const numIndices = indices.size();
+	p.lods[0] = { (GLuint)numIndices, 0 };
+	p.numLods = 1;
+
+	uint8_t const* positions;
+	size_t stride;
+	if (!GetPositions(doc, primitive, positions, stride))
+		return;
+
+	uint32_t const numVertices = doc.accessors[primitive.attributes.at("POSITION")].count;
+	Core::ArenaVector<uint32_t> lodIndices(numIndices, indices.get_allocator());
+	// every lod has at most half the indices of the previous one, so all of them fit
+	indices.reserve(numIndices * 2);
+	for (uint lod = 1; lod < Model::Mesh::Primitive::MaxLods; lod++)
+	{
+		size_t const targetIndices = (numIndices >> lod) / 3 * 3;
+		size_t const count = MeshProcessing::Simplify(
+			lodIndices.data(), indices.data(), numIndices,
+			positions, numVertices, stride,
+			targetIndices, LodErrors[lod]
+		);
+		if (count == 0 || count > p.lods[lod - 1].numIndices * 9 / 10)
 			break;
+
+		p.lods[lod] = { (GLuint)count, (GLuint)indices.size() };
+		indices.insert(indices.end(), lodIndices.begin(), lodIndices.begin() + count);
+		p.numLods++;
+	}
+}
+
+//------------------------------------------------------------------------------
+/**
+	Reorders the triangles of every lod for the vertex cache, and optionally
+	for overdraw afterwards.
+*/
+void
+OptimizeIndices(fx::gltf::Document const& doc, fx::gltf::Primitive const& primitive, Model::Mesh::Primitive const& p, Core::ArenaVector<uint32_t>& indices, uint32_t numVertices, bool optimizeOverdraw)
+{
+	uint8_t const* positions;
+	size_t stride;
+	bool const hasPositions = GetPositions(doc, primitive, positions, stride);
+
+	Core::ArenaVector<uint32_t> optimized(p.lods[0].numIndices, indices.get_allocator());
+	for (uint lod = 0; lod < p.numLods; lod++)
+	{
+		uint32_t* lodIndices = &indices[p.lods[lod].offset];
+		size_t const count = p.lods[lod].numIndices;
+		MeshProcessing::OptimizeVertexCache(optimized.data(), lodIndices, count, numVertices);
+		if (optimizeOverdraw && hasPositions)
+			MeshProcessing::OptimizeOverdraw(lodIndices, optimized.data(), count, positions, numVertices, stride);
+		else
+			memcpy(lodIndices, optimized.data(), count * sizeof(uint32_t));
+	}
+}
+
+//------------------------------------------------------------------------------
+/**
+	Picks the compressed format of a float attribute. Normals and tangents are
+	only compressed together, since the shaders decode both or neither.
+*/
+void
+CompressAttribute(Model::VertexAttribute& attr, bool quantizePositions, bool octahedralNormals)
+{
+	if (attr.type != GL_FLOAT)
+		return;
+
+	if (attr.slot == 0 && attr.components == 3 && quantizePositions)
+	{
+		attr.encoding = Model::VertexAttribute::Encoding::QuantizedPosition;
+		attr.type = GL_UNSIGNED_SHORT;
+		attr.normalized = GL_TRUE;
+	}
+	else if (attr.slot == 1 && attr.components == 3 && octahedralNormals)
+	{
+		attr.encoding = Model::VertexAttribute::Encoding::Octahedral16;
+		attr.type = GL_SHORT;
+		attr.components = 2;
+		attr.normalized = GL_TRUE;
+	}
+	else if (attr.slot == 2 && attr.components == 4 && octahedralNormals)
+	{
+		attr.encoding = Model::VertexAttribute::Encoding::Octahedral8Signed;
+		attr.type = GL_BYTE;
+		attr.normalized = GL_TRUE;
+	}
+	else if ((attr.slot == 3 || attr.slot == 7 || attr.slot == 8) && attr.components == 2)
+	{
+		attr.encoding = Model::VertexAttribute::Encoding::Half;
+		attr.type = GL_HALF_FLOAT;
+	}
+}
+
+//------------------------------------------------------------------------------
+/**
+	Writes one element of an attribute in its encoding. src is the element as
+	stored in the gltf.
+*/
+void
+EncodeElement(Model::VertexAttribute const& attr, Model::Mesh::Primitive const& p, uint8_t const* src, GLsizei srcSize, uint8_t* dst)
+{
+	float v[4];
+	if (attr.encoding != Model::VertexAttribute::Encoding::None)
+		memcpy(v, src, srcSize);
+
+	switch (attr.encoding)
+	{
+	case Model::VertexAttribute::Encoding::None:
+		memcpy(dst, src, srcSize);
+		break;
+	case Model::VertexAttribute::Encoding::QuantizedPosition:
+	{
+		glm::vec3 const n = (glm::vec3(v[0], v[1], v[2]) - p.positionOffset) / p.positionScale;
+		uint16_t const q[3] = { glm::packUnorm1x16(n.x), glm::packUnorm1x16(n.y), glm::packUnorm1x16(n.z) };
+		memcpy(dst, q, sizeof(q));
+		break;
+	}
+	case Model::VertexAttribute::Encoding::Octahedral16:
+	{
+		uint32_t const q = glm::packSnorm2x16(MeshProcessing::OctahedralEncode(glm::vec3(v[0], v[1], v[2])));
+		memcpy(dst, &q, sizeof(q));
+		break;
+	}
+	case Model::VertexAttribute::Encoding::Octahedral8Signed:
+	{
+		glm::vec2 const e = MeshProcessing::OctahedralEncode(glm::vec3(v[0], v[1], v[2]));
+		uint32_t const q = glm::packSnorm4x8(glm::vec4(e, v[3] < 0.0f ? -1.0f : 1.0f, 0.0f));
+		memcpy(dst, &q, sizeof(q));
+		break;
+	}
+	case Model::VertexAttribute::Encoding::Half:
+	{
+		uint32_t const q = glm::packHalf2x16(glm::vec2(v[0], v[1]));
+		memcpy(dst, &q, sizeof(q));
+		break;
+	}
+	}
+}
+
+//------------------------------------------------------------------------------
+/**
+	Copies the attributes of a primitive into one vertex buffer, one tightly
+	packed stream per attribute, in the vertex order given by remap. With
+	compress set, float positions, normals, tangents and texture coordinates
+	are stored in the compressed encodings of Model::VertexAttribute. Sets up
+	the attribute pointers of the vao that is currently bound, and returns the
+	position attribute in position.
+*/
+GLuint
+UploadVertices(fx::gltf::Document const& doc, fx::gltf::Primitive const& primitive, Model::Mesh::Primitive& p, Core::ArenaVector<uint32_t> const& remap, uint32_t numUsedVertices, bool compress, Model::VertexAttribute& position)
+{
+	bool quantizePositions = false;
+	if (compress)
+	{
+		auto const IsFloatVector = [&doc, &primitive](char const* name, fx::gltf::Accessor::Type type)
+		{
+			auto const attribute = primitive.attributes.find(name);
+			if (attribute == primitive.attributes.end())
+				return false;
+			fx::gltf::Accessor const& accessor = doc.accessors[attribute->second];
+			return accessor.componentType == fx::gltf::Accessor::ComponentType::Float && accessor.type == type;
+		};
+		p.octahedralNormals = IsFloatVector("NORMAL", fx::gltf::Accessor::Type::Vec3) &&
+			(primitive.attributes.count("TANGENT") == 0 || IsFloatVector("TANGENT", fx::gltf::Accessor::Type::Vec4));
+
+		// quantization range of the positions that are actually used
+		uint8_t const* positions;
+		size_t stride;
+		if (GetPositions(doc, primitive, positions, stride))
+		{
+			glm::vec3 boundsMin = glm::vec3(FLT_MAX);
+			glm::vec3 boundsMax = glm::vec3(-FLT_MAX);
+			for (uint32_t v = 0; v < remap.size(); v++)
+			{
+				if (remap[v] == ~0u)
+					continue;
+				glm::vec3 position;
+				memcpy(&position, positions + v * stride, sizeof(position));
+				boundsMin = glm::min(boundsMin, position);
+				boundsMax = glm::max(boundsMax, position);
+			}
+			if (boundsMin.x <= boundsMax.x)
+			{
+				p.positionOffset = boundsMin;
+				p.positionScale = glm::max(boundsMax - boundsMin, glm::vec3(FLT_MIN));
+				quantizePositions = true;
+			}
 		}
 	}
 
-	if (infer)
-    {
-        // TODO: could be better
-        for (auto const& mesh : model.meshes)
-        {
-            for (auto const& primitive : mesh.primitives)
-            {
-                for (auto const& attr : primitive.attributes)
-                {
-                    auto const& accessor = model.accessors[attr.second];
-                    model.bufferViews[accessor.bufferView].target = (fx::gltf::BufferView::TargetType)GL_ARRAY_BUFFER;
-                }
-
-                auto const& accessor = model.accessors[primitive.indices];
-				model.bufferViews[accessor.bufferView].target = (fx::gltf::BufferView::TargetType)GL_ELEMENT_ARRAY_BUFFER;
-            }
-        }
-    }
+	Core::ArenaVector<uint8_t> vertexData(remap.get_allocator());
+	Core::ArenaVector<Model::VertexAttribute> attributes(remap.get_allocator());
+	for (auto const& attribute : primitive.attributes)
+	{
+		fx::gltf::Accessor const& accessor = doc.accessors[attribute.second];
+		n_assert((int)accessor.type > 0 && (int)accessor.type <= 4);
+
+		Model::VertexAttribute attr;
+		attr.slot = SlotFromGltf(attribute.first);
+		attr.type = (GLenum)accessor.componentType;
+		attr.components = (GLint)accessor.type;
+		attr.normalized = accessor.normalized;
+		GLsizei const srcSize = attr.components * ComponentSize(attr.type);
+
+		if (compress)
+			CompressAttribute(attr, quantizePositions, p.octahedralNormals);
+
+		// streams start at 4 byte aligned offsets
+		GLsizei const elementSize = attr.components * ComponentSize(attr.type);
+		attr.stride = (elementSize + 3) & ~3;
+		attr.offset = (GLsizei)vertexData.size();
+		attributes.push_back(attr);
+		if (attr.slot == 0)
+			position = attr;
+
+		fx::gltf::BufferView const& bufferView = doc.bufferViews[accessor.bufferView];
+		uint8_t const* src = &doc.buffers[bufferView.buffer].data[bufferView.byteOffset + accessor.byteOffset];
+		size_t const srcStride = bufferView.byteStride != 0 ? bufferView.byteStride : srcSize;
+
+		vertexData.resize(vertexData.size() + (size_t)attr.stride * numUsedVertices, 0);
+		uint8_t* dst = &vertexData[attr.offset];
+		for (uint32_t v = 0; v < accessor.count && v < remap.size(); v++)
+		{
+			if (remap[v] != ~0u)
+				EncodeElement(attr, p, src + v * srcStride, srcSize, dst + (size_t)remap[v] * attr.stride);
+		}
+	}
+
+	GLuint buffer;
+	glGenBuffers(1, &buffer);
+	glBindBuffer(GL_ARRAY_BUFFER, buffer);
+	glBufferData(GL_ARRAY_BUFFER, vertexData.size(), vertexData.data(), GL_STATIC_DRAW);
+
+	for (Model::VertexAttribute const& attr : attributes)
+	{
+		glEnableVertexAttribArray(attr.slot);
+		glVertexAttribPointer(
+			attr.slot,
+			attr.components,
+			attr.type,
+			attr.normalized,
+			attr.stride,
+			(void*)(intptr_t)attr.offset
+		);
+	}
+	return buffer;
+}
+
+//------------------------------------------------------------------------------
+/**
+	Uploads all lods of a primitive into one index buffer, bound to the vao that
+	is currently bound. Uses 16 bit indices when the vertices allow it.
+*/
+GLuint
+UploadIndices(Model::Mesh::Primitive& p, Core::ArenaVector<uint32_t> const& indices, uint32_t numVertices)
+{
+	GLuint buffer;
+	glGenBuffers(1, &buffer);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffer);
+
+	GLuint indexSize;
+	if (numVertices <= 0x10000)
+	{
+		Core::ArenaVector<uint16_t> const shortIndices(indices.begin(), indices.end(), indices.get_allocator());
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, shortIndices.size() * sizeof(uint16_t), shortIndices.data(), GL_STATIC_DRAW);
+		p.indexType = GL_UNSIGNED_SHORT;
+		indexSize = sizeof(uint16_t);
+	}
+	else
+	{
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(uint32_t), indices.data(), GL_STATIC_DRAW);
+		p.indexType = GL_UNSIGNED_INT;
+		indexSize = sizeof(uint32_t);
+	}
+
+	for (uint lod = 0; lod < p.numLods; lod++)
+		p.lods[lod].offset *= indexSize;
+	return buffer;
+}
+
+//------------------------------------------------------------------------------
+/**
+	Creates a vao that only reads the position stream of the vertex buffer.
+	Every attribute is a separate tightly packed stream, so depth only passes
+	fetch nothing but positions.
+*/
+GLuint
+SetupDepthVertexArray(Model::VertexAttribute const& position, GLuint vertexBuffer, GLuint indexBuffer)
+{
+	GLuint vao;
+	glGenVertexArrays(1, &vao);
+	GLState::BindVertexArray(vao);
+	glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+	glEnableVertexAttribArray(position.slot);
+	glVertexAttribPointer(
+		position.slot,
+		position.components,
+		position.type,
+		position.normalized,
+		position.stride,
+		(void*)(intptr_t)position.offset
+	);
+	GLState::BindVertexArray(0);
+	return vao;
 }
 
 //------------------------------------------------------------------------------
@@ -96,46 +467,15 @@ LoadGLTF(std::string const& uri)
 		return Model();
 	}
 	
-    InferBufferTargets(doc); // fix up buffertargets if necessary
-
-	int numBuffers = 0;
-	//count number of buffers necessary
-	size_t const numBufferViews = doc.bufferViews.size();
-	for (unsigned i = 0; i < numBufferViews; i++)
-	{
-		numBuffers += (doc.bufferViews[i].target != fx::gltf::BufferView::TargetType::None);
-	}
-
-	std::vector<fx::gltf::Primitive const*> proxyPrimitives;
-
 	Model model;
-	model.buffers.resize(numBuffers, -1);
-	glGenBuffers(numBuffers, &model.buffers[0]);
 
-	std::vector<int> bufferViewMap(numBufferViews);
+	bool const optimizeOverdraw = Core::CVarReadInt(r_mesh_overdraw) > 0;
+	bool const compressVertices = Core::CVarReadInt(r_mesh_compress) > 0;
+	bool const verbose = Core::CVarReadInt(r_mesh_verbose) > 0;
+	float acmrBefore = 0.0f;
+	float acmrAfter = 0.0f;
+	size_t numTriangles = 0;
 
-	//TODO: We should use less buffers and possibly rebind less often.
-	//		Put everything in one buffer and just use the offsets in the attribute pointers
-
-	unsigned bufferIndex = 0;
-    for (unsigned i = 0; i < numBufferViews; i++)
-    {
-		auto const& bufferView = doc.bufferViews[i];
-		if (bufferView.target != fx::gltf::BufferView::TargetType::None)
-		{
-			GLenum const target = (GLenum)bufferView.target;
-			glBindBuffer(target, model.buffers[bufferIndex]);
-			glBufferData(
-				target,
-				bufferView.byteLength,
-				&(doc.buffers[bufferView.buffer].data[0]) + bufferView.byteOffset,
-				GL_STATIC_DRAW
-			);
-			bufferViewMap[i] = bufferIndex;
-			bufferIndex++;
-		}
-    }
-	
 	std::vector<TextureResourceId> textures;
 	textures.resize(doc.textures.size(), InvalidResourceId);
 	
@@ -248,52 +588,59 @@ LoadGLTF(std::string const& uri)
 		LoadTexture(i, texture);
     }
 
+	// the temporaries of a primitive are about as large as its data in the file, the arena grows if they aren't
+	size_t scratchSize = 0;
+	for (auto const& buffer : doc.buffers)
+		scratchSize = std::max(scratchSize, buffer.data.size());
+	Core::LinearArena scratch(scratchSize);
+
     for (auto const& mesh : doc.meshes)
     {
         Model::Mesh m;
         for (auto const& primitive : mesh.primitives)
         {
             Model::Mesh::Primitive p;
+			// the temporaries of the previous primitive are gone
+			scratch.Reset();
 
             glGenVertexArrays(1, &p.vao);
-            glBindVertexArray(p.vao);
-            for (auto const& attribute : primitive.attributes)
-            {
+            GLState::BindVertexArray(p.vao);
+			uint32_t const numVertices = doc.accessors[primitive.attributes.at("POSITION")].count;
+			Core::ArenaVector<uint32_t> indices(&scratch);
+			ReadIndices(doc, primitive, numVertices, indices);
+			GenerateLods(doc, primitive, p, indices);
+
+			if (verbose)
+				acmrBefore += MeshProcessing::ComputeACMR(indices.data(), p.lods[0].numIndices, numVertices) * (p.lods[0].numIndices / 3);
+			OptimizeIndices(doc, primitive, p, indices, numVertices, optimizeOverdraw);
+			if (verbose)
+			{
+				acmrAfter += MeshProcessing::ComputeACMR(indices.data(), p.lods[0].numIndices, numVertices) * (p.lods[0].numIndices / 3);
+				numTriangles += p.lods[0].numIndices / 3;
+			}
+
+			// order the vertices by first use, which also drops unused ones
+			Core::ArenaVector<uint32_t> remap(numVertices, &scratch);
+			uint32_t const numUsedVertices = (uint32_t)MeshProcessing::OptimizeVertexFetch(remap.data(), indices.data(), indices.size(), numVertices);
+			for (uint32_t& index : indices)
+				index = remap[index];
+
+			for (auto const& attribute : primitive.attributes)
+			{
 				auto const& accessor = doc.accessors[attribute.second];
-                
-                Model::VertexAttribute attr;
-                attr.offset = accessor.byteOffset;
-				attr.stride = doc.bufferViews[accessor.bufferView].byteStride;
-                attr.normalized = accessor.normalized;
-
-                attr.slot = SlotFromGltf(attribute.first);
-				attr.type = (GLenum)accessor.componentType;
-
-				n_assert((int)accessor.type > 0 && (int)accessor.type <= 4);
-				attr.components = (GLint)accessor.type;
-                
-				fx::gltf::BufferView const& bufferView = doc.bufferViews[accessor.bufferView];
-				fx::gltf::Buffer const& buffer = doc.buffers[bufferView.buffer];
-                glBindBuffer(
-					(GLenum)doc.bufferViews[accessor.bufferView].target,
-					model.buffers[bufferViewMap[accessor.bufferView]]
-				);
-				glEnableVertexArrayAttrib(p.vao, attr.slot);
-                glVertexAttribPointer(
-					attr.slot,
-					attr.components,
-					attr.type,
-					attr.normalized,
-					attr.stride,
-					(void*)(intptr_t)attr.offset
-				);
-            }
+				if (SlotFromGltf(attribute.first) == 0 && accessor.min.size() == 3 && accessor.max.size() == 3)
+				{
+					model.boundsMin = glm::min(model.boundsMin, glm::vec3(accessor.min[0], accessor.min[1], accessor.min[2]));
+					model.boundsMax = glm::max(model.boundsMax, glm::vec3(accessor.max[0], accessor.max[1], accessor.max[2]));
+					p.center = (glm::vec3(accessor.min[0], accessor.min[1], accessor.min[2]) + glm::vec3(accessor.max[0], accessor.max[1], accessor.max[2])) * 0.5f;
+				}
+			}
 
-            auto const& ibAccessor = doc.accessors[primitive.indices];
-			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, model.buffers[bufferViewMap[ibAccessor.bufferView]]);
-            p.numIndices = ibAccessor.count;
-			p.offset = ibAccessor.byteOffset;
-            p.indexType = (GLenum)ibAccessor.componentType;
+			Model::VertexAttribute position;
+			GLuint const vertexBuffer = UploadVertices(doc, primitive, p, remap, numUsedVertices, compressVertices, position);
+			GLuint const indexBuffer = UploadIndices(p, indices, numUsedVertices);
+			model.buffers.push_back(vertexBuffer);
+			model.buffers.push_back(indexBuffer);
             
 			if (primitive.material != -1)
 			{
@@ -332,16 +679,33 @@ LoadGLTF(std::string const& uri)
 					m.opaquePrimitives.push_back((uint16_t)m.primitives.size());
 			}
 
-            glBindVertexArray(0);
+            GLState::BindVertexArray(0);
+
+			p.depthVao = SetupDepthVertexArray(position, vertexBuffer, indexBuffer);
 
             m.primitives.push_back(std::move(p));
         }
 		model.meshes.push_back(std::move(m));
     }
 
+	if (verbose && numTriangles > 0)
+		printf("Optimized mesh '%s': ACMR %.3f -> %.3f\n", uri.c_str(), acmrBefore / numTriangles, acmrAfter / numTriangles);
+
     return model;
 }
 
+//------------------------------------------------------------------------------
+/**
+*/
+void
+InitializeModels()
+{
+	// off by default, the depth prepass already removes most overdraw
+	r_mesh_overdraw = Core::CVarCreate(Core::CVarType::CVar_Int, "r_mesh_overdraw", "0", "Reorder imported triangles to reduce overdraw");
+	r_mesh_compress = Core::CVarCreate(Core::CVarType::CVar_Int, "r_mesh_compress", "1", "Store imported vertices in compressed formats");
+	r_mesh_verbose = Core::CVarCreate(Core::CVarType::CVar_Int, "r_mesh_verbose", "0", "Print how well the vertex cache is used by each imported model");
+}
+
 //------------------------------------------------------------------------------
 /**
 */
@@ -6,9 +6,10 @@
     (C) 2022 Individual contributors, see AUTHORS file
 */
 //------------------------------------------------------------------------------
-#include "GL/glew.h"
+#include "render/renderbackend.h"
 #include <string>
 #include <vector>
+#include <cfloat>
 #include "renderdevice.h"
 #include "resourceid.h"
 #include "textureresource.h"
@@ -20,12 +21,27 @@ struct Model
 {
     struct VertexAttribute
     {
+        /// how the attribute is compressed, decoded in shd/vertexdecode.glsl
+        enum class Encoding : uint8_t
+        {
+            None,
+            /// 16 bit unorm relative to the primitive's bounds
+            QuantizedPosition,
+            /// octahedral unit vector in 2x16 bit snorm
+            Octahedral16,
+            /// octahedral unit vector and sign in 4x8 bit snorm
+            Octahedral8Signed,
+            /// 16 bit floats
+            Half
+        };
+
         GLuint slot = 0;
         GLint components = 0;
         GLenum type = GL_NONE;
         GLsizei stride = 0;
         GLsizei offset = 0;
         GLboolean normalized = GL_FALSE;
+        Encoding encoding = Encoding::None;
     };
 
     struct Material
@@ -68,10 +84,29 @@ struct Model
     {
         struct Primitive
         {
+            static constexpr uint MaxLods = 4;
+
+            /// range in the primitive's index buffer. Every lod indexes the same vertices.
+            struct Lod
+            {
+                GLuint numIndices = 0;
+                GLuint offset = 0;
+            };
+
             GLuint vao;
-            GLuint numIndices;
-            GLuint offset = 0;
+            /// only has the position stream and the index buffer, for passes that only write depth
+            GLuint depthVao;
             GLenum indexType;
+            /// lod 0 is the full detail mesh, and every following lod has roughly half the triangles
+            Lod lods[MaxLods];
+            uint numLods = 1;
+            /// decodes quantized positions, position = stored * positionScale + positionOffset
+            glm::vec3 positionScale = glm::vec3(1.0f);
+            glm::vec3 positionOffset = glm::vec3(0.0f);
+            /// object space center of the primitive's bounds, used to sort transparent primitives
+            glm::vec3 center = glm::vec3(0.0f);
+            /// normals and tangents are octahedral encoded
+            bool octahedralNormals = false;
             Material material;
         };
 
@@ -83,9 +118,15 @@ struct Model
     std::vector<Mesh> meshes;
     //std::vector<TextureResourceId> textures;
     std::vector<GLuint> buffers;
+    /// object space bounds of all meshes, from the gltf position accessors
+    glm::vec3 boundsMin = glm::vec3(FLT_MAX);
+    glm::vec3 boundsMax = glm::vec3(-FLT_MAX);
     uint refcount;
 };
 
+/// create the cvars of the model loader, before any model is loaded
+void InitializeModels();
+
 ModelId LoadModel(std::string name);
 
 void UnloadModel(ModelId);
@@ -0,0 +1,270 @@
+//------------------------------------------------------------------------------
+//  @file occlusionbuffer.cc
+//  @copyright (C) 2022 Individual contributors, see AUTHORS file
+//------------------------------------------------------------------------------
+#include "config.h"
+#include "occlusionbuffer.h"
+#include "core/jobsystem.h"
+#include <cfloat>
+
+namespace Render
+{
+
+static_assert(OcclusionBuffer::Width % OcclusionBuffer::TileWidth == 0 && OcclusionBuffer::Height % OcclusionBuffer::TileHeight == 0);
+static_assert(OcclusionBuffer::TileWidth % OcclusionBuffer::BlockSize == 0 && OcclusionBuffer::TileHeight % OcclusionBuffer::BlockSize == 0);
+static_assert(OcclusionBuffer::BlockSize == 8, "the block reduction loads two rows of four pixels");
+
+constexpr uint32_t numTilesX = OcclusionBuffer::Width / OcclusionBuffer::TileWidth;
+constexpr uint32_t numTilesY = OcclusionBuffer::Height / OcclusionBuffer::TileHeight;
+constexpr uint32_t numBlocksX = OcclusionBuffer::Width / OcclusionBuffer::BlockSize;
+constexpr uint32_t numBlocksY = OcclusionBuffer::Height / OcclusionBuffer::BlockSize;
+
+//------------------------------------------------------------------------------
+/**
+*/
+OcclusionBuffer::OcclusionBuffer() :
+    depth(Width * Height, 0.0f),
+    hiz(numBlocksX * numBlocksY, 0.0f)
+{
+    // empty
+}
+
+//------------------------------------------------------------------------------
+/**
+    Triangles that touch the near plane are dropped rather than clipped. Missing
+    occluder triangles only make the culling less aggressive, never wrong.
+*/
+void
+OcclusionBuffer::SetupTriangles(glm::mat4 const& viewProjection, Occluder const& occluder, Triangle* out)
+{
+    glm::mat4 const modelViewProjection = viewProjection * occluder.transform;
+    char const* const vertices = (char const*)occluder.vertices;
+
+    for (uint32_t t = 0; t < occluder.numTriangles; t++)
+    {
+        Triangle& tri = out[t];
+        tri.minX = 1;
+        tri.maxX = 0;
+
+        glm::vec4 clip[3];
+        uint32_t outside = 0xF;
+        bool nearPlane = false;
+        for (int v = 0; v < 3; v++)
+        {
+            glm::vec3 const& position = *(glm::vec3 const*)(vertices + t * occluder.triangleStride + v * sizeof(glm::vec3));
+            clip[v] = modelViewProjection * glm::vec4(position, 1.0f);
+            nearPlane |= clip[v].w <= FLT_EPSILON || clip[v].z < -clip[v].w;
+            outside &= (clip[v].x < -clip[v].w ? 1u : 0u) | (clip[v].x > clip[v].w ? 2u : 0u) | (clip[v].y < -clip[v].w ? 4u : 0u) | (clip[v].y > clip[v].w ? 8u : 0u);
+        }
+        if (nearPlane || outside != 0)
+            continue;
+
+        float x[3], y[3], invW[3];
+        for (int v = 0; v < 3; v++)
+        {
+            invW[v] = 1.0f / clip[v].w;
+            x[v] = (clip[v].x * invW[v] * 0.5f + 0.5f) * (float)Width;
+            y[v] = (clip[v].y * invW[v] * 0.5f + 0.5f) * (float)Height;
+        }
+
+        float area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+        if (fabsf(area) < 1e-6f)
+            continue;
+        if (area < 0.0f)
+        {
+            // occluders are rasterized double sided
+            std::swap(x[1], x[2]);
+            std::swap(y[1], y[2]);
+            std::swap(invW[1], invW[2]);
+            area = -area;
+        }
+
+        // edge i is opposite to vertex i, so it's zero on the edge and area at vertex i
+        float const invArea = 1.0f / area;
+        tri.depthA = tri.depthB = tri.depthC = 0.0f;
+        for (int i = 0; i < 3; i++)
+        {
+            int const a = (i + 1) % 3;
+            int const b = (i + 2) % 3;
+            tri.edgeA[i] = y[a] - y[b];
+            tri.edgeB[i] = x[b] - x[a];
+            tri.edgeC[i] = (y[b] - y[a]) * x[a] - (x[b] - x[a]) * y[a];
+            tri.depthA += invW[i] * tri.edgeA[i] * invArea;
+            tri.depthB += invW[i] * tri.edgeB[i] * invArea;
+            tri.depthC += invW[i] * tri.edgeC[i] * invArea;
+        }
+
+        tri.minX = glm::max((int32_t)floorf(glm::min(x[0], glm::min(x[1], x[2]))), 0);
+        tri.maxX = glm::min((int32_t)ceilf(glm::max(x[0], glm::max(x[1], x[2]))), (int32_t)Width - 1);
+        tri.minY = glm::max((int32_t)floorf(glm::min(y[0], glm::min(y[1], y[2]))), 0);
+        tri.maxY = glm::min((int32_t)ceilf(glm::max(y[0], glm::max(y[1], y[2]))), (int32_t)Height - 1);
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+OcclusionBuffer::RasterizeTile(uint32_t tileX, uint32_t tileY)
+{
+    int32_t const tileMinX = (int32_t)(tileX * TileWidth);
+    int32_t const tileMaxX = tileMinX + (int32_t)TileWidth - 1;
+    int32_t const tileMinY = (int32_t)(tileY * TileHeight);
+    int32_t const tileMaxY = tileMinY + (int32_t)TileHeight - 1;
+
+    for (int32_t y = tileMinY; y <= tileMaxY; y++)
+        std::fill_n(this->depth.data() + y * Width + tileMinX, TileWidth, 0.0f);
+
+    __m128 const zero = _mm_setzero_ps();
+    __m128 const pixelCenters = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+
+    for (Triangle const& tri : this->triangles)
+    {
+        if (tri.maxX < tileMinX || tri.minX > tileMaxX || tri.maxY < tileMinY || tri.minY > tileMaxY || tri.minX > tri.maxX)
+            continue;
+
+        // the tile starts on a multiple of four, so aligning down stays inside it
+        int32_t const startX = glm::max(tri.minX, tileMinX) & ~3;
+        int32_t const endX = glm::min(tri.maxX, tileMaxX);
+        int32_t const startY = glm::max(tri.minY, tileMinY);
+        int32_t const endY = glm::min(tri.maxY, tileMaxY);
+
+        __m128 const edgeA0 = _mm_set1_ps(tri.edgeA[0]);
+        __m128 const edgeA1 = _mm_set1_ps(tri.edgeA[1]);
+        __m128 const edgeA2 = _mm_set1_ps(tri.edgeA[2]);
+        __m128 const depthA = _mm_set1_ps(tri.depthA);
+
+        for (int32_t y = startY; y <= endY; y++)
+        {
+            float const py = (float)y + 0.5f;
+            __m128 const row0 = _mm_set1_ps(tri.edgeB[0] * py + tri.edgeC[0]);
+            __m128 const row1 = _mm_set1_ps(tri.edgeB[1] * py + tri.edgeC[1]);
+            __m128 const row2 = _mm_set1_ps(tri.edgeB[2] * py + tri.edgeC[2]);
+            __m128 const rowDepth = _mm_set1_ps(tri.depthB * py + tri.depthC);
+            float* const row = this->depth.data() + y * Width;
+
+            for (int32_t x = startX; x <= endX; x += 4)
+            {
+                __m128 const px = _mm_add_ps(_mm_set1_ps((float)x), pixelCenters);
+                __m128 const e0 = _mm_add_ps(_mm_mul_ps(edgeA0, px), row0);
+                __m128 const e1 = _mm_add_ps(_mm_mul_ps(edgeA1, px), row1);
+                __m128 const e2 = _mm_add_ps(_mm_mul_ps(edgeA2, px), row2);
+                __m128 const inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(e0, zero), _mm_cmpge_ps(e1, zero)), _mm_cmpge_ps(e2, zero));
+                if (_mm_movemask_ps(inside) == 0)
+                    continue;
+
+                __m128 const z = _mm_add_ps(_mm_mul_ps(depthA, px), rowDepth);
+                __m128 const old = _mm_loadu_ps(row + x);
+                __m128 const closest = _mm_max_ps(old, z);
+                _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, closest), _mm_andnot_ps(inside, old)));
+            }
+        }
+    }
+
+    // farthest depth of every block in the tile
+    for (int32_t by = tileMinY / (int32_t)BlockSize; by <= tileMaxY / (int32_t)BlockSize; by++)
+    {
+        for (int32_t bx = tileMinX / (int32_t)BlockSize; bx <= tileMaxX / (int32_t)BlockSize; bx++)
+        {
+            float const* const block = this->depth.data() + by * BlockSize * Width + bx * BlockSize;
+            __m128 farthest = _mm_set1_ps(FLT_MAX);
+            for (uint32_t y = 0; y < BlockSize; y++)
+            {
+                farthest = _mm_min_ps(farthest, _mm_loadu_ps(block + y * Width));
+                farthest = _mm_min_ps(farthest, _mm_loadu_ps(block + y * Width + 4));
+            }
+            farthest = _mm_min_ps(farthest, _mm_shuffle_ps(farthest, farthest, _MM_SHUFFLE(1, 0, 3, 2)));
+            farthest = _mm_min_ps(farthest, _mm_shuffle_ps(farthest, farthest, _MM_SHUFFLE(2, 3, 0, 1)));
+            this->hiz[by * numBlocksX + bx] = _mm_cvtss_f32(farthest);
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+    Setup is parallel over occluders and rasterization over tiles. The tiles
+    don't overlap, so no synchronization is needed between them.
+*/
+void
+OcclusionBuffer::Render(glm::mat4 const& viewProjection, Occluder const* occluders, uint32_t numOccluders)
+{
+    this->triangleOffsets.resize(numOccluders + 1);
+    uint32_t total = 0;
+    for (uint32_t i = 0; i < numOccluders; i++)
+    {
+        this->triangleOffsets[i] = total;
+        total += occluders[i].numTriangles;
+    }
+    this->triangleOffsets[numOccluders] = total;
+    this->triangles.resize(total);
+
+    Core::JobSystem::ParallelFor(numOccluders, 1, [&](uint begin, uint end)
+    {
+        for (uint i = begin; i < end; i++)
+            this->SetupTriangles(viewProjection, occluders[i], this->triangles.data() + this->triangleOffsets[i]);
+    });
+
+    this->numTriangles = 0;
+    for (Triangle const& tri : this->triangles)
+        this->numTriangles += tri.minX <= tri.maxX ? 1 : 0;
+
+    Core::JobSystem::ParallelFor(numTilesX * numTilesY, 1, [this](uint begin, uint end)
+    {
+        for (uint tile = begin; tile < end; tile++)
+            this->RasterizeTile(tile % numTilesX, tile / numTilesX);
+    });
+}
+
+//------------------------------------------------------------------------------
+/**
+    w is linear in view space, so the closest point of the box is one of its corners.
+*/
+bool
+OcclusionBuffer::IsVisible(glm::mat4 const& modelViewProjection, glm::vec3 const& boundsMin, glm::vec3 const& boundsMax) const
+{
+    float minX = FLT_MAX, maxX = -FLT_MAX;
+    float minY = FLT_MAX, maxY = -FLT_MAX;
+    float closest = 0.0f;
+    for (int i = 0; i < 8; i++)
+    {
+        glm::vec3 const corner = glm::vec3(
+            (i & 1) ? boundsMax.x : boundsMin.x,
+            (i & 2) ? boundsMax.y : boundsMin.y,
+            (i & 4) ? boundsMax.z : boundsMin.z
+        );
+        glm::vec4 const clip = modelViewProjection * glm::vec4(corner, 1.0f);
+
+        // intersects the near plane, can't be projected
+        if (clip.w <= FLT_EPSILON || clip.z < -clip.w)
+            return true;
+
+        float const invW = 1.0f / clip.w;
+        float const x = (clip.x * invW * 0.5f + 0.5f) * (float)Width;
+        float const y = (clip.y * invW * 0.5f + 0.5f) * (float)Height;
+        minX = glm::min(minX, x);
+        maxX = glm::max(maxX, x);
+        minY = glm::min(minY, y);
+        maxY = glm::max(maxY, y);
+        closest = glm::max(closest, invW);
+    }
+
+    if (maxX < 0.0f || minX > (float)Width || maxY < 0.0f || minY > (float)Height)
+        return false;
+
+    int32_t const bx0 = (int32_t)glm::clamp(minX, 0.0f, (float)(Width - 1)) / (int32_t)BlockSize;
+    int32_t const bx1 = (int32_t)glm::clamp(maxX, 0.0f, (float)(Width - 1)) / (int32_t)BlockSize;
+    int32_t const by0 = (int32_t)glm::clamp(minY, 0.0f, (float)(Height - 1)) / (int32_t)BlockSize;
+    int32_t const by1 = (int32_t)glm::clamp(maxY, 0.0f, (float)(Height - 1)) / (int32_t)BlockSize;
+
+    for (int32_t by = by0; by <= by1; by++)
+    {
+        for (int32_t bx = bx0; bx <= bx1; bx++)
+        {
+            if (closest >= this->hiz[by * numBlocksX + bx])
+                return true;
+        }
+    }
+    return false;
+}
+
+} // namespace Render
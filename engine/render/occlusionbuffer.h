@@ -0,0 +1,85 @@
+#pragma once
+//------------------------------------------------------------------------------
+/**
+    @file occlusionbuffer.h
+
+    Software occlusion culling.
+
+    A small set of occluder meshes is rasterized into a low resolution depth
+    buffer on the CPU. The buffer is split into tiles that are rasterized in
+    parallel on the job system, four pixels at a time with SSE. Each tile then
+    reduces its depth into a hierarchical depth buffer of 8x8 pixel blocks that
+    stores the farthest occluder depth of each block. Bounding boxes are tested
+    against the blocks they cover.
+
+    Depth is stored as 1/w, so larger values are closer, and 0 means that no
+    occluder covers the pixel.
+
+    Has no GL dependencies, so it can run and be validated without a context.
+
+    @copyright
+    (C) 2022 Individual contributors, see AUTHORS file
+*/
+//------------------------------------------------------------------------------
+#include <vector>
+
+namespace Render
+{
+
+class OcclusionBuffer
+{
+public:
+    static constexpr uint32_t Width = 256;
+    static constexpr uint32_t Height = 128;
+    static constexpr uint32_t TileWidth = 64;
+    static constexpr uint32_t TileHeight = 32;
+    static constexpr uint32_t BlockSize = 8;
+
+    //------------------------------------------------------------------------------
+    /**
+        Triangle list occluder. Vertex v of triangle t is read from
+        vertices + t * triangleStride + v * sizeof(glm::vec3) (in bytes).
+    */
+    struct Occluder
+    {
+        glm::mat4 transform;
+        void const* vertices;
+        uint32_t numTriangles;
+        uint32_t triangleStride;
+    };
+
+    OcclusionBuffer();
+
+    /// clear, rasterize the occluders and build the hierarchical depth buffer
+    void Render(glm::mat4 const& viewProjection, Occluder const* occluders, uint32_t numOccluders);
+    /// test a box in model space. Returns false if it is hidden behind occluders or outside the screen.
+    bool IsVisible(glm::mat4 const& modelViewProjection, glm::vec3 const& boundsMin, glm::vec3 const& boundsMax) const;
+
+    /// per pixel depth (1/w), Width x Height
+    std::vector<float> depth;
+    /// farthest depth of every block
+    std::vector<float> hiz;
+    /// number of triangles that survived setup in the last Render
+    uint32_t numTriangles = 0;
+
+private:
+    /// screen space triangle with edge and depth plane equations, evaluated at pixel centers
+    struct Triangle
+    {
+        float edgeA[3];
+        float edgeB[3];
+        float edgeC[3];
+        float depthA, depthB, depthC;
+        int32_t minX, maxX, minY, maxY;
+    };
+
+    /// transform and set up one occluder's triangles. Writes invalid triangles with an empty bounding box.
+    void SetupTriangles(glm::mat4 const& viewProjection, Occluder const& occluder, Triangle* out);
+    /// rasterize all triangles overlapping a tile and reduce it into the hierarchical depth buffer
+    void RasterizeTile(uint32_t tileX, uint32_t tileY);
+
+    std::vector<Triangle> triangles;
+    std::vector<uint32_t> triangleOffsets;
+};
+
+} // namespace Render
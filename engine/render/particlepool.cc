@@ -0,0 +1,136 @@
+//------------------------------------------------------------------------------
+//  @file particlepool.cc
+//  @copyright (C) 2022 Individual contributors, see AUTHORS file
+//------------------------------------------------------------------------------
+#include "config.h"
+#include "particlepool.h"
+#include <algorithm>
+
+namespace Render
+{
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+ParticlePool::Reserve(uint32_t capacity)
+{
+    if (capacity <= this->capacity)
+        return;
+
+    this->AddFreeRange(this->capacity, capacity - this->capacity);
+    this->capacity = capacity;
+}
+
+//------------------------------------------------------------------------------
+/**
+    Best fit, ties go to the lowest range, which keeps the allocations
+    packed towards the start of the pool.
+*/
+uint32_t
+ParticlePool::Allocate(uint32_t count)
+{
+    if (count == 0)
+    {
+        this->numAllocations++;
+        return 0;
+    }
+
+    size_t best = SIZE_MAX;
+    for (size_t i = 0; i < this->freeRanges.size(); i++)
+    {
+        uint32_t const size = this->freeRanges[i].y;
+        if (size >= count && (best == SIZE_MAX || size < this->freeRanges[best].y))
+        {
+            best = i;
+            if (size == count)
+                break;
+        }
+    }
+
+    if (best == SIZE_MAX)
+    {
+        this->Reserve(glm::max(this->capacity * 2, this->capacity + count));
+        return this->Allocate(count);
+    }
+
+    glm::uvec2& range = this->freeRanges[best];
+    uint32_t const first = range.x;
+    range.x += count;
+    range.y -= count;
+    if (range.y == 0)
+        this->freeRanges.erase(this->freeRanges.begin() + best);
+
+    this->allocated += count;
+    this->numAllocations++;
+    return first;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+ParticlePool::Free(uint32_t first, uint32_t count)
+{
+    n_assert(first + count <= this->capacity);
+    n_assert(this->allocated >= count && this->numAllocations > 0);
+    this->allocated -= count;
+    this->numAllocations--;
+    this->AddFreeRange(first, count);
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+ParticlePool::AddFreeRange(uint32_t first, uint32_t count)
+{
+    if (count == 0)
+        return;
+
+    auto next = std::lower_bound(this->freeRanges.begin(), this->freeRanges.end(), first,
+        [](glm::uvec2 const& range, uint32_t first) { return range.x < first; });
+    n_assert2(next == this->freeRanges.end() || first + count <= next->x, "Freed particle range overlaps a free range");
+
+    // merge with the range before and after it
+    if (next != this->freeRanges.begin())
+    {
+        auto previous = next - 1;
+        n_assert2(previous->x + previous->y <= first, "Freed particle range overlaps a free range");
+        if (previous->x + previous->y == first)
+        {
+            previous->y += count;
+            if (next != this->freeRanges.end() && previous->x + previous->y == next->x)
+            {
+                previous->y += next->y;
+                this->freeRanges.erase(next);
+            }
+            return;
+        }
+    }
+    if (next != this->freeRanges.end() && first + count == next->x)
+    {
+        next->x = first;
+        next->y += count;
+        return;
+    }
+    this->freeRanges.insert(next, glm::uvec2(first, count));
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+ParticlePool::Stats
+ParticlePool::GetStats() const
+{
+    Stats stats;
+    stats.capacity = this->capacity;
+    stats.allocated = this->allocated;
+    stats.numAllocations = this->numAllocations;
+    stats.numFreeRanges = (uint32_t)this->freeRanges.size();
+    for (glm::uvec2 const& range : this->freeRanges)
+        stats.largestFreeRange = glm::max(stats.largestFreeRange, range.y);
+    return stats;
+}
+
+} // namespace Render
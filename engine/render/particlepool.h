@@ -0,0 +1,61 @@
+#pragma once
+//------------------------------------------------------------------------------
+/**
+    @file particlepool.h
+
+    Sub-allocator for the shared particle buffers.
+
+    Emitters get a contiguous range of particles from the pool. Free ranges
+    are kept sorted and merged with their neighbours, and allocations take
+    the smallest free range that fits, so emitters of the same size reuse
+    each other's ranges exactly. The pool only grows when no free range is
+    large enough, and then at least doubles, so the GL buffers that mirror
+    it are rarely reallocated.
+
+    The pool only does the bookkeeping and has no GL dependencies.
+
+    @copyright
+    (C) 2022 Individual contributors, see AUTHORS file
+*/
+//------------------------------------------------------------------------------
+#include <vector>
+
+namespace Render
+{
+
+class ParticlePool
+{
+public:
+    struct Stats
+    {
+        /// number of particles the pool has room for
+        uint32_t capacity = 0;
+        /// number of particles in allocated ranges
+        uint32_t allocated = 0;
+        uint32_t numAllocations = 0;
+        uint32_t numFreeRanges = 0;
+        /// the largest allocation that fits without growing the pool
+        uint32_t largestFreeRange = 0;
+    };
+
+    /// grow the pool to at least capacity particles
+    void Reserve(uint32_t capacity);
+    /// allocate a range, growing the pool if needed. Returns the first particle of the range.
+    uint32_t Allocate(uint32_t count);
+    void Free(uint32_t first, uint32_t count);
+
+    uint32_t GetCapacity() const { return this->capacity; }
+    Stats GetStats() const;
+
+private:
+    /// adds a free range and merges it with its neighbours
+    void AddFreeRange(uint32_t first, uint32_t count);
+
+    /// free ranges as first particle and count, sorted by first particle
+    std::vector<glm::uvec2> freeRanges;
+    uint32_t capacity = 0;
+    uint32_t allocated = 0;
+    uint32_t numAllocations = 0;
+};
+
+} // namespace Render
@@ -0,0 +1,225 @@
+//------------------------------------------------------------------------------
+//  @file particlesim.cc
+//  @copyright (C) 2022 Individual contributors, see AUTHORS file
+//------------------------------------------------------------------------------
+#include "config.h"
+#include "particlesim.h"
+#include <bit>
+
+namespace Render
+{
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+CpuParticles::Resize(uint32_t numParticles)
+{
+    this->numParticles = numParticles;
+    this->capacity = numParticles;
+    size_t const padded = (numParticles + 3) & ~3u;
+    for (std::vector<float>* array : { &this->positionX, &this->positionY, &this->positionZ, &this->scale,
+                                       &this->velocityX, &this->velocityY, &this->velocityZ, &this->lifetime,
+                                       &this->colorR, &this->colorG, &this->colorB, &this->colorA })
+        array->resize(padded, 0.0f);
+
+    this->packedPositions.resize(numParticles);
+    this->packedVelocities.resize(numParticles);
+    this->packedColors.resize(numParticles);
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+CpuParticles::SetNumParticles(uint32_t numParticles)
+{
+    n_assert(numParticles <= this->capacity);
+    this->numParticles = numParticles;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+CpuParticles::Pack()
+{
+    for (uint32_t i = 0; i < this->numParticles; i++)
+    {
+        this->packedPositions[i] = glm::vec4(this->positionX[i], this->positionY[i], this->positionZ[i], this->scale[i]);
+        this->packedVelocities[i] = glm::vec4(this->velocityX[i], this->velocityY[i], this->velocityZ[i], this->lifetime[i]);
+        this->packedColors[i] = glm::vec4(this->colorR[i], this->colorG[i], this->colorB[i], this->colorA[i]);
+    }
+}
+
+namespace ParticleSimulation
+{
+
+//------------------------------------------------------------------------------
+/**
+    The hash that the shader uses as random function.
+*/
+static float
+Random(float x, float y)
+{
+    float const value = sinf(x * 12.9898f + y * 78.233f) * 43758.5453123f;
+    return value - floorf(value);
+}
+
+//------------------------------------------------------------------------------
+/**
+    Same as SphericalFibonacci in utils.glsl.
+*/
+static glm::vec3
+SphericalFibonacci(float i, float n)
+{
+    float const pi = 3.14159265359f;
+    float const phi = sqrtf(5.0f) * 0.5f + 0.5f;
+    float const mf = i * (phi - 1.0f) + (-floorf(i * (phi - 1.0f)));
+    float const angle = 2.0f * pi * mf;
+    float const cosTheta = 1.0f - (2.0f * i + 1.0f) * (1.0f / n);
+    float const sinTheta = sqrtf(glm::clamp(1.0f - cosTheta * cosTheta, 0.0f, 1.0f));
+    return glm::vec3(cosf(angle) * sinTheta, cosTheta, sinf(angle) * sinTheta);
+}
+
+//------------------------------------------------------------------------------
+/**
+    Resets a particle to the emitter, like the reset branch of the shader.
+*/
+static void
+Respawn(ParticleEmitter::EmitterBlock const& block, float timeStep, uint32_t index, CpuParticles& particles)
+{
+    float const id = (float)index / (float)block.numParticles;
+    float const rnd0 = Random(id, timeStep);
+    float const rnd1 = Random(timeStep, id);
+
+    particles.lifetime[index] = block.decayTime - (rnd0 * block.randomTimeOffsetDist);
+    glm::vec3 position = glm::vec3(block.origin);
+    glm::vec3 direction;
+    if (block.emitterType == 0)
+    {
+        direction = SphericalFibonacci((float)index, (float)block.numParticles);
+    }
+    else
+    {
+        // RandomOnUnitCircle
+        float const a = glm::min(rnd0, rnd1);
+        float const b = glm::max(rnd0, rnd1);
+        float const circleAngle = 2.0f * 3.14159265f * a / b;
+        glm::vec2 const emitFrom = glm::vec2(b * block.discRadius * cosf(circleAngle), b * block.discRadius * sinf(circleAngle));
+
+        float const angle = rnd0 * 3.14159265f * 2.0f;
+        glm::vec2 const p = glm::normalize(glm::vec2(cosf(angle) * rnd1, sinf(angle) * rnd1)) * sinf(block.theta);
+        glm::vec3 const v = glm::vec3(p, cosf(block.theta));
+
+        glm::vec3 const ww = glm::vec3(block.dir);
+        glm::vec3 const uu = glm::normalize(glm::cross(ww, glm::vec3(0, 1, 0)));
+        glm::vec3 const vv = glm::normalize(glm::cross(uu, ww));
+        glm::mat3 const m = glm::mat3(uu, vv, ww);
+        direction = m * v;
+        position += m * glm::vec3(emitFrom, 0.0f);
+    }
+
+    particles.positionX[index] = position.x;
+    particles.positionY[index] = position.y;
+    particles.positionZ[index] = position.z;
+    particles.velocityX[index] = direction.x;
+    particles.velocityY[index] = direction.y;
+    particles.velocityZ[index] = direction.z;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+Simulate(ParticleEmitter::EmitterBlock const& block, float timeStep, CpuParticles& particles)
+{
+    uint32_t const count = particles.numParticles;
+    __m128 const zero = _mm_setzero_ps();
+    __m128 const one = _mm_set1_ps(1.0f);
+    __m128 const dt = _mm_set1_ps(timeStep);
+    __m128 const decayTime = _mm_set1_ps(block.decayTime);
+    __m128 const startSpeed = _mm_set1_ps(block.startSpeed);
+    __m128 const endSpeed = _mm_set1_ps(block.endSpeed);
+    __m128 const startScale = _mm_set1_ps(block.startScale);
+    __m128 const endScale = _mm_set1_ps(block.endScale);
+    __m128 const startColor[4] = { _mm_set1_ps(block.startColor.r), _mm_set1_ps(block.startColor.g), _mm_set1_ps(block.startColor.b), _mm_set1_ps(block.startColor.a) };
+    __m128 const endColor[4] = { _mm_set1_ps(block.endColor.r), _mm_set1_ps(block.endColor.g), _mm_set1_ps(block.endColor.b), _mm_set1_ps(block.endColor.a) };
+
+    float* const position[3] = { particles.positionX.data(), particles.positionY.data(), particles.positionZ.data() };
+    float* const velocity[3] = { particles.velocityX.data(), particles.velocityY.data(), particles.velocityZ.data() };
+    float* const color[4] = { particles.colorR.data(), particles.colorG.data(), particles.colorB.data(), particles.colorA.data() };
+    float* const lifetime = particles.lifetime.data();
+    float* const scale = particles.scale.data();
+
+    for (uint32_t i = 0; i < count; i += 4)
+    {
+        __m128 life = _mm_sub_ps(_mm_loadu_ps(lifetime + i), dt);
+        _mm_storeu_ps(lifetime + i, life);
+
+        uint32_t respawn = 0;
+        if (block.fireOnce > 0)
+            respawn = 0xF;
+        else if (block.looping > 0)
+            respawn = (uint32_t)_mm_movemask_ps(_mm_cmple_ps(life, zero));
+        // the padding after the last particle is never respawned
+        if (count - i < 4)
+            respawn &= (1u << (count - i)) - 1;
+
+        if (respawn != 0)
+        {
+            while (respawn != 0)
+            {
+                Respawn(block, timeStep, i + std::countr_zero(respawn), particles);
+                respawn &= respawn - 1;
+            }
+            life = _mm_loadu_ps(lifetime + i);
+        }
+
+        __m128 const t = _mm_sub_ps(one, _mm_div_ps(life, decayTime));
+        __m128 const oneMinusT = _mm_sub_ps(one, t);
+        for (int c = 0; c < 3; c++)
+        {
+            __m128 const direction = _mm_loadu_ps(velocity[c] + i);
+            __m128 const speed = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(direction, startSpeed), oneMinusT), _mm_mul_ps(_mm_mul_ps(direction, endSpeed), t));
+            _mm_storeu_ps(position[c] + i, _mm_add_ps(_mm_loadu_ps(position[c] + i), _mm_mul_ps(speed, dt)));
+        }
+        _mm_storeu_ps(scale + i, _mm_add_ps(_mm_mul_ps(startScale, oneMinusT), _mm_mul_ps(endScale, t)));
+        for (int c = 0; c < 4; c++)
+            _mm_storeu_ps(color[c] + i, _mm_add_ps(_mm_mul_ps(startColor[c], oneMinusT), _mm_mul_ps(endColor[c], t)));
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+    Follows the shader line by line. mix(x, y, t) is x * (1 - t) + y * t.
+*/
+void
+SimulateReference(ParticleEmitter::EmitterBlock const& block, float timeStep, CpuParticles& particles)
+{
+    for (uint32_t i = 0; i < particles.numParticles; i++)
+    {
+        particles.lifetime[i] -= timeStep;
+        if ((particles.lifetime[i] <= 0.0f && block.looping > 0) || block.fireOnce > 0)
+            Respawn(block, timeStep, i, particles);
+
+        float const t = 1.0f - (particles.lifetime[i] / block.decayTime);
+        float const oneMinusT = 1.0f - t;
+
+        glm::vec3 const direction = glm::vec3(particles.velocityX[i], particles.velocityY[i], particles.velocityZ[i]);
+        glm::vec3 const speed = (direction * block.startSpeed) * oneMinusT + (direction * block.endSpeed) * t;
+        particles.positionX[i] += speed.x * timeStep;
+        particles.positionY[i] += speed.y * timeStep;
+        particles.positionZ[i] += speed.z * timeStep;
+
+        particles.scale[i] = block.startScale * oneMinusT + block.endScale * t;
+        particles.colorR[i] = block.startColor.r * oneMinusT + block.endColor.r * t;
+        particles.colorG[i] = block.startColor.g * oneMinusT + block.endColor.g * t;
+        particles.colorB[i] = block.startColor.b * oneMinusT + block.endColor.b * t;
+        particles.colorA[i] = block.startColor.a * oneMinusT + block.endColor.a * t;
+    }
+}
+
+} // namespace ParticleSimulation
+
+} // namespace Render
@@ -0,0 +1,67 @@
+#pragma once
+//------------------------------------------------------------------------------
+/**
+    @file particlesim.h
+
+    CPU particle simulation.
+
+    Simulates an emitter with the same rules as cs_particle_sim_bufstorage.glsl,
+    so emitters can be run, tested and benchmarked without a GPU, and small
+    emitters don't have to pay for a dispatch.
+
+    The particles are stored as a structure of arrays, and Simulate integrates
+    four of them at a time with SSE. Particles that respawn are reset one at a
+    time, with the same code the scalar SimulateReference uses, and every
+    operation is done in the same order in both versions, so they produce
+    identical output. The GPU evaluates sin and cos with its own precision, so
+    the shader only matches them approximately.
+
+    @copyright
+    (C) 2022 Individual contributors, see AUTHORS file
+*/
+//------------------------------------------------------------------------------
+#include "particlesystem.h"
+#include <vector>
+
+namespace Render
+{
+
+//------------------------------------------------------------------------------
+/**
+    State of all particles of one emitter. The arrays are padded to a multiple
+    of four, the padding is simulated but never respawned or packed.
+*/
+struct CpuParticles
+{
+    /// resize the arrays, new particles start out dead at the origin
+    void Resize(uint32_t numParticles);
+    /// only simulate and pack the first numParticles, without reallocating. Can't be more than the last Resize.
+    void SetNumParticles(uint32_t numParticles);
+    /// interleave into the layout of the particle buffers: position and scale, velocity and lifetime, color
+    void Pack();
+
+    uint32_t numParticles = 0;
+    /// number of particles the arrays have room for
+    uint32_t capacity = 0;
+
+    std::vector<float> positionX, positionY, positionZ, scale;
+    std::vector<float> velocityX, velocityY, velocityZ, lifetime;
+    std::vector<float> colorR, colorG, colorB, colorA;
+
+    /// filled by Pack
+    std::vector<glm::vec4> packedPositions;
+    std::vector<glm::vec4> packedVelocities;
+    std::vector<glm::vec4> packedColors;
+};
+
+namespace ParticleSimulation
+{
+
+/// advance all particles by timeStep, four at a time with SSE
+void Simulate(ParticleEmitter::EmitterBlock const& block, float timeStep, CpuParticles& particles);
+/// scalar version, one particle at a time. Produces identical output to Simulate.
+void SimulateReference(ParticleEmitter::EmitterBlock const& block, float timeStep, CpuParticles& particles);
+
+} // namespace ParticleSimulation
+
+} // namespace Render
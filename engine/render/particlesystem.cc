@@ -1,9 +1,13 @@
 #include "config.h"
 #include "particlesystem.h"
+#include "particlesim.h"
 #include "shaderresource.h"
+#include "core/cvar.h"
 
 namespace Render
 {
+    static Core::CVar* r_particle_pool_size = nullptr;
+
 	void ParticleSystem::Initialize()
 	{
         auto vs = Render::ShaderResource::LoadShader(Render::ShaderResource::ShaderType::VERTEXSHADER, "shd/vs_particles_bufstorage.glsl");
@@ -11,34 +15,97 @@ namespace Render
         this->particleShaderId = Render::ShaderResource::CompileShaderProgram({ vs, fs });
         auto cs = Render::ShaderResource::LoadShader(Render::ShaderResource::ShaderType::COMPUTESHADER, "shd/cs_particle_sim_bufstorage.glsl");
         this->particleSimComputeShaderId = Render::ShaderResource::CompileShaderProgram({ cs });
-        glGenBuffers(1, &this->emitterBlockUBO);
+
+        // created (not just generated) since the particle buffers are only used with DSA calls
+        glCreateBuffers(2, this->bufPositions);
+        glCreateBuffers(2, this->bufVelocities);
+        glCreateBuffers(2, this->bufColors);
+        glCreateBuffers(1, &this->emitterTableBuffer);
+
+        // number of particles to allocate up front, so spawning emitters doesn't reallocate the particle buffers
+        r_particle_pool_size = Core::CVarCreate(Core::CVarType::CVar_Int, "r_particle_pool_size", "262144");
+        this->pool.Reserve((uint32_t)glm::max(Core::CVarReadInt(r_particle_pool_size), 0));
 	}
-    
+
+    ParticleEmitter* ParticleSystem::CreateEmitter(uint32_t numParticles)
+    {
+        ParticleEmitter* emitter = nullptr;
+        for (size_t i = 0; i < this->recycledEmitters.size(); i++)
+        {
+            if (this->recycledEmitters[i]->maxParticles == numParticles)
+            {
+                emitter = this->recycledEmitters[i];
+                this->recycledEmitters[i] = this->recycledEmitters.back();
+                this->recycledEmitters.pop_back();
+                // fireOnce is set by default, so the particles of the previous owner are reset on the first frame
+                emitter->data = ParticleEmitter::EmitterBlock();
+                emitter->data.numParticles = numParticles;
+                break;
+            }
+        }
+        if (emitter == nullptr)
+            emitter = new ParticleEmitter(numParticles);
+
+        this->AddEmitter(emitter);
+        return emitter;
+    }
+
+    void ParticleSystem::DestroyEmitter(ParticleEmitter* emitter)
+    {
+        this->RemoveEmitter(emitter);
+        this->destroyedEmitters.push_back(emitter);
+    }
+
+    void ParticleSystem::ReleaseDestroyedEmitters()
+    {
+        for (ParticleEmitter* emitter : this->destroyedEmitters)
+        {
+            if (this->recycledEmitters.size() < MaxRecycledEmitters)
+                this->recycledEmitters.push_back(emitter);
+            else
+                delete emitter;
+        }
+        this->destroyedEmitters.clear();
+    }
+
+    uint32_t ParticleSystem::AllocateParticles(uint32_t numParticles)
+    {
+        return this->pool.Allocate(numParticles);
+    }
+
+    void ParticleSystem::FreeParticles(uint32_t firstParticle, uint32_t numParticles)
+    {
+        this->pool.Free(firstParticle, numParticles);
+    }
+
+    void ParticleSystem::ReserveBuffers(uint32_t capacity)
+    {
+        if (capacity <= this->bufferCapacity)
+            return;
+
+        // the pool grows geometrically, so this only happens when it runs out of room
+        for (GLuint* buffer : { &this->bufPositions[0], &this->bufPositions[1], &this->bufVelocities[0], &this->bufVelocities[1], &this->bufColors[0], &this->bufColors[1] })
+        {
+            GLuint newBuffer;
+            glCreateBuffers(1, &newBuffer);
+            glNamedBufferData(newBuffer, capacity * sizeof(glm::vec4), nullptr, GL_DYNAMIC_DRAW);
+            if (this->bufferCapacity > 0)
+                glCopyNamedBufferSubData(*buffer, newBuffer, 0, 0, this->bufferCapacity * sizeof(glm::vec4));
+            glDeleteBuffers(1, buffer);
+            *buffer = newBuffer;
+        }
+        this->bufferCapacity = capacity;
+    }
+
     ParticleEmitter::ParticleEmitter(uint32_t numParticles)
     {
         data.numParticles = numParticles;
-        glGenBuffers(2, this->bufPositions);
-        glGenBuffers(2, this->bufVelocities);
-        glGenBuffers(2, this->bufColors);
-
-        glBindBuffer(GL_SHADER_STORAGE_BUFFER, this->bufPositions[0]);
-        glBufferData(GL_SHADER_STORAGE_BUFFER, this->data.numParticles * sizeof(glm::vec4), NULL, GL_DYNAMIC_DRAW);
-        glBindBuffer(GL_SHADER_STORAGE_BUFFER, this->bufPositions[1]);
-        glBufferData(GL_SHADER_STORAGE_BUFFER, this->data.numParticles * sizeof(glm::vec4), NULL, GL_DYNAMIC_DRAW);
-        glBindBuffer(GL_SHADER_STORAGE_BUFFER, this->bufVelocities[0]);
-        glBufferData(GL_SHADER_STORAGE_BUFFER, this->data.numParticles * sizeof(glm::vec4), NULL, GL_DYNAMIC_DRAW);
-        glBindBuffer(GL_SHADER_STORAGE_BUFFER, this->bufVelocities[1]);
-        glBufferData(GL_SHADER_STORAGE_BUFFER, this->data.numParticles * sizeof(glm::vec4), NULL, GL_DYNAMIC_DRAW);
-        glBindBuffer(GL_SHADER_STORAGE_BUFFER, this->bufColors[0]);
-        glBufferData(GL_SHADER_STORAGE_BUFFER, this->data.numParticles * sizeof(glm::vec4), NULL, GL_DYNAMIC_DRAW);
-        glBindBuffer(GL_SHADER_STORAGE_BUFFER, this->bufColors[1]);
-        glBufferData(GL_SHADER_STORAGE_BUFFER, this->data.numParticles * sizeof(glm::vec4), NULL, GL_DYNAMIC_DRAW);
+        this->maxParticles = numParticles;
+        this->firstParticle = ParticleSystem::Instance()->AllocateParticles(numParticles);
     }
 
     ParticleEmitter::~ParticleEmitter()
     {
-        glDeleteBuffers(2, this->bufPositions);
-        glDeleteBuffers(2, this->bufVelocities);
-        glDeleteBuffers(2, this->bufColors);
+        ParticleSystem::Instance()->FreeParticles(this->firstParticle, this->maxParticles);
     }
-}
\ No newline at end of file
+}
@@ -1,7 +1,9 @@
 #pragma once
 #include <vector>
+#include <algorithm>
 #include "resourceid.h"
-#include <gl/glew.h>
+#include "render/renderbackend.h"
+#include "particlepool.h"
 
 namespace Render
 {
@@ -32,10 +34,25 @@ struct ParticleEmitter
         float discRadius; // only used if the emitterType is 1.
     } data;
 
-    GLuint bufPositions[2]; // position.xyz and scale
-    GLuint bufVelocities[2]; // velocity.xyz and lifetime
-    GLuint bufColors[2]; // rgba - TODO: alpha should use stippling
+    uint32_t firstParticle; // where the particles of this emitter start in the particle buffers of the ParticleSystem
+    uint32_t maxParticles; // number of particles that were allocated, data.numParticles is clamped to this
+    uint32_t id = 0; // set when the emitter is added, the render thread keeps its state of the emitter under this id
+};
+
+//------------------------------------------------------------------------------
+/**
+    Entry of the emitter table, matches the Emitter struct in particles.glsl.
+    The particles of all emitters are simulated and drawn as one range, and
+    dispatchOffset is where the emitter's particles start in that range.
+*/
+struct GpuEmitter
+{
+    ParticleEmitter::EmitterBlock block;
+    uint32_t firstParticle;
+    uint32_t dispatchOffset;
+    uint32_t padding[2];
 };
+static_assert(sizeof(GpuEmitter) == 128, "GpuEmitter must match the std430 layout of Emitter in particles.glsl");
 
 class ParticleSystem
 {
@@ -54,6 +71,8 @@ public:
 
     void AddEmitter(ParticleEmitter* emitter)
     {
+        // an emitter that is added again starts over on the render thread
+        emitter->id = this->nextEmitterId++;
         this->emitters.push_back(emitter);
     }
 
@@ -62,13 +81,59 @@ public:
         this->emitters.erase(std::find(this->emitters.begin(), this->emitters.end(), emitter));
     }
 
+    /// get an emitter with room for numParticles particles and add it. Reuses a destroyed emitter of the same size if there is one.
+    ParticleEmitter* CreateEmitter(uint32_t numParticles);
+    /// remove an emitter from CreateEmitter. It and its particles are kept around for the next CreateEmitter once the render thread is done with it.
+    void DestroyEmitter(ParticleEmitter* emitter);
+
+    /// reserve a range of the particle buffers, and return its first particle. Called on the game thread.
+    uint32_t AllocateParticles(uint32_t numParticles);
+    void FreeParticles(uint32_t firstParticle, uint32_t numParticles);
+    /// number of particles the particle buffers need room for
+    uint32_t GetParticleCapacity() const { return this->pool.GetCapacity(); }
+    ParticlePool::Stats GetPoolStats() const { return this->pool.GetStats(); }
+    /// number of destroyed emitters that are waiting to be reused
+    uint32_t GetNumRecycledEmitters() const { return (uint32_t)this->recycledEmitters.size(); }
+    /// emitters and particles that were simulated and drawn in the last rendered frame, after culling and lod
+    uint32_t GetNumDrawnEmitters() const { return this->numDrawnEmitters; }
+    uint32_t GetNumDrawnParticles() const { return this->numDrawnParticles; }
+
 private:
-    std::vector<ParticleEmitter*> emitters;
     friend class RenderDevice;
+
+    /// grow the particle buffers to the capacity of the pool, keeping their contents
+    void ReserveBuffers(uint32_t capacity);
+    /// recycle or delete the emitters destroyed since the last sync. Called by RenderDevice while the render thread is idle.
+    void ReleaseDestroyedEmitters();
+
+    /// at most this many destroyed emitters are kept for reuse, the rest are deleted
+    static constexpr size_t MaxRecycledEmitters = 64;
+
+    std::vector<ParticleEmitter*> emitters;
+    std::vector<ParticleEmitter*> recycledEmitters;
+    /// destroyed since the last sync, the frame the render thread is drawing may still have them
+    std::vector<ParticleEmitter*> destroyedEmitters;
+    ParticlePool pool;
+    uint32_t nextEmitterId = 0;
+
     GLuint writeIndex = 0;
     Render::ShaderProgramId particleShaderId;
     Render::ShaderProgramId particleSimComputeShaderId;
-    GLuint emitterBlockUBO;
+
+    /// particles of all emitters, double buffered
+    GLuint bufPositions[2]; // position.xyz and scale
+    GLuint bufVelocities[2]; // velocity.xyz and lifetime
+    GLuint bufColors[2]; // rgba - TODO: alpha should use stippling
+    /// number of particles the buffers have room for
+    uint32_t bufferCapacity = 0;
+
+    /// GpuEmitter for every emitter that is drawn this frame
+    GLuint emitterTableBuffer;
+    size_t emitterTableCapacity = 0;
+    std::vector<GpuEmitter> emitterTable;
+
+    uint32_t numDrawnEmitters = 0;
+    uint32_t numDrawnParticles = 0;
 };
 
-}
\ No newline at end of file
+}
@@ -316,11 +316,7 @@ void VisualizeBVH()
 
 struct ColliderMesh
 {
-    struct Triangle
-    {
-        glm::vec3 vertices[3];
-        glm::vec3 normal;
-    };
+    using Triangle = ColliderTriangle;
     std::vector<Triangle> tris;
     float bSphereRadius;
 };
@@ -527,6 +523,31 @@ SetTransform(ColliderId collider, glm::mat4 const& transform)
     colliders.invTransforms[collider.index] = glm::inverse(transform);
 }
 
+//------------------------------------------------------------------------------
+/**
+*/
+void
+GetColliderGeometry(std::vector<ColliderGeometry>& geometry)
+{
+    geometry.clear();
+    int numColliders = (int)colliders.active.size();
+    for (int colliderIndex = 0; colliderIndex < numColliders; colliderIndex++)
+    {
+        if (!colliders.active[colliderIndex])
+            continue;
+
+        ColliderMesh const* const mesh = &meshes[colliders.meshes[colliderIndex].index];
+        glm::vec4 const& PS = colliders.positionsAndScales[colliderIndex];
+
+        ColliderGeometry g;
+        g.boundingSphere = glm::vec4(glm::vec3(PS), mesh->bSphereRadius * PS.w);
+        g.invTransform = colliders.invTransforms[colliderIndex];
+        g.triangles = mesh->tris.data();
+        g.numTriangles = mesh->tris.size();
+        geometry.push_back(g);
+    }
+}
+
 //------------------------------------------------------------------------------
 /**
     Cast ray from start point in direction. Make sure the direction is a unit vector.
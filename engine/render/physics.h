@@ -8,6 +8,7 @@
 */
 //------------------------------------------------------------------------------
 #include <string>
+#include <vector>
 
 namespace Physics
 {
@@ -79,6 +80,28 @@ struct ColliderMeshId
     const bool operator>(const ColliderMeshId& rhs) const { return index > rhs.index; }
 };
 
+struct ColliderTriangle
+{
+    glm::vec3 vertices[3];
+    glm::vec3 normal;
+};
+
+//------------------------------------------------------------------------------
+/**
+    Collider geometry for use outside of physics, for example as occluders.
+    The triangles are in model space. The transform is a copy, and collider
+    meshes are never unloaded or changed once loaded, so the geometry can be
+    read on another thread while the colliders change.
+*/
+struct ColliderGeometry
+{
+    /// world space center and radius
+    glm::vec4 boundingSphere;
+    glm::mat4 invTransform;
+    ColliderTriangle const* triangles;
+    size_t numTriangles;
+};
+
 struct RaycastPayload
 {
     bool hit = false;
@@ -95,6 +118,9 @@ ColliderMeshId LoadColliderMesh(std::string path);
 
 void SetTransform(ColliderId collider, glm::mat4 const& transform);
 
+/// get the geometry of all active colliders
+void GetColliderGeometry(std::vector<ColliderGeometry>& geometry);
+
 // temp
 void SetupBVH();
 void VisualizeBVH();
@@ -0,0 +1,299 @@
+//------------------------------------------------------------------------------
+//  @file renderbackend.cc
+//  @copyright (C) 2022 Individual contributors, see AUTHORS file
+//------------------------------------------------------------------------------
+#include "config.h"
+#define RENDER_BACKEND_IMPLEMENTATION
+#include "render/renderbackend.h"
+#include <cstring>
+#include <type_traits>
+
+namespace Render
+{
+namespace Backend
+{
+
+GL11Table gl11 = {
+#define RENDER_BACKEND_DRIVER(ret, name, params, args) &::gl##name,
+    RENDER_BACKEND_GL11_FUNCTIONS(RENDER_BACKEND_DRIVER)
+#undef RENDER_BACKEND_DRIVER
+};
+
+static Type type = Type::OpenGL;
+static Stats stats;
+static bool recording = false;
+static std::vector<Command> commands;
+
+/// last object name handed out by the null backend, shared by all object types
+static GLuint nullObjectName = 0;
+/// the null backend remembers the viewport, since RenderDevice reads it back
+static GLint nullViewport[4] = { 0, 0, 0, 0 };
+
+//------------------------------------------------------------------------------
+/**
+*/
+template<typename T> static void
+CaptureArg(Command& command, T arg)
+{
+    if constexpr (std::is_integral_v<T> || std::is_enum_v<T>)
+    {
+        if (command.numArgs < Command::MaxArgs)
+            command.args[command.numArgs++] = (int64_t)arg;
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+    Counts the call, and derives the draw and upload totals from its arguments.
+*/
+template<typename... ARGS> static void
+Record(Function function, ARGS... args)
+{
+    Command command;
+    command.function = function;
+    command.numArgs = 0;
+    (CaptureArg(command, args), ...);
+
+    stats.calls[function]++;
+    switch (function)
+    {
+    case FUNCTION_DrawElements:
+        stats.drawCalls++;
+        stats.vertices += command.args[1];
+        break;
+    case FUNCTION_DrawArrays:
+        stats.drawCalls++;
+        stats.vertices += command.args[2];
+        break;
+    case FUNCTION_DispatchCompute:
+        stats.dispatches++;
+        break;
+    case FUNCTION_BufferData:
+    case FUNCTION_NamedBufferData:
+        stats.bytesUploaded += command.args[1];
+        break;
+    case FUNCTION_NamedBufferSubData:
+        stats.bytesUploaded += command.args[2];
+        break;
+    default:
+        break;
+    }
+
+    if (recording)
+        commands.push_back(command);
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+static void
+GenerateNames(GLsizei n, GLuint* names)
+{
+    for (GLsizei i = 0; i < n; i++)
+        names[i] = ++nullObjectName;
+}
+
+//------------------------------------------------------------------------------
+/**
+    Null implementations that have to return something sensible.
+*/
+namespace Null
+{
+
+static void GLAPIENTRY GenTextures(GLsizei n, GLuint* textures) { Record(FUNCTION_GenTextures, n); GenerateNames(n, textures); }
+static void GLAPIENTRY GenBuffers(GLsizei n, GLuint* buffers) { Record(FUNCTION_GenBuffers, n); GenerateNames(n, buffers); }
+static void GLAPIENTRY CreateBuffers(GLsizei n, GLuint* buffers) { Record(FUNCTION_CreateBuffers, n); GenerateNames(n, buffers); }
+static void GLAPIENTRY GenVertexArrays(GLsizei n, GLuint* arrays) { Record(FUNCTION_GenVertexArrays, n); GenerateNames(n, arrays); }
+static void GLAPIENTRY GenFramebuffers(GLsizei n, GLuint* framebuffers) { Record(FUNCTION_GenFramebuffers, n); GenerateNames(n, framebuffers); }
+static void GLAPIENTRY GenQueries(GLsizei n, GLuint* ids) { Record(FUNCTION_GenQueries, n); GenerateNames(n, ids); }
+static GLuint GLAPIENTRY CreateShader(GLenum shaderType) { Record(FUNCTION_CreateShader, shaderType); return ++nullObjectName; }
+static GLuint GLAPIENTRY CreateProgram() { Record(FUNCTION_CreateProgram); return ++nullObjectName; }
+static GLint GLAPIENTRY GetUniformLocation(GLuint program, const GLchar*) { Record(FUNCTION_GetUniformLocation, program); return -1; }
+static GLenum GLAPIENTRY CheckFramebufferStatus(GLenum target) { Record(FUNCTION_CheckFramebufferStatus, target); return GL_FRAMEBUFFER_COMPLETE; }
+static const GLubyte* GLAPIENTRY GetString(GLenum name) { Record(FUNCTION_GetString, name); return (const GLubyte*)"Null"; }
+
+static void GLAPIENTRY
+Viewport(GLint x, GLint y, GLsizei width, GLsizei height)
+{
+    Record(FUNCTION_Viewport, x, y, width, height);
+    nullViewport[0] = x;
+    nullViewport[1] = y;
+    nullViewport[2] = width;
+    nullViewport[3] = height;
+}
+
+static void GLAPIENTRY
+GetIntegerv(GLenum pname, GLint* params)
+{
+    Record(FUNCTION_GetIntegerv, pname);
+    if (pname == GL_VIEWPORT)
+        memcpy(params, nullViewport, sizeof(nullViewport));
+    else
+        params[0] = 0;
+}
+
+// compile and link status are GL_TRUE, info logs are empty
+static void GLAPIENTRY GetShaderiv(GLuint shader, GLenum pname, GLint* param) { Record(FUNCTION_GetShaderiv, shader, pname); *param = pname == GL_INFO_LOG_LENGTH ? 0 : GL_TRUE; }
+static void GLAPIENTRY GetProgramiv(GLuint program, GLenum pname, GLint* param) { Record(FUNCTION_GetProgramiv, program, pname); *param = pname == GL_INFO_LOG_LENGTH ? 0 : GL_TRUE; }
+
+static void GLAPIENTRY
+GetShaderInfoLog(GLuint shader, GLsizei bufSize, GLsizei* length, GLchar* infoLog)
+{
+    Record(FUNCTION_GetShaderInfoLog, shader);
+    if (length != nullptr)
+        *length = 0;
+    if (bufSize > 0)
+        infoLog[0] = '\0';
+}
+
+static void GLAPIENTRY
+GetProgramInfoLog(GLuint program, GLsizei bufSize, GLsizei* length, GLchar* infoLog)
+{
+    Record(FUNCTION_GetProgramInfoLog, program);
+    if (length != nullptr)
+        *length = 0;
+    if (bufSize > 0)
+        infoLog[0] = '\0';
+}
+
+} // namespace Null
+
+//------------------------------------------------------------------------------
+/**
+    Every other entry point only records the call. Functions with special
+    implementations above get a generic one too, which is never installed.
+*/
+namespace NullGeneric
+{
+
+template<typename RET> static RET
+DefaultResult()
+{
+    if constexpr (!std::is_void_v<RET>)
+        return RET{};
+}
+
+#define RENDER_BACKEND_GENERIC(ret, name, params, args) \
+    static ret GLAPIENTRY name params { Record args_with_function(FUNCTION_##name, args); return DefaultResult<ret>(); }
+#define args_with_function(function, args) (function RENDER_BACKEND_EXPAND_ARGS args)
+#define RENDER_BACKEND_EXPAND_ARGS(...) __VA_OPT__(,) __VA_ARGS__
+RENDER_BACKEND_GL11_FUNCTIONS(RENDER_BACKEND_GENERIC)
+RENDER_BACKEND_GLEW_FUNCTIONS(RENDER_BACKEND_GENERIC)
+#undef RENDER_BACKEND_EXPAND_ARGS
+#undef args_with_function
+#undef RENDER_BACKEND_GENERIC
+
+} // namespace NullGeneric
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+Init(Type newType)
+{
+    if (newType == type)
+        return;
+
+    n_assert2(newType == Type::Null, "The null backend can't be switched back to OpenGL");
+    type = newType;
+
+    // generic recording stubs for everything, then the special ones on top
+#define RENDER_BACKEND_INSTALL_GL11(ret, name, params, args) gl11.name = &NullGeneric::name;
+#define RENDER_BACKEND_INSTALL_GLEW(ret, name, params, args) __glew##name = &NullGeneric::name;
+    RENDER_BACKEND_GL11_FUNCTIONS(RENDER_BACKEND_INSTALL_GL11)
+    RENDER_BACKEND_GLEW_FUNCTIONS(RENDER_BACKEND_INSTALL_GLEW)
+#undef RENDER_BACKEND_INSTALL_GL11
+#undef RENDER_BACKEND_INSTALL_GLEW
+
+    gl11.GenTextures = &Null::GenTextures;
+    gl11.GetString = &Null::GetString;
+    gl11.Viewport = &Null::Viewport;
+    gl11.GetIntegerv = &Null::GetIntegerv;
+    __glewGenBuffers = &Null::GenBuffers;
+    __glewCreateBuffers = &Null::CreateBuffers;
+    __glewGenVertexArrays = &Null::GenVertexArrays;
+    __glewGenFramebuffers = &Null::GenFramebuffers;
+    __glewGenQueries = &Null::GenQueries;
+    __glewCreateShader = &Null::CreateShader;
+    __glewCreateProgram = &Null::CreateProgram;
+    __glewGetUniformLocation = &Null::GetUniformLocation;
+    __glewCheckFramebufferStatus = &Null::CheckFramebufferStatus;
+    __glewGetShaderiv = &Null::GetShaderiv;
+    __glewGetProgramiv = &Null::GetProgramiv;
+    __glewGetShaderInfoLog = &Null::GetShaderInfoLog;
+    __glewGetProgramInfoLog = &Null::GetProgramInfoLog;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+Type
+GetType()
+{
+    return type;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+bool
+IsHeadless()
+{
+    return type == Type::Null;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+Stats const&
+GetStats()
+{
+    return stats;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+ResetStats()
+{
+    stats = Stats();
+    commands.clear();
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+SetRecording(bool enabled)
+{
+    recording = enabled;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+std::vector<Command> const&
+GetCommands()
+{
+    return commands;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+char const*
+GetFunctionName(Function function)
+{
+    static char const* const names[NUM_FUNCTIONS] = {
+#define RENDER_BACKEND_NAME(ret, name, params, args) "gl" #name,
+        RENDER_BACKEND_GL11_FUNCTIONS(RENDER_BACKEND_NAME)
+        RENDER_BACKEND_GLEW_FUNCTIONS(RENDER_BACKEND_NAME)
+#undef RENDER_BACKEND_NAME
+    };
+    n_assert(function < NUM_FUNCTIONS);
+    return names[function];
+}
+
+} // namespace Backend
+} // namespace Render
@@ -0,0 +1,214 @@
+#pragma once
+//------------------------------------------------------------------------------
+/**
+    @file renderbackend.h
+
+    Thin layer between the renderer and OpenGL.
+
+    With the OpenGL backend every GL call goes straight to the driver. The null
+    backend replaces every GL entry point the engine uses with a stub that
+    records the call and its integer arguments, hands out object names, and
+    reports every shader and framebuffer as complete. That way the CPU side of
+    a frame (resource loading, culling, command building, light and particle
+    bookkeeping) runs without a window or GL context, for headless profiling
+    and regression tests.
+
+    Entry points from GL 1.2 and later are redirected through the GLEW function
+    pointers. GL 1.1 entry points are linked directly, so this header redirects
+    them with macros. Include it instead of GL/glew.h in code that calls GL.
+    GL functions that the engine starts to use must be added to the lists below,
+    or they are null pointers in the null backend.
+
+    @copyright
+    (C) 2022 Individual contributors, see AUTHORS file
+*/
+//------------------------------------------------------------------------------
+#include "GL/glew.h"
+#include <vector>
+
+// GL 1.1 entry points: X(return type, name, parameters, arguments)
+#define RENDER_BACKEND_GL11_FUNCTIONS(X) \
+    X(void, BindTexture, (GLenum target, GLuint texture), (target, texture)) \
+    X(void, TexParameteri, (GLenum target, GLenum pname, GLint param), (target, pname, param)) \
+    X(void, Enable, (GLenum cap), (cap)) \
+    X(void, Disable, (GLenum cap), (cap)) \
+    X(void, TexImage2D, (GLenum target, GLint level, GLint internalformat, GLsizei width, GLsizei height, GLint border, GLenum format, GLenum type, const void* pixels), (target, level, internalformat, width, height, border, format, type, pixels)) \
+    X(void, GenTextures, (GLsizei n, GLuint* textures), (n, textures)) \
+    X(void, DepthFunc, (GLenum func), (func)) \
+    X(void, Viewport, (GLint x, GLint y, GLsizei width, GLsizei height), (x, y, width, height)) \
+    X(void, PolygonMode, (GLenum face, GLenum mode), (face, mode)) \
+    X(void, DrawElements, (GLenum mode, GLsizei count, GLenum type, const void* indices), (mode, count, type, indices)) \
+    X(void, Clear, (GLbitfield mask), (mask)) \
+    X(void, DrawArrays, (GLenum mode, GLint first, GLsizei count), (mode, first, count)) \
+    X(void, DepthRange, (GLclampd zNear, GLclampd zFar), (zNear, zFar)) \
+    X(void, CullFace, (GLenum mode), (mode)) \
+    X(void, PixelStorei, (GLenum pname, GLint param), (pname, param)) \
+    X(void, ReadBuffer, (GLenum mode), (mode)) \
+    X(void, LineWidth, (GLfloat width), (width)) \
+    X(const GLubyte*, GetString, (GLenum name), (name)) \
+    X(void, DrawBuffer, (GLenum mode), (mode)) \
+    X(void, ColorMask, (GLboolean red, GLboolean green, GLboolean blue, GLboolean alpha), (red, green, blue, alpha)) \
+    X(void, ClearColor, (GLclampf red, GLclampf green, GLclampf blue, GLclampf alpha), (red, green, blue, alpha)) \
+    X(void, GetIntegerv, (GLenum pname, GLint* params), (pname, params)) \
+    X(void, DeleteTextures, (GLsizei n, const GLuint* textures), (n, textures)) \
+    X(void, BlendFunc, (GLenum sfactor, GLenum dfactor), (sfactor, dfactor)) \
+    X(void, DepthMask, (GLboolean flag), (flag))
+
+// GL 1.2+ entry points, loaded by GLEW
+#define RENDER_BACKEND_GLEW_FUNCTIONS(X) \
+    X(GLint, GetUniformLocation, (GLuint program, const GLchar* name), (program, name)) \
+    X(void, BindVertexArray, (GLuint array), (array)) \
+    X(void, BindBuffer, (GLenum target, GLuint buffer), (target, buffer)) \
+    X(void, UniformMatrix4fv, (GLint location, GLsizei count, GLboolean transpose, const GLfloat* value), (location, count, transpose, value)) \
+    X(void, BufferData, (GLenum target, GLsizeiptr size, const void* data, GLenum usage), (target, size, data, usage)) \
+    X(void, BindFramebuffer, (GLenum target, GLuint framebuffer), (target, framebuffer)) \
+    X(void, Uniform4fv, (GLint location, GLsizei count, const GLfloat* value), (location, count, value)) \
+    X(void, UseProgram, (GLuint program), (program)) \
+    X(void, GenBuffers, (GLsizei n, GLuint* buffers), (n, buffers)) \
+    X(void, BindBufferBase, (GLenum target, GLuint index, GLuint buffer), (target, index, buffer)) \
+    X(void, Uniform1f, (GLint location, GLfloat v0), (location, v0)) \
+    X(void, Uniform1i, (GLint location, GLint v0), (location, v0)) \
+    X(void, VertexAttribPointer, (GLuint index, GLint size, GLenum type, GLboolean normalized, GLsizei stride, const void* pointer), (index, size, type, normalized, stride, pointer)) \
+    X(void, NamedBufferSubData, (GLuint buffer, GLintptr offset, GLsizeiptr size, const void* data), (buffer, offset, size, data)) \
+    X(void, GenVertexArrays, (GLsizei n, GLuint* arrays), (n, arrays)) \
+    X(void, ActiveTexture, (GLenum texture), (texture)) \
+    X(void, Uniform3fv, (GLint location, GLsizei count, const GLfloat* value), (location, count, value)) \
+    X(void, NamedBufferData, (GLuint buffer, GLsizeiptr size, const void* data, GLenum usage), (buffer, size, data, usage)) \
+    X(void, GenerateMipmap, (GLenum target), (target)) \
+    X(void, EnableVertexAttribArray, (GLuint index), (index)) \
+    X(void, DeleteBuffers, (GLsizei n, const GLuint* buffers), (n, buffers)) \
+    X(void, ShaderSource, (GLuint shader, GLsizei count, const GLchar* const* string, const GLint* length), (shader, count, string, length)) \
+    X(void, GenFramebuffers, (GLsizei n, GLuint* framebuffers), (n, framebuffers)) \
+    X(void, DeleteShader, (GLuint shader), (shader)) \
+    X(GLuint, CreateShader, (GLenum type), (type)) \
+    X(void, CompileShader, (GLuint shader), (shader)) \
+    X(void, AttachShader, (GLuint program, GLuint shader), (program, shader)) \
+    X(void, TexImage3D, (GLenum target, GLint level, GLint internalFormat, GLsizei width, GLsizei height, GLsizei depth, GLint border, GLenum format, GLenum type, const void* pixels), (target, level, internalFormat, width, height, depth, border, format, type, pixels)) \
+    X(void, LinkProgram, (GLuint program), (program)) \
+    X(void, FramebufferTextureLayer, (GLenum target, GLenum attachment, GLuint texture, GLint level, GLint layer), (target, attachment, texture, level, layer)) \
+    X(void, FramebufferTexture, (GLenum target, GLenum attachment, GLuint texture, GLint level), (target, attachment, texture, level)) \
+    X(void, DeleteProgram, (GLuint program), (program)) \
+    X(GLuint, CreateProgram, (void), ()) \
+    X(void, Uniform4ui, (GLint location, GLuint v0, GLuint v1, GLuint v2, GLuint v3), (location, v0, v1, v2, v3)) \
+    X(void, Uniform4f, (GLint location, GLfloat v0, GLfloat v1, GLfloat v2, GLfloat v3), (location, v0, v1, v2, v3)) \
+    X(void, Uniform3ui, (GLint location, GLuint v0, GLuint v1, GLuint v2), (location, v0, v1, v2)) \
+    X(void, Uniform1ui, (GLint location, GLuint v0), (location, v0)) \
+    X(void, GetShaderiv, (GLuint shader, GLenum pname, GLint* param), (shader, pname, param)) \
+    X(void, GetShaderInfoLog, (GLuint shader, GLsizei bufSize, GLsizei* length, GLchar* infoLog), (shader, bufSize, length, infoLog)) \
+    X(void, GetProgramiv, (GLuint program, GLenum pname, GLint* param), (program, pname, param)) \
+    X(void, GetProgramInfoLog, (GLuint program, GLsizei bufSize, GLsizei* length, GLchar* infoLog), (program, bufSize, length, infoLog)) \
+    X(void, GetActiveUniform, (GLuint program, GLuint index, GLsizei bufSize, GLsizei* length, GLint* size, GLenum* type, GLchar* name), (program, index, bufSize, length, size, type, name)) \
+    X(void, EnableVertexArrayAttrib, (GLuint vaobj, GLuint index), (vaobj, index)) \
+    X(void, DrawBuffers, (GLsizei n, const GLenum* bufs), (n, bufs)) \
+    X(void, DispatchCompute, (GLuint num_groups_x, GLuint num_groups_y, GLuint num_groups_z), (num_groups_x, num_groups_y, num_groups_z)) \
+    X(void, DebugMessageControl, (GLenum source, GLenum type, GLenum severity, GLsizei count, const GLuint* ids, GLboolean enabled), (source, type, severity, count, ids, enabled)) \
+    X(void, DebugMessageCallback, (GLDEBUGPROC callback, const void* userParam), (callback, userParam)) \
+    X(void, CreateBuffers, (GLsizei n, GLuint* buffers), (n, buffers)) \
+    X(void, CopyNamedBufferSubData, (GLuint readBuffer, GLuint writeBuffer, GLintptr readOffset, GLintptr writeOffset, GLsizeiptr size), (readBuffer, writeBuffer, readOffset, writeOffset, size)) \
+    X(void, MemoryBarrier, (GLbitfield barriers), (barriers)) \
+    X(void, DrawElementsInstanced, (GLenum mode, GLsizei count, GLenum type, const void* indices, GLsizei instancecount), (mode, count, type, indices, instancecount)) \
+    X(void, CopyImageSubData, (GLuint srcName, GLenum srcTarget, GLint srcLevel, GLint srcX, GLint srcY, GLint srcZ, GLuint dstName, GLenum dstTarget, GLint dstLevel, GLint dstX, GLint dstY, GLint dstZ, GLsizei srcWidth, GLsizei srcHeight, GLsizei srcDepth), (srcName, srcTarget, srcLevel, srcX, srcY, srcZ, dstName, dstTarget, dstLevel, dstX, dstY, dstZ, srcWidth, srcHeight, srcDepth)) \
+    X(GLenum, CheckFramebufferStatus, (GLenum target), (target)) \
+    X(void, BlitNamedFramebuffer, (GLuint readFramebuffer, GLuint drawFramebuffer, GLint srcX0, GLint srcY0, GLint srcX1, GLint srcY1, GLint dstX0, GLint dstY0, GLint dstX1, GLint dstY1, GLbitfield mask, GLenum filter), (readFramebuffer, drawFramebuffer, srcX0, srcY0, srcX1, srcY1, dstX0, dstY0, dstX1, dstY1, mask, filter)) \
+    X(void, DeleteFramebuffers, (GLsizei n, const GLuint* framebuffers), (n, framebuffers)) \
+    X(void, GenQueries, (GLsizei n, GLuint* ids), (n, ids)) \
+    X(void, BeginQuery, (GLenum target, GLuint id), (target, id)) \
+    X(void, EndQuery, (GLenum target), (target)) \
+    X(void, GetQueryObjectiv, (GLuint id, GLenum pname, GLint* params), (id, pname, params)) \
+    X(void, GetQueryObjectui64v, (GLuint id, GLenum pname, GLuint64* params), (id, pname, params)) \
+    X(void, TextureParameteri, (GLuint texture, GLenum pname, GLint param), (texture, pname, param))
+
+namespace Render
+{
+namespace Backend
+{
+
+enum class Type
+{
+    OpenGL,
+    Null
+};
+
+enum Function : uint16_t
+{
+#define RENDER_BACKEND_ENUM(ret, name, params, args) FUNCTION_##name,
+    RENDER_BACKEND_GL11_FUNCTIONS(RENDER_BACKEND_ENUM)
+    RENDER_BACKEND_GLEW_FUNCTIONS(RENDER_BACKEND_ENUM)
+#undef RENDER_BACKEND_ENUM
+    NUM_FUNCTIONS
+};
+
+/// one recorded call with its first integer arguments
+struct Command
+{
+    static constexpr uint32_t MaxArgs = 4;
+
+    Function function;
+    uint8_t numArgs;
+    int64_t args[MaxArgs];
+};
+
+/// calls since the last ResetStats. Only collected by the null backend.
+struct Stats
+{
+    uint64_t calls[NUM_FUNCTIONS] = {};
+    uint64_t drawCalls = 0;
+    /// indices or vertices submitted by draw calls
+    uint64_t vertices = 0;
+    uint64_t dispatches = 0;
+    uint64_t bytesUploaded = 0;
+};
+
+/// Selects the backend. The null backend must be selected before a window is
+/// opened or any resource is created, and can't be switched back.
+void Init(Type type);
+Type GetType();
+/// true when running without a GL context
+bool IsHeadless();
+
+Stats const& GetStats();
+void ResetStats();
+/// Records every call of the null backend into a command list, which is cleared by ResetStats.
+void SetRecording(bool enabled);
+std::vector<Command> const& GetCommands();
+char const* GetFunctionName(Function function);
+
+/// GL 1.1 entry points of the active backend
+struct GL11Table
+{
+#define RENDER_BACKEND_MEMBER(ret, name, params, args) ret (GLAPIENTRY* name) params;
+    RENDER_BACKEND_GL11_FUNCTIONS(RENDER_BACKEND_MEMBER)
+#undef RENDER_BACKEND_MEMBER
+};
+extern GL11Table gl11;
+
+} // namespace Backend
+} // namespace Render
+
+#ifndef RENDER_BACKEND_IMPLEMENTATION
+#define glBindTexture Render::Backend::gl11.BindTexture
+#define glTexParameteri Render::Backend::gl11.TexParameteri
+#define glEnable Render::Backend::gl11.Enable
+#define glDisable Render::Backend::gl11.Disable
+#define glTexImage2D Render::Backend::gl11.TexImage2D
+#define glGenTextures Render::Backend::gl11.GenTextures
+#define glDepthFunc Render::Backend::gl11.DepthFunc
+#define glViewport Render::Backend::gl11.Viewport
+#define glPolygonMode Render::Backend::gl11.PolygonMode
+#define glDrawElements Render::Backend::gl11.DrawElements
+#define glClear Render::Backend::gl11.Clear
+#define glDrawArrays Render::Backend::gl11.DrawArrays
+#define glDepthRange Render::Backend::gl11.DepthRange
+#define glCullFace Render::Backend::gl11.CullFace
+#define glPixelStorei Render::Backend::gl11.PixelStorei
+#define glReadBuffer Render::Backend::gl11.ReadBuffer
+#define glLineWidth Render::Backend::gl11.LineWidth
+#define glGetString Render::Backend::gl11.GetString
+#define glDrawBuffer Render::Backend::gl11.DrawBuffer
+#define glColorMask Render::Backend::gl11.ColorMask
+#define glClearColor Render::Backend::gl11.ClearColor
+#define glGetIntegerv Render::Backend::gl11.GetIntegerv
+#define glDeleteTextures Render::Backend::gl11.DeleteTextures
+#define glBlendFunc Render::Backend::gl11.BlendFunc
+#define glDepthMask Render::Backend::gl11.DepthMask
+#endif
@@ -7,6 +7,7 @@
 #include "model.h"
 #include "textureresource.h"
 #include "shaderresource.h"
+#include "glstate.h"
 #include "lightserver.h"
 #include "cameramanager.h"
 #include "debugrender.h"
@@ -15,6 +16,14 @@
 #include "core/cvar.h"
 #include "core/random.h"
 #include "particlesystem.h"
+#include "particlesim.h"
+#include "occlusionbuffer.h"
+#include "physics.h"
+#include "core/jobsystem.h"
+#include "core/framearena.h"
+#include <algorithm>
+#include <bit>
+#include <cstring>
 
 namespace Render
 {
@@ -23,22 +32,119 @@ Render::ShaderProgramId directionalLightProgram;
 Render::ShaderProgramId pointlightProgram;
 Render::ShaderProgramId staticGeometryProgram;
 Render::ShaderProgramId staticShadowProgram;
+Render::ShaderProgramId staticDepthProgram;
 Render::ShaderProgramId skyboxProgram;
-Render::ShaderProgramId lightCullingProgram;
+Render::ShaderProgramId finalizeProgram;
 
 GLuint fullscreenQuadVB;
 GLuint fullscreenQuadVAO;
 
+static OcclusionBuffer occlusionBuffer;
+static std::vector<OcclusionBuffer::Occluder> occluders;
+static Core::CVar* r_occlusion_culling = nullptr;
+static Core::CVar* r_occlusion_max_occluders = nullptr;
+static Core::CVar* r_lod_bias = nullptr;
+static Core::CVar* r_render_thread = nullptr;
+static Core::CVar* r_transparent_sort_per_object = nullptr;
+static Core::CVar* r_light_format = nullptr;
+static Core::CVar* r_tonemap = nullptr;
+static Core::CVar* r_exposure = nullptr;
+static Core::CVar* r_particles_cpu = nullptr;
+static Core::CVar* r_particle_culling = nullptr;
+static Core::CVar* r_particle_budget = nullptr;
+static Core::CVar* r_particle_lod_size = nullptr;
+
+static constexpr uint64_t FnvOffsetBasis = 14695981039346656037ull;
+
+//------------------------------------------------------------------------------
+/**
+    FNV-1a, used to detect when the casters of the shadow cache or a cascade change.
+*/
+static void
+HashBytes(uint64_t& hash, void const* data, size_t size)
+{
+    for (size_t b = 0; b < size; b++)
+        hash = (hash ^ ((uint8_t const*)data)[b]) * 1099511628211ull;
+}
+
+//------------------------------------------------------------------------------
+/**
+    Uniforms that shd/vertexdecode.glsl needs to decode compressed vertices.
+*/
+struct VertexDecodeLocations
+{
+    GLint positionScale;
+    GLint positionOffset;
+    GLint octahedralNormals;
+};
+
+//------------------------------------------------------------------------------
+/**
+*/
+static VertexDecodeLocations
+GetVertexDecodeLocations(ShaderProgramId program)
+{
+    return {
+        ShaderResource::GetUniformLocation(program, "PositionScale"),
+        ShaderResource::GetUniformLocation(program, "PositionOffset"),
+        ShaderResource::GetUniformLocation(program, "OctahedralNormals")
+    };
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+static void
+SetVertexDecodeUniforms(VertexDecodeLocations const& locations, Model::Mesh::Primitive const& primitive)
+{
+    glUniform3fv(locations.positionScale, 1, &primitive.positionScale[0]);
+    glUniform3fv(locations.positionOffset, 1, &primitive.positionOffset[0]);
+    glUniform1i(locations.octahedralNormals, primitive.octahedralNormals ? 1 : 0);
+}
+
+//------------------------------------------------------------------------------
+/**
+    Format of the HDR light target. R11G11B10F is a quarter of the size of
+    RGBA32F, and has no alpha channel, which no pass blends against.
+*/
+static GLenum
+GetLightFormat()
+{
+    char const* format = Core::CVarReadString(r_light_format);
+    if (strcmp(format, "rgba32f") == 0)
+        return GL_RGBA32F;
+    if (strcmp(format, "rgba16f") == 0)
+        return GL_RGBA16F;
+    return GL_R11F_G11F_B10F;
+}
+
 //------------------------------------------------------------------------------
 /**
 */
 RenderDevice::RenderDevice() :
-    frameSizeW(1024),
-    frameSizeH(1024)
+    frameSizeW(0),
+    frameSizeH(0)
 {
     // empty
 }
 
+//------------------------------------------------------------------------------
+/**
+    Only stops the thread, the window may be gone by now.
+*/
+RenderDevice::~RenderDevice()
+{
+    if (this->renderThread.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(this->renderMutex);
+            this->stopRenderThread = true;
+        }
+        this->renderCondition.notify_all();
+        this->renderThread.join();
+    }
+}
+
 void SetupFullscreenQuad()
 {
     const float verts[] = {
@@ -49,14 +155,14 @@ void SetupFullscreenQuad()
     
     glGenBuffers(1, &fullscreenQuadVB);
     glGenVertexArrays(1, &fullscreenQuadVAO);
-    glBindVertexArray(fullscreenQuadVAO);
+    GLState::BindVertexArray(fullscreenQuadVAO);
     glBindBuffer(GL_ARRAY_BUFFER, fullscreenQuadVB);
     glBufferData(GL_ARRAY_BUFFER, sizeof(verts), (void*)&verts, GL_STATIC_DRAW);
     
     glEnableVertexArrayAttrib(fullscreenQuadVAO, 0);
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, nullptr);
     
-    glBindVertexArray(0);
+    GLState::BindVertexArray(0);
     glBindBuffer(GL_ARRAY_BUFFER, 0);
 }
 
@@ -64,6 +170,8 @@ void RenderDevice::Init()
 {
     RenderDevice::Instance();
     CameraManager::Create();
+    // the light server loads a model
+    InitializeModels();
     LightServer::Initialize();
     TextureResource::Create();
     
@@ -80,6 +188,10 @@ void RenderDevice::Init()
         auto fs = Render::ShaderResource::LoadShader(Render::ShaderResource::ShaderType::FRAGMENTSHADER, "shd/fs_static_shadow.glsl");
         staticShadowProgram = Render::ShaderResource::CompileShaderProgram({ vs, fs });
     }
+    {
+        auto vs = Render::ShaderResource::LoadShader(Render::ShaderResource::ShaderType::VERTEXSHADER, "shd/vs_static_depth.glsl");
+        staticDepthProgram = Render::ShaderResource::CompileShaderProgram({ vs });
+    }
     {
         auto vs = Render::ShaderResource::LoadShader(Render::ShaderResource::ShaderType::VERTEXSHADER, "shd/vs_skybox.glsl");
         auto fs = Render::ShaderResource::LoadShader(Render::ShaderResource::ShaderType::FRAGMENTSHADER, "shd/fs_skybox.glsl");
@@ -90,133 +202,304 @@ void RenderDevice::Init()
         auto fs = Render::ShaderResource::LoadShader(Render::ShaderResource::ShaderType::FRAGMENTSHADER, "shd/fs_directional_light.glsl");
         directionalLightProgram = Render::ShaderResource::CompileShaderProgram({ vs, fs });
     }
+    {
+        auto vs = Render::ShaderResource::LoadShader(Render::ShaderResource::ShaderType::VERTEXSHADER, "shd/vs_fullscreen.glsl");
+        auto fs = Render::ShaderResource::LoadShader(Render::ShaderResource::ShaderType::FRAGMENTSHADER, "shd/fs_finalize.glsl");
+        finalizeProgram = Render::ShaderResource::CompileShaderProgram({ vs, fs });
+    }
     {
         auto vs = Render::ShaderResource::LoadShader(Render::ShaderResource::ShaderType::VERTEXSHADER, "shd/vs_pointlight.glsl");
         auto fs = Render::ShaderResource::LoadShader(Render::ShaderResource::ShaderType::FRAGMENTSHADER, "shd/fs_pointlight.glsl");
         pointlightProgram = Render::ShaderResource::CompileShaderProgram({ vs, fs });
     }
+
+    ParticleSystem::Instance()->Initialize();
+
+    Debug::InitDebugRendering();
+
+    Instance()->dynamicResolution.Setup();
+
+    r_occlusion_culling = Core::CVarCreate(Core::CVarType::CVar_Int, "r_occlusion_culling", "1");
+    r_occlusion_max_occluders = Core::CVarCreate(Core::CVarType::CVar_Int, "r_occlusion_max_occluders", "24");
+    r_lod_bias = Core::CVarCreate(Core::CVarType::CVar_Float, "r_lod_bias", "0");
+    r_render_thread = Core::CVarCreate(Core::CVarType::CVar_Int, "r_render_thread", "1");
+    r_transparent_sort_per_object = Core::CVarCreate(Core::CVarType::CVar_Int, "r_transparent_sort_per_object", "0");
+    r_light_format = Core::CVarCreate(Core::CVarType::CVar_String, "r_light_format", "r11g11b10f");
+    r_tonemap = Core::CVarCreate(Core::CVarType::CVar_Int, "r_tonemap", "2");
+    r_exposure = Core::CVarCreate(Core::CVarType::CVar_Float, "r_exposure", "1");
+    // simulate particles on the CPU and upload them, instead of running the simulation shader
+    r_particles_cpu = Core::CVarCreate(Core::CVarType::CVar_Int, "r_particles_cpu", "0");
+    r_particle_culling = Core::CVarCreate(Core::CVarType::CVar_Int, "r_particle_culling", "1");
+    // maximum number of particles simulated and drawn per frame, 0 for no limit
+    r_particle_budget = Core::CVarCreate(Core::CVarType::CVar_Int, "r_particle_budget", "262144");
+    // screen size, as a fraction of half the screen height, below which emitters start losing particles. 0 turns the lod off.
+    r_particle_lod_size = Core::CVarCreate(Core::CVarType::CVar_Float, "r_particle_lod_size", "0.25");
+}
+
+void RenderDevice::Draw(ModelId model, glm::mat4 localToWorld, uint32_t flags)
+{
+    Instance()->gameFrame.drawCommands.push_back({ model, localToWorld, flags, true, 0 });
+}
+
+//------------------------------------------------------------------------------
+/**
+    Casters overlapping the cascade in x and y, that are not behind the slice.
+*/
+float
+RenderDevice::CullShadowCasters(uint cascadeIndex, uint32_t flagMask, uint32_t flags, CommandList& list)
+{
+    LightServer::ShadowCascade const& cascade = LightServer::GetShadowCascade(cascadeIndex);
+    list.Clear();
+    float casterMaxZ = cascade.boundsMax.z;
+    for (uint32_t i = 0; i < (uint32_t)this->renderFrame.drawCommands.size(); i++)
     {
-        auto cs = Render::ShaderResource::LoadShader(Render::ShaderResource::ShaderType::COMPUTESHADER, "shd/cs_lightculling.glsl");
-        lightCullingProgram = Render::ShaderResource::CompileShaderProgram({ cs });
+        if ((this->renderFrame.drawCommands[i].flags & flagMask) != flags)
+            continue;
+
+        ShadowCasterBounds const& bounds = this->shadowCasterBounds[i];
+        if (bounds.valid)
+        {
+            glm::vec3 const lo = bounds.center - bounds.extents;
+            glm::vec3 const hi = bounds.center + bounds.extents;
+            if (hi.x < cascade.boundsMin.x || lo.x > cascade.boundsMax.x ||
+                hi.y < cascade.boundsMin.y || lo.y > cascade.boundsMax.y ||
+                hi.z < cascade.boundsMin.z)
+                continue;
+            casterMaxZ = glm::max(casterMaxZ, hi.z);
+        }
+        list.Add(i);
     }
-    GLint dims[4] = { 0 };
-    glGetIntegerv(GL_VIEWPORT, dims);
-    // default viewport extents
-    GLint fbWidth = dims[2];
-    GLint fbHeight = dims[3];
-    
-    // Setup drawing buffers
-    glGenFramebuffers(1, &Instance()->forwardFrameBuffer);
-    glBindFramebuffer(GL_FRAMEBUFFER, Instance()->forwardFrameBuffer );
+    return casterMaxZ;
+}
 
-    glGenTextures(2, Instance()->renderTargets.RT);
+//------------------------------------------------------------------------------
+/**
+    Opaque primitives are drawn first, with a program that has no fragment
+    shader and their position only vao. Alpha masked primitives follow with
+    the program that samples the base color to discard with. The model matrix
+    is only uploaded when the packet belongs to another draw command than the
+    previous one, and culling follows the materials' doubleSided, so the
+    depth matches what the forward pass draws.
+*/
+void
+RenderDevice::SubmitDepthPackets(CommandList const& list, glm::mat4 const& viewProjection)
+{
+    GLState::UseProgram(Render::ShaderResource::GetProgramHandle(staticDepthProgram));
+    glUniformMatrix4fv(ShaderResource::GetUniformLocation(staticDepthProgram, "ViewProjection"), 1, false, &viewProjection[0][0]);
+    GLint modelLocation = ShaderResource::GetUniformLocation(staticDepthProgram, "Model");
+    VertexDecodeLocations vertexDecodeLocations = GetVertexDecodeLocations(staticDepthProgram);
+
+    bool hasMasked = false;
+    uint32_t currentDrawCommand = UINT32_MAX;
+    list.ForEachPacket([&](DrawPacket const& packet)
+    {
+        Model::Mesh::Primitive const& primitive = GetModel(packet.model).meshes[packet.mesh].primitives[packet.primitive];
+        if (primitive.material.alphaMode == Model::Material::AlphaMode::Mask)
+        {
+            hasMasked = true;
+            return;
+        }
 
-    glBindTexture(GL_TEXTURE_2D, Instance()->renderTargets.light);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, fbWidth, fbHeight, 0, GL_RGBA, GL_FLOAT, 0);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    
-    glBindTexture(GL_TEXTURE_2D, Instance()->renderTargets.normal);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16F, fbWidth, fbHeight, 0, GL_RG, GL_FLOAT, 0);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    
-    glGenTextures(1, &Instance()->depthStencilBuffer);
-    glBindTexture(GL_TEXTURE_2D, Instance()->depthStencilBuffer);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT32F, fbWidth, fbHeight, 0, GL_DEPTH_COMPONENT, GL_FLOAT, 0);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    
-    glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, Instance()->renderTargets.light, 0);
-    glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, Instance()->depthStencilBuffer, 0);
-    
-    const GLenum drawbuffers[1] = { GL_COLOR_ATTACHMENT0 };
-    glDrawBuffers(1, drawbuffers);
+        DrawCommand const& cmd = this->renderFrame.drawCommands[packet.drawCommand];
+        if (packet.drawCommand != currentDrawCommand)
+        {
+            glUniformMatrix4fv(modelLocation, 1, false, &cmd.transform[0][0]);
+            currentDrawCommand = packet.drawCommand;
+        }
 
-    { GLenum err = glCheckFramebufferStatus(GL_FRAMEBUFFER);
-    assert(err == GL_FRAMEBUFFER_COMPLETE); }
+        GLState::SetEnabled(GL_CULL_FACE, !primitive.material.doubleSided);
+        SetVertexDecodeUniforms(vertexDecodeLocations, primitive);
+        Model::Mesh::Primitive::Lod const& lod = primitive.lods[glm::min((uint)cmd.lod, primitive.numLods - 1)];
+        GLState::BindVertexArray(primitive.depthVao);
+        glDrawElements(GL_TRIANGLES, lod.numIndices, primitive.indexType, (void*)(intptr_t)lod.offset);
+    });
 
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    if (hasMasked)
+    {
+        GLState::UseProgram(Render::ShaderResource::GetProgramHandle(staticShadowProgram));
+        glUniformMatrix4fv(ShaderResource::GetUniformLocation(staticShadowProgram, "ViewProjection"), 1, false, &viewProjection[0][0]);
+        GLint baseColorFactorLocation = ShaderResource::GetUniformLocation(staticShadowProgram, "BaseColorFactor");
+        GLint alphaCutoffLocation = ShaderResource::GetUniformLocation(staticShadowProgram, "AlphaCutoff");
+        modelLocation = ShaderResource::GetUniformLocation(staticShadowProgram, "Model");
+        vertexDecodeLocations = GetVertexDecodeLocations(staticShadowProgram);
+        glUniform1i(Model::Material::TEXTURE_BASECOLOR, Model::Material::TEXTURE_BASECOLOR);
+
+        currentDrawCommand = UINT32_MAX;
+        list.ForEachPacket([&](DrawPacket const& packet)
+        {
+            Model::Mesh::Primitive const& primitive = GetModel(packet.model).meshes[packet.mesh].primitives[packet.primitive];
+            if (primitive.material.alphaMode != Model::Material::AlphaMode::Mask)
+                return;
 
-    LightServer::UpdateWorkGroups(fbWidth, fbHeight);
+            DrawCommand const& cmd = this->renderFrame.drawCommands[packet.drawCommand];
+            if (packet.drawCommand != currentDrawCommand)
+            {
+                glUniformMatrix4fv(modelLocation, 1, false, &cmd.transform[0][0]);
+                currentDrawCommand = packet.drawCommand;
+            }
 
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-    glBindTexture(GL_TEXTURE_2D, 0);
+            GLuint const baseColor = Render::TextureResource::GetTextureHandle(primitive.material.textures[Model::Material::TEXTURE_BASECOLOR]);
+            GLState::BindTextureUnit(Model::Material::TEXTURE_BASECOLOR, GL_TEXTURE_2D, baseColor);
 
-    ParticleSystem::Instance()->Initialize();
+            glUniform4fv(baseColorFactorLocation, 1, &primitive.material.baseColorFactor[0]);
+            glUniform1f(alphaCutoffLocation, primitive.material.alphaCutoff);
 
-    Debug::InitDebugRendering();
-}
+            GLState::SetEnabled(GL_CULL_FACE, !primitive.material.doubleSided);
+            SetVertexDecodeUniforms(vertexDecodeLocations, primitive);
+            Model::Mesh::Primitive::Lod const& lod = primitive.lods[glm::min((uint)cmd.lod, primitive.numLods - 1)];
+            GLState::BindVertexArray(primitive.vao);
+            glDrawElements(GL_TRIANGLES, lod.numIndices, primitive.indexType, (void*)(intptr_t)lod.offset);
+        });
+    }
 
-void RenderDevice::Draw(ModelId model, glm::mat4 localToWorld)
-{
-    Instance()->drawCommands.push_back({ model, localToWorld });
+    GLState::Enable(GL_CULL_FACE);
 }
 
 //------------------------------------------------------------------------------
 /**
+    Fits the cascades and decides which casters the shadow pass draws into
+    them. With the shadow cache enabled, static casters are rendered into a
+    cache that is only updated when the cascade moves or the static casters
+    change. When the cache or the dynamic casters of a cascade change, the
+    cache is copied into the shadow map and the dynamic casters are drawn on
+    top. Otherwise the shadow map already holds the same depth.
 */
 void
-RenderDevice::StaticShadowPass()
+RenderDevice::ShadowCullingPass()
 {
-    uint shadowMapSize = LightServer::GetShadowMapSize();
-    glViewport(0, 0, shadowMapSize, shadowMapSize);
-    glBindFramebuffer(GL_FRAMEBUFFER, LightServer::GetGlobalShadowFramebuffer());
-    glClear(GL_DEPTH_BUFFER_BIT);
-    glEnable(GL_DEPTH_TEST);
-    glEnable(GL_CULL_FACE);
-    glCullFace(GL_BACK);
+    LightServer::UpdateShadowCascades();
+
+    // light space bounds of every draw command. All cascades share the same light space rotation.
+    // static casters are also hashed, to detect when they change.
+    glm::mat4 const lightView = LightServer::GetShadowCascade(0).view;
+    uint64_t staticHash = FnvOffsetBasis;
+    this->shadowCasterBounds.resize(this->renderFrame.drawCommands.size());
+    for (size_t i = 0; i < this->renderFrame.drawCommands.size(); i++)
+    {
+        DrawCommand const& cmd = this->renderFrame.drawCommands[i];
+        if (cmd.flags & DRAW_STATIC)
+        {
+            HashBytes(staticHash, &cmd.modelId, sizeof(cmd.modelId));
+            HashBytes(staticHash, &cmd.transform, sizeof(cmd.transform));
+        }
 
-    Camera const* const mainCamera = CameraManager::GetCamera(CAMERA_MAIN);
-    Camera* const shadowCamera = CameraManager::GetCamera(CAMERA_SHADOW);
+        Model const& model = GetModel(cmd.modelId);
+        ShadowCasterBounds& bounds = this->shadowCasterBounds[i];
+        bounds.valid = model.boundsMin.x <= model.boundsMax.x;
+        if (!bounds.valid)
+            continue;
+
+        glm::vec3 const center = (model.boundsMin + model.boundsMax) * 0.5f;
+        glm::vec3 const extents = (model.boundsMax - model.boundsMin) * 0.5f;
+        glm::mat3 rotation = glm::mat3(lightView) * glm::mat3(cmd.transform);
+        for (int c = 0; c < 3; c++)
+            rotation[c] = glm::abs(rotation[c]);
+        bounds.center = glm::vec3(lightView * cmd.transform * glm::vec4(center, 1.0f));
+        bounds.extents = rotation * extents;
+    }
 
-    glm::vec3 shadowCamOffset = glm::normalize(LightServer::globalLightDirection) * 250.0f;
-    glm::vec3 shadowCamTarget = glm::vec3(mainCamera->invView[3]);
-    shadowCamTarget.y = 0.0f;
-    shadowCamera->view = glm::lookAt(shadowCamTarget + shadowCamOffset,
-        shadowCamTarget,
-        glm::vec3(0.0f, 1.0f, 0.0f));
+    bool const caching = LightServer::IsShadowCacheEnabled();
+    this->shadowCascadeLists.resize(LightServer::GetNumShadowCascades());
+    for (uint cascadeIndex = 0; cascadeIndex < LightServer::GetNumShadowCascades(); cascadeIndex++)
+    {
+        LightServer::ShadowCascade& cascade = LightServer::GetShadowCascade(cascadeIndex);
+        ShadowCascadeLists& lists = this->shadowCascadeLists[cascadeIndex];
+        lists.cache.Clear();
+        lists.casters.Clear();
+        lists.rebuildCache = false;
+        lists.redrawCasters = false;
+        if (!cascade.update)
+            continue;
+
+        if (!caching)
+        {
+            // the near plane is pulled back to include casters between the light and the slice
+            cascade.boundsMax.z = this->CullShadowCasters(cascadeIndex, 0, 0, lists.casters);
+            cascade.UpdateProjection();
+
+            // invalidate the cache, the placement may be reused once caching is enabled again
+            cascade.staticHash = 0;
+            lists.castersHash = 0;
+            continue;
+        }
 
-    CameraManager::UpdateCamera(shadowCamera);
+        if (cascade.moved || cascade.staticHash != staticHash)
+        {
+            cascade.boundsMax.z = this->CullShadowCasters(cascadeIndex, DRAW_STATIC, DRAW_STATIC, lists.cache);
+            cascade.UpdateProjection();
+            cascade.staticHash = staticHash;
+            lists.rebuildCache = true;
+        }
 
-    auto programHandle = Render::ShaderResource::GetProgramHandle(staticShadowProgram);
-    glUseProgram(programHandle);
-    glUniformMatrix4fv(glGetUniformLocation(programHandle, "ViewProjection"), 1, false, &shadowCamera->viewProjection[0][0]);
+        // depth clamping keeps dynamic casters in front of the near plane, so they don't need to extend the cached depth range
+        this->CullShadowCasters(cascadeIndex, DRAW_STATIC, 0, lists.casters);
 
-    GLuint baseColorFactorLocation = glGetUniformLocation(programHandle, "BaseColorFactor");
-    GLuint modelLocation = glGetUniformLocation(programHandle, "Model");
-    GLuint alphaCutoffLocation = glGetUniformLocation(programHandle, "AlphaCutoff");
+        // the projection only changes when the cache is rebuilt, so the casters and the lods they are drawn with are enough
+        uint64_t castersHash = FnvOffsetBasis;
+        for (uint32_t i : lists.casters.GetDrawCommands())
+        {
+            DrawCommand const& cmd = this->renderFrame.drawCommands[i];
+            HashBytes(castersHash, &cmd.modelId, sizeof(cmd.modelId));
+            HashBytes(castersHash, &cmd.transform, sizeof(cmd.transform));
+            HashBytes(castersHash, &cmd.lod, sizeof(cmd.lod));
+        }
+        lists.redrawCasters = lists.rebuildCache || castersHash != lists.castersHash;
+        lists.castersHash = castersHash;
+    }
+}
 
-    // Draw opaque first
-    for (auto const& cmd : this->drawCommands)
+//------------------------------------------------------------------------------
+/**
+    Draws the lists recorded by ShadowCullingPass.
+*/
+void
+RenderDevice::StaticShadowPass()
+{
+    uint shadowMapSize = LightServer::GetShadowMapSize();
+    GLState::Viewport(0, 0, shadowMapSize, shadowMapSize);
+    GLState::Enable(GL_DEPTH_TEST);
+    GLState::Enable(GL_DEPTH_CLAMP);
+    GLState::Enable(GL_CULL_FACE);
+    GLState::CullFace(GL_BACK);
+
+    bool const caching = LightServer::IsShadowCacheEnabled();
+    for (uint cascadeIndex = 0; cascadeIndex < LightServer::GetNumShadowCascades(); cascadeIndex++)
     {
-        Model const& model = GetModel(cmd.modelId);
-        glUniformMatrix4fv(modelLocation, 1, false, &cmd.transform[0][0]);
+        LightServer::ShadowCascade const& cascade = LightServer::GetShadowCascade(cascadeIndex);
+        ShadowCascadeLists const& lists = this->shadowCascadeLists[cascadeIndex];
+        if (!cascade.update)
+            continue;
 
-        for (auto const& mesh : model.meshes)
+        if (!caching)
         {
-            for (auto& primitiveId : mesh.opaquePrimitives)
-            {
-                auto& primitive = mesh.primitives[primitiveId];
+            GLState::BindFramebuffer(GL_FRAMEBUFFER, LightServer::GetShadowCascadeFramebuffer(cascadeIndex));
+            glClear(GL_DEPTH_BUFFER_BIT);
+            this->SubmitDepthPackets(lists.casters, cascade.viewProjection);
+            continue;
+        }
 
-                glActiveTexture(GL_TEXTURE0 + Model::Material::TEXTURE_BASECOLOR);
-                glBindTexture(GL_TEXTURE_2D, Render::TextureResource::GetTextureHandle(primitive.material.textures[Model::Material::TEXTURE_BASECOLOR]));
-                glUniform1i(Model::Material::TEXTURE_BASECOLOR, Model::Material::TEXTURE_BASECOLOR);
+        if (lists.rebuildCache)
+        {
+            GLState::BindFramebuffer(GL_FRAMEBUFFER, LightServer::GetStaticShadowCacheFramebuffer(cascadeIndex));
+            glClear(GL_DEPTH_BUFFER_BIT);
+            this->SubmitDepthPackets(lists.cache, cascade.viewProjection);
+        }
 
-                glUniform4fv(baseColorFactorLocation, 1, &primitive.material.baseColorFactor[0]);
+        if (!lists.redrawCasters)
+            continue;
 
-                if (primitive.material.alphaMode == Model::Material::AlphaMode::Mask)
-                    glUniform1f(alphaCutoffLocation, primitive.material.alphaCutoff);
-                else
-                    glUniform1f(alphaCutoffLocation, 0);
+        glCopyImageSubData(
+            LightServer::GetStaticShadowCacheHandle(), GL_TEXTURE_2D_ARRAY, 0, 0, 0, cascadeIndex,
+            LightServer::GetGlobalShadowMapHandle(), GL_TEXTURE_2D_ARRAY, 0, 0, 0, cascadeIndex,
+            shadowMapSize, shadowMapSize, 1
+        );
 
-                glBindVertexArray(primitive.vao);
-                glDrawElements(GL_TRIANGLES, primitive.numIndices, primitive.indexType, (void*)(intptr_t)primitive.offset);
-            }
-        }
+        GLState::BindFramebuffer(GL_FRAMEBUFFER, LightServer::GetShadowCascadeFramebuffer(cascadeIndex));
+        this->SubmitDepthPackets(lists.casters, cascade.viewProjection);
     }
 
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    GLState::Disable(GL_DEPTH_CLAMP);
+    GLState::BindFramebuffer(GL_FRAMEBUFFER, 0);
 }
 
 //------------------------------------------------------------------------------
@@ -225,171 +508,447 @@ RenderDevice::StaticShadowPass()
 void
 RenderDevice::StaticGeometryPrepass()
 {
-    Camera* const mainCamera = CameraManager::GetCamera(CAMERA_MAIN);
-    glBindFramebuffer(GL_FRAMEBUFFER, Instance()->forwardFrameBuffer);
-    glClearColor(255.0f, 0, 0, 1);
-    glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
-    glEnable(GL_DEPTH_TEST);
-    glEnable(GL_CULL_FACE);
-    glCullFace(GL_BACK);
+    Camera const* const mainCamera = CameraManager::GetRenderCamera(CAMERA_MAIN);
+    glClear(GL_DEPTH_BUFFER_BIT);
+    GLState::Enable(GL_DEPTH_TEST);
+    GLState::DepthFunc(GL_LESS);
+    GLState::Enable(GL_CULL_FACE);
+    GLState::CullFace(GL_BACK);
 
-    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    GLState::ColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
 
-    // Models
-    auto staticOpaquePrepassProgramHandle = Render::ShaderResource::GetProgramHandle(staticShadowProgram);
-    glUseProgram(staticOpaquePrepassProgramHandle);
-    glUniformMatrix4fv(glGetUniformLocation(staticOpaquePrepassProgramHandle, "ViewProjection"), 1, false, &mainCamera->viewProjection[0][0]);
-    
-    GLuint baseColorFactorLocation = glGetUniformLocation(staticOpaquePrepassProgramHandle, "BaseColorFactor");
-    GLuint modelLocation = glGetUniformLocation(staticOpaquePrepassProgramHandle, "Model");
-    GLuint alphaCutoffLocation = glGetUniformLocation(staticOpaquePrepassProgramHandle, "AlphaCutoff");
+    this->SubmitDepthPackets(this->opaqueList, mainCamera->viewProjection);
+
+    GLState::ColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+}
+
+//------------------------------------------------------------------------------
+/**
+    Picks a level of detail for every draw command from the size of its
+    bounding sphere on screen. Lod 0 is used while the sphere covers at least
+    a quarter of the screen height, and every following lod takes over when
+    the size halves. r_lod_bias adds to the lod index, so positive values
+    switch to lower detail closer to the camera. Shadow passes use the lod of
+    the main camera.
+*/
+void
+RenderDevice::LodSelectionPass()
+{
+    static constexpr float LodScreenSize = 0.5f;
 
-    // Opaque
-    for (auto const& cmd : this->drawCommands)
+    Camera const* const mainCamera = CameraManager::GetRenderCamera(CAMERA_MAIN);
+    glm::vec3 const cameraPosition = glm::vec3(mainCamera->invView[3]);
+    float const projectionScale = mainCamera->projection[1][1];
+    float const bias = Core::CVarReadFloat(r_lod_bias);
+
+    for (DrawCommand& cmd : this->renderFrame.drawCommands)
     {
+        cmd.lod = 0;
         Model const& model = GetModel(cmd.modelId);
-        glUniformMatrix4fv(modelLocation, 1, false, &cmd.transform[0][0]);
+        if (model.boundsMin.x > model.boundsMax.x)
+            continue;
+
+        float const scale = glm::max(glm::max(glm::length(glm::vec3(cmd.transform[0])), glm::length(glm::vec3(cmd.transform[1]))), glm::length(glm::vec3(cmd.transform[2])));
+        float const radius = glm::length(model.boundsMax - model.boundsMin) * 0.5f * scale;
+        glm::vec3 const center = glm::vec3(cmd.transform * glm::vec4((model.boundsMin + model.boundsMax) * 0.5f, 1.0f));
+        float const distance = glm::distance(center, cameraPosition);
+        if (distance <= radius)
+            continue;
+
+        // in normalized device coordinates, so 1 is half the screen height
+        float const screenSize = radius * projectionScale / distance;
+        float const lod = glm::log2(LodScreenSize / screenSize) + bias;
+        cmd.lod = (uint8_t)glm::clamp(lod, 0.0f, (float)(Model::Mesh::Primitive::MaxLods - 1));
+    }
+}
 
-        for (auto const& mesh : model.meshes)
+//------------------------------------------------------------------------------
+/**
+    The colliders that cover the largest part of the screen are rasterized
+    into the software occlusion buffer, and every draw command's bounding box
+    is tested against it. Hidden commands are skipped by the main camera passes,
+    but still cast shadows.
+*/
+void
+RenderDevice::OcclusionCullingPass()
+{
+    if (Core::CVarReadInt(r_occlusion_culling) <= 0)
+        return;
+
+    Camera const* const mainCamera = CameraManager::GetRenderCamera(CAMERA_MAIN);
+    glm::vec3 const cameraPosition = glm::vec3(mainCamera->invView[3]);
+
+    // largest nearby colliders first, by the ratio between radius and distance
+    std::vector<Physics::ColliderGeometry>& occluderCandidates = this->renderFrame.occluderCandidates;
+    auto const Coverage = [&cameraPosition](Physics::ColliderGeometry const& g)
+    {
+        float const distance = glm::max(glm::distance(glm::vec3(g.boundingSphere), cameraPosition), 0.001f);
+        return g.boundingSphere.w / distance;
+    };
+    size_t const maxOccluders = (size_t)glm::max(Core::CVarReadInt(r_occlusion_max_occluders), 0);
+    size_t const numOccluders = glm::min(maxOccluders, occluderCandidates.size());
+    std::partial_sort(occluderCandidates.begin(), occluderCandidates.begin() + numOccluders, occluderCandidates.end(),
+        [&Coverage](Physics::ColliderGeometry const& a, Physics::ColliderGeometry const& b) { return Coverage(a) > Coverage(b); });
+
+    occluders.clear();
+    for (size_t i = 0; i < numOccluders; i++)
+    {
+        Physics::ColliderGeometry const& g = occluderCandidates[i];
+        OcclusionBuffer::Occluder occluder;
+        occluder.transform = glm::inverse(g.invTransform);
+        occluder.vertices = g.triangles->vertices;
+        occluder.numTriangles = (uint32_t)g.numTriangles;
+        occluder.triangleStride = sizeof(Physics::ColliderTriangle);
+        occluders.push_back(occluder);
+    }
+
+    occlusionBuffer.Render(mainCamera->viewProjection, occluders.data(), (uint32_t)occluders.size());
+
+    Core::JobSystem::ParallelFor((uint)this->renderFrame.drawCommands.size(), 64, [this, mainCamera](uint begin, uint end)
+    {
+        for (uint i = begin; i < end; i++)
+        {
+            DrawCommand& cmd = this->renderFrame.drawCommands[i];
+            Model const& model = GetModel(cmd.modelId);
+            if (model.boundsMin.x <= model.boundsMax.x)
+                cmd.visible = occlusionBuffer.IsVisible(mainCamera->viewProjection * cmd.transform, model.boundsMin, model.boundsMax);
+        }
+    });
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+RenderDevice::LightCullingPass()
+{
+    // clusters are built on the CPU, so this no longer depends on the depth prepass
+    LightServer::BuildClusters();
+}
+
+//------------------------------------------------------------------------------
+/**
+    Culls the emitters of the frame, and picks how many particles each of the
+    rest gets.
+
+    An emitter's particles stay within a sphere around its origin, as far as
+    the fastest particle travels in one lifetime, plus how far the origin
+    itself moved during the last lifetime, since the particles trail behind.
+    Emitters whose sphere is outside the main camera frustum are paused: they
+    are neither simulated nor drawn, and continue where they stopped once
+    they are visible again. Their particles, and the ones the LOD and budget
+    drop, are collected in skippedParticles so ParticlePass can carry them
+    over to the next buffer.
+
+    Visible emitters keep all their particles while the sphere covers more
+    than r_particle_lod_size of the screen, and lose them in proportion to
+    their size below that. Fewer particles respawn over the same lifetime,
+    so the spawn rate follows. If the frame then still wants more than
+    r_particle_budget particles, all emitters are scaled down evenly.
+
+    An emitter that fires this frame is exempt from all of it, since the reset
+    only happens on that frame and has to reach every one of its particles.
+*/
+void
+RenderDevice::ParticleBudgetPass()
+{
+    static constexpr uint32_t MinLodParticles = 16;
+
+    Camera const* const mainCamera = CameraManager::GetRenderCamera(CAMERA_MAIN);
+    glm::vec3 const cameraPosition = glm::vec3(mainCamera->invView[3]);
+    float const projectionScale = mainCamera->projection[1][1];
+    glm::vec4 planes[6];
+    CameraManager::GetFrustumPlanes(mainCamera, planes);
+
+    bool const culling = Core::CVarReadInt(r_particle_culling) > 0;
+    float const lodSize = Core::CVarReadFloat(r_particle_lod_size);
+    int const budget = Core::CVarReadInt(r_particle_budget);
+    float const dt = this->renderFrame.dt;
+
+    std::vector<EmitterSnapshot>& emitters = this->renderFrame.emitters;
+    std::vector<glm::uvec2>& skipped = this->skippedParticles;
+    skipped.clear();
+    size_t numVisible = 0;
+    uint64_t numWanted = 0;
+    for (size_t i = 0; i < emitters.size(); i++)
+    {
+        EmitterSnapshot snapshot = emitters[i];
+        ParticleEmitter::EmitterBlock& data = snapshot.data;
+        EmitterState* const state = snapshot.state;
+        glm::vec3 const origin = glm::vec3(data.origin);
+        float const decayTime = glm::max(data.decayTime, 0.001f);
+
+        // decays the trail by the part of a lifetime that passed, which is close enough for an upper bound
+        if (state->trailLength < 0.0f)
+            state->trailLength = 0.0f;
+        else
+            state->trailLength = state->trailLength * glm::max(1.0f - dt / decayTime, 0.0f) + glm::distance(origin, state->lastOrigin);
+        state->lastOrigin = origin;
+
+        float const speed = glm::max(glm::abs(data.startSpeed), glm::abs(data.endSpeed));
+        float const radius = speed * decayTime + data.discRadius + glm::max(data.startScale, data.endScale) + state->trailLength;
+
+        bool const firing = data.fireOnce > 0;
+        if (culling && !firing)
         {
-            for (auto& primitiveId : mesh.opaquePrimitives)
+            bool inside = true;
+            for (glm::vec4 const& plane : planes)
+                inside = inside && glm::dot(glm::vec3(plane), origin) + plane.w > -radius;
+            if (!inside)
             {
-                auto& primitive = mesh.primitives[primitiveId];
+                skipped.push_back({ snapshot.firstParticle, data.numParticles });
+                continue;
+            }
+        }
 
-                glActiveTexture(GL_TEXTURE0 + Model::Material::TEXTURE_BASECOLOR);
-                glBindTexture(GL_TEXTURE_2D, Render::TextureResource::GetTextureHandle(primitive.material.textures[Model::Material::TEXTURE_BASECOLOR]));
-                glUniform1i(Model::Material::TEXTURE_BASECOLOR, Model::Material::TEXTURE_BASECOLOR);
-                glUniform4fv(baseColorFactorLocation, 1, &primitive.material.baseColorFactor[0]);
+        float const distance = glm::distance(origin, cameraPosition);
+        if (lodSize > 0.0f && distance > radius && !firing)
+        {
+            // in normalized device coordinates, so 1 is half the screen height
+            float const screenSize = radius * projectionScale / distance;
+            float const fraction = glm::min(screenSize / lodSize, 1.0f);
+            uint32_t const numParticles = glm::max((uint32_t)ceilf(data.numParticles * fraction), glm::min(data.numParticles, MinLodParticles));
+            skipped.push_back({ snapshot.firstParticle + numParticles, data.numParticles - numParticles });
+            data.numParticles = numParticles;
+        }
+        numWanted += data.numParticles;
+        emitters[numVisible++] = snapshot;
+    }
+    emitters.resize(numVisible);
 
-                if (primitive.material.alphaMode == Model::Material::AlphaMode::Mask)
-                    glUniform1f(alphaCutoffLocation, primitive.material.alphaCutoff);
-                else
-                    glUniform1f(alphaCutoffLocation, 0);
+    if (budget > 0 && numWanted > (uint64_t)budget)
+    {
+        float const scale = (float)budget / (float)numWanted;
+        for (EmitterSnapshot& snapshot : emitters)
+        {
+            if (snapshot.data.fireOnce > 0)
+                continue;
+            uint32_t const numParticles = glm::max((uint32_t)(snapshot.data.numParticles * scale), glm::min(snapshot.data.numParticles, MinLodParticles));
+            skipped.push_back({ snapshot.firstParticle + numParticles, snapshot.data.numParticles - numParticles });
+            snapshot.data.numParticles = numParticles;
+        }
+    }
 
-                glBindVertexArray(primitive.vao);
-                glDrawElements(GL_TRIANGLES, primitive.numIndices, primitive.indexType, (void*)(intptr_t)primitive.offset);
-            }
+    // the LOD and budget ranges of an emitter are adjacent, and so are neighbouring emitters in the pool
+    std::sort(skipped.begin(), skipped.end(), [](glm::uvec2 const& a, glm::uvec2 const& b) { return a.x < b.x; });
+    size_t numRanges = 0;
+    for (glm::uvec2 const& range : skipped)
+    {
+        if (range.y == 0)
+            continue;
+        if (numRanges > 0 && skipped[numRanges - 1].x + skipped[numRanges - 1].y == range.x)
+            skipped[numRanges - 1].y += range.y;
+        else
+            skipped[numRanges++] = range;
+    }
+    skipped.resize(numRanges);
+}
+
+//------------------------------------------------------------------------------
+/**
+    Records the command lists of the geometry passes on the job system, so the
+    GPU passes only have to translate packets into GL calls.
+*/
+void
+RenderDevice::RecordCommandListsPass()
+{
+    this->opaqueList.Clear();
+    this->transparentList.Clear();
+    for (uint32_t i = 0; i < (uint32_t)this->renderFrame.drawCommands.size(); i++)
+    {
+        if (this->renderFrame.drawCommands[i].visible)
+        {
+            this->opaqueList.Add(i);
+            this->transparentList.Add(i);
         }
     }
 
-    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    CommandList* lists[2 + 2 * LightServer::MaxShadowCascades];
+    uint32_t numLists = 0;
+    lists[numLists++] = &this->opaqueList;
+    lists[numLists++] = &this->transparentList;
+    for (ShadowCascadeLists& cascadeLists : this->shadowCascadeLists)
+    {
+        lists[numLists++] = &cascadeLists.cache;
+        lists[numLists++] = &cascadeLists.casters;
+    }
+
+    CommandList::Record(lists, numLists, [this](CommandList const& list, uint32_t drawCommand, std::vector<DrawPacket>& packets)
+    {
+        DrawCommand const& cmd = this->renderFrame.drawCommands[drawCommand];
+        Model const& model = GetModel(cmd.modelId);
+        bool const blend = &list == &this->transparentList;
+        for (uint16_t meshIndex = 0; meshIndex < (uint16_t)model.meshes.size(); meshIndex++)
+        {
+            Model::Mesh const& mesh = model.meshes[meshIndex];
+            for (auto primitiveId : blend ? mesh.blendPrimitives : mesh.opaquePrimitives)
+                packets.push_back({ drawCommand, cmd.modelId, meshIndex, (uint16_t)primitiveId });
+        }
+    });
+
+    this->SortTransparentPackets();
 }
 
 //------------------------------------------------------------------------------
 /**
+    The sort key has the view depth in the upper 20 bits, inverted so that
+    far packets come first, and a hash of the material's textures in the lower
+    12 bits, so that packets at the same quantized depth are batched by their
+    textures. The depth is quantized by dropping the low bits of the float,
+    which keeps a relative precision of 1/4096 at any distance.
+
+    With r_transparent_sort_per_object the depth is taken from the center of
+    the object, and all of its primitives keep their order.
 */
 void
-RenderDevice::LightCullingPass()
+RenderDevice::SortTransparentPackets()
 {
-    GLuint lightCullingProgramHandle = ShaderResource::GetProgramHandle(lightCullingProgram);
-    glUseProgram(lightCullingProgramHandle);
+    if (this->transparentList.GetNumPackets() == 0)
+        return;
 
-    Camera* const mainCamera = CameraManager::GetCamera(CAMERA_MAIN);
-    glUniformMatrix4fv(glGetUniformLocation(lightCullingProgramHandle, "View"), 1, false, &mainCamera->view[0][0]);
-    glUniformMatrix4fv(glGetUniformLocation(lightCullingProgramHandle, "Projection"), 1, false, &mainCamera->projection[0][0]);
-    glUniformMatrix4fv(glGetUniformLocation(lightCullingProgramHandle, "ViewProjection"), 1, false, &mainCamera->viewProjection[0][0]);
+    Camera const* const mainCamera = CameraManager::GetRenderCamera(CAMERA_MAIN);
+    glm::mat4 const view = mainCamera->view;
+    bool const perObject = Core::CVarReadInt(r_transparent_sort_per_object) > 0;
 
-    // Bind depth map texture to texture location 20 (which will not be used by any model texture)
-    glActiveTexture(GL_TEXTURE30);
-    glUniform1i(glGetUniformLocation(lightCullingProgramHandle, "DepthMap"), 30);
-    glBindTexture(GL_TEXTURE_2D, depthStencilBuffer);
+    this->transparentList.SortByKey([this, &view, perObject](DrawPacket const& packet)
+    {
+        DrawCommand const& cmd = this->renderFrame.drawCommands[packet.drawCommand];
+        Model const& model = GetModel(cmd.modelId);
+        Model::Mesh::Primitive const& primitive = model.meshes[packet.mesh].primitives[packet.primitive];
 
-    glUniform1i(glGetUniformLocation(lightCullingProgramHandle, "NumPointLights"), LightServer::GetNumPointLights());
-    
-    // Bind shader storage buffer objects for the light and index buffers
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, LightServer::GetBuffer(LightServer::PointLightBuffer::POSITIONS));
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, LightServer::GetBuffer(LightServer::PointLightBuffer::RADII));
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, LightServer::GetBuffer(LightServer::PointLightBuffer::VISIBLE_INDICES));
-    
-    glUniform2ui(glGetUniformLocation(lightCullingProgramHandle, "NumTiles"), LightServer::GetWorkGroupsX(), LightServer::GetWorkGroupsY());
+        glm::vec3 const center = perObject ? (model.boundsMin + model.boundsMax) * 0.5f : primitive.center;
+        float const viewDepth = glm::max(-(view * cmd.transform * glm::vec4(center, 1.0f)).z, 0.0f);
+        uint32_t const depthBits = std::bit_cast<uint32_t>(viewDepth) >> 11;
 
-    glDispatchCompute(LightServer::GetWorkGroupsX(), LightServer::GetWorkGroupsY(), 1);
+        uint32_t state = 0;
+        if (!perObject)
+        {
+            for (TextureResourceId texture : primitive.material.textures)
+                state = state * 31 + texture;
+            state = (state ^ (state >> 12) ^ (state >> 24)) & 0xFFF;
+        }
 
-    glActiveTexture(GL_TEXTURE30);
-    glBindTexture(GL_TEXTURE_2D, 0);
+        return ((0xFFFFF - depthBits) << 12) | state;
+    });
 }
 
 //------------------------------------------------------------------------------
 /**
+    Keeps the depth of the prepass, and only shades the fragments that are
+    visible in it, so every pixel is shaded once.
 */
 void
 RenderDevice::StaticForwardPass()
 {   
-    glBindFramebuffer(GL_FRAMEBUFFER, Instance()->forwardFrameBuffer);
+    GLState::ClearColor(255.0f, 0, 0, 1);
+    glClear(GL_COLOR_BUFFER_BIT);
+
+    GLState::DepthFunc(GL_EQUAL);
+    GLState::DepthMask(GL_FALSE);
+    GLState::Enable(GL_CULL_FACE);
+    GLState::CullFace(GL_BACK);
+
+    this->SubmitForwardPackets(this->opaqueList);
+
+    GLState::DepthMask(GL_TRUE);
+    GLState::DepthFunc(GL_LESS);
+}
 
-    glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
+//------------------------------------------------------------------------------
+/**
+    Blended primitives are drawn back to front after everything opaque, and
+    test against the opaque depth without writing it.
+*/
+void
+RenderDevice::TransparentPass()
+{
+    GLState::Enable(GL_BLEND);
+    GLState::BlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    GLState::DepthMask(GL_FALSE);
+    GLState::DepthFunc(GL_LESS);
+    GLState::Enable(GL_CULL_FACE);
+    GLState::CullFace(GL_BACK);
 
-    glDepthFunc(GL_LESS);
-    glEnable(GL_CULL_FACE);
-    glCullFace(GL_BACK);
+    this->SubmitForwardPackets(this->transparentList);
 
-    Camera* const mainCamera = CameraManager::GetCamera(CAMERA_MAIN);
+    GLState::DepthMask(GL_TRUE);
+    GLState::Disable(GL_BLEND);
+}
+
+//------------------------------------------------------------------------------
+/**
+    Packets are translated with the lit forward program. Textures are only
+    bound when they differ from the previous packet's, which is what sorting
+    the transparent packets by material within a depth bucket gains.
+*/
+void
+RenderDevice::SubmitForwardPackets(CommandList const& list)
+{
+    Camera const* const mainCamera = CameraManager::GetRenderCamera(CAMERA_MAIN);
     
-    auto programHandle = Render::ShaderResource::GetProgramHandle(staticGeometryProgram);
-    glUseProgram(programHandle);
+    GLState::UseProgram(Render::ShaderResource::GetProgramHandle(staticGeometryProgram));
 
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, LightServer::GetBuffer(LightServer::PointLightBuffer::POSITIONS));
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, LightServer::GetBuffer(LightServer::PointLightBuffer::COLORS));
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, LightServer::GetBuffer(LightServer::PointLightBuffer::RADII));
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, LightServer::GetBuffer(LightServer::PointLightBuffer::VISIBLE_INDICES));
+    LightServer::BindPointLightBuffers();
 
-    glUniform2ui(glGetUniformLocation(programHandle, "NumTiles"), LightServer::GetWorkGroupsX(), LightServer::GetWorkGroupsY());
-    glUniformMatrix4fv(glGetUniformLocation(programHandle, "ViewProjection"), 1, false, &mainCamera->viewProjection[0][0]);
+    glUniformMatrix4fv(ShaderResource::GetUniformLocation(staticGeometryProgram, "ViewProjection"), 1, false, &mainCamera->viewProjection[0][0]);
     
-    glUniform4fv(glGetUniformLocation(programHandle, "CameraPosition"), 1, &mainCamera->view[3][0]);
+    glUniform4fv(ShaderResource::GetUniformLocation(staticGeometryProgram, "CameraPosition"), 1, &mainCamera->view[3][0]);
 
     LightServer::Update(staticGeometryProgram);
 
-    glActiveTexture(GL_TEXTURE16);
-    glBindTexture(GL_TEXTURE_2D, LightServer::GetGlobalShadowMapHandle());
-    glUniform1i(glGetUniformLocation(programHandle, "GlobalShadowMap"), 16);
-    Camera* globalShadowCamera = CameraManager::GetCamera(CAMERA_SHADOW);
-    glUniformMatrix4fv(glGetUniformLocation(programHandle, "GlobalShadowMatrix"), 1, false, &globalShadowCamera->viewProjection[0][0]);
+    GLState::BindTextureUnit(16, GL_TEXTURE_2D_ARRAY, LightServer::GetGlobalShadowMapHandle());
+    glUniform1i(ShaderResource::GetUniformLocation(staticGeometryProgram, "GlobalShadowMap"), 16);
+
+    // the material samplers are at locations 0 to NUM_TEXTURES - 1
+    for (int i = 0; i < Model::Material::NUM_TEXTURES; i++)
+        glUniform1i(i, i);
+
+    GLint baseColorFactorLocation = ShaderResource::GetUniformLocation(staticGeometryProgram, "BaseColorFactor");
+    GLint emissiveFactorLocation = ShaderResource::GetUniformLocation(staticGeometryProgram, "EmissiveFactor");
+    GLint metallicFactorLocation = ShaderResource::GetUniformLocation(staticGeometryProgram, "MetallicFactor");
+    GLint roughnessFactorLocation = ShaderResource::GetUniformLocation(staticGeometryProgram, "RoughnessFactor");
+    GLint modelLocation = ShaderResource::GetUniformLocation(staticGeometryProgram, "Model");
+    GLint alphaCutoffLocation = ShaderResource::GetUniformLocation(staticGeometryProgram, "AlphaCutoff");
+    VertexDecodeLocations const vertexDecodeLocations = GetVertexDecodeLocations(staticGeometryProgram);
 
-    GLuint baseColorFactorLocation = glGetUniformLocation(programHandle, "BaseColorFactor");
-    GLuint emissiveFactorLocation = glGetUniformLocation(programHandle, "EmissiveFactor");
-    GLuint metallicFactorLocation = glGetUniformLocation(programHandle, "MetallicFactor");
-    GLuint roughnessFactorLocation = glGetUniformLocation(programHandle, "RoughnessFactor");
-    GLuint modelLocation = glGetUniformLocation(programHandle, "Model");
-    GLuint alphaCutoffLocation = glGetUniformLocation(programHandle, "AlphaCutoff");
+    uint32_t currentDrawCommand = UINT32_MAX;
 
-    // Draw opaque first
-    for (auto const& cmd : this->drawCommands)
+    list.ForEachPacket([&](DrawPacket const& packet)
     {
-        Model const& model = GetModel(cmd.modelId);
-        glUniformMatrix4fv(modelLocation, 1, false, &cmd.transform[0][0]);
+        DrawCommand const& cmd = this->renderFrame.drawCommands[packet.drawCommand];
+        if (packet.drawCommand != currentDrawCommand)
+        {
+            glUniformMatrix4fv(modelLocation, 1, false, &cmd.transform[0][0]);
+            currentDrawCommand = packet.drawCommand;
+        }
 
-        for (auto const& mesh : model.meshes)
+        Model::Mesh::Primitive const& primitive = GetModel(packet.model).meshes[packet.mesh].primitives[packet.primitive];
+
+        for (int i = 0; i < Model::Material::NUM_TEXTURES; i++)
         {
-            for (auto& primitiveId : mesh.opaquePrimitives)
-            {
-                auto& primitive = mesh.primitives[primitiveId];
-
-                for (int i = 0; i < Model::Material::NUM_TEXTURES; i++)
-                {
-                    if (primitive.material.textures[i] != InvalidResourceId)
-                    {
-                        glActiveTexture(GL_TEXTURE0 + i);
-                        glBindTexture(GL_TEXTURE_2D, Render::TextureResource::GetTextureHandle(primitive.material.textures[i]));
-                        glUniform1i(i, i);
-                    }
-                }
-
-                glUniform4fv(baseColorFactorLocation, 1, &primitive.material.baseColorFactor[0]);
-                glUniform4fv(emissiveFactorLocation, 1, &primitive.material.emissiveFactor[0]);
-                glUniform1f(metallicFactorLocation, primitive.material.metallicFactor);
-                glUniform1f(roughnessFactorLocation, primitive.material.roughnessFactor);
-
-                if (primitive.material.alphaMode == Model::Material::AlphaMode::Mask)
-                    glUniform1f(alphaCutoffLocation, primitive.material.alphaCutoff);
-                else
-                    glUniform1f(alphaCutoffLocation, 0);
-
-                glBindVertexArray(primitive.vao);
-                glDrawElements(GL_TRIANGLES, primitive.numIndices, primitive.indexType, (void*)(intptr_t)primitive.offset);
-            }
+            if (primitive.material.textures[i] != InvalidResourceId)
+                GLState::BindTextureUnit(i, GL_TEXTURE_2D, Render::TextureResource::GetTextureHandle(primitive.material.textures[i]));
         }
-    }
+
+        GLState::SetEnabled(GL_CULL_FACE, !primitive.material.doubleSided);
+
+        glUniform4fv(baseColorFactorLocation, 1, &primitive.material.baseColorFactor[0]);
+        glUniform4fv(emissiveFactorLocation, 1, &primitive.material.emissiveFactor[0]);
+        glUniform1f(metallicFactorLocation, primitive.material.metallicFactor);
+        glUniform1f(roughnessFactorLocation, primitive.material.roughnessFactor);
+
+        if (primitive.material.alphaMode == Model::Material::AlphaMode::Mask)
+            glUniform1f(alphaCutoffLocation, primitive.material.alphaCutoff);
+        else
+            glUniform1f(alphaCutoffLocation, 0);
+
+        SetVertexDecodeUniforms(vertexDecodeLocations, primitive);
+        Model::Mesh::Primitive::Lod const& lod = primitive.lods[glm::min((uint)cmd.lod, primitive.numLods - 1)];
+        GLState::BindVertexArray(primitive.vao);
+        glDrawElements(GL_TRIANGLES, lod.numIndices, primitive.indexType, (void*)(intptr_t)lod.offset);
+    });
+
+    GLState::Enable(GL_CULL_FACE);
 }
 
 //------------------------------------------------------------------------------
@@ -398,64 +957,136 @@ RenderDevice::StaticForwardPass()
 void
 RenderDevice::SkyboxPass()
 {
-    Camera* const camera = CameraManager::GetCamera(CAMERA_MAIN);
-    glEnable(GL_DEPTH_TEST);
-    glDepthFunc(GL_LEQUAL);
-    GLuint handle = Render::ShaderResource::GetProgramHandle(skyboxProgram);
-    glUseProgram(handle);
-    glBindVertexArray(fullscreenQuadVAO);
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, TextureResource::GetTextureHandle(skybox));
+    Camera const* const camera = CameraManager::GetRenderCamera(CAMERA_MAIN);
+    GLState::Enable(GL_DEPTH_TEST);
+    GLState::DepthFunc(GL_LEQUAL);
+    GLState::UseProgram(Render::ShaderResource::GetProgramHandle(skyboxProgram));
+    GLState::BindVertexArray(fullscreenQuadVAO);
+    GLState::BindTextureUnit(0, GL_TEXTURE_CUBE_MAP, TextureResource::GetTextureHandle(skybox));
     glUniform1i(0, 0);
     glUniformMatrix4fv(1, 1, false, &camera->invProjection[0][0]);
     glUniformMatrix4fv(2, 1, false, &camera->invView[0][0]);
     glDrawArrays(GL_TRIANGLES, 0, 3);
-    glDepthFunc(GL_LESS);
+    GLState::DepthFunc(GL_LESS);
 }
 
 //------------------------------------------------------------------------------
 /**
+    Emitters don't depend on each other, so they are simulated in parallel,
+    a whole emitter per job. The results go to the buffers that the shader
+    would have written, so the draws can't tell the difference, and switching
+    back to the shader continues from the same state.
+*/
+void
+RenderDevice::SimulateParticlesOnCpu(float dt, uint32_t writeIndex)
+{
+    ParticleSystem* particles = ParticleSystem::Instance();
+    std::vector<EmitterSnapshot> const& emitters = this->renderFrame.emitters;
+    Core::JobSystem::ParallelFor((uint)emitters.size(), 1, [&emitters, dt](uint begin, uint end)
+    {
+        for (uint i = begin; i < end; i++)
+        {
+            EmitterSnapshot const& snapshot = emitters[i];
+            // sized for all particles of the emitter at the sync, the budget only lowers the count
+            CpuParticles& cpuParticles = snapshot.state->cpuParticles;
+            cpuParticles.SetNumParticles(snapshot.data.numParticles);
+
+            ParticleSimulation::Simulate(snapshot.data, dt, cpuParticles);
+            cpuParticles.Pack();
+        }
+    });
+
+    for (EmitterSnapshot const& snapshot : emitters)
+    {
+        CpuParticles const& cpuParticles = snapshot.state->cpuParticles;
+        GLintptr const offset = snapshot.firstParticle * sizeof(glm::vec4);
+        GLsizeiptr const size = cpuParticles.numParticles * sizeof(glm::vec4);
+        if (size == 0)
+            continue;
+        glNamedBufferSubData(particles->bufPositions[writeIndex], offset, size, cpuParticles.packedPositions.data());
+        glNamedBufferSubData(particles->bufVelocities[writeIndex], offset, size, cpuParticles.packedVelocities.data());
+        glNamedBufferSubData(particles->bufColors[writeIndex], offset, size, cpuParticles.packedColors.data());
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+    The particles of all emitters live in shared buffers, and an emitter table
+    describes where each emitter's particles are. The particles of the frame's
+    emitters are simulated with one dispatch and drawn as one range, so the
+    cost doesn't depend on the number of emitters. Each thread finds its
+    emitter in the table from its index.
 */
 void
 RenderDevice::ParticlePass(float dt)
 {
     ParticleSystem* particles = ParticleSystem::Instance();
-    GLuint simProgramHandle = ShaderResource::GetProgramHandle(particles->particleSimComputeShaderId);
-    glUseProgram(simProgramHandle);
-    glUniform1f(glGetUniformLocation(simProgramHandle, "TimeStep"), dt);
-    
-    uint32_t readIndex = (particles->writeIndex + 1) % 2;
+    particles->ReserveBuffers(this->renderFrame.particleCapacity);
+
+    uint32_t numParticles = 0;
+    particles->emitterTable.clear();
+    for (EmitterSnapshot const& snapshot : this->renderFrame.emitters)
+    {
+        GpuEmitter entry = {};
+        entry.block = snapshot.data;
+        entry.firstParticle = snapshot.firstParticle;
+        entry.dispatchOffset = numParticles;
+        particles->emitterTable.push_back(entry);
+        numParticles += snapshot.data.numParticles;
+    }
+    particles->numDrawnEmitters = (uint32_t)particles->emitterTable.size();
+    particles->numDrawnParticles = numParticles;
+    if (numParticles == 0)
+        return;
 
-    for (auto emitter : particles->emitters)
+    size_t const tableSize = particles->emitterTable.size() * sizeof(GpuEmitter);
+    if (tableSize > particles->emitterTableCapacity)
     {
+        particles->emitterTableCapacity = glm::max(tableSize, particles->emitterTableCapacity * 2);
+        glNamedBufferData(particles->emitterTableBuffer, particles->emitterTableCapacity, nullptr, GL_DYNAMIC_DRAW);
+    }
+    glNamedBufferSubData(particles->emitterTableBuffer, 0, tableSize, particles->emitterTable.data());
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, particles->emitterTableBuffer);
+
+    uint32_t const readIndex = (particles->writeIndex + 1) % 2;
+    uint32_t const writeIndex = particles->writeIndex;
+    if (this->renderFrame.particlesOnCpu)
+    {
+        this->SimulateParticlesOnCpu(dt, writeIndex);
+    }
+    else
+    {
+        ShaderProgramId const simulation = particles->particleSimComputeShaderId;
+        GLState::UseProgram(ShaderResource::GetProgramHandle(simulation));
+        glUniform1f(ShaderResource::GetUniformLocation(simulation, "TimeStep"), dt);
+        glUniform3ui(ShaderResource::GetUniformLocation(simulation, "Random"), Core::FastRandom(), Core::FastRandom(), Core::FastRandom());
+        glUniform1ui(ShaderResource::GetUniformLocation(simulation, "NumEmitters"), (GLuint)particles->emitterTable.size());
+        glUniform1ui(ShaderResource::GetUniformLocation(simulation, "NumParticles"), numParticles);
+
         // Integrate particle dynamics
-        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, emitter->bufPositions[readIndex]);
-        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, emitter->bufColors[readIndex]);
-        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, emitter->bufVelocities[readIndex]);
-        
-        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, emitter->bufPositions[particles->writeIndex]);
-        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, emitter->bufColors[particles->writeIndex]);
-        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, emitter->bufVelocities[particles->writeIndex]);
-
-        glBindBuffer(GL_UNIFORM_BUFFER, particles->emitterBlockUBO);
-        glBindBufferBase(GL_UNIFORM_BUFFER, 10, particles->emitterBlockUBO);
-        glBufferData(GL_UNIFORM_BUFFER, sizeof(ParticleEmitter::EmitterBlock), &emitter->data, GL_STATIC_DRAW);
-
-        glUniform3ui(glGetUniformLocation(simProgramHandle, "Random"), Core::FastRandom(), Core::FastRandom(), Core::FastRandom());
-
-        const int numWorkGroups[3] = {
-            emitter->data.numParticles / 1024,
-            1,
-            1
-        };
-        glDispatchCompute(numWorkGroups[0], numWorkGroups[1], numWorkGroups[2]);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, particles->bufPositions[readIndex]);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, particles->bufColors[readIndex]);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, particles->bufVelocities[readIndex]);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, particles->bufPositions[writeIndex]);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, particles->bufColors[writeIndex]);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, particles->bufVelocities[writeIndex]);
+        glDispatchCompute((numParticles + 1023) / 1024, 1, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    }
 
-        emitter->data.fireOnce = false;
+    // the buffers swap below, so particles that weren't simulated are carried over as they are
+    for (glm::uvec2 const& range : this->skippedParticles)
+    {
+        GLintptr const offset = range.x * sizeof(glm::vec4);
+        GLsizeiptr const size = range.y * sizeof(glm::vec4);
+        glCopyNamedBufferSubData(particles->bufPositions[readIndex], particles->bufPositions[writeIndex], offset, offset, size);
+        glCopyNamedBufferSubData(particles->bufVelocities[readIndex], particles->bufVelocities[writeIndex], offset, offset, size);
+        glCopyNamedBufferSubData(particles->bufColors[readIndex], particles->bufColors[writeIndex], offset, offset, size);
     }
 
-    Camera const* const mainCamera = CameraManager::GetCamera(CAMERA_MAIN);
-    GLuint programHandle = ShaderResource::GetProgramHandle(particles->particleShaderId);
-    glUseProgram(programHandle);
+    Camera const* const mainCamera = CameraManager::GetRenderCamera(CAMERA_MAIN);
+    ShaderProgramId const draw = particles->particleShaderId;
+    GLState::UseProgram(ShaderResource::GetProgramHandle(draw));
     glBindBuffer(GL_ARRAY_BUFFER, 0);
 
     glm::mat4 billboardView = glm::mat4(
@@ -466,100 +1097,359 @@ RenderDevice::ParticlePass(float dt)
     );
     glm::mat4 billboardViewProjection = mainCamera->projection * billboardView;
 
-    glUniformMatrix4fv(glGetUniformLocation(programHandle, "ViewProjection"), 1, false, &mainCamera->viewProjection[0][0]);
-    glUniformMatrix4fv(glGetUniformLocation(programHandle, "BillBoardViewProjection"), 1, false, &billboardViewProjection[0][0]);
-    GLuint particleOffsetLoc = glGetUniformLocation(programHandle, "ParticleOffset");
-
-    for (auto emitter : particles->emitters)
-    { // DRAW
-        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, emitter->bufPositions[readIndex]);
-        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, emitter->bufColors[readIndex]);
-
-        // Split drawcalls into smaller bits, since integer division on AMD cards is inaccurate
-        int numVerts = emitter->data.numParticles * 6;
-        const int numVertsPerDrawCall = 0x44580; // has to be divisible with 6
-        int numDrawCalls = emitter->data.numParticles / numVertsPerDrawCall;
-        int particleOffset = 0;
-        while (numVerts > 0)
-        {
-            int drawVertCount = glm::min(numVerts, numVertsPerDrawCall);
-            glUniform1i(particleOffsetLoc, particleOffset);
-            glDrawArrays(GL_TRIANGLES, 0, drawVertCount);
-            numVerts -= drawVertCount;
-            particleOffset += drawVertCount / 6;
-        }
+    glUniformMatrix4fv(ShaderResource::GetUniformLocation(draw, "ViewProjection"), 1, false, &mainCamera->viewProjection[0][0]);
+    glUniformMatrix4fv(ShaderResource::GetUniformLocation(draw, "BillBoardViewProjection"), 1, false, &billboardViewProjection[0][0]);
+    glUniform1ui(ShaderResource::GetUniformLocation(draw, "NumEmitters"), (GLuint)particles->emitterTable.size());
+    glUniform1ui(ShaderResource::GetUniformLocation(draw, "NumParticles"), numParticles);
+    GLint particleOffsetLoc = ShaderResource::GetUniformLocation(draw, "ParticleOffset");
+
+    // draw the particles that were just simulated
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, particles->bufPositions[writeIndex]);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, particles->bufColors[writeIndex]);
+
+    // Split drawcalls into smaller bits, since integer division on AMD cards is inaccurate
+    int numVerts = numParticles * 6;
+    const int numVertsPerDrawCall = 0x44580; // has to be divisible with 6
+    int particleOffset = 0;
+    while (numVerts > 0)
+    {
+        int drawVertCount = glm::min(numVerts, numVertsPerDrawCall);
+        glUniform1i(particleOffsetLoc, particleOffset);
+        glDrawArrays(GL_TRIANGLES, 0, drawVertCount);
+        numVerts -= drawVertCount;
+        particleOffset += drawVertCount / 6;
     }
 
-    glUseProgram(0);
+    GLState::UseProgram(0);
 
     // swap doublebuffer particles index
     particles->writeIndex = readIndex;
 }
 
+//------------------------------------------------------------------------------
+/**
+    Resolves the HDR light target to the backbuffer, with the exposure and
+    tonemapping operator from r_exposure and r_tonemap.
+*/
+void
+RenderDevice::FinalizePass(FrameGraph::Resource light)
+{
+    // the light target may be smaller than the backbuffer, and is upscaled with bilinear filtering
+    GLuint const lightTexture = this->frameGraph.GetTexture(light);
+    glTextureParameteri(lightTexture, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTextureParameteri(lightTexture, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTextureParameteri(lightTexture, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTextureParameteri(lightTexture, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    GLState::Disable(GL_DEPTH_TEST);
+    GLState::UseProgram(ShaderResource::GetProgramHandle(finalizeProgram));
+    GLState::BindTextureUnit(0, GL_TEXTURE_2D, lightTexture);
+    glUniform1i(ShaderResource::GetUniformLocation(finalizeProgram, "LightTexture"), 0);
+    glUniform1f(ShaderResource::GetUniformLocation(finalizeProgram, "Exposure"), Core::CVarReadFloat(r_exposure));
+    glUniform1i(ShaderResource::GetUniformLocation(finalizeProgram, "TonemapOperator"), Core::CVarReadInt(r_tonemap));
+    GLState::BindVertexArray(fullscreenQuadVAO);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    GLState::BindVertexArray(0);
+    GLState::Enable(GL_DEPTH_TEST);
+}
+
+//------------------------------------------------------------------------------
+/**
+    Declares the GPU passes of the frame. The graph orders them, culls passes
+    whose output isn't used, and allocates the frame sized targets, so they
+    follow the window size without being recreated by hand.
+*/
+void
+RenderDevice::BuildFrameGraph(float dt)
+{
+    FrameGraph& graph = this->frameGraph;
+    graph.Reset();
+
+    uint const shadowMapSize = LightServer::GetShadowMapSize();
+    FrameGraph::Resource depth = graph.Create("Depth", { GL_DEPTH_COMPONENT32F, this->frameSizeW, this->frameSizeH });
+    FrameGraph::Resource light = graph.Create("Light", { GetLightFormat(), this->frameSizeW, this->frameSizeH });
+    FrameGraph::Resource shadowMap = graph.Import("ShadowMap", LightServer::GetGlobalShadowMapHandle(), { GL_DEPTH_COMPONENT32F, shadowMapSize, shadowMapSize });
+    FrameGraph::Resource backbuffer = graph.ImportBackbuffer(this->renderFrame.windowWidth, this->renderFrame.windowHeight);
+
+    {
+        FrameGraph::PassBuilder pass = graph.AddPass("DepthPrepass", [this]() { this->StaticGeometryPrepass(); });
+        depth = pass.Write(depth, FrameGraph::Attachment::Depth);
+    }
+    {
+        FrameGraph::PassBuilder pass = graph.AddPass("Shadows", [this]() { this->StaticShadowPass(); });
+        shadowMap = pass.Write(shadowMap);
+    }
+    {
+        // tests against the prepass depth, and clears the light target
+        FrameGraph::PassBuilder pass = graph.AddPass("Forward", [this]() { this->StaticForwardPass(); });
+        pass.Read(shadowMap);
+        depth = pass.Modify(depth, FrameGraph::Attachment::Depth);
+        light = pass.Write(light, FrameGraph::Attachment::Color0);
+    }
+    if (this->skybox != InvalidResourceId)
+    {
+        FrameGraph::PassBuilder pass = graph.AddPass("Skybox", [this]() { this->SkyboxPass(); });
+        depth = pass.Modify(depth, FrameGraph::Attachment::Depth);
+        light = pass.Modify(light, FrameGraph::Attachment::Color0);
+    }
+    {
+        // only tests against the depth, the attachment is read-only in practice
+        FrameGraph::PassBuilder pass = graph.AddPass("Transparent", [this]() { this->TransparentPass(); });
+        depth = pass.Modify(depth, FrameGraph::Attachment::Depth);
+        light = pass.Modify(light, FrameGraph::Attachment::Color0);
+    }
+    {
+        // also advances the simulation, which has to happen even if nothing is drawn
+        FrameGraph::PassBuilder pass = graph.AddPass("Particles", [this, dt]() { this->ParticlePass(dt); });
+        pass.SideEffect();
+        depth = pass.Modify(depth, FrameGraph::Attachment::Depth);
+        light = pass.Modify(light, FrameGraph::Attachment::Color0);
+    }
+    {
+        FrameGraph::PassBuilder pass = graph.AddPass("Debug", []()
+        {
+            Debug::DispatchDebugDrawing();
+            LightServer::DebugDrawPointLights();
+        });
+        depth = pass.Modify(depth, FrameGraph::Attachment::Depth);
+        light = pass.Modify(light, FrameGraph::Attachment::Color0);
+    }
+    {
+        FrameGraph::PassBuilder pass = graph.AddPass("Finalize", [this, light]() { this->FinalizePass(light); });
+        pass.Read(light);
+        backbuffer = pass.Write(backbuffer, FrameGraph::Attachment::Color0);
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+    Everything the render thread reads from the game side is copied here, so
+    the game thread can build the next frame while this one renders.
+*/
 void
-Render::RenderDevice::FinalizePass(Display::Window* wnd)
+RenderDevice::SyncRenderThread(Display::Window* wnd, float dt)
 {
+    // the render thread is idle, so the arena it read the oldest frame from can be reused
+    Core::FrameArena::NextFrame();
+
+    CameraManager::SyncRenderThread();
+    LightServer::SyncRenderThread();
+    Debug::SyncRenderThread();
+
+    // swapping keeps the capacity of both packets, so filling them doesn't allocate after the first frames
+    std::swap(this->gameFrame, this->renderFrame);
+    this->gameFrame.drawCommands.clear();
+    this->gameFrame.renderCommands.clear();
+
+    // the render thread only reads the colliders through this copy
+    if (Core::CVarReadInt(r_occlusion_culling) > 0)
+        Physics::GetColliderGeometry(this->renderFrame.occluderCandidates);
+    else
+        this->renderFrame.occluderCandidates.clear();
+    this->renderFrame.dt = dt;
+
     int w, h;
     wnd->GetSize(w, h);
-    glViewport(0, 0, w, h);
+    this->renderFrame.windowWidth = (uint32_t)glm::max(w, 1);
+    this->renderFrame.windowHeight = (uint32_t)glm::max(h, 1);
 
-    glBlitNamedFramebuffer(this->forwardFrameBuffer, 0, 0, 0, w, h, 0, 0, w, h, GL_COLOR_BUFFER_BIT, GL_NEAREST);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    // the render thread is done with the frame that still had the destroyed emitters
+    ParticleSystem::Instance()->ReleaseDestroyedEmitters();
+    this->renderFrame.particleCapacity = ParticleSystem::Instance()->GetParticleCapacity();
+
+    // the UI reads game and render stats, so it is built here where neither side is running
+    wnd->BuildUi();
+
+    // the CPU simulation runs in jobs on the render thread, so the storage it needs is allocated here
+    this->renderFrame.particlesOnCpu = Core::CVarReadInt(r_particles_cpu) > 0;
+    this->syncIndex++;
+
+    // fireOnce only resets the particles of the frame it was submitted with
+    this->renderFrame.emitters.clear();
+    for (ParticleEmitter* emitter : ParticleSystem::Instance()->emitters)
+    {
+        EmitterState& state = this->emitterStates[emitter->id];
+        state.lastSync = this->syncIndex;
+        if (this->renderFrame.particlesOnCpu && state.cpuParticles.capacity != emitter->maxParticles)
+            state.cpuParticles.Resize(emitter->maxParticles);
+
+        EmitterSnapshot snapshot = { &state, emitter->data, emitter->firstParticle };
+        snapshot.data.numParticles = glm::min(snapshot.data.numParticles, emitter->maxParticles);
+        this->renderFrame.emitters.push_back(snapshot);
+        emitter->data.fireOnce = false;
+    }
+
+    for (auto it = this->emitterStates.begin(); it != this->emitterStates.end();)
+    {
+        if (it->second.lastSync != this->syncIndex)
+            it = this->emitterStates.erase(it);
+        else
+            ++it;
+    }
 }
 
 //------------------------------------------------------------------------------
 /**
 */
 void
-RenderDevice::Render(Display::Window* wnd, float dt)
+RenderDevice::RenderFrame(Display::Window* wnd)
 {
+    for (std::function<void()> const& command : this->renderFrame.renderCommands)
+        command();
+
     TextureResource::PollPendingTextureLoads();
 
-    wnd->MakeCurrent();
+    // counts the state changes of this frame, the UI shows them when it is built at the next sync
+    GLState::ResetStats();
+    GLState::Enable(GL_DEPTH_TEST);
+    GLState::Enable(GL_CULL_FACE);
+    GLState::CullFace(GL_BACK);
+
+    // the frame sized targets follow the window and the resolution scale, and are reallocated by the frame graph
+    float const scale = this->dynamicResolution.Update();
+    uint const frameSizeW = glm::max((uint)(this->renderFrame.windowWidth * scale), 1u);
+    uint const frameSizeH = glm::max((uint)(this->renderFrame.windowHeight * scale), 1u);
+    if (frameSizeW != this->frameSizeW || frameSizeH != this->frameSizeH)
+    {
+        this->frameSizeW = frameSizeW;
+        this->frameSizeH = frameSizeH;
+        LightServer::UpdateClusterGrid(frameSizeW, frameSizeH);
+    }
 
-    CameraManager::OnBeforeRender();
     LightServer::OnBeforeRender();
 
-    // Begin depth prepass renderpass
-    int w, h;
-    wnd->GetSize(w, h);
-    glViewport(0, 0, w, h);
+    // CPU passes, that decide what the GPU passes draw
+    this->LodSelectionPass();
+    this->OcclusionCullingPass();
+    this->ShadowCullingPass();
+    this->LightCullingPass();
+    this->ParticleBudgetPass();
+    this->RecordCommandListsPass();
+
+    this->BuildFrameGraph(this->renderFrame.dt);
+    this->dynamicResolution.BeginFrame();
+    this->frameGraph.Execute();
+    this->dynamicResolution.EndFrame();
+
+    // transfer new frame to window
+    wnd->SwapBuffers();
+}
 
-    Instance()->StaticGeometryPrepass();
-    // end depth prepass renderpass
+//------------------------------------------------------------------------------
+/**
+    The render thread owns the GL context while it runs.
+*/
+void
+RenderDevice::RenderThreadLoop(Display::Window* wnd)
+{
+    wnd->MakeCurrent();
+    TextureResource::AdoptPendingTextureLoads();
+    // the window set up the context without going through the state cache
+    GLState::Invalidate();
 
-    // begin light culling compute pass
-    Instance()->LightCullingPass();
-    // end lightculling compute pass
+    for (;;)
+    {
+        {
+            std::unique_lock<std::mutex> lock(this->renderMutex);
+            this->renderCondition.wait(lock, [this]() { return this->frameSubmitted || this->stopRenderThread; });
+            if (!this->frameSubmitted)
+                break;
+        }
 
-    // Begin sun shadowmap renderpass. this has a single subpass, with two subpass dependencies for layout transitions (shader-read -> depth-write, and back)
-    Instance()->StaticShadowPass();
-    // end sun shadowmap renderpass
+        this->RenderFrame(wnd);
+
+        {
+            std::lock_guard<std::mutex> lock(this->renderMutex);
+            this->frameSubmitted = false;
+        }
+        this->renderCondition.notify_all();
+    }
 
-    // begin forward shading renderpass
-    glViewport(0, 0, w, h);
+    wnd->DetachContext();
+}
 
-    Instance()->StaticForwardPass();
-    
-    if (Instance()->skybox != InvalidResourceId)
+//------------------------------------------------------------------------------
+/**
+*/
+void
+RenderDevice::WaitForRenderThread()
+{
+    std::unique_lock<std::mutex> lock(this->renderMutex);
+    this->renderCondition.wait(lock, [this]() { return !this->frameSubmitted; });
+}
+
+//------------------------------------------------------------------------------
+/**
+    Runs on the game thread. Waits for the render thread to finish the previous
+    frame, hands it this one and returns, so the game can simulate the next
+    frame while this one renders. With r_render_thread 0 the frame is rendered
+    before returning.
+*/
+void
+RenderDevice::Render(Display::Window* wnd, float dt)
+{
+    RenderDevice* device = Instance();
+    bool const threaded = Core::CVarReadInt(r_render_thread) != 0;
+
+    device->WaitForRenderThread();
+    if (!threaded)
+        Shutdown();
+
+    device->SyncRenderThread(wnd, dt);
+
+    if (!threaded)
     {
-        Instance()->SkyboxPass();
+        wnd->MakeCurrent();
+        device->RenderFrame(wnd);
+        return;
     }
-    
-    Instance()->ParticlePass(dt);
 
-    // end forward shading renderpass
+    if (!device->renderThread.joinable())
+    {
+        // the context can only be current on one thread
+        wnd->DetachContext();
+        device->renderWindow = wnd;
+        device->stopRenderThread = false;
+        device->renderThread = std::thread(&RenderDevice::RenderThreadLoop, device, wnd);
+    }
 
-    // begin debug drawing renderpass
-    Debug::DispatchDebugDrawing();
-    LightServer::DebugDrawPointLights();
-    // end debug drawing renderpass
+    {
+        std::lock_guard<std::mutex> lock(device->renderMutex);
+        device->frameSubmitted = true;
+    }
+    device->renderCondition.notify_all();
+}
 
-    // begin finalization pass and present
-    Instance()->FinalizePass(wnd);
-    // end finalization pass and present
+//------------------------------------------------------------------------------
+/**
+    Finishes the frame in flight first. Does nothing if the thread isn't running.
+*/
+void
+RenderDevice::Shutdown()
+{
+    RenderDevice* device = Instance();
+    if (!device->renderThread.joinable())
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(device->renderMutex);
+        device->stopRenderThread = true;
+    }
+    device->renderCondition.notify_all();
+    device->renderThread.join();
+    device->stopRenderThread = false;
+
+    device->renderWindow->MakeCurrent();
+    device->renderWindow = nullptr;
+}
 
-    Instance()->drawCommands.clear();
+//------------------------------------------------------------------------------
+/**
+*/
+void
+RenderDevice::EnqueueRenderCommand(std::function<void()> const& command)
+{
+    Instance()->gameFrame.renderCommands.push_back(command);
 }
 
 } // namespace Render
@@ -6,11 +6,22 @@
     (C) 2019 Individual contributors, see AUTHORS file
 */
 //------------------------------------------------------------------------------
-#include "GL/glew.h"
+#include "render/renderbackend.h"
 #include <string>
 #include <vector>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 #include "render/window.h"
 #include "resourceid.h"
+#include "render/framegraph.h"
+#include "render/particlesystem.h"
+#include "render/particlesim.h"
+#include "render/physics.h"
+#include <unordered_map>
+#include "render/commandlist.h"
+#include "render/dynamicresolution.h"
 
 namespace Render
 {
@@ -31,6 +42,7 @@ class RenderDevice
 {
 public:
     RenderDevice();
+    ~RenderDevice();
     static RenderDevice* Instance()
     {
         static RenderDevice instance;
@@ -40,42 +52,157 @@ public:
     RenderDevice(const RenderDevice&) = delete;
     void operator=(const RenderDevice&) = delete;
 
+    enum DrawFlags : uint32_t
+    {
+        DRAW_DYNAMIC = 0,
+        /// the object doesn't move, so it can be cached in the shadow maps
+        DRAW_STATIC = 1 << 0,
+    };
+
     static void Init();
-    static void Draw(ModelId model, glm::mat4 localToWorld);
+    static void Draw(ModelId model, glm::mat4 localToWorld, uint32_t flags = DRAW_DYNAMIC);
+    /// submit the frame drawn since the last call, and render it on the render thread
     static void Render(Display::Window* wnd, float dt);
+    /// stop the render thread, and make the window's context current on the calling thread again
+    static void Shutdown();
+    /// run a function on the render thread before the next submitted frame, for work that needs the GL context
+    static void EnqueueRenderCommand(std::function<void()> const& command);
     static void SetSkybox(TextureResourceId tex);
 
 private:
-    GLuint forwardFrameBuffer;
-    union RenderTargets
-    {
-        GLuint RT[2];
-        struct
-        {
-            GLuint light;     // GL_RGBA32F linear HDR buffer
-            GLuint normal;    // compressed screenspace normals, RG16F format
-        };
-    } renderTargets;
-    GLuint depthStencilBuffer; // GL_DEPTH24_STENCIL8
+    /// rebuilt every frame from the GPU passes
+    FrameGraph frameGraph;
 
     struct DrawCommand
     {
         ModelId modelId;
         glm::mat4 transform;
+        uint32_t flags;
+        /// cleared by OcclusionCullingPass if the command is hidden from the main camera
+        bool visible;
+        /// level of detail picked by LodSelectionPass
+        uint8_t lod;
+    };
+
+    /// what the render thread keeps of an emitter between frames, under the emitter's id
+    struct EmitterState
+    {
+        /// particles of the emitter while they are simulated on the CPU, allocated at the sync
+        CpuParticles cpuParticles;
+        /// origin in the previous frame
+        glm::vec3 lastOrigin = glm::vec3(0);
+        /// how far the origin moved during the last particle lifetime, negative until the first frame
+        float trailLength = -1.0f;
+        /// sync the emitter was last submitted at, the states of emitters that are gone are dropped
+        uint64_t lastSync = 0;
     };
+    std::unordered_map<uint32_t, EmitterState> emitterStates;
+    uint64_t syncIndex = 0;
 
-    std::vector<DrawCommand> drawCommands;
+    /// an emitter and its settings at the time the frame was submitted
+    struct EmitterSnapshot
+    {
+        EmitterState* state;
+        ParticleEmitter::EmitterBlock data;
+        /// where the emitter's particles are in the particle buffers
+        uint32_t firstParticle;
+    };
 
+    /// everything the render thread needs for a frame. The game thread fills one while the render thread renders the other.
+    struct FramePacket
+    {
+        std::vector<DrawCommand> drawCommands;
+        std::vector<EmitterSnapshot> emitters;
+        /// colliders that may be rasterized as occluders, copied since physics changes while the frame renders
+        std::vector<Physics::ColliderGeometry> occluderCandidates;
+        std::vector<std::function<void()>> renderCommands;
+        float dt = 0.0f;
+        /// size of the window when the frame was submitted
+        uint32_t windowWidth = 1;
+        uint32_t windowHeight = 1;
+        /// number of particles the particle buffers need room for
+        uint32_t particleCapacity = 0;
+        /// simulate the particles on the CPU, decided at the sync since the CPU storage is allocated there
+        bool particlesOnCpu = false;
+    };
+
+    FramePacket gameFrame;
+    FramePacket renderFrame;
+    /// particle ranges of the frame's emitters that are culled or reduced, as first and count. They are copied to the write buffers since nothing simulates them.
+    std::vector<glm::uvec2> skippedParticles;
+
+    /// light space bounds of a draw command, used to cull shadow casters per cascade
+    struct ShadowCasterBounds
+    {
+        glm::vec3 center;
+        glm::vec3 extents;
+        bool valid;
+    };
+    std::vector<ShadowCasterBounds> shadowCasterBounds;
+
+    /// what the shadow pass draws into a cascade
+    struct ShadowCascadeLists
+    {
+        /// static casters, recorded if the static caster cache has to be redrawn
+        CommandList cache;
+        bool rebuildCache = false;
+        /// casters drawn on top of the cache, or all casters if caching is disabled
+        CommandList casters;
+        /// hash of the casters drawn on top of the cache the last time, the shadow map is only restored from the cache when they change
+        uint64_t castersHash = 0;
+        bool redrawCasters = false;
+    };
+    std::vector<ShadowCascadeLists> shadowCascadeLists;
+    /// visible draw commands, drawn by both the depth prepass and the forward pass
+    CommandList opaqueList;
+    /// blended primitives of the visible draw commands, sorted back to front
+    CommandList transparentList;
+
+    /// gather the draw commands whose flags match that overlap a cascade. Returns the light space z of the caster closest to the light.
+    float CullShadowCasters(uint cascadeIndex, uint32_t flagMask, uint32_t flags, CommandList& list);
+    /// translate packets to GL calls that only write depth. Only alpha masked primitives sample their base color.
+    void SubmitDepthPackets(CommandList const& list, glm::mat4 const& viewProjection);
+    /// translate packets to GL calls with the lit forward program
+    void SubmitForwardPackets(CommandList const& list);
+    void SortTransparentPackets();
+
+    void LodSelectionPass();
+    void OcclusionCullingPass();
+    void ShadowCullingPass();
     void LightCullingPass();
+    /// cull particle emitters and fit their particle counts to the budget
+    void ParticleBudgetPass();
+    void RecordCommandListsPass();
     void StaticShadowPass();
     void StaticGeometryPrepass();
     void StaticForwardPass();
+    void TransparentPass();
     void SkyboxPass();
     void ParticlePass(float dt);
-    void FinalizePass(Display::Window* wnd);
-
+    /// simulate all emitters with the CPU particle backend, and upload the particles for the draws
+    void SimulateParticlesOnCpu(float dt, uint32_t writeIndex);
+    void FinalizePass(FrameGraph::Resource light);
+    void BuildFrameGraph(float dt);
+
+    /// hand the game thread's frame to the render thread. The render thread has to be idle.
+    void SyncRenderThread(Display::Window* wnd, float dt);
+    void WaitForRenderThread();
+    void RenderThreadLoop(Display::Window* wnd);
+    /// render the frame in renderFrame and present it
+    void RenderFrame(Display::Window* wnd);
+
+    std::thread renderThread;
+    std::mutex renderMutex;
+    std::condition_variable renderCondition;
+    /// set by the game thread when a frame is submitted, cleared by the render thread when it's done
+    bool frameSubmitted = false;
+    bool stopRenderThread = false;
+    Display::Window* renderWindow = nullptr;
+
+    /// size of the frame sized targets, the window size times the dynamic resolution scale
     unsigned int frameSizeW;
     unsigned int frameSizeH;
+    DynamicResolution dynamicResolution;
     TextureResourceId skybox = InvalidResourceId;
 };
 
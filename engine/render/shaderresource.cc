@@ -8,6 +8,7 @@
 #include <string>
 #include <sstream>
 #include "renderdevice.h"
+#include "glstate.h"
 
 namespace Render
 {
@@ -123,8 +124,37 @@ ShaderResource::CompileShaderProgram(std::vector<ShaderResourceId> const& shader
         delete[] buf;
     }
 
+    // uniform locations are cached, so passes don't look them up by string every frame
+    UniformLocations locations;
+    GLint numUniforms = 0;
+    GLint maxNameLength = 0;
+    glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &numUniforms);
+    glGetProgramiv(program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxNameLength);
+    std::vector<GLchar> name(maxNameLength + 1);
+    for (GLint i = 0; i < numUniforms; i++)
+    {
+        GLsizei length = 0;
+        GLint size = 0;
+        GLenum type = GL_NONE;
+        name[0] = 0;
+        glGetActiveUniform(program, (GLuint)i, (GLsizei)name.size(), &length, &size, &type, name.data());
+        if (length <= 0 || name[0] == 0)
+            continue;
+
+        std::string uniform(name.data(), length);
+        GLint const location = glGetUniformLocation(program, uniform.c_str());
+        if (location < 0)
+            continue; // in a uniform block
+
+        // arrays are reported as name[0], but are also looked up without the index
+        if (uniform.size() > 3 && uniform.compare(uniform.size() - 3, 3, "[0]") == 0)
+            locations.emplace(uniform.substr(0, uniform.size() - 3), location);
+        locations.emplace(std::move(uniform), location);
+    }
+
     Instance()->programs.push_back(program);
     Instance()->programShaders.push_back(shaders);
+    Instance()->uniformLocations.push_back(std::move(locations));
     printf("OK\n");
     return ShaderProgramId(Instance()->programs.size() - 1);
 }
@@ -138,6 +168,24 @@ ShaderResource::GetProgramHandle(ShaderProgramId programId)
     return Instance()->programs[programId];
 }
 
+//------------------------------------------------------------------------------
+/**
+    Names that weren't reported at link time, like elements of arrays other
+    than the first, are asked from GL once, and remembered as well.
+*/
+GLint
+ShaderResource::GetUniformLocation(ShaderProgramId programId, char const* name)
+{
+    UniformLocations& locations = Instance()->uniformLocations[programId];
+    auto const location = locations.find(std::string_view(name));
+    if (location != locations.end())
+        return location->second;
+
+    GLint const queried = glGetUniformLocation(Instance()->programs[programId], name);
+    locations.emplace(name, queried);
+    return queried;
+}
+
 //------------------------------------------------------------------------------
 /**
 */
@@ -167,11 +215,12 @@ ShaderResource::ReloadShaders()
 
     for (size_t i = 0; i < Instance()->programs.size(); i++)
     {
-        glDeleteProgram(Instance()->programs[i]);
+        GLState::DeleteProgram(Instance()->programs[i]);
     }
 
     Instance()->programs.clear();
     Instance()->programShaders.clear();
+    Instance()->uniformLocations.clear();
 
     for (size_t i = 0; i < progs.size(); i++)
     {
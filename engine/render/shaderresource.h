@@ -9,7 +9,9 @@
 #include "resourceid.h"
 #include <vector>
 #include <string>
-#include <gl/glew.h>
+#include <string_view>
+#include <unordered_map>
+#include "render/renderbackend.h"
 
 namespace Render
 {
@@ -39,6 +41,8 @@ public:
     static ShaderProgramId CompileShaderProgram(std::vector<ShaderResourceId> const& shaders);
 
     static GLuint GetProgramHandle(ShaderProgramId);
+    /// location of a uniform, from the table that is filled when the program is linked
+    static GLint GetUniformLocation(ShaderProgramId, char const* name);
 
     static void ReloadShaders();
 
@@ -52,6 +56,15 @@ private:
     // ShaderProgramId
     std::vector<std::vector<ShaderResourceId>> programShaders;
     std::vector<GLuint> programs;
+
+    /// looked up by string_view, so a lookup doesn't allocate
+    struct UniformNameHash
+    {
+        using is_transparent = void;
+        size_t operator()(std::string_view name) const { return std::hash<std::string_view>()(name); }
+    };
+    typedef std::unordered_map<std::string, GLint, UniformNameHash, std::equal_to<>> UniformLocations;
+    std::vector<UniformLocations> uniformLocations;
 };
 
 
@@ -4,6 +4,7 @@
 //------------------------------------------------------------------------------
 #include "config.h"
 #include "textureresource.h"
+#include "glstate.h"
 #include <cstring>
 #define STB_IMAGE_IMPLEMENTATION
 #define STB_IMAGE_WRITE_IMPLEMENTATION
@@ -80,6 +81,18 @@ TextureResource::PollPendingTextureLoads()
     }
 }
 
+//------------------------------------------------------------------------------
+/**
+    Loads are completed on the thread that started them, since that's the one
+    that has the GL context current.
+*/
+void
+TextureResource::AdoptPendingTextureLoads()
+{
+    for (LoadTask& item : loadingTasks)
+        item.loadingThread = std::this_thread::get_id();
+}
+
 
 //------------------------------------------------------------------------------
 /**
@@ -114,7 +127,7 @@ TextureResource::Create()
         GLuint const& imageHandle = instance->imageHandles[imageIds[i]];
         ImageExtents const& imageExtents = instance->imageExtents[imageIds[i]];
 
-        glBindTexture(GL_TEXTURE_2D, imageHandle);
+        GLState::BindTexture(GL_TEXTURE_2D, imageHandle);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
@@ -123,7 +136,7 @@ TextureResource::Create()
         glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, imageExtents.w, imageExtents.h, 0, GL_RGBA, GL_UNSIGNED_BYTE, buffer);
         glGenerateMipmap(GL_TEXTURE_2D);
     }
-    glBindTexture(GL_TEXTURE_2D, 0);
+    GLState::BindTexture(GL_TEXTURE_2D, 0);
 
     instance->whiteTexture = imageIds[0];
     instance->blackTexture = imageIds[1];
@@ -163,7 +176,7 @@ TextureResource::LoadTextureFromMemory(TextureLoadInfo const& info)
 
         GLuint handle = GetImageHandle(iid);
         
-        glBindTexture(GL_TEXTURE_2D, handle);
+        GLState::BindTexture(GL_TEXTURE_2D, handle);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, (GLenum)info.minFilter);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, (GLenum)info.magFilter);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, (GLenum)info.wrappingModeS);
@@ -212,7 +225,7 @@ TextureResource::LoadTextureFromMemory(TextureLoadInfo const& info)
         {
             auto& img = result.get();
             
-            glBindTexture(GL_TEXTURE_2D, handle);
+            GLState::BindTexture(GL_TEXTURE_2D, handle);
             glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, (GLenum)min);
             glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, (GLenum)mag);
             glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, (GLenum)wrapModeS);
@@ -270,7 +283,7 @@ TextureResource::LoadTexture(const char * path, MagFilter mag, MinFilter min, Wr
 
     GLuint handle;
     glGenTextures(1, &handle);
-    glBindTexture(GL_TEXTURE_2D, handle);
+    GLState::BindTexture(GL_TEXTURE_2D, handle);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, (GLenum)min);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, (GLenum)mag);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, (GLenum)wrapModeS);
@@ -289,7 +302,7 @@ TextureResource::LoadTexture(const char * path, MagFilter mag, MinFilter min, Wr
     }
 
     glGenerateMipmap(GL_TEXTURE_2D);
-    glBindTexture(GL_TEXTURE_2D, 0);
+    GLState::BindTexture(GL_TEXTURE_2D, 0);
     stbi_image_free(image);
 
     Instance()->imageHandles[iid] = handle;
@@ -314,7 +327,7 @@ TextureResource::LoadTextureFromMemory(std::string name, void* buffer, uint64_t
     auto stop = std::chrono::high_resolution_clock::now();
     std::chrono::duration<double, std::milli> duration = stop - start;
     std::cout << "Loaded " << imageExtents.w << "x" << imageExtents.h << " " << channels << "BPP texture from memory in : " << duration.count() << " (ms)" << std::endl;
-    glBindTexture(GL_TEXTURE_2D, imageHandle);
+    GLState::BindTexture(GL_TEXTURE_2D, imageHandle);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, (GLenum)min);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, (GLenum)mag);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, (GLenum)wrapModeS);
@@ -334,7 +347,7 @@ TextureResource::LoadTextureFromMemory(std::string name, void* buffer, uint64_t
 
     stbi_image_free(decompressed);
     glGenerateMipmap(GL_TEXTURE_2D);
-    glBindTexture(GL_TEXTURE_2D, 0);
+    GLState::BindTexture(GL_TEXTURE_2D, 0);
     Instance()->imageRegistry.emplace(name, imageId);
     return imageId;
 }
@@ -347,7 +360,7 @@ TextureResource::LoadCubemap(std::string const& name, std::vector<const char*> c
 {
     GLuint handle;
     glGenTextures(1, &handle);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, handle);
+    GLState::BindTexture(GL_TEXTURE_CUBE_MAP, handle);
 
     int w, h, nrChannels;
     for (unsigned int i = 0; i < paths.size(); i++)
@@ -6,7 +6,7 @@
     (C) 2019 Individual contributors, see AUTHORS file
 */
 //------------------------------------------------------------------------------
-#include "GL/glew.h"
+#include "render/renderbackend.h"
 #include "renderdevice.h"
 #include "resourceid.h"
 
@@ -108,6 +108,8 @@ public:
     static void Destroy();
 
     static void PollPendingTextureLoads();
+    // complete the loads started on other threads on the calling thread, when the GL context moves to it
+    static void AdoptPendingTextureLoads();
 
     // PNG or JPG
     static TextureResourceId LoadTextureFromMemory(TextureLoadInfo const& info);
@@ -63,10 +63,11 @@ int32 Window::WindowCount = 0;
 /**
 */
 Window::Window() :
-	window(nullptr),
 	width(1024),
 	height(768),
-	title("gscept Lab Environment")
+	title("gscept Lab Environment"),
+	window(nullptr),
+	headless(false)
 {
 	// empty
 }
@@ -211,10 +212,8 @@ Window::Resize()
 {
 	if (nullptr != this->window)
 	{
+		// no viewport here, the render thread owns the context and its passes set their own viewports
 		glfwSetWindowSize(this->window, this->width, this->height);
-
-		// setup viewport
-		glViewport(0, 0, this->width, this->height);
 	}
 }
 
@@ -233,6 +232,16 @@ Window::Retitle()
 bool
 Window::Open()
 {
+	// the null backend has no context to create, so there is nothing to show either
+	if (Render::Backend::IsHeadless())
+	{
+		glViewport(0, 0, this->width, this->height);
+		Input::InputHandler::Create();
+		Window::WindowCount++;
+		this->headless = true;
+		return true;
+	}
+
 	if (Window::WindowCount == 0)
 	{
 		if (!glfwInit()) return false;
@@ -327,6 +336,8 @@ Window::Open()
 	unsigned char* buffer;
 	int width, height, channels;
 	io.Fonts->GetTexDataAsRGBA32(&buffer, &width, &height, &channels);
+	// the UI is built on the main thread before the render thread has run, so the font texture has to exist by then
+	ImGui_ImplOpenGL3_CreateDeviceObjects();
 
 	glfwSetCharCallback(window, ImGui_ImplGlfw_CharCallback);
 
@@ -346,6 +357,13 @@ Window::Open()
 void
 Window::Close()
 {
+	if (this->headless)
+	{
+		this->headless = false;
+		Window::WindowCount--;
+		return;
+	}
+
 	if (nullptr != this->window) glfwDestroyWindow(this->window);
 	this->window = nullptr;
 	Window::WindowCount--;
@@ -364,7 +382,18 @@ Window::Close()
 void
 Window::MakeCurrent()
 {
-	glfwMakeContextCurrent(this->window);
+	if (nullptr != this->window)
+		glfwMakeContextCurrent(this->window);
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+Window::DetachContext()
+{
+	if (nullptr != this->window)
+		glfwMakeContextCurrent(nullptr);
 }
 
 //------------------------------------------------------------------------------
@@ -374,26 +403,45 @@ void
 Window::Update()
 {
 	Input::InputHandler::BeginFrame();
-	glfwPollEvents();	
+	if (nullptr != this->window)
+		glfwPollEvents();
+}
+
+//------------------------------------------------------------------------------
+/**
+	Runs on the main thread, where GLFW and the event callbacks that feed ImGui
+	run, while the render thread is idle. The UI reads game and render state, and
+	both are at rest at that point. The draw data stays untouched until the next
+	call, so the render thread draws it without copying.
+*/
+void
+Window::BuildUi()
+{
+	if (nullptr == this->window)
+		return;
+
+	ImGui_ImplGlfw_NewFrame();
+	ImGui::NewFrame();
+	if (nullptr != this->uiFunc)
+		this->uiFunc();
+	ImGui::Render();
+	this->uiDrawData = ImGui::GetDrawData();
 }
 
 //------------------------------------------------------------------------------
 /**
+	Draws the UI that was built by the last BuildUi, and presents the frame.
 */
 void
 Window::SwapBuffers()
 {
 	if (this->window)
 	{
-		ImGui_ImplOpenGL3_NewFrame();
-		ImGui_ImplGlfw_NewFrame();
-
-		ImGui::NewFrame();
-		if (nullptr != this->uiFunc)
-			this->uiFunc();
-
-		ImGui::Render();
-		ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+		if (nullptr != this->uiDrawData)
+		{
+			ImGui_ImplOpenGL3_NewFrame();
+			ImGui_ImplOpenGL3_RenderDrawData(this->uiDrawData);
+		}
 		glfwSwapBuffers(this->window);
 	}
 }
@@ -404,6 +452,11 @@ Window::SwapBuffers()
 void
 Window::GetMousePos(float64& x, float64& y)
 {
+	if (nullptr == this->window)
+	{
+		x = y = 0.0;
+		return;
+	}
 	glfwGetCursorPos(this->window, &x, &y);
 }
 
@@ -7,10 +7,12 @@
 */
 //------------------------------------------------------------------------------
 #include <functional>
-#include <GL/glew.h>
+#include "render/renderbackend.h"
 #include <GLFW/glfw3.h>
 #include <string>
 
+struct ImDrawData;
+
 namespace Display
 {
 class Window
@@ -37,10 +39,14 @@ public:
 
 	/// make this window current, meaning all draws will direct to this window context
 	void MakeCurrent();
+	/// release the window context from the calling thread, so that another thread can make it current
+	void DetachContext();
 
 	/// update a tick
 	void Update();
-	/// swap buffers at end of frame
+	/// build the UI of the frame that is handed to the render thread. Called on the main thread while the render thread is idle.
+	void BuildUi();
+	/// draw the UI and swap buffers at end of frame
 	void SwapBuffers();
 
 	/// set key press function callback
@@ -108,6 +114,10 @@ private:
 	int32 height;
 	std::string title;
 	GLFWwindow* window;
+	/// opened without a GL context, for the null render backend
+	bool headless;
+	/// UI built by BuildUi, drawn by SwapBuffers on the render thread
+	ImDrawData* uiDrawData = nullptr;
 };
 
 //------------------------------------------------------------------------------
@@ -148,7 +158,7 @@ Window::SetTitle(const std::string& title)
 inline const bool
 Window::IsOpen() const
 {
-	return nullptr != this->window;
+	return nullptr != this->window || this->headless;
 }
 
 //------------------------------------------------------------------------------
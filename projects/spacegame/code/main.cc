@@ -4,11 +4,21 @@
 //------------------------------------------------------------------------------
 #include "config.h"
 #include "spacegameapp.h"
+#include <cstring>
+#include <cstdlib>
 
 int
 main(int argc, const char** argv)
 {
 	Game::SpaceGameApp app;
+
+	// --headless <frames> runs the given number of frames on the null render backend
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--headless") == 0)
+			app.SetHeadless(i + 1 < argc ? (uint)atoi(argv[++i]) : 1000);
+	}
+
 	if (app.Open())
 	{
 		app.Run();
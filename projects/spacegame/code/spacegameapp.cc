@@ -8,15 +8,18 @@
 #include "imgui.h"
 #include "render/renderdevice.h"
 #include "render/shaderresource.h"
+#include "render/glstate.h"
 #include <vector>
 #include "render/textureresource.h"
 #include "render/model.h"
 #include "render/cameramanager.h"
 #include "render/lightserver.h"
 #include "render/debugrender.h"
+#include "render/particlesystem.h"
 #include "core/random.h"
 #include "render/input/inputserver.h"
 #include "core/cvar.h"
+#include "core/framearena.h"
 #include "render/physics.h"
 #include <chrono>
 #include "spaceship.h"
@@ -30,7 +33,8 @@ namespace Game
 //------------------------------------------------------------------------------
 /**
 */
-SpaceGameApp::SpaceGameApp()
+SpaceGameApp::SpaceGameApp() :
+    headlessFrames(0)
 {
     // empty
 }
@@ -50,13 +54,18 @@ bool
 SpaceGameApp::Open()
 {
 	App::Open();
+	if (this->headlessFrames > 0)
+	{
+		Render::Backend::Init(Render::Backend::Type::Null);
+	}
+
 	this->window = new Display::Window;
     this->window->SetSize(2500, 2000);
 
     if (this->window->Open())
 	{
 		// set clear color to gray
-		glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
+		Render::GLState::ClearColor(0.1f, 0.1f, 0.1f, 1.0f);
 
         RenderDevice::Init();
 
@@ -183,20 +192,22 @@ SpaceGameApp::Run()
     std::clock_t c_start = std::clock();
     double dt = 0.01667f;
 
+    // headless runs measure the frames only, not resource loading
+    uint frameIndex = 0;
+    double cpuTime = 0.0;
+    Render::Backend::ResetStats();
+
     // game loop
     while (this->window->IsOpen())
 	{
         auto timeStart = std::chrono::steady_clock::now();
-		glClear(GL_DEPTH_BUFFER_BIT);
-		glEnable(GL_DEPTH_TEST);
-		glEnable(GL_CULL_FACE);
-		glCullFace(GL_BACK);
         
         this->window->Update();
 
         if (kbd->pressed[Input::Key::Code::End])
         {
-            ShaderResource::ReloadShaders();
+            // shaders are compiled where the GL context is
+            RenderDevice::EnqueueRenderCommand([]() { ShaderResource::ReloadShaders(); });
         }
 
         ship.Update(dt);
@@ -208,23 +219,59 @@ SpaceGameApp::Run()
         // Store all drawcalls in the render device
         for (auto const& asteroid : asteroids)
         {
-            RenderDevice::Draw(std::get<0>(asteroid), std::get<2>(asteroid));
+            RenderDevice::Draw(std::get<0>(asteroid), std::get<2>(asteroid), RenderDevice::DRAW_STATIC);
         }
 
         RenderDevice::Draw(ship.model, ship.transform);
 
-        // Execute the entire rendering pipeline
+        // Hand the frame to the render thread, which executes the entire rendering pipeline and presents it
         RenderDevice::Render(this->window, dt);
 
-		// transfer new frame to window
-		this->window->SwapBuffers();
-
         auto timeEnd = std::chrono::steady_clock::now();
-        dt = std::min(0.04, std::chrono::duration<double>(timeEnd - timeStart).count());
+        double frameTime = std::chrono::duration<double>(timeEnd - timeStart).count();
+        cpuTime += frameTime;
+        frameIndex++;
+
+        if (this->headlessFrames > 0)
+        {
+            // fixed timestep, so that runs can be compared with each other
+            if (frameIndex == this->headlessFrames)
+                this->Exit();
+        }
+        else
+        {
+            dt = std::min(0.04, frameTime);
+        }
 
         if (kbd->pressed[Input::Key::Code::Escape])
             this->Exit();
 	}
+
+    if (this->headlessFrames > 0 && frameIndex > 0)
+    {
+        Render::Backend::Stats const& stats = Render::Backend::GetStats();
+        uint64_t totalCalls = 0;
+        for (uint i = 0; i < Render::Backend::NUM_FUNCTIONS; i++)
+            totalCalls += stats.calls[i];
+
+        printf("Headless: %u frames, %.3f ms CPU per frame\n", frameIndex, cpuTime * 1000.0 / frameIndex);
+        printf("Headless: per frame %.1f draw calls, %.0f vertices, %.1f dispatches, %.0f bytes uploaded, %.1f GL calls\n",
+            (double)stats.drawCalls / frameIndex,
+            (double)stats.vertices / frameIndex,
+            (double)stats.dispatches / frameIndex,
+            (double)stats.bytesUploaded / frameIndex,
+            (double)totalCalls / frameIndex
+        );
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+SpaceGameApp::SetHeadless(uint numFrames)
+{
+    this->headlessFrames = numFrames;
 }
 
 //------------------------------------------------------------------------------
@@ -233,6 +280,7 @@ SpaceGameApp::Run()
 void
 SpaceGameApp::Exit()
 {
+    RenderDevice::Shutdown();
     this->window->Close();
 }
 
@@ -254,6 +302,23 @@ SpaceGameApp::RenderUI()
         int lightSphereId = Core::CVarReadInt(r_draw_light_sphere_id);
         if (ImGui::InputInt("LightSphereId", (int*)&lightSphereId))
             Core::CVarWriteInt(r_draw_light_sphere_id, lightSphereId);
+
+        Render::GLState::Stats const& stateStats = Render::GLState::GetStats();
+        ImGui::Text("GL state changes: %llu issued, %llu elided", (unsigned long long)stateStats.issued, (unsigned long long)stateStats.elided);
+        ImGui::Text("Point lights: %zu in view, %zu shaded, %zu total", Render::LightServer::GetNumVisiblePointLights(),
+            Render::LightServer::GetNumUploadedPointLights(), Render::LightServer::GetNumPointLights());
+
+        Render::ParticlePool::Stats const poolStats = Render::ParticleSystem::Instance()->GetPoolStats();
+        ImGui::Text("Particle pool: %u / %u particles (%.1f%%), %u emitters, %u recycled", poolStats.allocated, poolStats.capacity,
+            poolStats.capacity > 0 ? 100.0f * poolStats.allocated / poolStats.capacity : 0.0f, poolStats.numAllocations, Render::ParticleSystem::Instance()->GetNumRecycledEmitters());
+        ImGui::Text("Particle pool free ranges: %u, largest %u", poolStats.numFreeRanges, poolStats.largestFreeRange);
+        ImGui::Text("Particles drawn: %u in %u emitters", Render::ParticleSystem::Instance()->GetNumDrawnParticles(), Render::ParticleSystem::Instance()->GetNumDrawnEmitters());
+
+        Core::FrameArena::Stats const& memoryStats = Core::FrameArena::GetLastFrameStats();
+        ImGui::Text("Frame arena: %zu / %zu bytes, %u overflows", memoryStats.arenaBytes, memoryStats.arenaCapacity, memoryStats.arenaOverflows);
+#if SPACE_COUNT_HEAP_ALLOCATIONS
+        ImGui::Text("Heap per frame: %llu allocations, %llu frees", (unsigned long long)memoryStats.heapAllocations, (unsigned long long)memoryStats.heapFrees);
+#endif
         
         ImGui::End();
 
@@ -25,11 +25,15 @@ public:
 	void Run();
 	/// exit app
 	void Exit();
+	/// run the given number of frames without a window, and print CPU timings. Must be set before Open.
+	void SetHeadless(uint numFrames);
 private:
 
 	/// show some ui things
 	void RenderUI();
 
 	Display::Window* window;
+	/// frames to run on the null render backend, or 0 to open a window
+	uint headlessFrames;
 };
 } // namespace Game
\ No newline at end of file
@@ -15,7 +15,7 @@ namespace Game
 SpaceShip::SpaceShip()
 {
     uint32_t numParticles = 2048;
-    this->particleEmitterLeft = new ParticleEmitter(numParticles);
+    this->particleEmitterLeft = ParticleSystem::Instance()->CreateEmitter(numParticles);
     this->particleEmitterLeft->data = {
         .origin = glm::vec4(this->position + (vec3(this->transform[2]) * emitterOffset),1),
         .dir = glm::vec4(glm::vec3(-this->transform[2]), 0),
@@ -33,11 +33,8 @@ SpaceShip::SpaceShip()
         .emitterType = 1,
         .discRadius = 0.020f
     };
-    this->particleEmitterRight = new ParticleEmitter(numParticles);
+    this->particleEmitterRight = ParticleSystem::Instance()->CreateEmitter(numParticles);
     this->particleEmitterRight->data = this->particleEmitterLeft->data;
-
-    ParticleSystem::Instance()->AddEmitter(this->particleEmitterLeft);
-    ParticleSystem::Instance()->AddEmitter(this->particleEmitterRight);
 }
 
 void
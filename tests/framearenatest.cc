@@ -0,0 +1,105 @@
+//------------------------------------------------------------------------------
+//  @file framearenatest.cc
+//  @copyright (C) 2022 Individual contributors, see AUTHORS file
+//
+//  Checks the frame arena: allocations from several jobs at once must not
+//  overlap, memory must stay valid until NumFrames - 1 more frames started,
+//  and a steady workload must stop overflowing once the ring has grown.
+//------------------------------------------------------------------------------
+#include "config.h"
+#include "core/framearena.h"
+#include "core/jobsystem.h"
+#include <cstdio>
+#include <cstring>
+
+int
+main()
+{
+    int failures = 0;
+
+    char const* const text = "longer than the small string buffer of std::string";
+    char const* kept[Core::FrameArena::NumFrames] = {};
+    for (uint32_t frame = 0; frame < 20; frame++)
+    {
+        kept[frame % Core::FrameArena::NumFrames] = Core::FrameArena::CopyString(text);
+
+        // every job fills its allocations with its own byte, and checks them after all jobs are done
+        uint const numJobs = 64;
+        uint const numAllocations = 50;
+        std::vector<uint8_t*> blocks(numJobs * numAllocations);
+        Core::JobSystem::ParallelFor(numJobs, 1, [&](uint begin, uint end)
+        {
+            for (uint job = begin; job < end; job++)
+            {
+                for (uint i = 0; i < numAllocations; i++)
+                {
+                    size_t const size = 16 + (i * 37) % 200;
+                    uint8_t* const block = Core::FrameArena::Allocate<uint8_t>(size);
+                    memset(block, (int)job, size);
+                    blocks[job * numAllocations + i] = block;
+                }
+            }
+        });
+        for (uint job = 0; job < numJobs; job++)
+        {
+            for (uint i = 0; i < numAllocations; i++)
+            {
+                size_t const size = 16 + (i * 37) % 200;
+                uint8_t const* const block = blocks[job * numAllocations + i];
+                for (size_t b = 0; b < size; b++)
+                {
+                    if (block[b] != (uint8_t)job)
+                    {
+                        printf("frame %u: an allocation of job %u was overwritten\n", frame, job);
+                        failures++;
+                        break;
+                    }
+                }
+            }
+        }
+
+        Core::FrameArena::NextFrame();
+        Core::FrameArena::Stats const& stats = Core::FrameArena::GetLastFrameStats();
+        // the first frames grow the arenas of the ring, after that the same workload has to fit
+        if (frame >= Core::FrameArena::NumFrames && stats.arenaOverflows > 0)
+        {
+            printf("frame %u: %u overflows with a steady workload\n", frame, stats.arenaOverflows);
+            failures++;
+        }
+
+        // the strings of the frames that are still in the ring haven't been reset
+        for (uint32_t i = 0; i < Core::FrameArena::NumFrames - 1 && i <= frame; i++)
+        {
+            char const* str = kept[(frame - i) % Core::FrameArena::NumFrames];
+            if (strcmp(str, text) != 0)
+            {
+                printf("frame %u: the string of frame %u was overwritten\n", frame, frame - i);
+                failures++;
+            }
+        }
+    }
+
+    // like LoadGLTF: a scratch arena that is reset for every primitive
+    Core::LinearArena scratch(1024);
+    for (int primitive = 0; primitive < 4; primitive++)
+    {
+        scratch.Reset();
+        Core::ArenaVector<uint32_t> indices(1000, &scratch);
+        Core::ArenaVector<uint8_t> bytes(indices.get_allocator());
+        bytes.resize(5000);
+        void* const aligned = scratch.Allocate(64, 64);
+        if ((uintptr_t)aligned % 64 != 0)
+        {
+            printf("scratch allocation isn't aligned to 64 bytes\n");
+            failures++;
+        }
+        if (primitive > 0 && scratch.GetNumOverflows() > 0)
+        {
+            printf("primitive %d: the scratch arena overflowed after it was reset\n", primitive);
+            failures++;
+        }
+    }
+
+    printf("framearenatest: %d failures\n", failures);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,69 @@
+//------------------------------------------------------------------------------
+//  @file jobsystemtest.cc
+//  @copyright (C) 2022 Individual contributors, see AUTHORS file
+//
+//  Checks that ParallelFor runs every index exactly once, in chunks no larger
+//  than the grain size, including nested calls from inside a job.
+//------------------------------------------------------------------------------
+#include "config.h"
+#include "core/jobsystem.h"
+#include <cstdio>
+#include <vector>
+
+int
+main()
+{
+    int failures = 0;
+
+    for (uint count : { 0u, 1u, 7u, 64u, 1000u, 100003u })
+    {
+        for (uint grainSize : { 1u, 3u, 64u, 4096u })
+        {
+            std::vector<std::atomic<uint32_t>> visits(count);
+            std::atomic<uint32_t> oversized = 0;
+            Core::JobSystem::ParallelFor(count, grainSize, [&](uint begin, uint end)
+            {
+                if (end - begin > grainSize || end > count)
+                    oversized++;
+                for (uint i = begin; i < end; i++)
+                    visits[i]++;
+            });
+
+            uint32_t wrong = 0;
+            for (std::atomic<uint32_t> const& v : visits)
+                wrong += v != 1;
+            if (wrong > 0 || oversized > 0)
+            {
+                printf("count %u, grain %u: %u indices not run once, %u bad chunks\n", count, grainSize, wrong, oversized.load());
+                failures++;
+            }
+        }
+    }
+
+    // the calling thread helps with the inner loops, so nesting can't deadlock
+    uint const outer = 64;
+    uint const inner = 500;
+    std::vector<std::atomic<uint32_t>> visits(outer * inner);
+    Core::JobSystem::ParallelFor(outer, 1, [&](uint begin, uint end)
+    {
+        for (uint o = begin; o < end; o++)
+        {
+            Core::JobSystem::ParallelFor(inner, 16, [&](uint innerBegin, uint innerEnd)
+            {
+                for (uint i = innerBegin; i < innerEnd; i++)
+                    visits[o * inner + i]++;
+            });
+        }
+    });
+    uint32_t wrong = 0;
+    for (std::atomic<uint32_t> const& v : visits)
+        wrong += v != 1;
+    if (wrong > 0)
+    {
+        printf("nested: %u indices not run once\n", wrong);
+        failures++;
+    }
+
+    printf("jobsystemtest: %d failures, %u workers\n", failures, Core::JobSystem::NumWorkers());
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,96 @@
+//------------------------------------------------------------------------------
+//  @file lightclusterstest.cc
+//  @copyright (C) 2022 Individual contributors, see AUTHORS file
+//
+//  Checks that the SSE light cluster builder produces exactly the same lists
+//  as the scalar reference, for random resolutions, projections, views and
+//  lights, that no light is missing from a cluster containing part of its
+//  sphere, and that the depth slices round trip.
+//------------------------------------------------------------------------------
+#include "config.h"
+#include "render/lightclusters.h"
+#include <algorithm>
+#include <cstdio>
+#include <random>
+
+using namespace Render;
+
+int
+main()
+{
+    std::mt19937 rng(3);
+    std::uniform_real_distribution<float> random(-1.0f, 1.0f);
+    int failures = 0;
+
+    for (int test = 0; test < 40; test++)
+    {
+        uint32_t const width = 800 + rng() % 2000;
+        uint32_t const height = 600 + rng() % 1500;
+        glm::mat4 const projection = glm::perspective(glm::radians(60.0f + 30.0f * random(rng)), (float)width / height, 0.01f + 0.1f * fabsf(random(rng)), 1000.0f);
+        glm::mat4 const view = glm::lookAt(glm::vec3(random(rng), random(rng), random(rng)) * 10.0f, glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+
+        uint32_t const numLights = 500;
+        std::vector<glm::vec4> positions(numLights);
+        std::vector<float> radii(numLights);
+        for (uint32_t i = 0; i < numLights; i++)
+        {
+            positions[i] = glm::vec4(random(rng) * 100.0f, random(rng) * 100.0f, random(rng) * 100.0f, 1.0f);
+            radii[i] = fabsf(random(rng)) * 20.0f + 0.1f;
+        }
+
+        LightClusterBuilder builder, reference;
+        builder.Setup(width, height, projection);
+        reference.Setup(width, height, projection);
+        builder.Build(view, positions.data(), radii.data(), numLights);
+        reference.BuildReference(view, positions.data(), radii.data(), numLights);
+        if (builder.clusterLights != reference.clusterLights || builder.lightIndices != reference.lightIndices)
+        {
+            printf("Build and BuildReference differ for %ux%u, test %d\n", width, height, test);
+            failures++;
+        }
+
+        // every light whose sphere contains a point inside the frustum must be listed in that point's cluster
+        LightClusterGrid const& grid = builder.grid;
+        for (int sample = 0; sample < 2000; sample++)
+        {
+            float const px = (0.5f + 0.5f * random(rng)) * width;
+            float const py = (0.5f + 0.5f * random(rng)) * height;
+            float const depth = grid.nearZ * powf(grid.farZ / grid.nearZ, 0.5f + 0.5f * random(rng));
+            float const ndcX = px / width * 2.0f - 1.0f;
+            float const ndcY = py / height * 2.0f - 1.0f;
+            glm::vec3 const point((ndcX + projection[2][0]) * depth / projection[0][0], (ndcY + projection[2][1]) * depth / projection[1][1], -depth);
+
+            uint32_t const x = glm::min((uint32_t)px / grid.tileSize, grid.numClustersX - 1);
+            uint32_t const y = glm::min((uint32_t)py / grid.tileSize, grid.numClustersY - 1);
+            uint32_t const cluster = (grid.Slice(depth) * grid.numClustersY + y) * grid.numClustersX + x;
+            glm::uvec2 const list = builder.clusterLights[cluster];
+            for (uint32_t i = 0; i < numLights; i++)
+            {
+                glm::vec3 const center = view * positions[i];
+                if (glm::distance(center, point) >= radii[i] * 0.999f)
+                    continue;
+                uint32_t const* begin = builder.lightIndices.data() + list.x;
+                if (std::find(begin, begin + list.y, i) == begin + list.y)
+                {
+                    printf("light %u contains (%f, %f, %f) but is missing from cluster %u, test %d\n", i, point.x, point.y, point.z, cluster, test);
+                    failures++;
+                }
+            }
+        }
+    }
+
+    LightClusterBuilder builder;
+    builder.Setup(1920, 1080, glm::perspective(1.5f, 1.7f, 0.01f, 1000.0f));
+    for (uint32_t slice = 0; slice < builder.grid.numSlices; slice++)
+    {
+        float const depth = builder.grid.SliceBegin(slice) * 1.001f;
+        if (builder.grid.Slice(depth) != slice)
+        {
+            printf("depth %f is in slice %u, expected %u\n", depth, builder.grid.Slice(depth), slice);
+            failures++;
+        }
+    }
+
+    printf("lightclusterstest: %d failures\n", failures);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,134 @@
+//------------------------------------------------------------------------------
+//  @file meshprocessingtest.cc
+//  @copyright (C) 2022 Individual contributors, see AUTHORS file
+//
+//  Checks the vertex cache, overdraw and vertex fetch optimizations on a
+//  shuffled sphere grid: the triangles must stay the same, the ACMR has to
+//  drop, and the remap must be a compact permutation of the used vertices.
+//------------------------------------------------------------------------------
+#include "config.h"
+#include "render/meshprocessing.h"
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+using namespace Render;
+
+//------------------------------------------------------------------------------
+/**
+    Triangles with their indices rotated to start at the smallest, sorted, so
+    that two lists with the same triangles in any order compare equal.
+*/
+static std::vector<std::array<uint32_t, 3>>
+SortedTriangles(std::vector<uint32_t> const& indices)
+{
+    std::vector<std::array<uint32_t, 3>> triangles;
+    for (size_t i = 0; i < indices.size(); i += 3)
+    {
+        std::array<uint32_t, 3> t = { indices[i], indices[i + 1], indices[i + 2] };
+        std::rotate(t.begin(), std::min_element(t.begin(), t.end()), t.end());
+        triangles.push_back(t);
+    }
+    std::sort(triangles.begin(), triangles.end());
+    return triangles;
+}
+
+int
+main()
+{
+    int failures = 0;
+
+    uint32_t const rings = 128;
+    uint32_t const segments = 128;
+    std::vector<glm::vec3> positions;
+    for (uint32_t i = 0; i <= rings; i++)
+    {
+        for (uint32_t j = 0; j <= segments; j++)
+        {
+            float const theta = glm::pi<float>() * i / rings;
+            float const phi = glm::two_pi<float>() * j / segments;
+            positions.push_back(glm::vec3(sinf(theta) * cosf(phi), cosf(theta), sinf(theta) * sinf(phi)));
+        }
+    }
+    std::vector<uint32_t> grid;
+    for (uint32_t i = 0; i < rings; i++)
+    {
+        for (uint32_t j = 0; j < segments; j++)
+        {
+            uint32_t const a = i * (segments + 1) + j;
+            uint32_t const c = a + segments + 1;
+            grid.insert(grid.end(), { a, c, a + 1, a + 1, c, c + 1 });
+        }
+    }
+
+    // the grid order is already cache friendly, so the shuffled triangles are the real test
+    size_t const numTriangles = grid.size() / 3;
+    std::vector<uint32_t> order(numTriangles);
+    for (uint32_t i = 0; i < numTriangles; i++)
+        order[i] = i;
+    std::shuffle(order.begin(), order.end(), std::mt19937(1));
+    std::vector<uint32_t> indices(grid.size());
+    for (size_t i = 0; i < numTriangles; i++)
+        for (int k = 0; k < 3; k++)
+            indices[i * 3 + k] = grid[order[i] * 3 + k];
+
+    size_t const numVertices = positions.size();
+    std::vector<uint32_t> cacheOptimized(indices.size());
+    MeshProcessing::OptimizeVertexCache(cacheOptimized.data(), indices.data(), indices.size(), numVertices);
+    std::vector<uint32_t> overdrawOptimized(indices.size());
+    MeshProcessing::OptimizeOverdraw(overdrawOptimized.data(), cacheOptimized.data(), cacheOptimized.size(), positions.data(), numVertices, sizeof(glm::vec3));
+
+    std::vector<std::array<uint32_t, 3>> const triangles = SortedTriangles(indices);
+    if (SortedTriangles(cacheOptimized) != triangles || SortedTriangles(overdrawOptimized) != triangles)
+    {
+        printf("the optimized index lists don't contain the same triangles\n");
+        failures++;
+    }
+
+    float const acmrBefore = MeshProcessing::ComputeACMR(indices.data(), indices.size(), numVertices);
+    float const acmrCache = MeshProcessing::ComputeACMR(cacheOptimized.data(), cacheOptimized.size(), numVertices);
+    float const acmrOverdraw = MeshProcessing::ComputeACMR(overdrawOptimized.data(), overdrawOptimized.size(), numVertices);
+    printf("ACMR %.3f, after cache optimization %.3f, after overdraw optimization %.3f\n", acmrBefore, acmrCache, acmrOverdraw);
+    // a regular grid can't do much better than 0.5, and 0.8 leaves room for the cache size mismatch
+    if (acmrCache > 0.8f || acmrOverdraw > 0.8f || acmrBefore < 2.0f)
+    {
+        printf("the ACMR didn't drop as far as expected\n");
+        failures++;
+    }
+
+    std::vector<uint32_t> remap(numVertices);
+    size_t const numUsed = MeshProcessing::OptimizeVertexFetch(remap.data(), cacheOptimized.data(), cacheOptimized.size(), numVertices);
+    std::vector<bool> used(numVertices, false);
+    for (uint32_t index : cacheOptimized)
+        used[index] = true;
+    std::vector<bool> taken(numUsed, false);
+    uint32_t nextNew = 0;
+    bool remapValid = true;
+    for (uint32_t index : cacheOptimized)
+    {
+        uint32_t const r = remap[index];
+        if (r >= numUsed)
+        {
+            remapValid = false;
+            break;
+        }
+        // vertices are numbered in order of first use
+        if (!taken[r])
+        {
+            remapValid = remapValid && r == nextNew++;
+            taken[r] = true;
+        }
+    }
+    for (size_t v = 0; v < numVertices; v++)
+        remapValid = remapValid && (used[v] || remap[v] == ~0u);
+    if (!remapValid || nextNew != numUsed)
+    {
+        printf("OptimizeVertexFetch produced an invalid remap\n");
+        failures++;
+    }
+
+    printf("meshprocessingtest: %d failures\n", failures);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,90 @@
+//------------------------------------------------------------------------------
+//  @file particlepooltest.cc
+//  @copyright (C) 2022 Individual contributors, see AUTHORS file
+//
+//  Checks the particle pool with random allocate and free sequences: ranges
+//  must never overlap or leave the pool, freed neighbours must merge, and an
+//  emitter of the same size must get a freed range back exactly.
+//------------------------------------------------------------------------------
+#include "config.h"
+#include "render/particlepool.h"
+#include <cstdio>
+#include <iterator>
+#include <map>
+#include <random>
+
+using namespace Render;
+
+int
+main()
+{
+    int failures = 0;
+
+    ParticlePool pool;
+    pool.Reserve(1000);
+    std::mt19937 rng(1);
+    // first particle and count of every live range
+    std::map<uint32_t, uint32_t> live;
+    for (int i = 0; i < 100000 && failures == 0; i++)
+    {
+        if (live.empty() || rng() % 2 == 0)
+        {
+            uint32_t const count = 1 + rng() % 300;
+            uint32_t const first = pool.Allocate(count);
+            auto next = live.lower_bound(first);
+            bool const overlapsNext = next != live.end() && next->first < first + count;
+            bool const overlapsPrevious = next != live.begin() && std::prev(next)->first + std::prev(next)->second > first;
+            if (overlapsNext || overlapsPrevious || first + count > pool.GetCapacity())
+            {
+                printf("allocation %u of %u particles at %u overlaps or is outside the pool of %u\n", i, count, first, pool.GetCapacity());
+                failures++;
+            }
+            live[first] = count;
+        }
+        else
+        {
+            auto it = live.begin();
+            std::advance(it, rng() % live.size());
+            pool.Free(it->first, it->second);
+            live.erase(it);
+        }
+    }
+
+    for (auto const& [first, count] : live)
+        pool.Free(first, count);
+    ParticlePool::Stats const stats = pool.GetStats();
+    if (stats.allocated != 0 || stats.numAllocations != 0 || stats.numFreeRanges != 1 || stats.largestFreeRange != stats.capacity)
+    {
+        printf("after freeing everything: %u allocated in %u ranges, %u free ranges, largest %u of %u\n",
+            stats.allocated, stats.numAllocations, stats.numFreeRanges, stats.largestFreeRange, stats.capacity);
+        failures++;
+    }
+
+    // best fit gives a destroyed emitter's range to the next emitter of the same size
+    ParticlePool exact;
+    exact.Reserve(1024);
+    uint32_t const a = exact.Allocate(100);
+    uint32_t const separator = exact.Allocate(10);
+    uint32_t const b = exact.Allocate(200);
+    exact.Allocate(10);
+    exact.Free(a, 100);
+    exact.Free(b, 200);
+    if (exact.Allocate(200) != b || exact.Allocate(100) != a)
+    {
+        printf("freed ranges were not reused by allocations of the same size\n");
+        failures++;
+    }
+
+    // freeing the ranges around the separator merges all three, next to the free end of the pool
+    exact.Free(a, 100);
+    exact.Free(b, 200);
+    exact.Free(separator, 10);
+    if (exact.GetStats().numFreeRanges != 2 || exact.Allocate(310) != a)
+    {
+        printf("neighbouring free ranges were not merged\n");
+        failures++;
+    }
+
+    printf("particlepooltest: %d failures\n", failures);
+    return failures == 0 ? 0 : 1;
+}
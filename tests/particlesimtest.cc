@@ -0,0 +1,75 @@
+//------------------------------------------------------------------------------
+//  @file particlesimtest.cc
+//  @copyright (C) 2022 Individual contributors, see AUTHORS file
+//
+//  Checks that the SSE particle simulation is bit identical to the scalar
+//  reference, for both emitter types and particle counts that aren't a
+//  multiple of four, also when the arrays have room for more particles than
+//  are simulated, like the render thread's storage after the lod lowered it.
+//------------------------------------------------------------------------------
+#include "config.h"
+#include "render/particlesim.h"
+#include <cstdio>
+#include <cstring>
+
+using namespace Render;
+
+//------------------------------------------------------------------------------
+/**
+*/
+static bool
+PackedEqual(std::vector<glm::vec4> const& a, std::vector<glm::vec4> const& b, uint32_t numParticles)
+{
+    return a.size() >= numParticles && b.size() >= numParticles && memcmp(a.data(), b.data(), numParticles * sizeof(glm::vec4)) == 0;
+}
+
+int
+main()
+{
+    int failures = 0;
+
+    for (uint32_t emitterType = 0; emitterType < 2; emitterType++)
+    {
+        for (uint32_t numParticles : { 1u, 5u, 2047u, 2048u })
+        {
+            for (uint32_t extraCapacity : { 0u, 3u })
+            {
+                ParticleEmitter::EmitterBlock block;
+                block.numParticles = numParticles;
+                block.emitterType = emitterType;
+                block.looping = 1;
+                block.discRadius = 0.02f;
+                block.theta = 0.3f;
+                block.dir = glm::vec4(0.3f, 0.2f, 0.9f, 0.0f);
+                block.randomTimeOffsetDist = 2.0f;
+                block.decayTime = 1.5f;
+
+                CpuParticles simd, reference;
+                simd.Resize(numParticles + extraCapacity);
+                simd.SetNumParticles(numParticles);
+                reference.Resize(numParticles);
+                for (int step = 0; step < 200; step++)
+                {
+                    // enough steps with a changing time step that every particle respawns a few times
+                    float const dt = 0.016f + step * 0.0001f;
+                    block.fireOnce = step == 0;
+                    ParticleSimulation::Simulate(block, dt, simd);
+                    ParticleSimulation::SimulateReference(block, dt, reference);
+                }
+                simd.Pack();
+                reference.Pack();
+
+                if (!PackedEqual(simd.packedPositions, reference.packedPositions, numParticles) ||
+                    !PackedEqual(simd.packedVelocities, reference.packedVelocities, numParticles) ||
+                    !PackedEqual(simd.packedColors, reference.packedColors, numParticles))
+                {
+                    printf("Simulate and SimulateReference differ for emitter type %u, %u particles, %u extra capacity\n", emitterType, numParticles, extraCapacity);
+                    failures++;
+                }
+            }
+        }
+    }
+
+    printf("particlesimtest: %d failures\n", failures);
+    return failures == 0 ? 0 : 1;
+}